@@ -0,0 +1,88 @@
+/** \example make_support_blob.c
+ *  \brief   This example shows how to bundle the keys, seeds and certificates
+ *           from the support directories into a support blob, optionally as
+ *           C source to compile into a program.
+ */
+
+#include <nnc/support.h>
+#include <nnc/sigcert.h>
+#include <nnc/crypto.h>
+#include <string.h>
+#include <stdio.h>
+
+
+/* the blob is written as 64-bit words so the array is aligned well enough for nnc_support_open_memory() */
+static int write_c_source(const char *blob_name, const char *c_name, const char *array_name)
+{
+	FILE *in = fopen(blob_name, "rb"), *out = fopen(c_name, "w");
+	unsigned char word[8];
+	unsigned long size = 0;
+	size_t got;
+	if(!in || !out)
+	{
+		if(in) fclose(in);
+		if(out) fclose(out);
+		return 1;
+	}
+	fprintf(out, "#include <nnc/base.h>\n\nconst nnc_u64 %s[] = {", array_name);
+	while((got = fread(word, 1, sizeof(word), in)) != 0)
+	{
+		nnc_u64 val = 0;
+		memset(word + got, 0, sizeof(word) - got);
+		for(int i = 7; i >= 0; --i)
+			val = (val << 8) | word[i];
+		fprintf(out, "%s0x%016llXULL,", size % 32 == 0 ? "\n\t" : " ", (unsigned long long) val);
+		size += got;
+	}
+	fprintf(out, "\n};\nconst nnc_u32 %s_size = %lu;\n", array_name, size);
+	fclose(in);
+	return fclose(out) == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc != 2 && argc != 4)
+	{
+		fprintf(stderr,
+			"usage: %s <output.bin> [<output.c> <array-name>]\n"
+			"Bundles the retail keys, seeddb.bin and the certificates found in the support\n"
+			"directories into a blob for nnc_support_open_file(). When a C file is given\n"
+			"the blob is also written as an array for nnc_support_open_memory().\n"
+		, argv[0]);
+		return 1;
+	}
+
+	nnc_keyset kset = NNC_KEYSET_INIT;
+	nnc_certchain chain = { .len = 0 };
+	nnc_seeddb seeddb;
+	nnc_wfile out;
+	nnc_result res;
+
+	nnc_keyset_default(&kset, NNC_KEYSET_RETAIL);
+	if((res = nnc_scan_seeddb(&seeddb)) != NNC_R_OK)
+		fprintf(stderr, "Failed to load seeddb: %s. The blob will not contain seeds.\n", nnc_strerror(res));
+	nnc_scan_certchains(&chain);
+	if(chain.len == 0)
+		fprintf(stderr, "No certificates found. The blob will not contain certificates.\n");
+
+	if((res = nnc_wfile_open(&out, argv[1])) == NNC_R_OK)
+	{
+		res = nnc_write_support(NNC_WSP(&out), &kset, &seeddb, &chain);
+		NNC_WS_CALL0(out, close);
+	}
+	nnc_free_certchain(&chain);
+	nnc_free_seeddb(&seeddb);
+	if(res != NNC_R_OK)
+	{
+		fprintf(stderr, "%s: %s.\n", argv[1], nnc_strerror(res));
+		return 1;
+	}
+
+	if(argc == 4 && write_c_source(argv[1], argv[2], argv[3]) != 0)
+	{
+		fprintf(stderr, "%s: failed to write.\n", argv[2]);
+		return 1;
+	}
+	return 0;
+}
+
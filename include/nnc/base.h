@@ -71,6 +71,7 @@ enum nnc_result_codes {
 	NNC_R_OPEN,            ///< File open.
 	NNC_R_OS,              ///< Generic operating system error.
 	NNC_R_INTERNAL,        ///< Internal library error, this should not happen.
+	NNC_R_BAD_HASH,        ///< Data doesn't match the hash it is verified with.
 };
 
 enum nnc_tid_category {
@@ -112,6 +113,16 @@ nnc_u32 nnc_log2(nnc_u32 x);
  * */
 nnc_u32 nnc_pow2(nnc_u32 exp);
 
+/** \brief Memory allocation functions, used for the memory owned by a \ref nnc_ctx.
+ *  \note  All functions receive \p user as their first argument.
+ */
+typedef struct nnc_allocator {
+	void *(*alloc)(void *user, size_t size);              ///< Allocate \p size bytes, NULL on failure.
+	void *(*realloc)(void *user, void *ptr, size_t size); ///< Resize \p ptr, which may be NULL, to \p size bytes.
+	void (*free)(void *user, void *ptr);                  ///< Free \p ptr, which may be NULL.
+	void *user;                                           ///< User data for the functions.
+} nnc_allocator;
+
 /** \{
  *  \anchor tid
  *  \name   Title IDs
@@ -76,6 +76,7 @@ enum nnc_cia_wflags {
 	NNC_CIA_WF_TICKET_STREAM    = 8,   ///< Copy a ticket from a read stream.
 	NNC_CIA_WF_TMD_BUILD        = 16,  ///< Build a TMD, including the calculation of hashes.
 	NNC_CIA_WF_TMD_STREAM       = 32,  ///< Copy a TMD from a read stream.
+	NNC_CIA_WF_ENCRYPT_CONTENTS = 64,  ///< Encrypt the contents with the title key of the ticket, requires #NNC_CIA_WF_TMD_BUILD.
 };
 
 /** A pseudo-stream to hold all possible required streams, yet still
@@ -179,7 +180,17 @@ void nnc_cia_get_iv(nnc_u8 iv[0x10], nnc_u16 index);
  *  \param amount_contents  Amount of contents in this CIA.
  *  \param contents         Writable NCCH contents to put in the CIA container.
  *  \param ws               Output write stream.
+ *  \note                   If \p ws can't seek the CIA is built twice, first to fill in the header and TMD and then
+ *                          to write it front to back. All inputs are then read twice, built NCCHs more often.
+ *  \note                   With #NNC_CIA_WF_ENCRYPT_CONTENTS every content is encrypted with AES-CBC as described in \ref nnc_cia_get_iv,
+ *                          the title key is decrypted from the ticket with the keyset from \ref nnc_get_default_keyset.
+ *                          The contents then must have a size that is a multiple of 0x10. The NCCHs themselves are written as given,
+ *                          \ref nnc_write_ncch never encrypts the NCCHs it builds.
  *  \warning                If you use a stream for `tmd` you must ensure yourself that this TMD describes the rest of the contents.
+ *  \returns
+ *  \p NNC_R_INVAL => Invalid combination of \p wflags. \n
+ *  \p NNC_R_BAD_ALIGN => A content to encrypt doesn't have a size that is a multiple of 0x10. \n
+ *  Anything \ref nnc_decrypt_tkey can return.
  */
 nnc_result nnc_write_cia(
 	nnc_u8 wflags,
@@ -0,0 +1,146 @@
+/** \file   context.h
+ *  \brief  Library state that would otherwise be process wide.
+ *  \note   A context bundles everything needed to decrypt and verify titles:
+ *          a keyset, a SeedDB, certificates and a keypair cache. Using one
+ *          context per user allows different keysets to be used in one
+ *          process at the same time. The global defaults from
+ *          \ref nnc_get_default_keyset and \ref nnc_get_default_seeddb
+ *          remain available for programs that don't need this.
+ */
+#ifndef inc_nnc_context_h
+#define inc_nnc_context_h
+
+#include <nnc/support.h>
+#include <nnc/sigcert.h>
+#include <nnc/crypto.h>
+#include <nnc/stream.h>
+#include <nnc/base.h>
+NNC_BEGIN
+
+/** Amount of keypairs the cache of a context holds. */
+#define NNC_CTX_KEYPAIR_CACHE_SIZE 64
+
+enum nnc_ctx_flags {
+	NNC_CTX_DEV_KEYS    = 0x01, ///< Use the development keyset instead of the retail one.
+	NNC_CTX_SCAN_SEEDDB = 0x02, ///< Load seeddb.bin from the support directories, see \ref nnc_ctx_scan_seeddb.
+	NNC_CTX_SCAN_CERTS  = 0x04, ///< Load certificates from the support directories, see \ref nnc_ctx_scan_certchains.
+	NNC_CTX_NO_CACHE    = 0x08, ///< Don't cache derived keypairs.
+	NNC_CTX_SCAN_BLOB   = 0x10, ///< Load the support blob from the support directories if there is one,
+	                            ///< \ref NNC_CTX_SCAN_SEEDDB and \ref NNC_CTX_SCAN_CERTS are ignored if it is found.
+	                            ///< See \ref nnc_support_scan.
+};
+
+typedef struct nnc_ctx {
+	nnc_allocator allocator;    ///< Allocator for all memory owned by the context.
+	nnc_keyset keyset;          ///< Keyset, may be modified before the context is used.
+	nnc_seeddb seeddb;          ///< SeedDB, empty unless loaded.
+	nnc_certchain certs;        ///< Certificates used to verify signatures, empty unless loaded.
+	nnc_keypair_cache keypairs; ///< Derived keypairs, unused if \p has_cache is false.
+	bool has_cache;             ///< Whether \p keypairs is in use.
+} nnc_ctx;
+
+/** \brief            Initialize a context.
+ *  \param ctx        Output context.
+ *  \param allocator  Allocator to use for memory owned by the context, NULL for malloc() and friends.
+ *                    The allocator is copied into the context.
+ *  \param flags      Options, see \ref nnc_ctx_flags.
+ *  \note             Support files are only searched for here and in the scan functions,
+ *                    the result is kept for the lifetime of the context.
+ *  \note             Setting up a context is not thread safe. Once set up, a context may be
+ *                    shared between threads for the functions that don't modify it.
+ *  \note             Free the context with \ref nnc_ctx_free, also when this function fails.
+ *  \returns
+ *  \p NNC_R_NOMEM => Failed to allocate memory.\n
+ *  \p NNC_R_OS => Failed to create the lock of the keypair cache.\n
+ *  Anything \ref nnc_ctx_scan_seeddb can return except \p NNC_R_NOT_FOUND.
+ */
+nnc_result nnc_ctx_init(nnc_ctx *ctx, const nnc_allocator *allocator, nnc_u32 flags);
+
+/** \brief      Free all memory owned by a context.
+ *  \param ctx  Context to free.
+ */
+void nnc_ctx_free(nnc_ctx *ctx);
+
+/** \brief      Replace the SeedDB of a context.
+ *  \param ctx  Context to load the SeedDB into.
+ *  \param rs   Stream to read the SeedDB from.
+ *  \note       On failure the old SeedDB is kept.
+ *  \returns
+ *  Anything \ref nnc_seeds_seeddb can return.
+ */
+nnc_result nnc_ctx_load_seeddb(nnc_ctx *ctx, nnc_rstream *rs);
+
+/** \brief      Replace the SeedDB of a context with seeddb.bin from the support directories.
+ *  \param ctx  Context to load the SeedDB into.
+ *  \returns
+ *  Anything \ref nnc_scan_seeddb can return.
+ */
+nnc_result nnc_ctx_scan_seeddb(nnc_ctx *ctx);
+
+/** \brief      Add a certificate chain to a context.
+ *  \param ctx  Context to add the certificates to.
+ *  \param rs   Stream to read the certificate chain from.
+ *  \returns
+ *  Anything \ref nnc_read_certchain can return.
+ */
+nnc_result nnc_ctx_load_certchain(nnc_ctx *ctx, nnc_rstream *rs);
+
+/** \brief      Add the certificate chains from the support directories to a context.
+ *  \param ctx  Context to add the certificates to.
+ *  \see        \ref nnc_scan_certchains for the files loaded.
+ *  \returns
+ *  \p NNC_R_NOMEM => Failed to allocate memory, missing or bad chains are ignored.
+ */
+nnc_result nnc_ctx_scan_certchains(nnc_ctx *ctx);
+
+/** \brief      Copy the contents of a support blob into a context.
+ *  \param ctx  Context to load into.
+ *  \param sup  Support data from \ref nnc_support_open_memory or friends.
+ *  \note       The keyset and SeedDB are replaced if \p sup has them, certificates are added.
+ *              The data is copied as is, \p sup may be closed afterwards.
+ *  \returns
+ *  \p NNC_R_NOMEM => Failed to allocate memory.
+ */
+nnc_result nnc_ctx_load_support(nnc_ctx *ctx, const nnc_support *sup);
+
+/** \brief         \ref nnc_fill_keypair using the keyset, SeedDB and keypair cache of a context.
+ *  \param output  Output keypair.
+ *  \param ctx     Context to use.
+ *  \param ncch    NCCH to get keypair for.
+ *  \returns
+ *  Anything \ref nnc_fill_keypair can return.
+ */
+nnc_result nnc_ctx_fill_keypair(nnc_keypair *output, nnc_ctx *ctx, struct nnc_ncch_header *ncch);
+
+/** \brief            \ref nnc_decrypt_tkey using the keyset of a context.
+ *  \param tik        Ticket from \ref nnc_read_ticket.
+ *  \param ctx        Context to use.
+ *  \param decrypted  Output decrypted title key.
+ *  \returns
+ *  Anything \ref nnc_decrypt_tkey can return.
+ */
+nnc_result nnc_ctx_decrypt_tkey(struct nnc_ticket *tik, nnc_ctx *ctx, nnc_u8 decrypted[0x10]);
+
+/** \brief       \ref nnc_verify_signature using the certificates of a context.
+ *  \param ctx   Context to use.
+ *  \param sig   Signature to verify.
+ *  \param hash  Hash of the signed data.
+ *  \returns
+ *  Anything \ref nnc_verify_signature can return.
+ */
+nnc_result nnc_ctx_verify_signature(nnc_ctx *ctx, nnc_signature *sig, nnc_sha_hash hash);
+
+/** \brief          \ref nnc_verify_signatures_batch using the certificates of a context.
+ *  \param ctx      Context to use.
+ *  \param checks   Signatures to verify.
+ *  \param count    Amount of signatures in \p checks.
+ *  \param threads  Maximum amount of threads to use.
+ *  \returns
+ *  Anything \ref nnc_verify_signatures_batch can return.
+ */
+nnc_result nnc_ctx_verify_signatures_batch(nnc_ctx *ctx, nnc_signature_check *checks,
+	nnc_u32 count, nnc_u32 threads);
+
+NNC_END
+#endif
+
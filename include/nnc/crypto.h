@@ -40,7 +40,9 @@ typedef struct nnc_keyset {
 	nnc_u128 ky_comy5; ///< Common key 5.
 } nnc_keyset;
 
-/** Container struct to hold seeds. */
+/** Container struct to hold seeds.
+ *  \note \p entries is sorted by title ID, if you fill this struct yourself
+ *        make sure to keep it that way or \ref nnc_get_seed will not find seeds. */
 typedef struct nnc_seeddb {
 	nnc_u32 size;
 	struct nnc_seeddb_entry {
@@ -55,22 +57,39 @@ enum nnc_section {
 	NNC_SECTION_ROMFS     = 3, ///< NCCH RomFS section.
 };
 
+/** Default size of the decrypted window of AES read streams,
+ *  see \ref nnc_aes_ctr_set_window. */
+#define NNC_CRYPTO_WINDOW_DEFAULT 0x10000
+
 typedef struct nnc_aes_ctr {
 	const void *funcs;
-	void *crypto_ctx; ///< Context for the cryptographic library used.
+	void *crypto_ctx; ///< Context for the crypto backend used.
 	nnc_rstream *child;
 	nnc_u8 last_unaligned_block[0x10];
+	nnc_u8 *window;        ///< Decrypted data, see \ref nnc_aes_ctr_set_window.
+	nnc_u32 window_size;   ///< Maximum size of \p window.
+	nnc_u32 window_start;  ///< Offset of \p window in the stream.
+	nnc_u32 window_len;    ///< Amount of valid bytes in \p window.
+	nnc_u32 window_alloc;  ///< Allocated size of \p window.
+	nnc_u32 pos;           ///< Current offset in the stream.
 	nnc_u8 ctr[0x10];
 	nnc_u128 iv;
 } nnc_aes_ctr;
 
 typedef struct nnc_aes_cbc {
 	const void *funcs;
-	void *crypto_ctx; ///< Context for the cryptographic library used.
+	void *crypto_ctx; ///< Context for the crypto backend used.
 	nnc_rstream *child;
 	nnc_u8 last_unaligned_block[0x10];
+	nnc_u8 *window;        ///< Decrypted data, see \ref nnc_aes_cbc_set_window.
+	nnc_u32 window_size;   ///< Maximum size of \p window.
+	nnc_u32 window_start;  ///< Offset of \p window in the stream.
+	nnc_u32 window_len;    ///< Amount of valid bytes in \p window.
+	nnc_u32 window_alloc;  ///< Allocated size of \p window.
+	nnc_u32 pos;           ///< Current offset in the stream.
 	nnc_u8 init_iv[0x10];
 	nnc_u8 iv[0x10];
+	nnc_u32 iv_pos;        ///< Offset \p iv is the IV for.
 } nnc_aes_cbc;
 
 typedef struct nnc_keypair {
@@ -78,6 +97,15 @@ typedef struct nnc_keypair {
 	nnc_u128 secondary; ///< Also known as the "content" key.
 } nnc_keypair;
 
+/** A bounded cache of derived keypairs, see \ref nnc_keypair_cache_init. */
+typedef struct nnc_keypair_cache {
+	struct nnc_keypair_cache_entry *entries; ///< Cache slots, opaque.
+	void *lock;                              ///< Lock guarding \p entries.
+	nnc_u32 capacity;                        ///< Amount of slots.
+	nnc_u32 victim;                          ///< Used to decide which slot to evict.
+	nnc_allocator allocator;                 ///< Allocator \p entries and \p lock come from.
+} nnc_keypair_cache;
+
 /** An opaque struct to handle incremental hashing */
 typedef void *nnc_sha256_incremental_hash;
 
@@ -88,12 +116,76 @@ typedef struct nnc_hasher_writer {
 	nnc_u32 lim, hashed;
 } nnc_hasher_writer;
 
+/** \brief Digests a \ref nnc_multi_hasher can compute, combine them with bitwise OR. */
+enum nnc_digest_type {
+	NNC_DIGEST_SHA1   = 0x01, ///< SHA1, as used by the older signature types.
+	NNC_DIGEST_SHA256 = 0x02, ///< SHA256.
+	NNC_DIGEST_CRC32  = 0x04, ///< CRC32 as used by zlib.
+};
+
+/** Output of a \ref nnc_multi_hasher. */
+typedef struct nnc_digests {
+	nnc_u8 types;           ///< Digests that were computed, see \ref nnc_digest_type.
+	nnc_sha1_hash sha1;     ///< Only valid if \p types contains \ref NNC_DIGEST_SHA1.
+	nnc_sha256_hash sha256; ///< Only valid if \p types contains \ref NNC_DIGEST_SHA256.
+	nnc_u32 crc32;          ///< Only valid if \p types contains \ref NNC_DIGEST_CRC32.
+} nnc_digests;
+
+/** Computes several digests over the same data at once, see \ref nnc_multi_hasher_init. */
+typedef struct nnc_multi_hasher {
+	void *sha1;    ///< SHA1 state, opaque.
+	void *sha256;  ///< SHA256 state, opaque.
+	nnc_u32 crc32; ///< Running CRC32.
+	nnc_u8 types;  ///< Digests being computed.
+} nnc_multi_hasher;
+
+typedef struct nnc_multi_hasher_writer {
+	const nnc_wstream_funcs *funcs;
+	nnc_multi_hasher hasher;
+	nnc_wstream *child;
+	nnc_u32 lim, hashed;
+} nnc_multi_hasher_writer;
+
 /** \brief An enumeration containing the possible (builtin) keysets */
 enum nnc_keyset_selector {
 	NNC_KEYSET_RETAIL,
 	NNC_KEYSET_DEVELOPMENT,
 };
 
+/** \brief An enumeration of the implementations the cryptographic
+ *         primitives can come from, see \ref nnc_set_crypto_backend. */
+enum nnc_crypto_backend_type {
+	NNC_CRYPTO_BACKEND_MBEDTLS, ///< MbedTLS, the default if it was compiled in.
+	NNC_CRYPTO_BACKEND_OPENSSL, ///< OpenSSL's libcrypto.
+	NNC_CRYPTO_BACKEND_BUILTIN, ///< Dependency free implementation, always available.
+};
+
+/** \{
+ *  \name Crypto backends
+ */
+
+/** \brief       Select the implementation of AES, SHA and signature verification to use.
+ *  \param type  Backend to use.
+ *  \return      \ref NNC_R_UNSUPPORTED if the backend was not compiled in.
+ *  \note        Objects keep using the backend they were created with, this
+ *               only affects objects created after the call. This function
+ *               is not thread safe, call it before starting other threads.
+ *  \note        ECDSA signatures can only be verified with the OpenSSL backend,
+ *               the builtin and mbedtls backends return \ref NNC_R_UNSUPPORTED for them.
+ */
+nnc_result nnc_set_crypto_backend(enum nnc_crypto_backend_type type);
+
+/** \brief Get the currently selected backend. */
+enum nnc_crypto_backend_type nnc_get_crypto_backend(void);
+
+/** \brief       Get the name of a backend.
+ *  \param type  Backend to get the name of.
+ *  \return      Name or NULL if \p type is invalid.
+ */
+const char *nnc_crypto_backend_name(enum nnc_crypto_backend_type type);
+
+/** \} */
+
 /** \{
  *  \anchor incremental-sha256-hash
  *  \name   Incremental SHA256 hashing
@@ -151,6 +243,83 @@ void nnc_hasher_writer_digest(nnc_hasher_writer *self, nnc_sha256_hash digest);
 void nnc_hasher_writer_digest_reset(nnc_hasher_writer *self, nnc_sha256_hash digest);
 
 
+/** \} */
+
+/** \{
+ *  \anchor multi-digest-hash
+ *  \name   Multi-digest hashing
+ *  For when more than one digest of the same data is required,
+ *  the data is read only once and fed to every digest.
+ */
+
+/** \brief        Initializes a multi-digest hasher.
+ *  \param self   Output hasher.
+ *  \param types  Digests to compute, see \ref nnc_digest_type.
+ *  \returns
+ *  \p NNC_R_INVAL => \p types is empty or contains unknown digests.\n
+ *  \p NNC_R_NOMEM => Failed to allocate a hash context.
+ */
+nnc_result nnc_multi_hasher_init(nnc_multi_hasher *self, nnc_u8 types);
+
+/** \brief         Feed data to a multi-digest hasher.
+ *  \param self    Hasher to add the data to.
+ *  \param data    Data to hash.
+ *  \param length  Size of \p data in bytes.
+ */
+void nnc_multi_hasher_feed(nnc_multi_hasher *self, const nnc_u8 *data, nnc_u32 length);
+
+/** \brief          Extracts the digests from a hasher and resets it.
+ *  \param self     Hasher to finish.
+ *  \param digests  Output digests.
+ *  \note           This function does not free the hasher, for that see \ref nnc_multi_hasher_free.
+ */
+void nnc_multi_hasher_finish(nnc_multi_hasher *self, nnc_digests *digests);
+
+/** \brief       Frees memory in use by a multi-digest hasher.
+ *  \param self  Hasher to free.
+ */
+void nnc_multi_hasher_free(nnc_multi_hasher *self);
+
+/** \brief          Compute multiple digests of a \ref nnc_rstream partly in one pass.
+ *  \param rs       Stream to hash.
+ *  \param types    Digests to compute, see \ref nnc_digest_type.
+ *  \param digests  Output digests.
+ *  \param size     Amount of data to hash.
+ *  \returns
+ *  Anything \ref nnc_multi_hasher_init can return.\n
+ *  Anything \p rs->read() can return.\n
+ *  \p NNC_R_TOO_SMALL => \p rs is smaller than \p size.
+ */
+nnc_result nnc_crypto_multi_hash_part(nnc_rstream *rs, nnc_u8 types, nnc_digests *digests, nnc_u32 size);
+
+/** \brief          Compute multiple digests of the rest of a \ref nnc_rstream in one pass.
+ *  \param rs       Stream to hash.
+ *  \param types    Digests to compute, see \ref nnc_digest_type.
+ *  \param digests  Output digests.
+ *  \returns
+ *  Anything \ref nnc_crypto_multi_hash_part can return.
+ */
+nnc_result nnc_crypto_multi_hash_stream(nnc_rstream *rs, nnc_u8 types, nnc_digests *digests);
+
+/** \brief        Open a multi-digest hasher writer: hashes everything written to it
+ *                before passing it on to \p child.
+ *  \param self   Output hasher writer.
+ *  \param child  Child write stream.
+ *  \param types  Digests to compute, see \ref nnc_digest_type.
+ *  \param limit  Maximum amount of bytes to hash, 0 for no limit.
+ *  \note         Like \ref nnc_open_hasher_writer this stream does not support seeking.
+ *  \returns
+ *  Anything \ref nnc_multi_hasher_init can return.
+ */
+nnc_result nnc_open_multi_hasher_writer(nnc_multi_hasher_writer *self, nnc_wstream *child,
+	nnc_u8 types, nnc_u32 limit);
+
+/** \brief          Output the digests of a multi-digest hasher writer and close it.
+ *  \param self     Hasher writer to get the digests of and close.
+ *  \param digests  Output digests.
+ */
+void nnc_multi_hasher_writer_digest(nnc_multi_hasher_writer *self, nnc_digests *digests);
+
 /** \} */
 
 /** \brief         Hash a \ref nnc_rstream partly.
@@ -215,9 +384,11 @@ nnc_result nnc_keyset_default(nnc_keyset *ks, nnc_u8 setsel);
  *  \param seeddb  Output SeedDB.
  *  \note          This function allocates dynamic memory so be sure to free
  *                 it with \ref nnc_free_seeddb.
+ *  \note          The seed table is read with a single read and sorted afterwards.
  *  \returns
  *  Anything \p rs->read() can return.\n
- *  \p NNC_R_NOMEM => Failed to allocate memory for seeds.
+ *  \p NNC_R_NOMEM => Failed to allocate memory for seeds.\n
+ *  \p NNC_R_TOO_LARGE => SeedDB claims to contain more seeds than can be read.
  */
 nnc_result nnc_seeds_seeddb(nnc_rstream *rs, nnc_seeddb *seeddb);
 
@@ -239,6 +410,8 @@ nnc_result nnc_scan_seeddb(nnc_seeddb *seeddb);
  *  \param tid     Title ID to search for.
  *  \param seeddb  SeedDB to search in.
  *  \returns       Pointer to seed if found, else NULL.
+ *  \note          This function does not modify \p seeddb so it is safe to
+ *                 share one SeedDB between threads.
  */
 nnc_u8 *nnc_get_seed(nnc_seeddb *seeddb, nnc_u64 tid);
 
@@ -302,10 +475,12 @@ nnc_result nnc_get_ncch_iv(struct nnc_ncch_header *ncch, nnc_u8 for_section,
  *  \param child  Child stream to decrypt from.
  *  \param key    Encryption key.
  *  \param iv     Initial counter.
- *  \warning      As this stream does not keep it's own offsets, do not open one multiple
- *                times to one substream.
- *  \note         For optimal usage align all operations to 0x10 bytes,
- *                however unaligned reads are possible as well.
+ *  \warning      Do not open this stream multiple times on one substream.
+ *  \note         Reads are served from a window of decrypted data that is refilled
+ *                with large aligned reads, so small and unaligned reads are cheap.
+ *                See \ref nnc_aes_ctr_set_window.
+ *  \note         The expanded key is shared with other streams opened with the same key,
+ *                so opening many streams with one key is cheap.
  *  \note         Calling close on this stream doesn't close the substream.
  *  \returns
  *  \p NNC_R_NOMEM => Failed to allocate AES-CTR context.
@@ -313,15 +488,41 @@ nnc_result nnc_get_ncch_iv(struct nnc_ncch_header *ncch, nnc_u8 for_section,
 nnc_result nnc_aes_ctr_open(nnc_aes_ctr *self, nnc_rstream *child, nnc_u128 *key,
 	nnc_u8 iv[0x10]);
 
+/** \brief        Set the size of the decrypted window of an AES-CTR read stream.
+ *  \param self   AES-CTR stream from \ref nnc_aes_ctr_open.
+ *  \param size   New window size, rounded up to a multiple of 0x10.
+ *                The default is \ref NNC_CRYPTO_WINDOW_DEFAULT.
+ *  \note         The window is allocated on the first read and never larger than the stream.
+ *                Reads of at least the window size bypass it.
+ */
+nnc_result nnc_aes_ctr_set_window(nnc_aes_ctr *self, nnc_u32 size);
+
+/** \brief        Encrypt an AES-CTR stream on-the-fly.
+ *  \param self   Output AES-CTR stream.
+ *  \param child  Child stream to write encrypted data to.
+ *  \param key    Encryption key.
+ *  \param iv     Initial counter.
+ *  \note         Writes may be of any size, the counter is tracked relative to the offset
+ *                \p child was at when this stream was opened.
+ *  \note         This stream is seekable if \p child is seekable.
+ *  \note         Calling close on this stream doesn't close the substream.
+ *  \returns
+ *  \p NNC_R_NOMEM => Failed to allocate AES-CTR context.
+ */
+nnc_result nnc_aes_ctr_open_w(nnc_aes_ctr *self, nnc_wstream *child, nnc_u128 *key,
+	nnc_u8 iv[0x10]);
+
 /** \brief        Decrypt an AES-CBC stream on-the-fly.
  *  \param self   Output AES-CBC stream.
  *  \param child  Child stream to decrypt from.
  *  \param key    Encryption key.
  *  \param iv     IV.
- *  \warning      As this stream does not keep it's own offsets, do not open one multiple
- *                times to one substream.
- *  \note         For optimal usage align all operations to 0x10 bytes,
- *                however unaligned reads are possible as well.
+ *  \warning      Do not open this stream multiple times on one substream.
+ *  \note         Reads are served from a window of decrypted data that is refilled
+ *                with large aligned reads, so small and unaligned reads are cheap.
+ *                See \ref nnc_aes_cbc_set_window.
+ *  \note         The expanded key is shared with other streams opened with the same key,
+ *                so opening many streams with one key is cheap.
  *  \note         Calling close on this stream doesn't close the substream.
  *  \returns
  *  \p NNC_R_NOMEM => Failed to allocate AES-CBC context.
@@ -329,15 +530,23 @@ nnc_result nnc_aes_ctr_open(nnc_aes_ctr *self, nnc_rstream *child, nnc_u128 *key
 nnc_result nnc_aes_cbc_open(nnc_aes_cbc *self, nnc_rstream *child, nnc_u8 key[0x10],
 	nnc_u8 iv[0x10]);
 
+/** \brief        Set the size of the decrypted window of an AES-CBC read stream.
+ *  \param self   AES-CBC stream from \ref nnc_aes_cbc_open.
+ *  \param size   New window size, see \ref nnc_aes_ctr_set_window.
+ */
+nnc_result nnc_aes_cbc_set_window(nnc_aes_cbc *self, nnc_u32 size);
+
 /** \brief        Encrypt an AES-CBC stream on-the-fly.
  *  \param self   Output AES-CBC stream.
- *  \param child  Child stream to encrypt from.
+ *  \param child  Child stream to write encrypted data to.
  *  \param key    Encryption key.
  *  \param iv     IV.
- *  \warning      As this stream does not keep it's own offsets, do not open one multiple
- *                times to one substream.
- *  \note         All operations to this stream should be aligned to 0x10 bytes.
+ *  \note         Writes may be of any size, incomplete blocks are held back until
+ *                they are completed by a following write. If an incomplete block remains
+ *                when the stream is closed it is padded with zeroes.
  *  \note         Calling close on this stream doesn't close the substream.
+ *  \returns
+ *  \p NNC_R_NOMEM => Failed to allocate AES-CBC context.
  */
 nnc_result nnc_aes_cbc_open_w(nnc_aes_cbc *self, nnc_wstream *child, nnc_u8 key[0x10],
 	nnc_u8 iv[0x10]);
@@ -358,6 +567,57 @@ nnc_result nnc_aes_cbc_open_w(nnc_aes_cbc *self, nnc_wstream *child, nnc_u8 key[
 nnc_result nnc_fill_keypair(nnc_keypair *output, nnc_keyset *ks, nnc_seeddb *seeddb,
 	struct nnc_ncch_header *ncch);
 
+/** \{
+ *  \anchor keypair-cache
+ *  \name   Keypair cache
+ */
+
+/** \brief           Initialize a keypair cache.
+ *  \param cache     Output cache.
+ *  \param capacity  Maximum amount of keypairs to hold.
+ *  \note            A cache may be shared between threads, lookups and insertions are serialized internally.
+ *  \returns
+ *  \p NNC_R_NOMEM => Failed to allocate cache.\n
+ *  \p NNC_R_OS => Failed to create lock.
+ */
+nnc_result nnc_keypair_cache_init(nnc_keypair_cache *cache, nnc_u32 capacity);
+
+/** \brief        Free a keypair cache.
+ *  \param cache  Cache to free.
+ */
+void nnc_keypair_cache_free(nnc_keypair_cache *cache);
+
+/** \brief         Like \ref nnc_fill_keypair, but reuses previously derived keypairs.
+ *  \param output  Output keypair.
+ *  \param ks      Keyset from \ref nnc_keyset_default.
+ *  \param seeddb  SeedDB. See comments in \ref nnc_key_content.
+ *  \param ncch    NCCH to get keypair for.
+ *  \param cache   Cache to use, if NULL this function behaves exactly like \ref nnc_fill_keypair.
+ *  \note          Keypairs are cached by title ID, keyY, crypt method, seed and the KeyXs used,
+ *                 so it is safe to use one cache with multiple keysets.
+ *  \returns
+ *  Anything \ref nnc_fill_keypair can return.
+ */
+nnc_result nnc_fill_keypair_cached(nnc_keypair *output, nnc_keyset *ks, nnc_seeddb *seeddb,
+	struct nnc_ncch_header *ncch, nnc_keypair_cache *cache);
+
+/** \brief          Get the keypairs for multiple NCCHs at once.
+ *  \param outputs  Output keypairs, must have room for \p count keypairs.
+ *  \param results  Output results per NCCH, may be NULL.
+ *  \param ks       Keyset from \ref nnc_keyset_default.
+ *  \param seeddb   SeedDB. See comments in \ref nnc_key_content.
+ *  \param ncchs    Array of \p count NCCH headers.
+ *  \param count    Amount of NCCH headers.
+ *  \param cache    Cache to use, may be NULL.
+ *  \note           A failure for one NCCH does not stop the others from being processed.
+ *  \returns
+ *  The first error encountered, if any. See \ref nnc_fill_keypair.
+ */
+nnc_result nnc_fill_keypairs(nnc_keypair *outputs, nnc_result *results, nnc_keyset *ks,
+	nnc_seeddb *seeddb, struct nnc_ncch_header *ncchs, nnc_u32 count, nnc_keypair_cache *cache);
+
+/** \} */
+
 /* forward declaration from ticket.h */
 struct nnc_ticket;
 
@@ -54,8 +54,30 @@ typedef struct nnc_ivfc_writer {
 	nnc_u32 id, levels;
 	nnc_u32 block_size; /* not log2! */
 	nnc_u32 header_pos;
+	struct nnc_ivfc_hash_pool *pool; /* NULL if hashing on the calling thread */
 } nnc_ivfc_writer;
 
+/** Read stream of a RomFS IVFC that verifies the data it reads, see \ref nnc_open_ivfc_reader. */
+typedef struct nnc_ivfc_reader {
+	const nnc_rstream_funcs *funcs;
+	nnc_rstream *child;
+	nnc_ivfc ivfc;
+	nnc_u64 level_offset[3]; /* offsets of level 1, 2 and 3 in child */
+	nnc_u8 *l1, *l2;         /* levels 1 and 2, level 2 is read as it's needed */
+	nnc_u8 *l2_verified;     /* bitmap of verified level 2 blocks */
+	nnc_u8 *l3_verified;     /* bitmap of verified level 3 blocks */
+	nnc_u8 *block;           /* a single level 3 block */
+	nnc_u32 pos, size;
+	nnc_u64 bad_offset;      ///< Offset in the child stream of the block that failed to verify after \p NNC_R_BAD_HASH.
+} nnc_ivfc_reader;
+
+/** Blocks that failed \ref nnc_ivfc_verify_all, free with \ref nnc_ivfc_free_report. */
+typedef struct nnc_ivfc_verify_report {
+	nnc_u32 *bad_blocks[3]; ///< Ascending indices of the blocks that don't match their hash, per level in the order of \ref nnc_ivfc::level.
+	nnc_u32 bad_count[3];   ///< Amount of indices in each of \p bad_blocks.
+	nnc_u64 blocks[3];      ///< Amount of blocks in each level.
+} nnc_ivfc_verify_report;
+
 /** \brief                  Reads the header of an IVFC.
  *  \param rs               Stream to read from.
  *  \param ivfc             Output IVFC.
@@ -79,6 +101,86 @@ nnc_result nnc_read_ivfc_header(nnc_rstream *rs, nnc_ivfc *ivfc, nnc_u32 expecte
  */
 nnc_result nnc_open_ivfc_writer(nnc_ivfc_writer *self, nnc_wstream *child, nnc_u32 levels, nnc_u32 id, nnc_u32 block_size);
 
+/** \brief          Hash the written data on other threads.
+ *
+ *  By default the data is hashed by the thread writing it. With this
+ *  the data is hashed by worker threads in batches while the calling thread
+ *  keeps writing to the child stream, the output is the same either way.
+ *  The workers are joined when the stream is closed or aborted.
+ *  \param self     Writer from \ref nnc_open_ivfc_writer, nothing may have been written to it yet.
+ *  \param threads  Amount of threads to hash with, 0 to hash on the calling thread.
+ *  \note           If no thread can be started the data is hashed on the calling thread.
+ *  \returns
+ *  \p NNC_R_INVAL => Data was already written or the threads were already set.\n
+ *  \p NNC_R_NOMEM => Failed to allocate memory.\n
+ *  \p NNC_R_OS => Failed to create a lock.
+ */
+nnc_result nnc_ivfc_writer_set_threads(nnc_ivfc_writer *self, nnc_u32 threads);
+
+/** \brief         Write whole blocks of which the hashes are already known.
+ *
+ *  The data is written as is and \p hashes go into the hash level
+ *  instead of hashing the data again, which makes copying unchanged
+ *  blocks from an existing IVFC cheap.
+ *  \param self    Writer from \ref nnc_open_ivfc_writer.
+ *  \param buf     Data to write, \p blocks times the block size.
+ *  \param blocks  Amount of blocks in \p buf.
+ *  \param hashes  The hash of every block in \p buf.
+ *  \note          The hashes are not checked, wrong hashes give an IVFC that doesn't verify.
+ *  \returns
+ *  \p NNC_R_BAD_ALIGN => The data written so far doesn't end at a block boundary.\n
+ *  \p NNC_R_NOMEM => Failed to allocate memory.\n
+ *  Anything \p child->write() can return.
+ */
+nnc_result nnc_ivfc_writer_copy_blocks(nnc_ivfc_writer *self, nnc_u8 *buf, nnc_u32 blocks, nnc_sha256_hash *hashes);
+
+/** \brief        Open a read stream that verifies the data of a RomFS IVFC.
+ *
+ *  The stream has the same contents as \p child, so it can be passed to
+ *  \ref nnc_init_romfs in place of it. Every level 3 block is checked
+ *  against its hash in level 2 the first time it is read, every level 2
+ *  block against its hash in level 1 when one of its hashes is first
+ *  needed, level 1 is checked against the master hash when the stream is
+ *  opened. The blocks that passed are remembered so each is only hashed
+ *  once. Reads outside of level 3 are not checked.
+ *  \param self   Output reader.
+ *  \param child  Stream of the RomFS, starting with the IVFC header.
+ *  \note         Closing the reader frees it, \p child stays open.
+ *  \note         Levels 1 and 2 are kept in memory, about 1/128th of the size of level 3.
+ *  \returns
+ *  \p NNC_R_BAD_HASH => Level 1 doesn't match the master hash, or later a read found a block that doesn't
+ *                       match its hash. \p bad_offset is set to the offset of the block.\n
+ *  \p NNC_R_CORRUPT => The IVFC header is invalid.\n
+ *  \p NNC_R_UNSUPPORTED => The IVFC uses block sizes larger than 16 MiB.\n
+ *  \p NNC_R_NOMEM => Failed to allocate memory.\n
+ *  Anything \ref nnc_read_ivfc_header can return.
+ */
+nnc_result nnc_open_ivfc_reader(nnc_ivfc_reader *self, nnc_rstream *child);
+
+/** \brief          Check every hash of a RomFS IVFC.
+ *  \param rs       Stream of the RomFS, starting with the IVFC header.
+ *  \param header   Header from \ref nnc_read_ivfc_header.
+ *  \param threads  Maximum amount of threads to hash level 3 with, 0 is the same as 1.
+ *  \param report   Output bad blocks, free it with \ref nnc_ivfc_free_report whatever this function returns.
+ *  \note           Level 3 is split in a contiguous range per thread. The threads take turns
+ *                  reading \p rs in large chunks, the hashing is done in parallel.
+ *  \note           Blocks are compared with the hashes as they are in the level before, so
+ *                  a bad block in level 1 or 2 also means the blocks it has the hashes of
+ *                  can't be trusted.
+ *  \returns
+ *  \p NNC_R_BAD_HASH => At least one block is bad, see \p report.\n
+ *  \p NNC_R_CORRUPT => \p header doesn't describe a RomFS that fits in \p rs.\n
+ *  \p NNC_R_UNSUPPORTED => \p header isn't of a RomFS or uses block sizes larger than 16 MiB.\n
+ *  \p NNC_R_NOMEM => Failed to allocate memory.\n
+ *  Anything \p rs->read() can return.
+ */
+nnc_result nnc_ivfc_verify_all(nnc_rstream *rs, const nnc_ivfc *header, nnc_u32 threads, nnc_ivfc_verify_report *report);
+
+/** \brief         Free the memory of a report from \ref nnc_ivfc_verify_all.
+ *  \param report  Report to free.
+ */
+void nnc_ivfc_free_report(nnc_ivfc_verify_report *report);
+
 /** \brief       Frees memory in use by an IVFC writer without writing out the rest of the IVFC file.
  *  \param self  The writer to free.
  */
@@ -252,7 +252,10 @@ void nnc_condense_ncch(nnc_condensed_ncch_header *cnd, nnc_ncch_header *hdr);
  *  \param exefs     ExeFS section, for possible types see #nnc_ncch_wflags.
  *  \param romfs     RomFS section, for possible types see #nnc_ncch_wflags.
  *  \param ws        The output write stream.
- *  \note            The write stream *must* support seeking.
+ *  \note            If \p ws can't seek the NCCH is built twice, first to fill in the header and then
+ *                   to write it front to back. All inputs are then read twice.
+ *  \note            The NCCH is always written decrypted, with the NoCrypto flag set. Section encryption
+ *                   is not supported, use #NNC_CIA_WF_ENCRYPT_CONTENTS to encrypt it as a CIA content instead.
  */
 nnc_result nnc_write_ncch(
 	nnc_condensed_ncch_header *header,
@@ -29,6 +29,7 @@ typedef struct nnc_romfs_ctx {
 	nnc_u8 *file_meta_data;
 	nnc_u8 *dir_meta_data;
 	nnc_rstream *rs;
+	struct nnc_romfs_index *index; ///< Full path index, NULL unless built with \ref nnc_romfs_build_index.
 } nnc_romfs_ctx;
 
 /** Information about either a directory or file in RomFS. */
@@ -88,13 +89,87 @@ nnc_romfs_iterator nnc_romfs_mkit(nnc_romfs_ctx *ctx, const nnc_romfs_info *dir)
  *  \param ctx   Context from \ref nnc_init_romfs.
  *  \param info  Output info.
  *  \param path  The absolute RomFS path to the file or directory.
+ *  \note        This function doesn't modify \p ctx, so multiple threads may look up
+ *               paths in the same context at once. It uses the index if
+ *               \ref nnc_romfs_build_index was called, otherwise the path is
+ *               looked up one component at a time.
+ *  \returns
+ *  \p NNC_R_NOT_FOUND => \p path doesn't exist.\n
+ *  \p NNC_R_NOMEM => Failed to allocate memory for a long path.
  */
 nnc_result nnc_get_info(nnc_romfs_ctx *ctx, nnc_romfs_info *info, const char *path);
 
+/** \brief      Build an index of all full paths in a RomFS to speed up \ref nnc_get_info.
+ *  \param ctx  Context from \ref nnc_init_romfs.
+ *  \note       The index is built in a single pass over the metadata tables and is
+ *              freed by \ref nnc_free_romfs. Building it is worth it if many paths
+ *              are looked up, it uses memory proportional to the total length of all paths.
+ *  \note       This function modifies \p ctx, it may not be called while other threads use it.
+ *              Calling it again does nothing.
+ *  \returns
+ *  \p NNC_R_NOMEM => Failed to allocate memory.\n
+ *  \p NNC_R_CORRUPT => The metadata tables are invalid.\n
+ *  \p NNC_R_TOO_LARGE => The paths don't fit in the index.
+ */
+nnc_result nnc_romfs_build_index(nnc_romfs_ctx *ctx);
+
+/** Flat listing of a RomFS from \ref nnc_romfs_list_all, entry \p i of a kind is described by index \p i of each of its arrays. */
+typedef struct nnc_romfs_listing {
+	char *strings;           ///< All paths, each terminated by a NUL. Paths have no leading slash and the root is "".
+	nnc_u32 *file_paths;     ///< Offset in \p strings of the path of each file.
+	nnc_u64 *file_offsets;   ///< Offset of the data of each file, the same as \ref nnc_romfs_file_info::offset.
+	nnc_u64 *file_sizes;     ///< Size of the data of each file.
+	nnc_u32 *file_parents;   ///< Index of the directory each file is in.
+	nnc_u32 file_count;      ///< Amount of files.
+	nnc_u32 *dir_paths;      ///< Offset in \p strings of the path of each directory.
+	nnc_u32 *dir_parents;    ///< Index of the parent of each directory, the root is index 0 and its own parent.
+	nnc_u32 dir_count;       ///< Amount of directories.
+} nnc_romfs_listing;
+
+/** \brief       List all files and directories in a RomFS with their full paths.
+ *  \param ctx   Context from \ref nnc_init_romfs.
+ *  \param list  Output listing, free with \ref nnc_romfs_free_listing.
+ *  \note        The listing is made in a single pass over the metadata tables, each name is
+ *               converted to UTF-8 once. Entries are in the order of the tables.
+ *  \note        \p ctx is not modified, this may be called from multiple threads at once.
+ *  \returns
+ *  \p NNC_R_NOMEM => Failed to allocate memory.\n
+ *  \p NNC_R_CORRUPT => The metadata tables are invalid.\n
+ *  \p NNC_R_TOO_LARGE => The paths don't fit in the listing.
+ */
+nnc_result nnc_romfs_list_all(nnc_romfs_ctx *ctx, nnc_romfs_listing *list);
+
+/** \brief       Free a listing from \ref nnc_romfs_list_all.
+ *  \param list  Listing to free.
+ */
+void nnc_romfs_free_listing(nnc_romfs_listing *list);
+
+/** \brief          Find the files in a listing with a path that matches a glob pattern.
+ *  \param list     Listing from \ref nnc_romfs_list_all.
+ *  \param pattern  Pattern to match the whole path against, leading slashes are ignored.
+ *                  '?' matches one character, '*' any amount of characters except '/'
+ *                  and '**' any amount of characters including '/'. A '**' that makes up a
+ *                  whole path component matches any amount of directories, including none.
+ *                  Everything else is literal.
+ *  \param matches  Output indices of the matching files, must have room for \p list->file_count entries.
+ *  \returns        The amount of matching files.
+ */
+nnc_u32 nnc_romfs_list_glob(const nnc_romfs_listing *list, const char *pattern, nnc_u32 *matches);
+
+/** \brief          Find the files in a listing with a path that starts with a string.
+ *  \param list     Listing from \ref nnc_romfs_list_all.
+ *  \param prefix   The string to compare with, leading slashes are ignored.
+ *                  Use a trailing slash to only match the files under a directory.
+ *  \param matches  Output indices of the matching files, must have room for \p list->file_count entries.
+ *  \returns        The amount of matching files.
+ */
+nnc_u32 nnc_romfs_list_prefix(const nnc_romfs_listing *list, const char *prefix, nnc_u32 *matches);
+
 /** \brief       Convert the UTF16 filename to UTF8 in a NULL-terminated string.
  *  \param ctx   A context to get a UTF buffer from.
  *  \param info  The entry to get the filename from.
- *  \note        Subsequent calls to this function and #nnc_get_info will modify the original returned pointer.
+ *  \note        Subsequent calls to this function will modify the original returned pointer,
+ *               so unlike \ref nnc_get_info it may not be used by multiple threads at once.
  *  \note        You do not have to free the return of this function.
  *  \returns     This function may return NULL if allocation failed.
  */
@@ -106,6 +181,26 @@ const char *nnc_romfs_info_filename(nnc_romfs_ctx *ctx, nnc_romfs_info *info);
  */
 nnc_result nnc_romfs_to_vfs(nnc_romfs_ctx *ctx, nnc_vfs_directory_node *dir);
 
+/** \brief           Extract all files and directories in a RomFS to a directory.
+ *  \param ctx       Context from \ref nnc_init_romfs.
+ *  \param dest_dir  Directory to extract to, it is created if it doesn't exist.
+ *  \param threads   Maximum amount of threads to write files with, 0 is the same as 1.
+ *  \note            All directories are created first. The files are then extracted in the order
+ *                   their data is stored in, split in contiguous ranges with about the same amount
+ *                   of data for each thread, so the RomFS is read sequentially in large blocks
+ *                   (which matters a lot for encrypted streams).
+ *  \note            The stream of \p ctx is only used by one thread at a time, reading is
+ *                   serialized while writing the files is done concurrently.
+ *  \note            Existing files are overwritten.
+ *  \returns
+ *  \p NNC_R_NOMEM => Failed to allocate memory.\n
+ *  \p NNC_R_OS => Failed to create a directory.\n
+ *  \p NNC_R_UNSUPPORTED => Creating directories is not supported on this platform.\n
+ *  \p NNC_R_CORRUPT => A name is empty, "." or "..", or contains '/', '\\' or ':', no files are extracted then.\n
+ *  Anything \ref nnc_wfile_open or \p ctx->rs->read() can return.
+ */
+nnc_result nnc_romfs_extract_all(nnc_romfs_ctx *ctx, const char *dest_dir, nnc_u32 threads);
+
 /** \brief       Opens a RomFS file in a subview \ref nnc_rstream.
  *  \param ctx   Context from \ref nnc_init_romfs.
  *  \param sv    Output subview.
@@ -119,6 +214,7 @@ nnc_result nnc_romfs_open_subview(nnc_romfs_ctx *ctx, nnc_subview *sv, nnc_romfs
  *  \note       This function allocates dynamic memory so make sure to free
  *              \p ctx with \ref nnc_free_romfs.
  *  \note       If this function does not return NNC_R_OK you musn't call \ref nnc_free_romfs
+ *  \note       To check the hashes of everything read pass an \ref nnc_ivfc_reader opened on \p rs.
  */
 nnc_result nnc_init_romfs(nnc_rstream *rs, nnc_romfs_ctx *ctx);
 
@@ -134,13 +230,135 @@ void nnc_free_romfs(nnc_romfs_ctx *ctx);
  */
 nnc_result nnc_read_romfs_header(nnc_rstream *rs, nnc_romfs_header *romfs);
 
+/** Options for \ref nnc_write_romfs_ex. */
+typedef struct nnc_romfs_write_options {
+	nnc_u32 hash_threads;     ///< Threads to hash the file data on while it is written, 0 to hash it on the calling thread.
+	                          ///< See \ref nnc_ivfc_writer_set_threads.
+	nnc_u32 prefetch_bytes;   ///< Amount of file data that may be read ahead of the writer on another thread,
+	                          ///< 0 to read every file when it is written. The VFS streams are then read from that thread.
+	bool dedupe;              ///< Store files with the same contents only once, every file then points at the same data.
+	                          ///< All files whose size occurs more than once are read an extra time to find them.
+	nnc_u64 *dedupe_saved;    ///< If not NULL, receives the amount of file data bytes that \p dedupe didn't have to write,
+	                          ///< including the padding after each file.
+	const char **data_order;  ///< Paths of files, like "/dir/file", of which the data is put first in this order.
+	                          ///< The data of the other files follows in the usual order, paths that aren't
+	                          ///< in the VFS are skipped. Only the data moves, the metadata stays the same.
+	nnc_u32 data_order_count; ///< Amount of paths in \p data_order.
+	nnc_u32 data_align;       ///< Alignment of the data of files, a power of 2 of at least 16 (the default). Level 3 starts
+	                          ///< at a 4 KiB boundary, so up to 4096 the data is also aligned in the whole RomFS image,
+	                          ///< which allows files to be mapped or sent straight out of it.
+	nnc_u64 data_align_min_size; ///< Only files of at least this size are aligned to \p data_align, the others to 16.
+	                             ///< 0 aligns all files that aren't empty.
+} nnc_romfs_write_options;
+
+/** \brief       Set all options to their defaults, these give the same result as \ref nnc_write_romfs.
+ *  \param opts  Options to initialize.
+ *  \note        Always initialize options with this so that options added later get their default.
+ */
+void nnc_romfs_write_options_init(nnc_romfs_write_options *opts);
+
 /** \brief      Write a RomFS.
  *  \param vfs  The Virtual FileSystem to use to fill up the RomFS contents.
  *  \param ws   The stream to write the RomFS to.
- *  \note       This function requires the `seek` function in `ws`
+ *  \note       If \p ws can't seek the RomFS is built twice, first to calculate the hashes
+ *              and then to write it front to back. All files are then read twice.
  */
 nnc_result nnc_write_romfs(nnc_vfs *vfs, nnc_wstream *ws);
 
+/** \brief       Write a RomFS with options.
+ *  \param vfs   The Virtual FileSystem to use to fill up the RomFS contents.
+ *  \param ws    The stream to write the RomFS to.
+ *  \param opts  Options from \ref nnc_romfs_write_options_init, NULL for the defaults.
+ *  \note        See \ref nnc_write_romfs for streams that can't seek.
+ *  \returns
+ *  \p NNC_R_INVAL => \p opts->data_align isn't a power of 2 of at least 16.\n
+ *  \p NNC_R_MISMATCH => A file grew while the RomFS was written.
+ */
+nnc_result nnc_write_romfs_ex(nnc_vfs *vfs, nnc_wstream *ws, const nnc_romfs_write_options *opts);
+
+/** \brief          Write a RomFS that is an existing RomFS with some files replaced or added.
+ *
+ *  Files of \p base keep their data at the same offset and changed files are
+ *  written over their old data if they fit, other files are put after the data.
+ *  All level 3 blocks without changes are copied together with their hash
+ *  from \p base instead of being hashed again, so the time this takes mostly
+ *  depends on the size of the changes.
+ *  \param base     The RomFS to start from, also read from for the unchanged data.
+ *  \param changes  Files to replace or add, the path of a file in \p changes is its path in the RomFS.
+ *  \param ws       The stream to write the RomFS to, this may not be the stream of \p base.
+ *  \param opts     Options from \ref nnc_romfs_write_options_init, NULL for the defaults.
+ *                  \p prefetch_bytes, \p dedupe, \p data_order and the data alignment are ignored.
+ *  \note           Files can't be removed, data of replaced files that moved is left in place.
+ *  \note           Hashes can only be reused if \p base uses the RomFS block size for its data.
+ *                  Otherwise everything is hashed again.
+ *  \returns
+ *  \p NNC_R_MISMATCH => A file in \p changes changed size while it was written.\n
+ *  \p NNC_R_TOO_LARGE => The RomFS got too large.\n
+ *  Anything \ref nnc_read_ivfc_header can return.
+ */
+nnc_result nnc_write_romfs_incremental(nnc_romfs_ctx *base, nnc_vfs *changes, nnc_wstream *ws, const nnc_romfs_write_options *opts);
+
+/** How a file differs between two RomFS images, see \ref nnc_romfs_diff. */
+enum nnc_romfs_change {
+	NNC_ROMFS_ADDED,    ///< The file is only in the second RomFS.
+	NNC_ROMFS_REMOVED,  ///< The file is only in the first RomFS.
+	NNC_ROMFS_MODIFIED, ///< The file is in both with different data.
+	NNC_ROMFS_MOVED,    ///< The file is only in the first RomFS and a file with the same data is only in the second.
+};
+
+/** A range of bytes in a file. */
+typedef struct nnc_romfs_range {
+	nnc_u64 offset; ///< Offset in the file.
+	nnc_u64 size;   ///< Size of the range.
+} nnc_romfs_range;
+
+typedef struct nnc_romfs_diff_entry {
+	enum nnc_romfs_change change; ///< What changed.
+	const char *path_a;           ///< Path in the first RomFS, NULL if the file was added.
+	const char *path_b;           ///< Path in the second RomFS, NULL if the file was removed.
+	nnc_u64 size_a;               ///< Size in the first RomFS, 0 if the file was added.
+	nnc_u64 size_b;               ///< Size in the second RomFS, 0 if the file was removed.
+	nnc_u32 first_range;          ///< Index in \ref nnc_romfs_diff_report::ranges of the first changed range of a modified file.
+	nnc_u32 range_count;          ///< Amount of changed ranges of a modified file.
+} nnc_romfs_diff_entry;
+
+/** Differences between two RomFS images from \ref nnc_romfs_diff. */
+typedef struct nnc_romfs_diff_report {
+	nnc_romfs_diff_entry *entries; ///< The files that differ ordered by path, the path in the first RomFS for moved files.
+	nnc_u32 count;                 ///< Amount of entries.
+	nnc_romfs_range *ranges;       ///< Changed ranges of all modified files.
+	nnc_u32 range_count;           ///< Amount of ranges.
+	nnc_u64 bytes_read;            ///< Amount of file data read from both images, all other data was compared by its hashes.
+	nnc_romfs_listing a, b;        ///< Listings the paths point into.
+} nnc_romfs_diff_report;
+
+/** \brief       Find the files that differ between two RomFS images.
+ *
+ *  Files are matched by path. The hashes of the level 3 blocks are compared for
+ *  blocks that only hold data of the file being compared, so only blocks that
+ *  differ or that also hold data of other files are read. Files that are only in
+ *  one of the images but have the same data as a file only in the other are
+ *  reported as moved.
+ *  \param a     The first RomFS.
+ *  \param b     The second RomFS.
+ *  \param diff  Output differences, free with \ref nnc_romfs_free_diff.
+ *  \note        The changed ranges are offsets in the file, ranges closer together than
+ *               32 bytes are merged. If the sizes differ the bytes past the end of the
+ *               smaller file are one range. Directories aren't compared.
+ *  \note        The hashes are trusted, see \ref nnc_read_ivfc_header. If a RomFS has no usable
+ *               hashes or the data of a file has a different position within the blocks in each
+ *               image all of it is read.
+ *  \returns
+ *  \p NNC_R_NOMEM => Failed to allocate memory.\n
+ *  Anything \ref nnc_romfs_list_all or \p rs->read() of either RomFS can return.
+ */
+nnc_result nnc_romfs_diff(nnc_romfs_ctx *a, nnc_romfs_ctx *b, nnc_romfs_diff_report *diff);
+
+/** \brief       Free differences from \ref nnc_romfs_diff.
+ *  \param diff  Differences to free.
+ */
+void nnc_romfs_free_diff(nnc_romfs_diff_report *diff);
+
 NNC_END
 #endif
 
@@ -96,10 +96,36 @@ const char *nnc_sigstr(enum nnc_sigtype sig);
  *  \p NNC_R_OK => Signature passed verification.\n
  *  \p NNC_R_BAD_SIG => Signature failed verification.\n
  *  \p NNC_R_CERT_NOT_FOUND => Certificate not found in \p chain.
- *  \p NNC_R_INVALID_SIG => Invalid signature.
+ *  \p NNC_R_INVALID_SIG => Invalid signature.\n
+ *  \p NNC_R_UNSUPPORTED => ECDSA signature with the builtin or mbedtls backend, only OpenSSL verifies those.
  */
 nnc_result nnc_verify_signature(nnc_certchain *chain, nnc_signature *sig, nnc_sha_hash hash);
 
+/** A single signature to check with \ref nnc_verify_signatures_batch. */
+typedef struct nnc_signature_check {
+	nnc_signature *sig;  ///< Signature to verify.
+	const nnc_u8 *data;  ///< Signed data, if NULL \p hash must already be set.
+	nnc_u32 size;        ///< Size of \p data.
+	nnc_sha_hash hash;   ///< Hash of the signed data, filled in if \p data is set.
+	nnc_result status;   ///< Output, result of the verification.
+} nnc_signature_check;
+
+/** \brief          Verifies many signatures against the same chain.
+ *  \param chain    Chain to select certificates from.
+ *  \param checks   Signatures to verify, \ref nnc_signature_check::status is
+ *                  set to what \ref nnc_verify_signature (or hashing the data)
+ *                  returned for each of them.
+ *  \param count    Amount of \p checks.
+ *  \param threads  Maximum amount of threads to use including the calling one,
+ *                  0 or 1 verifies everything on the calling thread.
+ *  \return         \p NNC_R_OK if all signatures passed verification, otherwise
+ *                  the first failed result in \p checks.
+ *  \note           Parsed public keys are cached between calls to this function
+ *                  and \ref nnc_verify_signature.
+ */
+nnc_result nnc_verify_signatures_batch(nnc_certchain *chain, nnc_signature_check *checks,
+	nnc_u32 count, nnc_u32 threads);
+
 /** \brief         Selects either sha1 or sha256 based on \p sig.
  *  \param rs      Stream to read data from.
  *  \param sig     Signature type.
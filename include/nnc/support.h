@@ -0,0 +1,88 @@
+/** \file   support.h
+ *  \brief  Prebuilt support data: keys, seeds and certificates in one blob.
+ *  \note   Scanning the support directories means probing several paths and
+ *          parsing every file found. A support blob holds the same data already
+ *          in the in-memory layout nnc uses, so it can be mapped or compiled
+ *          into a program and used after a single checksum over the blob.
+ *          A blob is only valid for builds of nnc with the same struct layout,
+ *          a mismatch is detected when it is opened.
+ *  \note   See examples/make_support_blob.c to create one.
+ */
+#ifndef inc_nnc_support_h
+#define inc_nnc_support_h
+
+#include <nnc/sigcert.h>
+#include <nnc/crypto.h>
+#include <nnc/stream.h>
+#include <nnc/base.h>
+NNC_BEGIN
+
+/** Name of the support blob searched for by \ref nnc_support_scan. */
+#define NNC_SUPPORT_FILE_NAME "nnc_support.bin"
+/** Alignment a support blob in memory must have. */
+#define NNC_SUPPORT_ALIGN 8
+
+typedef struct nnc_support {
+	const nnc_u8 *data;  ///< The blob.
+	nnc_u32 size;        ///< Size of \p data.
+	nnc_keyset *keyset;  ///< Keyset in the blob or NULL if it has none.
+	nnc_seeddb seeddb;   ///< SeedDB in the blob, empty if it has none.
+	nnc_certchain certs; ///< Certificates in the blob, empty if it has none.
+	void *mapping;       ///< Opaque, set if \p data was mapped or allocated by nnc.
+} nnc_support;
+
+/** \brief       Use a support blob that is already in memory.
+ *  \param self  Output support data.
+ *  \param data  The blob, must be aligned to \ref NNC_SUPPORT_ALIGN and stay alive
+ *               for as long as \p self is used.
+ *  \param size  Size of \p data.
+ *  \note        \p keyset, \p seeddb and \p certs point into \p data and must be treated as read only,
+ *               they can be passed to any function taking a keyset, SeedDB or certificate chain.
+ *  \returns
+ *  \p NNC_R_BAD_ALIGN => \p data is not aligned properly.\n
+ *  \p NNC_R_CORRUPT => Not a support blob or the checksum doesn't match.\n
+ *  \p NNC_R_UNSUPPORTED => The blob was made by a build of nnc with a different struct layout.
+ */
+nnc_result nnc_support_open_memory(nnc_support *self, const void *data, nnc_u32 size);
+
+/** \brief       Map a support blob from a file.
+ *  \param self  Output support data.
+ *  \param path  Path to the blob.
+ *  \note        On platforms without memory mapping the file is read instead.
+ *  \note        Close with \ref nnc_support_close.
+ *  \returns
+ *  \p NNC_R_FAIL_OPEN => Failed to open or map the file.\n
+ *  \p NNC_R_NOMEM => Failed to allocate memory.\n
+ *  Anything \ref nnc_support_open_memory can return.
+ */
+nnc_result nnc_support_open_file(nnc_support *self, const char *path);
+
+/** \brief       Map \ref NNC_SUPPORT_FILE_NAME from the support directories.
+ *  \param self  Output support data.
+ *  \see         \ref nnc_scan_seeddb for the support directories scanned.
+ *  \returns
+ *  \p NNC_R_NOT_FOUND => No support blob found.\n
+ *  Anything \ref nnc_support_open_file can return.
+ */
+nnc_result nnc_support_scan(nnc_support *self);
+
+/** \brief       Release support data opened with any of the open functions.
+ *  \param self  Support data to close.
+ */
+void nnc_support_close(nnc_support *self);
+
+/** \brief         Write a support blob.
+ *  \param ws      Stream to write the blob to.
+ *  \param ks      Keyset to include, may be NULL.
+ *  \param seeddb  SeedDB to include, may be NULL.
+ *  \param chain   Certificates to include, may be NULL.
+ *  \returns
+ *  \p NNC_R_NOMEM => Failed to allocate memory.\n
+ *  \p NNC_R_TOO_LARGE => The data doesn't fit in a blob.\n
+ *  Anything \p ws->write() can return.
+ */
+nnc_result nnc_write_support(nnc_wstream *ws, nnc_keyset *ks, nnc_seeddb *seeddb, nnc_certchain *chain);
+
+NNC_END
+#endif
+
@@ -17,8 +17,10 @@ typedef struct nnc_utf_conversion_buffer {
 } nnc_utf_conversion_buffer;
 
 /** \brief         Converts a UTF16 string to a UTF8 one.
- *  \note          The NULL terminator is never placed.
+ *  \note          The NULL terminator is never placed, but one unit of \p out is always left
+ *                 unused for it. Conversion stops at a NULL in \p in, unpaired surrogates are skipped.
  *  \param out     Output UTF8 string. Something like (\p inlen * 4) will always fit the entire output.
+ *                 May be NULL if \p outlen is 0.
  *  \param outlen  Length of the `out` array.
  *  \param in      Input UTF16 string.
  *  \param inlen   Length of the `in` array.
@@ -27,8 +29,11 @@ typedef struct nnc_utf_conversion_buffer {
 size_t nnc_utf16_to_utf8(nnc_u8 *out, size_t outlen, const nnc_u16 *in, size_t inlen);
 
 /** \brief         Converts a UTF8 string to a UTF16 one.
- *  \note          The NULL terminator is never placed.
+ *  \note          The NULL terminator is never placed, but one unit of \p out is always left
+ *                 unused for it. Conversion stops at a NULL or a truncated sequence in \p in,
+ *                 bytes that can't start a sequence are skipped.
  *  \param out     Output UTF16 string. Something like (\p inlen * 4) will always fit the entire output.
+ *                 May be NULL if \p outlen is 0.
  *  \param outlen  Length of the `out` array.
  *  \param in      Input UTF8 string.
  *  \param inlen   Length of the `in` array.
@@ -36,6 +41,20 @@ size_t nnc_utf16_to_utf8(nnc_u8 *out, size_t outlen, const nnc_u16 *in, size_t i
  */
 size_t nnc_utf8_to_utf16(nnc_u16 *out, size_t outlen, const nnc_u8 *in, size_t inlen);
 
+/** \brief         Get the length \ref nnc_utf16_to_utf8 would convert a string to without converting it.
+ *  \param in      Input UTF16 string.
+ *  \param inlen   Length of the `in` array.
+ *  \returns       Length of the converted string, an output buffer of one more unit fits it entirely.
+ */
+size_t nnc_utf16_to_utf8_length(const nnc_u16 *in, size_t inlen);
+
+/** \brief         Get the length \ref nnc_utf8_to_utf16 would convert a string to without converting it.
+ *  \param in      Input UTF8 string.
+ *  \param inlen   Length of the `in` array.
+ *  \returns       Length of the converted string, an output buffer of one more unit fits it entirely.
+ */
+size_t nnc_utf8_to_utf16_length(const nnc_u8 *in, size_t inlen);
+
 /** \brief                 Initializes a UTF conversion buffer.
  *  \param buf             Output buffer.
  *  \param initial_length  Initial length of the buffer, may be 0 to pick the default.
@@ -135,6 +135,22 @@ void nnc_cia_free_reader(nnc_cia_content_reader *reader)
 	free(reader->chunks);
 }
 
+struct cia_single_pass {
+	nnc_u8 wflags;
+	nnc_certchain_or_stream certchain;
+	nnc_ticket_or_stream ticket;
+	nnc_tmd_or_stream tmd;
+	nnc_u16 amount_contents;
+	nnc_cia_writable_ncch *contents;
+};
+
+static result cia_single_pass_write(void *udata, nnc_wstream *ws)
+{
+	struct cia_single_pass *args = udata;
+	return nnc_write_cia(args->wflags, args->certchain, args->ticket, args->tmd,
+		args->amount_contents, args->contents, ws);
+}
+
 nnc_result nnc_write_cia(
 	nnc_u8 wflags,
 	nnc_certchain_or_stream certchain,
@@ -144,26 +160,51 @@ nnc_result nnc_write_cia(
 	nnc_cia_writable_ncch *contents,
 	nnc_wstream *ws)
 {
-	if(!ws->funcs->seek || !ws->funcs->subreadstream)
-		return NNC_R_INVAL;
-
 #define DO_VALIDATE_FOR(ptr, opt1, opt2) if( !ptr || (wflags & (opt1 | opt2)) == 0 || (wflags & (opt1 | opt2)) == (opt1 | opt2)) return NNC_R_INVAL
 	DO_VALIDATE_FOR(certchain, NNC_CIA_WF_CERTCHAIN_BUILD, NNC_CIA_WF_CERTCHAIN_STREAM);
 	DO_VALIDATE_FOR(ticket, NNC_CIA_WF_TICKET_BUILD, NNC_CIA_WF_TICKET_STREAM);
 	DO_VALIDATE_FOR(tmd, NNC_CIA_WF_TMD_BUILD, NNC_CIA_WF_TMD_STREAM);
 #undef DO_VALIDATE_FOR
 
+	/* the header and TMD are written last */
+	if(!ws->funcs->seek)
+	{
+		struct cia_single_pass args = { wflags, certchain, ticket, tmd, amount_contents, contents };
+		return write_single_pass(cia_single_pass_write, &args, ws);
+	}
+
 	result ret;
 	nnc_u32 certchain_size, ticket_size, tmd_size, hdr_off, tmd_off, off, size, chunkcount = 0, startpos, endpos;
 	nnc_chunk_record *chunk_records = NULL;
 	nnc_wstream *content_writer;
-	nnc_hasher_writer hasher = { NULL };
+	nnc_hasher_writer hasher = { NULL }, ncch_hasher;
+	nnc_aes_cbc crypt = { NULL };
+	nnc_wstream *content_child = ws;
 	nnc_u64 content_size = 0;
-	u8 header[0x2020];
+	u8 header[0x2020], tkey[0x10], iv[0x10];
+	bool encrypt = wflags & NNC_CIA_WF_ENCRYPT_CONTENTS, readback;
 
 	u8 *content_index = &header[0x20];
 	memset(content_index, 0x00, 0x2000);
 
+	if(encrypt)
+	{
+		/* the chunk records have to be marked as encrypted */
+		if(!(wflags & NNC_CIA_WF_TMD_BUILD))
+			return NNC_R_INVAL;
+		nnc_ticket tik, *tikp = (nnc_ticket *) ticket;
+		if(wflags & NNC_CIA_WF_TICKET_STREAM)
+		{
+			TRY(nnc_read_ticket((nnc_rstream *) ticket, &tik));
+			tikp = &tik;
+		}
+		TRY(nnc_decrypt_tkey(tikp, nnc_get_default_keyset(), tkey));
+		/* the hashes are over the decrypted contents, so the hashers write to the encryption stream */
+		content_child = NNC_WSP(&crypt);
+	}
+	/* encrypted contents can't be read back to hash them */
+	readback = (wflags & NNC_CIA_WF_TMD_BUILD) && ws->funcs->subreadstream && !encrypt;
+
 	/* reserve some space for the header before we start doing actual work */
 	hdr_off = NNC_WS_PCALL0(ws, tell);
 	TRY(nnc_write_padding(ws, HDRSIZE_AL));
@@ -196,7 +237,7 @@ nnc_result nnc_write_cia(
 		TRY(nnc_write_padding(ws, CALIGN(tmd_size)));
 		chunk_records = malloc(sizeof(nnc_chunk_record) * amount_contents);
 		if(!chunk_records) return NNC_R_NOMEM;
-		TRYLBL(nnc_open_hasher_writer(&hasher, ws, 0), out);
+		TRYLBL(nnc_open_hasher_writer(&hasher, content_child, 0), out);
 		content_writer = NNC_WSP(&hasher);
 	}
 	else
@@ -208,17 +249,30 @@ nnc_result nnc_write_cia(
 	/* Now we can start writing the contents */
 	for(u32 i = 0; i < amount_contents; ++i)
 	{
+		if(contents[i].type == NNC_CIA_NCCHBUILD_NONE)
+			continue; /* nothing to be done */
+		if(encrypt)
+		{
+			nnc_cia_get_iv(iv, i);
+			TRYLBL(nnc_aes_cbc_open_w(&crypt, ws, tkey, iv), out);
+		}
 		switch(contents[i].type)
 		{
-		case NNC_CIA_NCCHBUILD_NONE:
-			continue; /* nothing to be done */
 		case NNC_CIA_NCCHBUILD_STREAM:
 			TRYLBL(nnc_copy((nnc_rstream *) contents[i].ncch, content_writer, &size), out);
 			break;
 		case NNC_CIA_NCCHBUILD_BUILD:
 			off = NNC_WS_PCALL0(ws, tell);
 			/* this requires seeking... which our content_writer may not have since it may be a hasher */
-			if(wflags & NNC_CIA_WF_TMD_BUILD)
+			if((wflags & NNC_CIA_WF_TMD_BUILD) && !readback)
+			{
+				/* the NCCH can't be read back to hash it, so write it front to back through a hasher instead */
+				TRYLBL(nnc_open_hasher_writer(&ncch_hasher, content_child, 0), out);
+				ret = nnc_write_ncch_from_buildable((nnc_buildable_ncch *) contents[i].ncch, NNC_WSP(&ncch_hasher));
+				nnc_hasher_writer_digest(&ncch_hasher, chunk_records[chunkcount].hash);
+				if(ret != NNC_R_OK) goto out;
+			}
+			else if(wflags & NNC_CIA_WF_TMD_BUILD)
 			{
 				startpos = NNC_WS_PCALL0(ws, tell);
 				TRYLBL(nnc_write_ncch_from_buildable((nnc_buildable_ncch *) contents[i].ncch, ws), out);
@@ -226,9 +280,22 @@ nnc_result nnc_write_cia(
 			}
 			else
 				TRYLBL(nnc_write_ncch_from_buildable((nnc_buildable_ncch *) contents[i].ncch, content_writer), out);
-			size = NNC_WS_PCALL0(ws, tell) - off;
+			/* the encryption stream counts the bytes it still holds back */
+			size = NNC_WS_PCALL0(content_child, tell) - off;
 			break;
 		}
+		if(encrypt)
+		{
+			/* CBC can't encrypt a partial block without changing the size of the content */
+			if(size % 0x10)
+			{
+				ret = NNC_R_BAD_ALIGN;
+				goto out;
+			}
+			ret = NNC_WS_CALL0(crypt, close);
+			crypt.funcs = NULL;
+			if(ret != NNC_R_OK) goto out;
+		}
 		/* we don't need to hash the alignment bytes, so we can just use `ws` always */
 		TRYLBL(PERFORM_ALIGNMENT(size), out);
 
@@ -237,9 +304,10 @@ nnc_result nnc_write_cia(
 			/* now we write the chunk record for this content */
 			chunk_records[chunkcount].id = i;
 			chunk_records[chunkcount].index = i;
-			chunk_records[chunkcount].flags = 0; /* we don't set any flags */
+			chunk_records[chunkcount].flags = encrypt ? NNC_CHUNKF_ENCRYPTED : 0;
 			chunk_records[chunkcount].size = size;
-			if(contents[i].type == NNC_CIA_NCCHBUILD_BUILD)
+			/* without readback a built NCCH was already hashed while writing */
+			if(contents[i].type == NNC_CIA_NCCHBUILD_BUILD && readback)
 			{
 				/* we need to read back and hash */
 				nnc_subview sv;
@@ -249,7 +317,7 @@ nnc_result nnc_write_cia(
 				if(ret != NNC_R_OK)
 					goto out;
 			}
-			else
+			else if(contents[i].type != NNC_CIA_NCCHBUILD_BUILD)
 				nnc_hasher_writer_digest_reset(&hasher, chunk_records[chunkcount].hash);
 			++chunkcount;
 		}
@@ -304,6 +372,7 @@ nnc_result nnc_write_cia(
 
 out:
 	if(hasher.funcs) NNC_WS_CALL0(hasher, close);
+	if(crypt.funcs) NNC_WS_CALL0(crypt, close);
 	free(chunk_records);
 	return ret;
 }
@@ -0,0 +1,132 @@
+
+#include <nnc/context.h>
+#include <string.h>
+#include "./internal.h"
+
+result nnc_ctx_init(nnc_ctx *ctx, const nnc_allocator *allocator, u32 flags)
+{
+	result ret;
+	ctx->allocator = allocator ? *allocator : default_allocator;
+	ctx->seeddb.size = 0;
+	ctx->seeddb.entries = NULL;
+	ctx->certs.certs = NULL;
+	ctx->certs.len = 0;
+	ctx->has_cache = false;
+	ctx->keyset.flags = 0;
+	TRY(nnc_keyset_default(&ctx->keyset, (flags & NNC_CTX_DEV_KEYS) ? NNC_KEYSET_DEVELOPMENT : NNC_KEYSET_RETAIL));
+	if(!(flags & NNC_CTX_NO_CACHE))
+	{
+		TRY(keypair_cache_init_al(&ctx->keypairs, NNC_CTX_KEYPAIR_CACHE_SIZE, &ctx->allocator));
+		ctx->has_cache = true;
+	}
+	if(flags & NNC_CTX_SCAN_BLOB)
+	{
+		nnc_support sup;
+		if(nnc_support_scan(&sup) == NNC_R_OK)
+		{
+			ret = nnc_ctx_load_support(ctx, &sup);
+			nnc_support_close(&sup);
+			return ret;
+		}
+	}
+	/* not having support files is fine */
+	if((flags & NNC_CTX_SCAN_SEEDDB) && (ret = nnc_ctx_scan_seeddb(ctx)) != NNC_R_OK && ret != NNC_R_NOT_FOUND)
+		return ret;
+	if(flags & NNC_CTX_SCAN_CERTS)
+		TRY(nnc_ctx_scan_certchains(ctx));
+	return NNC_R_OK;
+}
+
+void nnc_ctx_free(nnc_ctx *ctx)
+{
+	al_free(&ctx->allocator, ctx->seeddb.entries);
+	al_free(&ctx->allocator, ctx->certs.certs);
+	if(ctx->has_cache) nnc_keypair_cache_free(&ctx->keypairs);
+	ctx->seeddb.entries = NULL;
+	ctx->seeddb.size = 0;
+	ctx->certs.certs = NULL;
+	ctx->certs.len = 0;
+	ctx->has_cache = false;
+}
+
+result nnc_ctx_load_seeddb(nnc_ctx *ctx, nnc_rstream *rs)
+{
+	nnc_seeddb seeddb;
+	result ret;
+	TRY(seeds_seeddb_al(rs, &seeddb, &ctx->allocator));
+	al_free(&ctx->allocator, ctx->seeddb.entries);
+	ctx->seeddb = seeddb;
+	return NNC_R_OK;
+}
+
+result nnc_ctx_scan_seeddb(nnc_ctx *ctx)
+{
+	char path[SUP_FILE_NAME_LEN];
+	if(!find_support_file("seeddb.bin", path))
+		return NNC_R_NOT_FOUND;
+	nnc_file f;
+	result ret;
+	TRY(nnc_file_open(&f, path));
+	ret = nnc_ctx_load_seeddb(ctx, NNC_RSP(&f));
+	NNC_RS_CALL0(f, close);
+	return ret;
+}
+
+result nnc_ctx_load_certchain(nnc_ctx *ctx, nnc_rstream *rs)
+{
+	return read_certchain_al(rs, &ctx->certs, true, &ctx->allocator);
+}
+
+result nnc_ctx_scan_certchains(nnc_ctx *ctx)
+{
+	return scan_certchains_al(&ctx->certs, true, &ctx->allocator);
+}
+
+result nnc_ctx_load_support(nnc_ctx *ctx, const nnc_support *sup)
+{
+	if(sup->seeddb.size)
+	{
+		u32 size = sup->seeddb.size * sizeof(struct nnc_seeddb_entry);
+		struct nnc_seeddb_entry *entries = al_alloc(&ctx->allocator, size);
+		if(!entries) return NNC_R_NOMEM;
+		memcpy(entries, sup->seeddb.entries, size);
+		al_free(&ctx->allocator, ctx->seeddb.entries);
+		ctx->seeddb.entries = entries;
+		ctx->seeddb.size = sup->seeddb.size;
+	}
+	if(sup->certs.len)
+	{
+		nnc_certificate *certs = al_realloc(&ctx->allocator, ctx->certs.certs,
+			(ctx->certs.len + sup->certs.len) * sizeof(nnc_certificate));
+		if(!certs) return NNC_R_NOMEM;
+		memcpy(&certs[ctx->certs.len], sup->certs.certs, sup->certs.len * sizeof(nnc_certificate));
+		ctx->certs.certs = certs;
+		ctx->certs.len += sup->certs.len;
+	}
+	if(sup->keyset)
+		ctx->keyset = *sup->keyset;
+	return NNC_R_OK;
+}
+
+result nnc_ctx_fill_keypair(nnc_keypair *output, nnc_ctx *ctx, struct nnc_ncch_header *ncch)
+{
+	return nnc_fill_keypair_cached(output, &ctx->keyset, &ctx->seeddb, ncch,
+		ctx->has_cache ? &ctx->keypairs : NULL);
+}
+
+result nnc_ctx_decrypt_tkey(struct nnc_ticket *tik, nnc_ctx *ctx, u8 decrypted[0x10])
+{
+	return nnc_decrypt_tkey(tik, &ctx->keyset, decrypted);
+}
+
+result nnc_ctx_verify_signature(nnc_ctx *ctx, nnc_signature *sig, nnc_sha_hash hash)
+{
+	return nnc_verify_signature(&ctx->certs, sig, hash);
+}
+
+result nnc_ctx_verify_signatures_batch(nnc_ctx *ctx, nnc_signature_check *checks,
+	u32 count, u32 threads)
+{
+	return nnc_verify_signatures_batch(&ctx->certs, checks, count, threads);
+}
+
@@ -1,56 +1,137 @@
 
-#include <mbedtls/version.h>
-#include <mbedtls/sha256.h>
-#include <mbedtls/sha1.h>
-#include <mbedtls/aes.h>
-#include <nnc/crypto.h>
+#include "./crypto_backend.h"
 #include <nnc/ticket.h>
 #include <nnc/ncch.h>
 #include <stdlib.h>
 #include <string.h>
 #include "./internal.h"
 
-/* In MbedTLS version 2 the normal functions were marked deprecated
- * you were supposed to use *_ret, but in mbedTLS version 3+ the
- * *_ret functions had the functions renamed to have the _ret suffix removed */
-#if MBEDTLS_VERSION_MAJOR == 2
-	#define mbedtls_sha256_starts mbedtls_sha256_starts_ret
-	#define mbedtls_sha256_update mbedtls_sha256_update_ret
-	#define mbedtls_sha256_finish mbedtls_sha256_finish_ret
-	#define mbedtls_sha1_starts mbedtls_sha1_starts_ret
-	#define mbedtls_sha1_update mbedtls_sha1_update_ret
-	#define mbedtls_sha1_finish mbedtls_sha1_finish_ret
+#if NNC_CRYPTO_MBEDTLS
+	#define DEFAULT_BACKEND nnc_crypto_mbedtls
+#elif NNC_CRYPTO_OPENSSL
+	#define DEFAULT_BACKEND nnc_crypto_openssl
+#else
+	#define DEFAULT_BACKEND nnc_crypto_builtin
 #endif
 
+const nnc_crypto_backend *nnc_crypto_backend_current = &DEFAULT_BACKEND;
+
+nnc_result nnc_set_crypto_backend(enum nnc_crypto_backend_type type)
+{
+	switch(type)
+	{
+#if NNC_CRYPTO_MBEDTLS
+	case NNC_CRYPTO_BACKEND_MBEDTLS:
+		CRYPTO = &nnc_crypto_mbedtls;
+		return NNC_R_OK;
+#endif
+#if NNC_CRYPTO_OPENSSL
+	case NNC_CRYPTO_BACKEND_OPENSSL:
+		CRYPTO = &nnc_crypto_openssl;
+		return NNC_R_OK;
+#endif
+	case NNC_CRYPTO_BACKEND_BUILTIN:
+		CRYPTO = &nnc_crypto_builtin;
+		return NNC_R_OK;
+	default:
+		return NNC_R_UNSUPPORTED;
+	}
+}
+
+enum nnc_crypto_backend_type nnc_get_crypto_backend(void)
+{
+	return CRYPTO->type;
+}
+
+const char *nnc_crypto_backend_name(enum nnc_crypto_backend_type type)
+{
+	switch(type)
+	{
+	case NNC_CRYPTO_BACKEND_MBEDTLS: return "mbedtls";
+	case NNC_CRYPTO_BACKEND_OPENSSL: return "openssl";
+	case NNC_CRYPTO_BACKEND_BUILTIN: return "builtin";
+	}
+	return NULL;
+}
+
+result nnc_crypto_pkcs1_check(const u8 *em, u32 size, enum nnc_crypto_hash md, const u8 *hash)
+{
+	/* DER encoded DigestInfo without the hash itself */
+	static const u8 sha1_info[] = {
+		0x30, 0x21, 0x30, 0x09, 0x06, 0x05, 0x2B, 0x0E, 0x03, 0x02, 0x1A, 0x05, 0x00, 0x04, 0x14,
+	};
+	static const u8 sha256_info[] = {
+		0x30, 0x31, 0x30, 0x0D, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01,
+		0x05, 0x00, 0x04, 0x20,
+	};
+	const u8 *info = md == NNC_CRYPTO_SHA1 ? sha1_info : sha256_info;
+	u32 info_size = md == NNC_CRYPTO_SHA1 ? sizeof(sha1_info) : sizeof(sha256_info);
+	u32 hash_size = HASH_SIZE(md);
+	/* 00 01 FF .. FF 00 DigestInfo hash, with at least 8 bytes of FF */
+	if(size < 11 + info_size + hash_size)
+		return NNC_R_BAD_SIG;
+	u32 pad_end = size - info_size - hash_size - 1;
+	bool ok = em[0] == 0x00 && em[1] == 0x01 && em[pad_end] == 0x00;
+	for(u32 i = 2; i < pad_end; ++i)
+		ok &= em[i] == 0xFF;
+	ok &= memcmp(em + pad_end + 1, info, info_size) == 0;
+	ok &= memcmp(em + pad_end + 1 + info_size, hash, hash_size) == 0;
+	return ok ? NNC_R_OK : NNC_R_BAD_SIG;
+}
+
+/* hash contexts remember their backend so they keep working if the
+ * current backend is changed while they're alive */
+struct crypto_hash {
+	const nnc_crypto_backend *backend;
+	void *ctx;
+};
+
+static struct crypto_hash *crypto_hash_new(enum nnc_crypto_hash type)
+{
+	struct crypto_hash *self = malloc(sizeof(struct crypto_hash));
+	if(!self) return NULL;
+	self->backend = CRYPTO;
+	if(!(self->ctx = self->backend->hash_new(type)))
+	{
+		free(self);
+		return NULL;
+	}
+	return self;
+}
+
+static void crypto_hash_free(struct crypto_hash *self)
+{
+	self->backend->hash_free(self->ctx);
+	free(self);
+}
+
 nnc_result nnc_crypto_sha256_incremental(nnc_sha256_incremental_hash *self)
 {
-	*self = malloc(sizeof(mbedtls_sha256_context));
-	if(!*self) return NNC_R_NOMEM;
-	mbedtls_sha256_init(*self);
-	mbedtls_sha256_starts(*self, 0);
-	return NNC_R_OK;
+	*self = crypto_hash_new(NNC_CRYPTO_SHA256);
+	return *self ? NNC_R_OK : NNC_R_NOMEM;
 }
 
 void nnc_crypto_sha256_feed(nnc_sha256_incremental_hash self, u8 *data, u32 length)
 {
-	mbedtls_sha256_update(self, data, length);
+	struct crypto_hash *hash = self;
+	hash->backend->hash_update(hash->ctx, data, length);
 }
 
 void nnc_crypto_sha256_finish(nnc_sha256_incremental_hash self, nnc_sha256_hash digest)
 {
-	mbedtls_sha256_finish(self, digest);
-	mbedtls_sha256_free(self);
+	struct crypto_hash *hash = self;
+	hash->backend->hash_finish(hash->ctx, digest);
 }
 
 void nnc_crypto_sha256_reset(nnc_sha256_incremental_hash self)
 {
-	mbedtls_sha256_init(self);
-	mbedtls_sha256_starts(self, 0);
+	struct crypto_hash *hash = self;
+	hash->backend->hash_reset(hash->ctx);
 }
 
 void nnc_crypto_sha256_free(nnc_sha256_incremental_hash self)
 {
-	free(self);
+	crypto_hash_free(self);
 }
 
 static result hasher_writer_write(nnc_hasher_writer *self, u8 *buf, u32 size)
@@ -92,11 +173,10 @@ void nnc_hasher_writer_digest_reset(nnc_hasher_writer *self, nnc_sha256_hash dig
 }
 
 
-result nnc_crypto_sha256_part(nnc_rstream *rs, nnc_sha256_hash digest, u32 size)
+static result crypto_hash_part(nnc_rstream *rs, enum nnc_crypto_hash type, u8 *digest, u32 size)
 {
-	mbedtls_sha256_context ctx;
-	mbedtls_sha256_init(&ctx);
-	mbedtls_sha256_starts(&ctx, 0);
+	struct crypto_hash *hash = crypto_hash_new(type);
+	if(!hash) return NNC_R_NOMEM;
 	u8 block[BLOCK_SZ];
 	u32 read_left = size, next_read = MIN(size, BLOCK_SZ), read_ret;
 	result ret;
@@ -105,41 +185,195 @@ result nnc_crypto_sha256_part(nnc_rstream *rs, nnc_sha256_hash digest, u32 size)
 		ret = NNC_RS_PCALL(rs, read, block, next_read, &read_ret);
 		if(ret != NNC_R_OK) goto out;
 		if(read_ret != next_read) { ret = NNC_R_TOO_SMALL; goto out; }
-		mbedtls_sha256_update(&ctx, block, read_ret);
+		hash->backend->hash_update(hash->ctx, block, read_ret);
 		read_left -= next_read;
 		next_read = MIN(read_left, BLOCK_SZ);
 	}
-	mbedtls_sha256_finish(&ctx, digest);
+	hash->backend->hash_finish(hash->ctx, digest);
 	ret = NNC_R_OK;
 out:
-	mbedtls_sha256_free(&ctx);
+	crypto_hash_free(hash);
 	return ret;
 }
 
+result nnc_crypto_sha256_part(nnc_rstream *rs, nnc_sha256_hash digest, u32 size)
+{
+	return crypto_hash_part(rs, NNC_CRYPTO_SHA256, digest, size);
+}
+
 result nnc_crypto_sha1_part(nnc_rstream *rs, nnc_sha1_hash digest, u32 size)
 {
-	mbedtls_sha1_context ctx;
-	mbedtls_sha1_init(&ctx);
-	mbedtls_sha1_starts(&ctx);
+	return crypto_hash_part(rs, NNC_CRYPTO_SHA1, digest, size);
+}
+
+/* reflected CRC32 with polynomial 0x04C11DB7, the one zlib uses */
+static const u32 crc32_table[0x100] = {
+	0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+	0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+	0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+	0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+	0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+	0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+	0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+	0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+	0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+	0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+	0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+	0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+	0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+	0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+	0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+	0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+	0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+	0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+	0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+	0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+	0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+	0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+	0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+	0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+	0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+	0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+	0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+	0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+	0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+	0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+	0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+	0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+	0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+	0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+	0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+	0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+	0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+	0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+	0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+	0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+	0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+	0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+	0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D,
+};
+
+u32 nnc_crc32_update(u32 crc, const u8 *data, u32 size)
+{
+	crc = ~crc;
+	while(size--)
+		crc = crc32_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+#define DIGEST_ALL (NNC_DIGEST_SHA1 | NNC_DIGEST_SHA256 | NNC_DIGEST_CRC32)
+
+result nnc_multi_hasher_init(nnc_multi_hasher *self, u8 types)
+{
+	self->sha1 = self->sha256 = NULL;
+	self->crc32 = 0;
+	self->types = types;
+	if(!types || (types & ~DIGEST_ALL))
+		return NNC_R_INVAL;
+	if(((types & NNC_DIGEST_SHA1) && !(self->sha1 = crypto_hash_new(NNC_CRYPTO_SHA1)))
+		|| ((types & NNC_DIGEST_SHA256) && !(self->sha256 = crypto_hash_new(NNC_CRYPTO_SHA256))))
+	{
+		nnc_multi_hasher_free(self);
+		return NNC_R_NOMEM;
+	}
+	return NNC_R_OK;
+}
+
+void nnc_multi_hasher_feed(nnc_multi_hasher *self, const u8 *data, u32 length)
+{
+	struct crypto_hash *hash;
+	if((hash = self->sha1))   hash->backend->hash_update(hash->ctx, data, length);
+	if((hash = self->sha256)) hash->backend->hash_update(hash->ctx, data, length);
+	if(self->types & NNC_DIGEST_CRC32)
+		self->crc32 = crc32_update(self->crc32, data, length);
+}
+
+void nnc_multi_hasher_finish(nnc_multi_hasher *self, nnc_digests *digests)
+{
+	struct crypto_hash *hash;
+	digests->types = self->types;
+	if((hash = self->sha1))
+	{
+		hash->backend->hash_finish(hash->ctx, digests->sha1);
+		hash->backend->hash_reset(hash->ctx);
+	}
+	if((hash = self->sha256))
+	{
+		hash->backend->hash_finish(hash->ctx, digests->sha256);
+		hash->backend->hash_reset(hash->ctx);
+	}
+	digests->crc32 = self->crc32;
+	self->crc32 = 0;
+}
+
+void nnc_multi_hasher_free(nnc_multi_hasher *self)
+{
+	if(self->sha1)   crypto_hash_free(self->sha1);
+	if(self->sha256) crypto_hash_free(self->sha256);
+	self->sha1 = self->sha256 = NULL;
+}
+
+result nnc_crypto_multi_hash_part(nnc_rstream *rs, u8 types, nnc_digests *digests, u32 size)
+{
+	nnc_multi_hasher hasher;
+	result ret;
+	TRY(nnc_multi_hasher_init(&hasher, types));
 	u8 block[BLOCK_SZ];
 	u32 read_left = size, next_read = MIN(size, BLOCK_SZ), read_ret;
-	result ret;
 	while(read_left != 0)
 	{
 		ret = NNC_RS_PCALL(rs, read, block, next_read, &read_ret);
 		if(ret != NNC_R_OK) goto out;
 		if(read_ret != next_read) { ret = NNC_R_TOO_SMALL; goto out; }
-		mbedtls_sha1_update(&ctx, block, read_ret);
+		nnc_multi_hasher_feed(&hasher, block, read_ret);
 		read_left -= next_read;
 		next_read = MIN(read_left, BLOCK_SZ);
 	}
-	mbedtls_sha1_finish(&ctx, digest);
+	nnc_multi_hasher_finish(&hasher, digests);
 	ret = NNC_R_OK;
 out:
-	mbedtls_sha1_free(&ctx);
+	nnc_multi_hasher_free(&hasher);
 	return ret;
 }
 
+result nnc_crypto_multi_hash_stream(nnc_rstream *rs, u8 types, nnc_digests *digests)
+{
+	return nnc_crypto_multi_hash_part(rs, types, digests, NNC_RS_PCALL0(rs, size) - NNC_RS_PCALL0(rs, tell));
+}
+
+static result multi_hasher_writer_write(nnc_multi_hasher_writer *self, u8 *buf, u32 size)
+{
+	u32 to_hash = self->lim ? MIN(self->lim - self->hashed, size) : size;
+	nnc_multi_hasher_feed(&self->hasher, buf, to_hash);
+	self->hashed += to_hash;
+	return self->child->funcs->write(self->child, buf, size);
+}
+
+static result multi_hasher_writer_wclose(nnc_multi_hasher_writer *self) { nnc_multi_hasher_free(&self->hasher); return NNC_R_OK; }
+static result multi_hasher_writer_wtell(nnc_multi_hasher_writer *self)  { return self->child->funcs->tell(self->child); }
+
+static const nnc_wstream_funcs multi_hasher_writer_wfuncs = {
+	.write = (nnc_write_func)  multi_hasher_writer_write,
+	.close = (nnc_wclose_func) multi_hasher_writer_wclose,
+	.tell  = (nnc_wtell_func)  multi_hasher_writer_wtell,
+};
+
+nnc_result nnc_open_multi_hasher_writer(nnc_multi_hasher_writer *self, nnc_wstream *child,
+	nnc_u8 types, nnc_u32 limit)
+{
+	self->funcs  = &multi_hasher_writer_wfuncs;
+	self->child  = child;
+	self->lim    = limit;
+	self->hashed = 0;
+	return nnc_multi_hasher_init(&self->hasher, types);
+}
+
+void nnc_multi_hasher_writer_digest(nnc_multi_hasher_writer *self, nnc_digests *digests)
+{
+	nnc_multi_hasher_finish(&self->hasher, digests);
+	multi_hasher_writer_wclose(self);
+}
+
 
 result nnc_crypto_sha256_stream(nnc_rstream *rs, nnc_sha256_hash digest)
 {
@@ -160,37 +394,69 @@ bool nnc_crypto_hasheq(nnc_sha256_hash a, nnc_sha256_hash b)
 
 result nnc_crypto_sha256(const u8 *buf, nnc_sha256_hash digest, u32 size)
 {
-	mbedtls_sha256_context ctx;
-	mbedtls_sha256_init(&ctx);
-	mbedtls_sha256_starts(&ctx, 0);
-	mbedtls_sha256_update(&ctx, buf, size);
-	mbedtls_sha256_finish(&ctx, digest);
-	mbedtls_sha256_free(&ctx);
+	struct crypto_hash *hash = crypto_hash_new(NNC_CRYPTO_SHA256);
+	if(!hash) return NNC_R_NOMEM;
+	hash->backend->hash_update(hash->ctx, buf, size);
+	hash->backend->hash_finish(hash->ctx, digest);
+	crypto_hash_free(hash);
 	return NNC_R_OK;
 }
 
+static int seeddb_entry_cmp(const void *a, const void *b)
+{
+	u64 ta = ((const struct nnc_seeddb_entry *) a)->title_id;
+	u64 tb = ((const struct nnc_seeddb_entry *) b)->title_id;
+	return (ta > tb) - (ta < tb);
+}
+
 nnc_result nnc_seeds_seeddb(nnc_rstream *rs, nnc_seeddb *seeddb)
 {
-	u8 buf[0x20];
+	return seeds_seeddb_al(rs, seeddb, &default_allocator);
+}
+
+result nnc_seeds_seeddb_al(nnc_rstream *rs, nnc_seeddb *seeddb, const nnc_allocator *al)
+{
+	u8 buf[0x10];
 	result ret;
 	seeddb->size = 0;
+	seeddb->entries = NULL;
 	u32 expected_size;
 	TRY(read_exact(rs, buf, 0x10));
 	expected_size = LE32P(&buf[0x00]);
-	if(!(seeddb->entries = malloc(expected_size * sizeof(struct nnc_seeddb_entry))))
-		return NNC_R_NOMEM;
-	for(u32 i = 0; i < expected_size; ++i, ++seeddb->size)
+	if(expected_size == 0)
+		return NNC_R_OK;
+	if(expected_size > (UINT32_MAX - 0x10) / 0x20)
+		return NNC_R_TOO_LARGE;
+	/* read the entire table in one go and convert it in place, this works
+	 * because an nnc_seeddb_entry is smaller than an entry on disk */
+	u8 *raw = al_alloc(al, expected_size * 0x20);
+	if(!raw) return NNC_R_NOMEM;
+	if((ret = read_exact(rs, raw, expected_size * 0x20)) != NNC_R_OK)
 	{
-		TRY(read_exact(rs, buf, 0x20));
-		memcpy(seeddb->entries[i].seed, &buf[0x08], NNC_SEED_SIZE);
-		seeddb->entries[i].title_id = LE64P(&buf[0x00]);
+		al_free(al, raw);
+		return ret;
 	}
+	struct nnc_seeddb_entry *entries = (struct nnc_seeddb_entry *) raw;
+	u8 seed[NNC_SEED_SIZE];
+	u64 tid;
+	for(u32 i = 0; i < expected_size; ++i)
+	{
+		tid = LE64P(&raw[i * 0x20 + 0x00]);
+		memcpy(seed, &raw[i * 0x20 + 0x08], NNC_SEED_SIZE);
+		memcpy(entries[i].seed, seed, NNC_SEED_SIZE);
+		entries[i].title_id = tid;
+	}
+	seeddb->entries = entries;
+	/* sorted so nnc_get_seed() can binary search */
+	qsort(seeddb->entries, expected_size, sizeof(struct nnc_seeddb_entry), seeddb_entry_cmp);
+	seeddb->size = expected_size;
 	return NNC_R_OK;
 }
 
 result nnc_scan_seeddb(nnc_seeddb *seeddb)
 {
 	seeddb->entries = NULL;
+	seeddb->size = 0;
 	char path[SUP_FILE_NAME_LEN];
 	if(!find_support_file("seeddb.bin", path))
 		return NNC_R_NOT_FOUND;
@@ -204,10 +470,16 @@ result nnc_scan_seeddb(nnc_seeddb *seeddb)
 
 u8 *nnc_get_seed(nnc_seeddb *seeddb, u64 tid)
 {
-	for(u32 i = 0; i < seeddb->size; ++i)
+	u32 lo = 0, hi = seeddb->size, mid;
+	while(lo < hi)
 	{
-		if(seeddb->entries[i].title_id == tid)
-			return seeddb->entries[i].seed;
+		mid = lo + (hi - lo) / 2;
+		if(seeddb->entries[mid].title_id < tid)
+			lo = mid + 1;
+		else if(seeddb->entries[mid].title_id > tid)
+			hi = mid;
+		else
+			return seeddb->entries[mid].seed;
 	}
 	return NULL;
 }
@@ -409,6 +681,169 @@ nnc_result nnc_fill_keypair(nnc_keypair *output, nnc_keyset *ks, nnc_seeddb *see
 	return nnc_key_menu_info(&output->primary, ks, ncch);
 }
 
+struct nnc_keypair_cache_entry {
+	/* everything that goes into deriving a keypair, zero'd before filling
+	 * in so padding compares equal as well */
+	struct keypair_cache_key {
+		u128 keyy;
+		u128 kx_menu;
+		u128 kx_content;
+		u64 title_id;
+		u8 seed[NNC_SEED_SIZE];
+		u8 seed_hash[4];
+		u8 crypt_method;
+		u8 flags;
+		u8 ks_flags;
+		u8 used;
+	} key;
+	nnc_keypair pair;
+};
+
+/* amount of slots looked at for one key */
+#define KEYPAIR_CACHE_WAYS 4
+
+nnc_result nnc_keypair_cache_init(nnc_keypair_cache *cache, nnc_u32 capacity)
+{
+	return keypair_cache_init_al(cache, capacity, &default_allocator);
+}
+
+result nnc_keypair_cache_init_al(nnc_keypair_cache *cache, u32 capacity, const nnc_allocator *al)
+{
+	result ret;
+	cache->allocator = *al;
+	cache->capacity = MAX(capacity, KEYPAIR_CACHE_WAYS);
+	cache->victim = 0;
+	cache->entries = al_alloc(al, cache->capacity * sizeof(struct nnc_keypair_cache_entry));
+	cache->lock = al_alloc(al, sizeof(nnc_mutex));
+	if(!cache->entries || !cache->lock)
+		ret = NNC_R_NOMEM;
+	else
+	{
+		memset(cache->entries, 0x00, cache->capacity * sizeof(struct nnc_keypair_cache_entry));
+		ret = mutex_init(cache->lock);
+	}
+	if(ret != NNC_R_OK)
+	{
+		al_free(al, cache->entries);
+		al_free(al, cache->lock);
+		cache->entries = NULL;
+		cache->lock = NULL;
+	}
+	return ret;
+}
+
+void nnc_keypair_cache_free(nnc_keypair_cache *cache)
+{
+	if(cache->lock) mutex_destroy(cache->lock);
+	al_free(&cache->allocator, cache->entries);
+	al_free(&cache->allocator, cache->lock);
+	cache->entries = NULL;
+	cache->lock = NULL;
+}
+
+static bool make_keypair_cache_key(struct keypair_cache_key *key, nnc_keyset *ks, nnc_seeddb *seeddb,
+	nnc_ncch_header *ncch)
+{
+	memset(key, 0x00, sizeof(struct keypair_cache_key));
+	key->keyy = ncch->keyy;
+	key->title_id = ncch->title_id;
+	key->crypt_method = ncch->crypt_method;
+	key->flags = ncch->flags & (NNC_NCCH_FIXED_KEY | NNC_NCCH_USES_SEED);
+	key->ks_flags = ks->flags;
+	key->used = 1;
+	if(ncch->flags & NNC_NCCH_FIXED_KEY)
+		return true;
+	if(ncch->flags & NNC_NCCH_USES_SEED)
+	{
+		u8 *seed;
+		/* let the uncached path figure out the error */
+		if(!seeddb || !(seed = nnc_get_seed(seeddb, ncch->title_id)))
+			return false;
+		memcpy(key->seed, seed, NNC_SEED_SIZE);
+		memcpy(key->seed_hash, ncch->seed_hash, sizeof(key->seed_hash));
+	}
+	key->kx_menu = ks->kx_ncch0;
+	switch(ncch->crypt_method)
+	{
+	case 0x00: key->kx_content = ks->kx_ncch0; break;
+	case 0x01: key->kx_content = ks->kx_ncch1; break;
+	case 0x0A: key->kx_content = ks->kx_ncchA; break;
+	case 0x0B: key->kx_content = ks->kx_ncchB; break;
+	default: return false;
+	}
+	return true;
+}
+
+static u32 hash_keypair_cache_key(struct keypair_cache_key *key)
+{
+	/* FNV-1a */
+	u8 *data = (u8 *) key;
+	u32 hash = 0x811C9DC5;
+	for(u32 i = 0; i < sizeof(struct keypair_cache_key); ++i)
+	{
+		hash ^= data[i];
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+nnc_result nnc_fill_keypair_cached(nnc_keypair *output, nnc_keyset *ks, nnc_seeddb *seeddb,
+	struct nnc_ncch_header *ncch, nnc_keypair_cache *cache)
+{
+	struct keypair_cache_key key;
+	if(!cache || (ncch->flags & NNC_NCCH_NO_CRYPTO) || !make_keypair_cache_key(&key, ks, seeddb, ncch))
+		return nnc_fill_keypair(output, ks, seeddb, ncch);
+
+	struct nnc_keypair_cache_entry *ent;
+	u32 base = hash_keypair_cache_key(&key) % cache->capacity, i;
+	result ret;
+
+	mutex_lock(cache->lock);
+	for(i = 0; i < KEYPAIR_CACHE_WAYS; ++i)
+	{
+		ent = &cache->entries[(base + i) % cache->capacity];
+		if(memcmp(&ent->key, &key, sizeof(key)) == 0)
+		{
+			*output = ent->pair;
+			mutex_unlock(cache->lock);
+			return NNC_R_OK;
+		}
+	}
+	mutex_unlock(cache->lock);
+
+	/* derive without holding the lock, and only cache successful results */
+	TRY(nnc_fill_keypair(output, ks, seeddb, ncch));
+
+	mutex_lock(cache->lock);
+	for(i = 0; i < KEYPAIR_CACHE_WAYS; ++i)
+	{
+		ent = &cache->entries[(base + i) % cache->capacity];
+		if(!ent->key.used)
+			break;
+	}
+	/* all slots for this key are in use, evict one */
+	if(i == KEYPAIR_CACHE_WAYS)
+		ent = &cache->entries[(base + (cache->victim++ % KEYPAIR_CACHE_WAYS)) % cache->capacity];
+	memcpy(&ent->key, &key, sizeof(key));
+	ent->pair = *output;
+	mutex_unlock(cache->lock);
+	return NNC_R_OK;
+}
+
+nnc_result nnc_fill_keypairs(nnc_keypair *outputs, nnc_result *results, nnc_keyset *ks,
+	nnc_seeddb *seeddb, struct nnc_ncch_header *ncchs, nnc_u32 count, nnc_keypair_cache *cache)
+{
+	result ret = NNC_R_OK, cur;
+	for(u32 i = 0; i < count; ++i)
+	{
+		cur = nnc_fill_keypair_cached(&outputs[i], ks, seeddb, &ncchs[i], cache);
+		if(results) results[i] = cur;
+		if(cur != NNC_R_OK && ret == NNC_R_OK)
+			ret = cur;
+	}
+	return ret;
+}
+
 result nnc_get_ncch_iv(struct nnc_ncch_header *ncch, u8 for_section,
 	u8 counter[0x10])
 {
@@ -453,92 +888,198 @@ struct generic_crypto_obj {
 	void *crypto_ctx;
 	void *child;
 	nnc_u8 last_unaligned_block[0x10];
+	nnc_u8 *window;
+	nnc_u32 window_size;
+	nnc_u32 window_start;
+	nnc_u32 window_len;
+	nnc_u32 window_alloc;
+	nnc_u32 pos;
 	/* crypto-method specific data */
 	nnc_u8 additional_data[];
 };
 
-typedef void   (*crypto_decrypt_func)(struct generic_crypto_obj *self, u32 size, u8 *buf);
-typedef result (*crypto_redo_iv_func)(struct generic_crypto_obj *self, u32 pos);
+/* reads `size' bytes from the child at `pos' (aligned to 0x10) and decrypts them into `buf' */
+typedef result (*crypto_fill_func)(struct generic_crypto_obj *self, u32 pos, u8 *buf, u32 size);
 
-static result do_crypto_seek(struct generic_crypto_obj *self, u32 pos, crypto_redo_iv_func redo_iv)
+static result crypto_child_read_at(struct generic_crypto_obj *self, u32 pos, u8 *buf, u32 size)
 {
-	u32 cpos = NNC_RS_PCALL0(self->child, tell);
-	nnc_result ret;
-	/* i doubt this will happen but it's here anyway
-	 * to save a bit of time. */
-	if(cpos == pos) return NNC_R_OK;
-	if(pos % 0x10 == 0)
-	{
-		TRY(redo_iv(self, pos));
-	}
-	else
+	result ret;
+	/* the child sees only sequential reads if we are reading sequentially */
+	if(NNC_RS_PCALL0(self->child, tell) != pos)
+		TRY(NNC_RS_PCALL(self->child, seek_abs, pos));
+	return read_exact(self->child, buf, size);
+}
+
+static result crypto_set_window(struct generic_crypto_obj *self, u32 size)
+{
+	size = ALIGN(MAX(size, 0x10), 0x10);
+	if(size == self->window_size) return NNC_R_OK;
+	/* allocated on the first read */
+	free(self->window);
+	self->window = NULL;
+	self->window_size = size;
+	self->window_len = 0;
+	self->window_alloc = 0;
+	return NNC_R_OK;
+}
+
+static result crypto_init_window(struct generic_crypto_obj *self)
+{
+	self->window = NULL;
+	self->window_size = 0;
+	self->window_start = 0;
+	self->window_len = 0;
+	self->window_alloc = 0;
+	self->pos = 0;
+	return crypto_set_window(self, NNC_CRYPTO_WINDOW_DEFAULT);
+}
+
+static result crypto_fill_window(struct generic_crypto_obj *self, u32 size, crypto_fill_func fill)
+{
+	result ret;
+	u32 start = ALIGN_DOWN(self->pos, 0x10);
+	/* no reason to allocate more than the stream will ever need, but the
+	 * configured size stays so a stream that grows gets a larger window */
+	u32 want = MIN(self->window_size, ALIGN(size, 0x10));
+	self->window_len = 0;
+	if(self->window_alloc < want)
 	{
-		/* we need to do the slightly more complicated version */
-		u32 aligned = ALIGN_DOWN(pos, 0x10);
-		NNC_RS_PCALL(self->child, seek_abs, aligned);
-		TRY(redo_iv(self, aligned));
-		u32 totalRead;
-		ret = NNC_RS_PCALL(self, read, self->last_unaligned_block, 0x10, &totalRead);
-		if(ret != NNC_R_OK || totalRead != 0x10)
-			return NNC_R_TOO_SMALL;
+		/* the old contents are replaced anyway */
+		free(self->window);
+		self->window_alloc = 0;
+		if(!(self->window = malloc(want)))
+			return NNC_R_NOMEM;
+		self->window_alloc = want;
 	}
-	return NNC_RS_PCALL(self->child, seek_abs, pos);
+	u32 len = MIN(want, size - start);
+	TRY(fill(self, start, self->window, len));
+	self->window_start = start;
+	self->window_len = len;
+	return NNC_R_OK;
 }
 
-static result do_crypto_read(struct generic_crypto_obj *self, u8 *buf, u32 max, u32 *totalRead, crypto_decrypt_func decrypt)
+static result do_crypto_read(struct generic_crypto_obj *self, u8 *buf, u32 max, u32 *totalRead, crypto_fill_func fill)
 {
-	u32 offset = NNC_RS_PCALL0(self->child, tell);
-	u32 real_read = 0;
-	/* if the starting offset is not aligned we need to do a little more fuckery */
-	if(offset % 0x10 != 0)
+	u32 size = NNC_RS_PCALL0(self->child, size), n;
+	result ret;
+	*totalRead = 0;
+	while(max != 0 && self->pos < size)
 	{
-		/* TODO: This does not account for case if the last read was at the end */
-		u8 skip = offset & (0x10 - 1);
-		u8 need = 0x10 - skip;
-		/* for the exceptional case that need > max */
-		need = MIN(need, max);
-		memcpy(buf, self->last_unaligned_block + skip, need);
-		real_read += need;
-		buf += need;
-		max -= need;
-		/* seek to the next block so we don't read data twice */
-		NNC_RS_PCALL(self->child, seek_rel, need);
+		n = ALIGN_DOWN(MIN(max, size - self->pos), 0x10);
+		/* served straight from the window */
+		if(self->pos >= self->window_start && self->pos < self->window_start + self->window_len)
+		{
+			n = MIN(max, self->window_start + self->window_len - self->pos);
+			memcpy(buf, self->window + (self->pos - self->window_start), n);
+		}
+		/* large aligned reads skip the window altogether */
+		else if(IS_ALIGNED(self->pos, 0x10) && max >= self->window_size && n != 0)
+		{
+			TRY(fill(self, self->pos, buf, n));
+		}
+		else
+		{
+			TRY(crypto_fill_window(self, size, fill));
+			continue;
+		}
+		self->pos += n;
+		*totalRead += n;
+		buf += n;
+		max -= n;
 	}
+	return NNC_R_OK;
+}
+
+static result do_crypto_seek(struct generic_crypto_obj *self, u32 pos)
+{
+	if(pos > NNC_RS_PCALL0(self->child, size))
+		return NNC_R_SEEK_RANGE;
+	self->pos = pos;
+	return NNC_R_OK;
+}
 
-	u32 aligned_max = ALIGN_DOWN(max, 0x10);
+/* expanded key schedules are shared between all streams using the same key.
+ * Most backends only read from the context while en/decrypting so this is safe
+ * even across threads. Schedules of backends that do write to it (see
+ * aes_shareable) are only reused once the stream that had them closes. */
+
+struct aes_schedule {
+	const nnc_crypto_backend *backend;
+	void *aes;
+	struct aes_schedule *next;
+	u8 key[0x10];
+	u8 decrypt;
+	u32 refs;
+};
 
-	result ret;
-	bool full_read;
-	if(aligned_max)
+/* amount of unused schedules we keep around for the next stream */
+#define AES_SCHEDULE_MAX_IDLE 32
+
+static nnc_mutex aes_schedules_lock = NNC_MUTEX_INIT;
+static struct aes_schedule *aes_schedules; /* most recently used first */
+static u32 aes_schedules_idle;
+
+static struct aes_schedule *aes_schedule_get(u8 key[0x10], bool decrypt)
+{
+	const nnc_crypto_backend *backend = CRYPTO;
+	struct aes_schedule *sched, **link;
+	mutex_lock(&aes_schedules_lock);
+	for(link = &aes_schedules; (sched = *link); link = &sched->next)
 	{
-		TRY(NNC_RS_PCALL(self->child, read, buf, aligned_max, totalRead));
-		full_read = *totalRead == aligned_max;
-		if(*totalRead % 0x10 != 0)
+		if(sched->backend == backend && sched->decrypt == decrypt && memcmp(sched->key, key, 0x10) == 0
+			&& (backend->aes_shareable || sched->refs == 0))
 		{
-			/* this could theorically be handled but i don't think it matters much */
-			return NNC_R_BAD_ALIGN;
+			if(sched->refs++ == 0) --aes_schedules_idle;
+			/* move to the front */
+			*link = sched->next;
+			sched->next = aes_schedules;
+			aes_schedules = sched;
+			mutex_unlock(&aes_schedules_lock);
+			return sched;
 		}
-		decrypt(self, *totalRead, buf);
-		real_read += *totalRead;
-		buf += *totalRead;
-		max -= *totalRead;
-	} else full_read = true;
-
-	/* if we still need to read some unaligned data: */
-	if(full_read && max)
-	{
-		TRY(NNC_RS_PCALL(self->child, read, self->last_unaligned_block, 0x10, totalRead));
-		if(*totalRead != 0x10)
-			memset(self->last_unaligned_block + *totalRead, 0x00, 0x10 - *totalRead);
-		decrypt(self, 0x10, self->last_unaligned_block);
-		u8 applicable_read = MIN(*totalRead, max);
-		/* "unread" the extra bytes we read so we get the correct offset */
-		TRY(NNC_RS_PCALL(self->child, seek_abs, NNC_RS_PCALL0(self->child, tell) - (0x10 - applicable_read)));
-		memcpy(buf, self->last_unaligned_block, applicable_read);
-		real_read += applicable_read;
-	}
-	*totalRead = real_read;
-	return NNC_R_OK;
+	}
+	mutex_unlock(&aes_schedules_lock);
+
+	/* not found, the key expansion is done without holding the lock */
+	if(!(sched = malloc(sizeof(struct aes_schedule))))
+		return NULL;
+	if(!(sched->aes = backend->aes_new(key, decrypt)))
+	{
+		free(sched);
+		return NULL;
+	}
+	sched->backend = backend;
+	memcpy(sched->key, key, 0x10);
+	sched->decrypt = decrypt;
+	sched->refs = 1;
+
+	mutex_lock(&aes_schedules_lock);
+	sched->next = aes_schedules;
+	aes_schedules = sched;
+	mutex_unlock(&aes_schedules_lock);
+	return sched;
+}
+
+static void aes_schedule_put(struct aes_schedule *sched)
+{
+	struct aes_schedule *victim = NULL, **link, **victim_link = NULL;
+	mutex_lock(&aes_schedules_lock);
+	if(--sched->refs == 0 && ++aes_schedules_idle > AES_SCHEDULE_MAX_IDLE)
+	{
+		/* too many unused schedules, get rid of the least recently used one */
+		for(link = &aes_schedules; *link; link = &(*link)->next)
+			if((*link)->refs == 0)
+				victim_link = link;
+		victim = *victim_link;
+		*victim_link = victim->next;
+		--aes_schedules_idle;
+	}
+	mutex_unlock(&aes_schedules_lock);
+	if(victim)
+	{
+		victim->backend->aes_free(victim->aes);
+		free(victim);
+	}
 }
 
 /* nnc_aes_ctr */
@@ -551,26 +1092,30 @@ static result redo_ctr_iv(nnc_aes_ctr *ac, u32 offset)
 	return NNC_R_OK;
 }
 
-static void aes_ctr_decrypt(nnc_aes_ctr *self, u32 size, u8 *buf)
+static result aes_ctr_fill(nnc_aes_ctr *self, u32 pos, u8 *buf, u32 size)
 {
-	size_t of = 0;
-	u8 block[0x10];
-	mbedtls_aes_crypt_ctr(self->crypto_ctx, size, &of, self->ctr, block, buf, buf);
+	result ret;
+	TRY(crypto_child_read_at((struct generic_crypto_obj *) self, pos, buf, size));
+	struct aes_schedule *sched = self->crypto_ctx;
+	u8 of = 0, block[0x10];
+	redo_ctr_iv(self, pos);
+	sched->backend->aes_ctr(sched->aes, size, &of, self->ctr, block, buf, buf);
+	return NNC_R_OK;
 }
 
 static result aes_ctr_read(nnc_aes_ctr *self, u8 *buf, u32 max, u32 *totalRead)
 {
-	return do_crypto_read((struct generic_crypto_obj *) self, buf, max, totalRead, (crypto_decrypt_func) aes_ctr_decrypt);
+	return do_crypto_read((struct generic_crypto_obj *) self, buf, max, totalRead, (crypto_fill_func) aes_ctr_fill);
 }
 
 static result aes_ctr_seek_abs(nnc_aes_ctr *self, u32 pos)
 {
-	return do_crypto_seek((struct generic_crypto_obj *) self, pos, (crypto_redo_iv_func) redo_ctr_iv);
+	return do_crypto_seek((struct generic_crypto_obj *) self, pos);
 }
 
 static result aes_ctr_seek_rel(nnc_aes_ctr *self, u32 pos)
 {
-	return aes_ctr_seek_abs(self, NNC_RS_PCALL0(self->child, tell) + pos);
+	return aes_ctr_seek_abs(self, self->pos + pos);
 }
 
 static u32 aes_ctr_size(nnc_aes_ctr *self)
@@ -580,13 +1125,13 @@ static u32 aes_ctr_size(nnc_aes_ctr *self)
 
 static u32 aes_ctr_tell(nnc_aes_ctr *self)
 {
-	return NNC_RS_PCALL0(self->child, tell);
+	return self->pos;
 }
 
 static void aes_ctr_close(nnc_aes_ctr *self)
 {
-	mbedtls_aes_free(self->crypto_ctx);
-	free(self->crypto_ctx);
+	aes_schedule_put(self->crypto_ctx);
+	free(self->window);
 }
 
 static const nnc_rstream_funcs aes_ctr_funcs = {
@@ -601,53 +1146,177 @@ static const nnc_rstream_funcs aes_ctr_funcs = {
 nnc_result nnc_aes_ctr_open(nnc_aes_ctr *self, nnc_rstream *child, u128 *key, u8 iv[0x10])
 {
 	self->funcs = &aes_ctr_funcs;
-	if(!(self->crypto_ctx = malloc(sizeof(mbedtls_aes_context))))
+	u8 buf[0x10];
+	nnc_u128_bytes_be(key, buf);
+	if(!(self->crypto_ctx = aes_schedule_get(buf, false)))
 		return NNC_R_NOMEM;
 	self->iv = nnc_u128_import_be(iv);
 	self->child = child;
 
-	u8 buf[0x10];
-	nnc_u128_bytes_be(key, buf);
-	mbedtls_aes_setkey_enc(self->crypto_ctx, buf, 128);
-
 	redo_ctr_iv(self, 0);
+	return crypto_init_window((struct generic_crypto_obj *) self);
+}
+
+nnc_result nnc_aes_ctr_set_window(nnc_aes_ctr *self, nnc_u32 size)
+{
+	return crypto_set_window((struct generic_crypto_obj *) self, size);
+}
+
+/* write streams allocate a bit more than just the AES context, so we have
+ * somewhere to encrypt to without clobbering the buffer of the caller */
+struct aes_wctx {
+	const nnc_crypto_backend *backend;
+	void *aes;
+	u32 start;     /* offset in the child the stream was opened at */
+	u8 nbuffered;  /* cbc: plaintext bytes pending in last_unaligned_block,
+	                * ctr: keystream bytes used of last_unaligned_block */
+	u8 scratch[0x4000];
+};
+
+static result init_aes_wctx(void *obj, void *child, u8 key[0x10])
+{
+	struct generic_crypto_obj *self = obj;
+	struct aes_wctx *wctx;
+	if(!(self->crypto_ctx = wctx = malloc(sizeof(struct aes_wctx))))
+		return NNC_R_NOMEM;
+	wctx->backend = CRYPTO;
+	if(!(wctx->aes = wctx->backend->aes_new(key, false)))
+	{
+		free(wctx);
+		return NNC_R_NOMEM;
+	}
+	wctx->start = NNC_WS_PCALL0(child, tell);
+	wctx->nbuffered = 0;
+	self->child = child;
 	return NNC_R_OK;
 }
 
-static nnc_result redo_cbc_iv(nnc_aes_cbc *self, u32 offset)
+static void ctr_skip_keystream(nnc_aes_ctr *self, struct aes_wctx *wctx, u32 pos)
 {
-	if(offset == 0) memcpy(self->iv, self->init_iv, 0x10);
-	else
+	redo_ctr_iv(self, pos);
+	wctx->nbuffered = 0;
+	if(pos % 0x10 != 0)
 	{
-		result ret;
-		/* the new IV is the previous encrypted block */
-		TRY(NNC_RS_PCALL(self->child, seek_abs, offset - 16));
-		u32 read;
-		ret = NNC_RS_PCALL(self->child, read, self->iv, 16, &read);
-		if(ret != NNC_R_OK || read != 0x10)
-			return NNC_R_TOO_SMALL;
+		/* generate the keystream for the block we're in the middle of */
+		u8 dummy[0x10];
+		wctx->backend->aes_ctr(wctx->aes, pos % 0x10, &wctx->nbuffered, self->ctr,
+			self->last_unaligned_block, dummy, dummy);
+	}
+}
+
+static result aes_ctr_write(nnc_aes_ctr *self, u8 *buf, u32 size)
+{
+	struct aes_wctx *wctx = self->crypto_ctx;
+	u32 next;
+	result ret;
+	while(size != 0)
+	{
+		next = MIN(size, sizeof(wctx->scratch));
+		/* the backend keeps track of the partially used keystream block for us */
+		wctx->backend->aes_ctr(wctx->aes, next, &wctx->nbuffered, self->ctr,
+			self->last_unaligned_block, buf, wctx->scratch);
+		TRY(NNC_WS_PCALL(self->child, write, wctx->scratch, next));
+		buf += next;
+		size -= next;
 	}
 	return NNC_R_OK;
 }
 
-static void aes_cbc_decrypt(nnc_aes_cbc *self, u32 size, u8 *buf)
+static result aes_ctr_wseek(nnc_aes_ctr *self, u32 pos)
 {
-	mbedtls_aes_crypt_cbc(self->crypto_ctx, MBEDTLS_AES_DECRYPT, size, self->iv, buf, buf);
+	struct aes_wctx *wctx = self->crypto_ctx;
+	result ret;
+	if(pos < wctx->start) return NNC_R_INVAL;
+	TRY(NNC_WS_PCALL(self->child, seek, pos));
+	ctr_skip_keystream(self, wctx, pos - wctx->start);
+	return NNC_R_OK;
+}
+
+static void free_aes_wctx(void *obj)
+{
+	struct generic_crypto_obj *self = obj;
+	struct aes_wctx *wctx = self->crypto_ctx;
+	wctx->backend->aes_free(wctx->aes);
+	free(wctx);
+}
+
+static result aes_ctr_wclose(nnc_aes_ctr *self)
+{
+	free_aes_wctx(self);
+	return NNC_R_OK;
+}
+
+static u32 aes_ctr_wtell(nnc_aes_ctr *self)
+{
+	return NNC_WS_PCALL0(self->child, tell);
+}
+
+static const nnc_wstream_funcs aes_ctr_wfuncs_seekable = {
+	.write = (nnc_write_func)  aes_ctr_write,
+	.close = (nnc_wclose_func) aes_ctr_wclose,
+	.seek  = (nnc_wseek_func)  aes_ctr_wseek,
+	.tell  = (nnc_wtell_func)  aes_ctr_wtell,
+};
+
+static const nnc_wstream_funcs aes_ctr_wfuncs = {
+	.write = (nnc_write_func)  aes_ctr_write,
+	.close = (nnc_wclose_func) aes_ctr_wclose,
+	.tell  = (nnc_wtell_func)  aes_ctr_wtell,
+};
+
+nnc_result nnc_aes_ctr_open_w(nnc_aes_ctr *self, nnc_wstream *child, u128 *key, u8 iv[0x10])
+{
+	self->funcs = child->funcs->seek ? &aes_ctr_wfuncs_seekable : &aes_ctr_wfuncs;
+	result ret;
+	u8 buf[0x10];
+	nnc_u128_bytes_be(key, buf);
+	TRY(init_aes_wctx(self, child, buf));
+	self->iv = nnc_u128_import_be(iv);
+
+	redo_ctr_iv(self, 0);
+	return NNC_R_OK;
+}
+
+static result aes_cbc_fill(nnc_aes_cbc *self, u32 pos, u8 *buf, u32 size)
+{
+	result ret;
+	/* the IV is the previous encrypted block, which we still have in self->iv
+	 * if this read directly follows the previous one */
+	if(pos == 0) memcpy(self->iv, self->init_iv, 0x10);
+	else if(pos != self->iv_pos)
+		TRY(crypto_child_read_at((struct generic_crypto_obj *) self, pos - 0x10, self->iv, 0x10));
+	struct aes_schedule *sched = self->crypto_ctx;
+	u32 aligned = ALIGN_DOWN(size, 0x10);
+	TRY(crypto_child_read_at((struct generic_crypto_obj *) self, pos, buf, size));
+	sched->backend->aes_cbc(sched->aes, aligned, self->iv, buf, buf);
+	self->iv_pos = pos + aligned;
+	if(aligned != size)
+	{
+		/* a trailing partial block can't really be decrypted, but
+		 * this is what decrypting it as if it were zero padded gives */
+		u8 block[0x10];
+		memset(block, 0x00, sizeof(block));
+		memcpy(block, buf + aligned, size - aligned);
+		sched->backend->aes_cbc(sched->aes, 0x10, self->iv, block, block);
+		memcpy(buf + aligned, block, size - aligned);
+		self->iv_pos = 0;
+	}
+	return NNC_R_OK;
 }
 
 static result aes_cbc_read(nnc_aes_cbc *self, u8 *buf, u32 max, u32 *totalRead)
 {
-	return do_crypto_read((struct generic_crypto_obj *) self, buf, max, totalRead, (crypto_decrypt_func) aes_cbc_decrypt);
+	return do_crypto_read((struct generic_crypto_obj *) self, buf, max, totalRead, (crypto_fill_func) aes_cbc_fill);
 }
 
 static result aes_cbc_seek_abs(nnc_aes_cbc *self, u32 pos)
 {
-	return do_crypto_seek((struct generic_crypto_obj *) self, pos, (crypto_redo_iv_func) redo_cbc_iv);
+	return do_crypto_seek((struct generic_crypto_obj *) self, pos);
 }
 
 static result aes_cbc_seek_rel(nnc_aes_cbc *self, u32 pos)
 {
-	return aes_cbc_seek_abs(self, NNC_RS_PCALL0(self->child, tell) + pos);
+	return aes_cbc_seek_abs(self, self->pos + pos);
 }
 
 static u32 aes_cbc_size(nnc_aes_cbc *self)
@@ -657,13 +1326,13 @@ static u32 aes_cbc_size(nnc_aes_cbc *self)
 
 static u32 aes_cbc_tell(nnc_aes_cbc *self)
 {
-	return NNC_RS_PCALL0(self->child, tell);
+	return self->pos;
 }
 
 static void aes_cbc_close(nnc_aes_cbc *self)
 {
-	mbedtls_aes_free(self->crypto_ctx);
-	free(self->crypto_ctx);
+	aes_schedule_put(self->crypto_ctx);
+	free(self->window);
 }
 
 static const nnc_rstream_funcs aes_cbc_funcs = {
@@ -675,52 +1344,82 @@ static const nnc_rstream_funcs aes_cbc_funcs = {
 	.tell = (nnc_tell_func) aes_cbc_tell,
 };
 
-static result init_aes_cbc(nnc_aes_cbc *self, void *child, u8 key[0x10], u8 iv[0x10], bool set_deckey)
+static result init_aes_cbc(nnc_aes_cbc *self, nnc_rstream *child, u8 key[0x10], u8 iv[0x10])
 {
-	if(!(self->crypto_ctx = malloc(sizeof(mbedtls_aes_context))))
+	if(!(self->crypto_ctx = aes_schedule_get(key, true)))
 		return NNC_R_NOMEM;
 	memcpy(self->init_iv, iv, 0x10);
 	memcpy(self->iv, iv, 0x10);
+	self->iv_pos = 0;
 	self->child = child;
-
-	if(set_deckey) mbedtls_aes_setkey_dec(self->crypto_ctx, key, 128);
-	else           mbedtls_aes_setkey_enc(self->crypto_ctx, key, 128);
-	return NNC_R_OK;
+	return crypto_init_window((struct generic_crypto_obj *) self);
 }
 
 nnc_result nnc_aes_cbc_open(nnc_aes_cbc *self, nnc_rstream *child, u8 key[0x10], u8 iv[0x10])
 {
 	self->funcs = &aes_cbc_funcs;
-	return init_aes_cbc(self, child, key, iv, true);
+	return init_aes_cbc(self, child, key, iv);
+}
+
+nnc_result nnc_aes_cbc_set_window(nnc_aes_cbc *self, nnc_u32 size)
+{
+	return crypto_set_window((struct generic_crypto_obj *) self, size);
 }
 
 static result aes_cbc_write(nnc_aes_cbc *self, u8 *buf, u32 size)
 {
-	if(size % 0x10 != 0) return NNC_R_BAD_ALIGN;
+	struct aes_wctx *wctx = self->crypto_ctx;
 	result ret;
-	u8 block[BLOCK_SZ];
-	u32 next_read, pos = 0;
-	while(size != 0)
+	u32 next;
+	/* first try to complete the block left over from a previous write */
+	if(wctx->nbuffered)
 	{
-		next_read = MIN(BLOCK_SZ, size);
-		mbedtls_aes_crypt_cbc(self->crypto_ctx, MBEDTLS_AES_ENCRYPT, next_read, self->iv,
-			&buf[pos], block);
-		TRY(NNC_WS_PCALL(self->child, write, block, next_read));
-		pos += next_read;
-		size -= next_read;
+		next = MIN((u32) 0x10 - wctx->nbuffered, size);
+		memcpy(self->last_unaligned_block + wctx->nbuffered, buf, next);
+		wctx->nbuffered += next;
+		buf += next;
+		size -= next;
+		if(wctx->nbuffered != 0x10)
+			return NNC_R_OK;
+		wctx->backend->aes_cbc(wctx->aes, 0x10, self->iv,
+			self->last_unaligned_block, self->last_unaligned_block);
+		wctx->nbuffered = 0;
+		TRY(NNC_WS_PCALL(self->child, write, self->last_unaligned_block, 0x10));
 	}
+	while(size >= 0x10)
+	{
+		next = MIN(ALIGN_DOWN(size, 0x10), sizeof(wctx->scratch));
+		wctx->backend->aes_cbc(wctx->aes, next, self->iv, buf, wctx->scratch);
+		TRY(NNC_WS_PCALL(self->child, write, wctx->scratch, next));
+		buf += next;
+		size -= next;
+	}
+	/* hold on to the remainder until we have a full block */
+	memcpy(self->last_unaligned_block, buf, size);
+	wctx->nbuffered = size;
 	return NNC_R_OK;
 }
 
 static result aes_cbc_wclose(nnc_aes_cbc *self)
 {
-	aes_cbc_close(self);
-	return NNC_R_OK;
+	struct aes_wctx *wctx = self->crypto_ctx;
+	result ret = NNC_R_OK;
+	if(wctx->nbuffered)
+	{
+		/* the final block is padded with zeroes */
+		memset(self->last_unaligned_block + wctx->nbuffered, 0x00, 0x10 - wctx->nbuffered);
+		wctx->backend->aes_cbc(wctx->aes, 0x10, self->iv,
+			self->last_unaligned_block, self->last_unaligned_block);
+		ret = NNC_WS_PCALL(self->child, write, self->last_unaligned_block, 0x10);
+	}
+	free_aes_wctx(self);
+	return ret;
 }
 
 static u32 aes_cbc_wtell(nnc_aes_cbc *self)
 {
-	return self->child->funcs->tell(self->child);
+	struct aes_wctx *wctx = self->crypto_ctx;
+	return NNC_WS_PCALL0(self->child, tell) + wctx->nbuffered;
 }
 
 static const nnc_wstream_funcs aes_cbc_wfuncs = {
@@ -732,7 +1431,11 @@ static const nnc_wstream_funcs aes_cbc_wfuncs = {
 nnc_result nnc_aes_cbc_open_w(nnc_aes_cbc *self, nnc_wstream *child, u8 key[0x10], u8 iv[0x10])
 {
 	self->funcs = &aes_cbc_wfuncs;
-	return init_aes_cbc(self, child, key, iv, false);
+	result ret;
+	TRY(init_aes_wctx(self, child, key));
+	memcpy(self->init_iv, iv, 0x10);
+	memcpy(self->iv, iv, 0x10);
+	return NNC_R_OK;
 }
 
 result nnc_decrypt_tkey(nnc_ticket *tik, nnc_keyset *ks, nnc_u8 decrypted[0x10])
@@ -749,17 +1452,21 @@ result nnc_decrypt_tkey(nnc_ticket *tik, nnc_keyset *ks, nnc_u8 decrypted[0x10])
 	default: return NNC_R_CORRUPT; /* invalid key selected */
 	}
 	u64 iv[2] = { BE64(tik->title_id), 0 };
-	mbedtls_aes_context ctx;
 	u8 buf[0x10];
+	void *ctx;
 
 	nnc_u128_bytes_be(used_keyy, buf);
-	mbedtls_aes_setkey_dec(&ctx, buf, 128);
-	mbedtls_aes_crypt_cbc(&ctx, MBEDTLS_AES_DECRYPT, 0x10, (u8 *) iv,
-		tik->title_key, decrypted);
-	mbedtls_aes_free(&ctx);
+	if(!(ctx = CRYPTO->aes_new(buf, true)))
+		return NNC_R_NOMEM;
+	CRYPTO->aes_cbc(ctx, 0x10, (u8 *) iv, tik->title_key, decrypted);
+	CRYPTO->aes_free(ctx);
 	return NNC_R_OK;
 }
 
+/* the defaults can be swapped and the default keyset is initialized on
+ * first use, which may happen on any thread */
+static nnc_mutex defaults_lock = NNC_MUTEX_INIT;
+
 static nnc_seeddb nnc_empty_seeddb = {
 	.size    = 0,
 	.entries = NULL,
@@ -769,12 +1476,20 @@ static nnc_seeddb *nnc_default_seeddb = &nnc_empty_seeddb;
 nnc_seeddb *nnc_set_default_seeddb(nnc_seeddb *sdb)
 {
 	if(!sdb) sdb = &nnc_empty_seeddb;
+	mutex_lock(&defaults_lock);
 	nnc_seeddb *ret = nnc_default_seeddb;
 	nnc_default_seeddb = sdb;
+	mutex_unlock(&defaults_lock);
 	return ret;
 }
 
-nnc_seeddb *nnc_get_default_seeddb(void) { return nnc_default_seeddb; }
+nnc_seeddb *nnc_get_default_seeddb(void)
+{
+	mutex_lock(&defaults_lock);
+	nnc_seeddb *ret = nnc_default_seeddb;
+	mutex_unlock(&defaults_lock);
+	return ret;
+}
 
 static nnc_keyset nnc_gkset = {
 	.flags = 0,
@@ -784,17 +1499,22 @@ static nnc_keyset *nnc_default_kset = &nnc_gkset;
 nnc_keyset *nnc_set_default_keyset(nnc_keyset *kset)
 {
 	if(!kset) kset = &nnc_gkset;
+	mutex_lock(&defaults_lock);
 	nnc_keyset *ret = nnc_default_kset;
 	nnc_default_kset = kset;
+	mutex_unlock(&defaults_lock);
 	return ret;
 }
 
 nnc_keyset *nnc_get_default_keyset(void)
 {
+	mutex_lock(&defaults_lock);
 	/* aka not yet initialized; this check is done here because nnc_set_default_keyset() is
 	 * not done for nnc_gkset */
 	if(!(nnc_default_kset->flags & TYPE_FIELD))
 		nnc_keyset_default(nnc_default_kset, false);
-	return nnc_default_kset;
+	nnc_keyset *ret = nnc_default_kset;
+	mutex_unlock(&defaults_lock);
+	return ret;
 }
 
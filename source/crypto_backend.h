@@ -0,0 +1,79 @@
+
+#ifndef inc_nnc_crypto_backend_h
+#define inc_nnc_crypto_backend_h
+
+/* this header intentionally does not include internal.h so backends can
+ * include it before the headers of the library they wrap */
+#include <nnc/crypto.h>
+
+/* The backends that get compiled in are selected by the build system with
+ * NNC_CRYPTO_MBEDTLS and NNC_CRYPTO_OPENSSL, the builtin backend is always
+ * available. If nothing is specified we use mbedtls like we always did. */
+#if !defined(NNC_CRYPTO_MBEDTLS) && !defined(NNC_CRYPTO_OPENSSL)
+	#define NNC_CRYPTO_MBEDTLS 1
+#endif
+
+enum nnc_crypto_hash {
+	NNC_CRYPTO_SHA1,
+	NNC_CRYPTO_SHA256,
+};
+
+/* All contexts are opaque to the rest of the library,
+ * a context may only be used with the backend that created it. */
+typedef struct nnc_crypto_backend {
+	enum nnc_crypto_backend_type type;
+	const char *name;
+
+	/* AES-128, a context is set up for either encryption or decryption.
+	 * CTR always uses the encryption direction. */
+	void *(*aes_new)(const nnc_u8 key[0x10], bool decrypt);
+	void (*aes_free)(void *aes);
+	/* same semantics as mbedtls_aes_crypt_ctr(), in may equal out */
+	void (*aes_ctr)(void *aes, nnc_u32 size, nnc_u8 *offset, nnc_u8 ctr[0x10],
+		nnc_u8 stream_block[0x10], const nnc_u8 *in, nnc_u8 *out);
+	/* size must be a multiple of 0x10, iv is updated, in may equal out */
+	void (*aes_cbc)(void *aes, nnc_u32 size, nnc_u8 iv[0x10], const nnc_u8 *in, nnc_u8 *out);
+	/* whether aes_ctr() and aes_cbc() only read from the context, so one
+	 * context may be used by several streams and threads at once */
+	bool aes_shareable;
+
+	/* hashing, a context may be reused after hash_reset() */
+	void *(*hash_new)(enum nnc_crypto_hash type);
+	void (*hash_reset)(void *hash);
+	void (*hash_update)(void *hash, const nnc_u8 *data, nnc_u32 size);
+	void (*hash_finish)(void *hash, nnc_u8 *digest);
+	void (*hash_free)(void *hash);
+
+	/* Public keys for signature verification, a key may be used by several
+	 * threads at once. RSA uses PKCS#1 v1.5 with a signature as large as
+	 * the modulus, ECDSA uses sect233r1 with the raw x || y public key and
+	 * r || s signature. Creating a key returns NNC_R_OK, NNC_R_NOMEM,
+	 * NNC_R_INVALID_CERT or NNC_R_UNSUPPORTED. */
+	nnc_result (*rsa_key_new)(void **key, const nnc_u8 *mod, nnc_u32 mod_size, const nnc_u8 exp[4]);
+	nnc_result (*ecdsa_key_new)(void **key, const nnc_u8 pubkey[0x3C]);
+	/* returns NNC_R_OK, NNC_R_BAD_SIG or NNC_R_NOMEM */
+	nnc_result (*key_verify)(void *key, enum nnc_crypto_hash md, const nnc_u8 *hash, const nnc_u8 *sig);
+	void (*key_free)(void *key);
+} nnc_crypto_backend;
+
+#if NNC_CRYPTO_MBEDTLS
+extern const nnc_crypto_backend nnc_crypto_mbedtls;
+#endif
+#if NNC_CRYPTO_OPENSSL
+extern const nnc_crypto_backend nnc_crypto_openssl;
+#endif
+extern const nnc_crypto_backend nnc_crypto_builtin;
+
+/* the backend new objects are created with */
+extern const nnc_crypto_backend *nnc_crypto_backend_current;
+#define CRYPTO nnc_crypto_backend_current
+
+#define HASH_SIZE(md) ((md) == NNC_CRYPTO_SHA1 ? sizeof(nnc_sha1_hash) : sizeof(nnc_sha256_hash))
+
+/* checks a PKCS#1 v1.5 encoded message (the result of the public key
+ * operation on a signature) against a hash, for backends that only
+ * provide the raw RSA operation */
+nnc_result nnc_crypto_pkcs1_check(const nnc_u8 *em, nnc_u32 size, enum nnc_crypto_hash md, const nnc_u8 *hash);
+
+#endif
+
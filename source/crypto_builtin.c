@@ -0,0 +1,525 @@
+
+/* Dependency free implementations of everything the library needs,
+ * these favour simplicity over speed and are not hardened against
+ * side channels (which doesn't matter much for what this library does) */
+
+#include "./crypto_backend.h"
+#include <stdlib.h>
+#include <string.h>
+#include "./internal.h"
+
+#define ROL32(x,n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR32(x,n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* AES-128 */
+
+static const u8 aes_sbox[256] = {
+	0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
+	0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
+	0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
+	0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A, 0x07, 0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75,
+	0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0, 0x52, 0x3B, 0xD6, 0xB3, 0x29, 0xE3, 0x2F, 0x84,
+	0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B, 0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58, 0xCF,
+	0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85, 0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8,
+	0x51, 0xA3, 0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5, 0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2,
+	0xCD, 0x0C, 0x13, 0xEC, 0x5F, 0x97, 0x44, 0x17, 0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73,
+	0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88, 0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB,
+	0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C, 0xC2, 0xD3, 0xAC, 0x62, 0x91, 0x95, 0xE4, 0x79,
+	0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9, 0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A, 0xAE, 0x08,
+	0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6, 0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A,
+	0x70, 0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E, 0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E,
+	0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
+	0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16,
+};
+
+static const u8 aes_inv_sbox[256] = {
+	0x52, 0x09, 0x6A, 0xD5, 0x30, 0x36, 0xA5, 0x38, 0xBF, 0x40, 0xA3, 0x9E, 0x81, 0xF3, 0xD7, 0xFB,
+	0x7C, 0xE3, 0x39, 0x82, 0x9B, 0x2F, 0xFF, 0x87, 0x34, 0x8E, 0x43, 0x44, 0xC4, 0xDE, 0xE9, 0xCB,
+	0x54, 0x7B, 0x94, 0x32, 0xA6, 0xC2, 0x23, 0x3D, 0xEE, 0x4C, 0x95, 0x0B, 0x42, 0xFA, 0xC3, 0x4E,
+	0x08, 0x2E, 0xA1, 0x66, 0x28, 0xD9, 0x24, 0xB2, 0x76, 0x5B, 0xA2, 0x49, 0x6D, 0x8B, 0xD1, 0x25,
+	0x72, 0xF8, 0xF6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xD4, 0xA4, 0x5C, 0xCC, 0x5D, 0x65, 0xB6, 0x92,
+	0x6C, 0x70, 0x48, 0x50, 0xFD, 0xED, 0xB9, 0xDA, 0x5E, 0x15, 0x46, 0x57, 0xA7, 0x8D, 0x9D, 0x84,
+	0x90, 0xD8, 0xAB, 0x00, 0x8C, 0xBC, 0xD3, 0x0A, 0xF7, 0xE4, 0x58, 0x05, 0xB8, 0xB3, 0x45, 0x06,
+	0xD0, 0x2C, 0x1E, 0x8F, 0xCA, 0x3F, 0x0F, 0x02, 0xC1, 0xAF, 0xBD, 0x03, 0x01, 0x13, 0x8A, 0x6B,
+	0x3A, 0x91, 0x11, 0x41, 0x4F, 0x67, 0xDC, 0xEA, 0x97, 0xF2, 0xCF, 0xCE, 0xF0, 0xB4, 0xE6, 0x73,
+	0x96, 0xAC, 0x74, 0x22, 0xE7, 0xAD, 0x35, 0x85, 0xE2, 0xF9, 0x37, 0xE8, 0x1C, 0x75, 0xDF, 0x6E,
+	0x47, 0xF1, 0x1A, 0x71, 0x1D, 0x29, 0xC5, 0x89, 0x6F, 0xB7, 0x62, 0x0E, 0xAA, 0x18, 0xBE, 0x1B,
+	0xFC, 0x56, 0x3E, 0x4B, 0xC6, 0xD2, 0x79, 0x20, 0x9A, 0xDB, 0xC0, 0xFE, 0x78, 0xCD, 0x5A, 0xF4,
+	0x1F, 0xDD, 0xA8, 0x33, 0x88, 0x07, 0xC7, 0x31, 0xB1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xEC, 0x5F,
+	0x60, 0x51, 0x7F, 0xA9, 0x19, 0xB5, 0x4A, 0x0D, 0x2D, 0xE5, 0x7A, 0x9F, 0x93, 0xC9, 0x9C, 0xEF,
+	0xA0, 0xE0, 0x3B, 0x4D, 0xAE, 0x2A, 0xF5, 0xB0, 0xC8, 0xEB, 0xBB, 0x3C, 0x83, 0x53, 0x99, 0x61,
+	0x17, 0x2B, 0x04, 0x7E, 0xBA, 0x77, 0xD6, 0x26, 0xE1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0C, 0x7D,
+};
+
+struct builtin_aes {
+	u8 rk[11][0x10];
+	bool decrypt;
+};
+
+static u8 xtime(u8 x)
+{
+	return (x << 1) ^ ((x & 0x80) ? 0x1B : 0x00);
+}
+
+static u8 gmul(u8 a, u8 b)
+{
+	u8 r = 0;
+	for(; b; b >>= 1, a = xtime(a))
+		if(b & 1) r ^= a;
+	return r;
+}
+
+static void *builtin_aes_new(const u8 key[0x10], bool decrypt)
+{
+	struct builtin_aes *self = malloc(sizeof(struct builtin_aes));
+	if(!self) return NULL;
+	self->decrypt = decrypt;
+	memcpy(self->rk[0], key, 0x10);
+	u8 rcon = 0x01;
+	for(int r = 1; r < 11; ++r)
+	{
+		u8 *prev = self->rk[r - 1], *cur = self->rk[r];
+		cur[0] = prev[0] ^ aes_sbox[prev[13]] ^ rcon;
+		cur[1] = prev[1] ^ aes_sbox[prev[14]];
+		cur[2] = prev[2] ^ aes_sbox[prev[15]];
+		cur[3] = prev[3] ^ aes_sbox[prev[12]];
+		for(int i = 4; i < 0x10; ++i)
+			cur[i] = prev[i] ^ cur[i - 4];
+		rcon = xtime(rcon);
+	}
+	return self;
+}
+
+static void builtin_aes_free(void *aes)
+{
+	free(aes);
+}
+
+static void add_round_key(u8 s[0x10], const u8 rk[0x10])
+{
+	for(int i = 0; i < 0x10; ++i)
+		s[i] ^= rk[i];
+}
+
+static void aes_encrypt_block(struct builtin_aes *self, const u8 in[0x10], u8 out[0x10])
+{
+	u8 s[0x10], t[0x10];
+	memcpy(s, in, 0x10);
+	add_round_key(s, self->rk[0]);
+	for(int r = 1; r < 11; ++r)
+	{
+		/* SubBytes + ShiftRows, the state is column major */
+		for(int c = 0; c < 4; ++c)
+			for(int row = 0; row < 4; ++row)
+				t[c * 4 + row] = aes_sbox[s[((c + row) % 4) * 4 + row]];
+		if(r != 10)
+		{
+			/* MixColumns */
+			for(int c = 0; c < 4; ++c)
+			{
+				u8 *col = &t[c * 4];
+				u8 a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3], all = a0 ^ a1 ^ a2 ^ a3;
+				col[0] ^= all ^ xtime(a0 ^ a1);
+				col[1] ^= all ^ xtime(a1 ^ a2);
+				col[2] ^= all ^ xtime(a2 ^ a3);
+				col[3] ^= all ^ xtime(a3 ^ a0);
+			}
+		}
+		add_round_key(t, self->rk[r]);
+		memcpy(s, t, 0x10);
+	}
+	memcpy(out, s, 0x10);
+}
+
+static void aes_decrypt_block(struct builtin_aes *self, const u8 in[0x10], u8 out[0x10])
+{
+	u8 s[0x10], t[0x10];
+	memcpy(s, in, 0x10);
+	add_round_key(s, self->rk[10]);
+	for(int r = 9; r >= 0; --r)
+	{
+		/* InvShiftRows + InvSubBytes */
+		for(int c = 0; c < 4; ++c)
+			for(int row = 0; row < 4; ++row)
+				t[((c + row) % 4) * 4 + row] = aes_inv_sbox[s[c * 4 + row]];
+		add_round_key(t, self->rk[r]);
+		if(r != 0)
+		{
+			/* InvMixColumns */
+			for(int c = 0; c < 4; ++c)
+			{
+				u8 *col = &t[c * 4];
+				u8 a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+				col[0] = gmul(a0, 14) ^ gmul(a1, 11) ^ gmul(a2, 13) ^ gmul(a3, 9);
+				col[1] = gmul(a0, 9) ^ gmul(a1, 14) ^ gmul(a2, 11) ^ gmul(a3, 13);
+				col[2] = gmul(a0, 13) ^ gmul(a1, 9) ^ gmul(a2, 14) ^ gmul(a3, 11);
+				col[3] = gmul(a0, 11) ^ gmul(a1, 13) ^ gmul(a2, 9) ^ gmul(a3, 14);
+			}
+		}
+		memcpy(s, t, 0x10);
+	}
+	memcpy(out, s, 0x10);
+}
+
+static void builtin_aes_ctr(void *aes, u32 size, u8 *offset, u8 ctr[0x10],
+	u8 stream_block[0x10], const u8 *in, u8 *out)
+{
+	u8 of = *offset;
+	for(u32 i = 0; i < size; ++i)
+	{
+		if(of == 0)
+		{
+			aes_encrypt_block(aes, ctr, stream_block);
+			for(int j = 0xF; j >= 0; --j)
+				if(++ctr[j] != 0) break;
+		}
+		out[i] = in[i] ^ stream_block[of];
+		of = (of + 1) % 0x10;
+	}
+	*offset = of;
+}
+
+static void builtin_aes_cbc(void *aes, u32 size, u8 iv[0x10], const u8 *in, u8 *out)
+{
+	struct builtin_aes *self = aes;
+	u8 block[0x10];
+	for(u32 i = 0; i < size; i += 0x10)
+	{
+		if(self->decrypt)
+		{
+			memcpy(block, in + i, 0x10);
+			aes_decrypt_block(self, block, out + i);
+			for(int j = 0; j < 0x10; ++j)
+				out[i + j] ^= iv[j];
+			memcpy(iv, block, 0x10);
+		}
+		else
+		{
+			for(int j = 0; j < 0x10; ++j)
+				block[j] = in[i + j] ^ iv[j];
+			aes_encrypt_block(self, block, out + i);
+			memcpy(iv, out + i, 0x10);
+		}
+	}
+}
+
+/* SHA-1 and SHA-256 */
+
+static const u32 sha256_k[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+struct builtin_hash {
+	enum nnc_crypto_hash type;
+	u32 state[8];
+	u64 length;
+	u8 buffer[0x40];
+};
+
+static u32 load_be32(const u8 *p)
+{
+	return ((u32) p[0] << 24) | ((u32) p[1] << 16) | ((u32) p[2] << 8) | p[3];
+}
+
+static void store_be32(u8 *p, u32 v)
+{
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static void sha1_block(u32 h[5], const u8 block[0x40])
+{
+	u32 w[80], a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f, k, t;
+	for(int i = 0; i < 16; ++i)
+		w[i] = load_be32(block + i * 4);
+	for(int i = 16; i < 80; ++i)
+		w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	for(int i = 0; i < 80; ++i)
+	{
+		if(i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+		else if(i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+		else if(i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+		else            { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+		t = ROL32(a, 5) + f + e + k + w[i];
+		e = d; d = c; c = ROL32(b, 30); b = a; a = t;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+static void sha256_block(u32 h[8], const u8 block[0x40])
+{
+	u32 w[64], s[8], t1, t2;
+	for(int i = 0; i < 16; ++i)
+		w[i] = load_be32(block + i * 4);
+	for(int i = 16; i < 64; ++i)
+		w[i] = w[i - 16] + (ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3))
+		     + w[i - 7] + (ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10));
+	memcpy(s, h, sizeof(s));
+	for(int i = 0; i < 64; ++i)
+	{
+		t1 = s[7] + (ROR32(s[4], 6) ^ ROR32(s[4], 11) ^ ROR32(s[4], 25))
+		   + ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i];
+		t2 = (ROR32(s[0], 2) ^ ROR32(s[0], 13) ^ ROR32(s[0], 22))
+		   + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+		memmove(s + 1, s, 7 * sizeof(u32));
+		s[4] += t1;
+		s[0] = t1 + t2;
+	}
+	for(int i = 0; i < 8; ++i)
+		h[i] += s[i];
+}
+
+static void builtin_hash_reset(void *hash)
+{
+	static const u32 sha1_init[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	static const u32 sha256_init[8] = {
+		0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+	};
+	struct builtin_hash *self = hash;
+	if(self->type == NNC_CRYPTO_SHA1) memcpy(self->state, sha1_init, sizeof(sha1_init));
+	else                              memcpy(self->state, sha256_init, sizeof(sha256_init));
+	self->length = 0;
+}
+
+static void *builtin_hash_new(enum nnc_crypto_hash type)
+{
+	struct builtin_hash *self = malloc(sizeof(struct builtin_hash));
+	if(!self) return NULL;
+	self->type = type;
+	builtin_hash_reset(self);
+	return self;
+}
+
+static void hash_block(struct builtin_hash *self, const u8 block[0x40])
+{
+	if(self->type == NNC_CRYPTO_SHA1) sha1_block(self->state, block);
+	else                              sha256_block(self->state, block);
+}
+
+static void builtin_hash_update(void *hash, const u8 *data, u32 size)
+{
+	struct builtin_hash *self = hash;
+	u32 used = self->length % 0x40, next;
+	self->length += size;
+	if(used)
+	{
+		next = MIN(0x40 - used, size);
+		memcpy(self->buffer + used, data, next);
+		data += next;
+		size -= next;
+		if(used + next != 0x40)
+			return;
+		hash_block(self, self->buffer);
+	}
+	for(; size >= 0x40; data += 0x40, size -= 0x40)
+		hash_block(self, data);
+	memcpy(self->buffer, data, size);
+}
+
+static void builtin_hash_finish(void *hash, u8 *digest)
+{
+	struct builtin_hash *self = hash;
+	u32 used = self->length % 0x40;
+	u64 bits = self->length * 8;
+	self->buffer[used++] = 0x80;
+	if(used > 0x38)
+	{
+		memset(self->buffer + used, 0x00, 0x40 - used);
+		hash_block(self, self->buffer);
+		used = 0;
+	}
+	memset(self->buffer + used, 0x00, 0x38 - used);
+	store_be32(self->buffer + 0x38, bits >> 32);
+	store_be32(self->buffer + 0x3C, bits);
+	hash_block(self, self->buffer);
+	for(int i = 0; i < (self->type == NNC_CRYPTO_SHA1 ? 5 : 8); ++i)
+		store_be32(digest + i * 4, self->state[i]);
+}
+
+static void builtin_hash_free(void *hash)
+{
+	free(hash);
+}
+
+/* RSA, the public exponent operation with Montgomery multiplication */
+
+#define BN_MAX_LIMBS (0x200 / 4)
+
+/* big endian bytes to little endian limbs */
+static void bn_read(u32 *r, const u8 *buf, u32 len)
+{
+	for(u32 i = 0; i < len / 4; ++i)
+		r[i] = load_be32(buf + len - 4 - i * 4);
+}
+
+static void bn_write(u8 *buf, const u32 *a, u32 len)
+{
+	for(u32 i = 0; i < len / 4; ++i)
+		store_be32(buf + len - 4 - i * 4, a[i]);
+}
+
+static int bn_cmp(const u32 *a, const u32 *b, u32 n)
+{
+	for(u32 i = n; i-- > 0; )
+		if(a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+	return 0;
+}
+
+static void bn_sub(u32 *a, const u32 *b, u32 n)
+{
+	u64 borrow = 0;
+	for(u32 i = 0; i < n; ++i)
+	{
+		u64 d = (u64) a[i] - b[i] - borrow;
+		a[i] = (u32) d;
+		borrow = (d >> 32) & 1;
+	}
+}
+
+/* r = a * b / R mod m, r may not alias a or b */
+static void bn_mont_mul(u32 *r, const u32 *a, const u32 *b, const u32 *m, u32 minv, u32 n)
+{
+	u32 t[BN_MAX_LIMBS + 2];
+	memset(t, 0, (n + 2) * sizeof(u32));
+	for(u32 i = 0; i < n; ++i)
+	{
+		u64 c = 0;
+		for(u32 j = 0; j < n; ++j)
+		{
+			c += (u64) a[j] * b[i] + t[j];
+			t[j] = (u32) c;
+			c >>= 32;
+		}
+		c += t[n];
+		t[n] = (u32) c;
+		t[n + 1] = (u32) (c >> 32);
+
+		u32 q = t[0] * minv;
+		c = ((u64) q * m[0] + t[0]) >> 32;
+		for(u32 j = 1; j < n; ++j)
+		{
+			c += (u64) q * m[j] + t[j];
+			t[j - 1] = (u32) c;
+			c >>= 32;
+		}
+		c += t[n];
+		t[n - 1] = (u32) c;
+		t[n] = t[n + 1] + (u32) (c >> 32);
+	}
+	if(t[n] || bn_cmp(t, m, n) >= 0)
+		bn_sub(t, m, n);
+	memcpy(r, t, n * sizeof(u32));
+}
+
+struct builtin_key {
+	u32 n;     /* limbs */
+	u32 e;
+	u32 minv;  /* -m^-1 mod 2^32 */
+	u32 m[BN_MAX_LIMBS];
+	u32 rr[BN_MAX_LIMBS]; /* R^2 mod m */
+};
+
+static result builtin_rsa_key_new(void **key, const u8 *mod, u32 mod_size, const u8 exp[4])
+{
+	struct builtin_key *self;
+	u32 n = mod_size / 4, minv = 1;
+	if(mod_size % 4 != 0 || n > BN_MAX_LIMBS || n == 0 || !(mod[mod_size - 1] & 1) || load_be32(exp) == 0)
+		return NNC_R_INVALID_CERT;
+	if(!(self = malloc(sizeof(struct builtin_key))))
+		return NNC_R_NOMEM;
+	self->n = n;
+	self->e = load_be32(exp);
+	bn_read(self->m, mod, mod_size);
+
+	/* newton iteration */
+	for(int i = 0; i < 5; ++i)
+		minv *= 2 - self->m[0] * minv;
+	self->minv = -minv;
+
+	/* R^2 mod m by doubling 1 2 * 32 * n times */
+	u32 *rr = self->rr;
+	memset(rr, 0, n * sizeof(u32));
+	rr[0] = 1;
+	for(u32 i = 0; i < 64 * n; ++i)
+	{
+		u32 carry = rr[n - 1] >> 31;
+		for(u32 j = n - 1; j > 0; --j)
+			rr[j] = (rr[j] << 1) | (rr[j - 1] >> 31);
+		rr[0] <<= 1;
+		if(carry || bn_cmp(rr, self->m, n) >= 0)
+			bn_sub(rr, self->m, n);
+	}
+
+	*key = self;
+	return NNC_R_OK;
+}
+
+static result builtin_ecdsa_key_new(void **key, const u8 pubkey[0x3C])
+{
+	/* deliberately not implemented: ECDSA on 3DS only shows up in a few
+	 * signatures using sect233r1, which would need binary field arithmetic
+	 * on top of the bignum code used for RSA, use the OpenSSL backend for it */
+	(void) key; (void) pubkey;
+	return NNC_R_UNSUPPORTED;
+}
+
+static result builtin_key_verify(void *key, enum nnc_crypto_hash md, const u8 *hash, const u8 *sig)
+{
+	struct builtin_key *self = key;
+	u32 s[BN_MAX_LIMBS], x[BN_MAX_LIMBS], t[BN_MAX_LIMBS], y[BN_MAX_LIMBS];
+	u32 n = self->n, e = self->e;
+	u8 em[0x200];
+	bn_read(s, sig, n * 4);
+	if(bn_cmp(s, self->m, n) >= 0)
+		return NNC_R_BAD_SIG;
+
+	/* left to right square and multiply in the montgomery domain */
+	bn_mont_mul(x, s, self->rr, self->m, self->minv, n); /* s * R */
+	memcpy(t, x, n * sizeof(u32));
+	int bit = 31;
+	while(!(e & (1u << bit))) --bit;
+	for(--bit; bit >= 0; --bit)
+	{
+		bn_mont_mul(y, x, x, self->m, self->minv, n);
+		if(e & (1u << bit)) bn_mont_mul(x, y, t, self->m, self->minv, n);
+		else                memcpy(x, y, n * sizeof(u32));
+	}
+	/* and back out of it */
+	memset(t, 0, n * sizeof(u32));
+	t[0] = 1;
+	bn_mont_mul(y, x, t, self->m, self->minv, n);
+
+	bn_write(em, y, n * 4);
+	return nnc_crypto_pkcs1_check(em, n * 4, md, hash);
+}
+
+static void builtin_key_free(void *key)
+{
+	free(key);
+}
+
+const nnc_crypto_backend nnc_crypto_builtin = {
+	.type          = NNC_CRYPTO_BACKEND_BUILTIN,
+	.name          = "builtin",
+	.aes_new       = builtin_aes_new,
+	.aes_free      = builtin_aes_free,
+	.aes_ctr       = builtin_aes_ctr,
+	.aes_cbc       = builtin_aes_cbc,
+	.aes_shareable = true,
+	.hash_new      = builtin_hash_new,
+	.hash_reset    = builtin_hash_reset,
+	.hash_update   = builtin_hash_update,
+	.hash_finish   = builtin_hash_finish,
+	.hash_free     = builtin_hash_free,
+	.rsa_key_new   = builtin_rsa_key_new,
+	.ecdsa_key_new = builtin_ecdsa_key_new,
+	.key_verify    = builtin_key_verify,
+	.key_free      = builtin_key_free,
+};
+
@@ -0,0 +1,199 @@
+
+#include "./crypto_backend.h"
+#if NNC_CRYPTO_MBEDTLS
+
+#include <mbedtls/version.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/sha1.h>
+#include <mbedtls/aes.h>
+#include <mbedtls/pk.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./internal.h"
+
+/* In MbedTLS version 2 the normal functions were marked deprecated
+ * you were supposed to use *_ret, but in mbedTLS version 3+ the
+ * *_ret functions had the functions renamed to have the _ret suffix removed */
+#if MBEDTLS_VERSION_MAJOR == 2
+	#define mbedtls_sha256_starts mbedtls_sha256_starts_ret
+	#define mbedtls_sha256_update mbedtls_sha256_update_ret
+	#define mbedtls_sha256_finish mbedtls_sha256_finish_ret
+	#define mbedtls_sha1_starts mbedtls_sha1_starts_ret
+	#define mbedtls_sha1_update mbedtls_sha1_update_ret
+	#define mbedtls_sha1_finish mbedtls_sha1_finish_ret
+#endif
+
+/* In MbedTLS version 3 struct members are now accessed with MBEDTLS_PRIVATE */
+#if MBEDTLS_VERSION_MAJOR == 3
+	#define ACCESS_PRIV(name) MBEDTLS_PRIVATE(name)
+#else
+	#define ACCESS_PRIV(name) name
+#endif
+
+struct mbed_aes {
+	mbedtls_aes_context aes;
+	int mode;
+};
+
+static void *mbed_aes_new(const u8 key[0x10], bool decrypt)
+{
+	struct mbed_aes *self = malloc(sizeof(struct mbed_aes));
+	if(!self) return NULL;
+	mbedtls_aes_init(&self->aes);
+	if(decrypt) mbedtls_aes_setkey_dec(&self->aes, key, 128);
+	else        mbedtls_aes_setkey_enc(&self->aes, key, 128);
+	self->mode = decrypt ? MBEDTLS_AES_DECRYPT : MBEDTLS_AES_ENCRYPT;
+	return self;
+}
+
+static void mbed_aes_free(void *aes)
+{
+	mbedtls_aes_free(&((struct mbed_aes *) aes)->aes);
+	free(aes);
+}
+
+static void mbed_aes_ctr(void *aes, u32 size, u8 *offset, u8 ctr[0x10],
+	u8 stream_block[0x10], const u8 *in, u8 *out)
+{
+	size_t of = *offset;
+	mbedtls_aes_crypt_ctr(&((struct mbed_aes *) aes)->aes, size, &of, ctr, stream_block, in, out);
+	*offset = of;
+}
+
+static void mbed_aes_cbc(void *aes, u32 size, u8 iv[0x10], const u8 *in, u8 *out)
+{
+	struct mbed_aes *self = aes;
+	mbedtls_aes_crypt_cbc(&self->aes, self->mode, size, iv, in, out);
+}
+
+struct mbed_hash {
+	enum nnc_crypto_hash type;
+	union {
+		mbedtls_sha1_context sha1;
+		mbedtls_sha256_context sha256;
+	} u;
+};
+
+static void mbed_hash_reset(void *hash)
+{
+	struct mbed_hash *self = hash;
+	if(self->type == NNC_CRYPTO_SHA1)
+		mbedtls_sha1_starts(&self->u.sha1);
+	else
+		mbedtls_sha256_starts(&self->u.sha256, 0);
+}
+
+static void *mbed_hash_new(enum nnc_crypto_hash type)
+{
+	struct mbed_hash *self = malloc(sizeof(struct mbed_hash));
+	if(!self) return NULL;
+	self->type = type;
+	if(type == NNC_CRYPTO_SHA1) mbedtls_sha1_init(&self->u.sha1);
+	else                        mbedtls_sha256_init(&self->u.sha256);
+	mbed_hash_reset(self);
+	return self;
+}
+
+static void mbed_hash_update(void *hash, const u8 *data, u32 size)
+{
+	struct mbed_hash *self = hash;
+	if(self->type == NNC_CRYPTO_SHA1)
+		mbedtls_sha1_update(&self->u.sha1, data, size);
+	else
+		mbedtls_sha256_update(&self->u.sha256, data, size);
+}
+
+static void mbed_hash_finish(void *hash, u8 *digest)
+{
+	struct mbed_hash *self = hash;
+	if(self->type == NNC_CRYPTO_SHA1)
+		mbedtls_sha1_finish(&self->u.sha1, digest);
+	else
+		mbedtls_sha256_finish(&self->u.sha256, digest);
+}
+
+static void mbed_hash_free(void *hash)
+{
+	struct mbed_hash *self = hash;
+	if(self->type == NNC_CRYPTO_SHA1) mbedtls_sha1_free(&self->u.sha1);
+	else                              mbedtls_sha256_free(&self->u.sha256);
+	free(self);
+}
+
+struct mbed_key {
+	mbedtls_pk_context pk;
+	u32 sig_size;
+};
+
+static result mbed_rsa_key_new(void **key, const u8 *mod, u32 mod_size, const u8 exp[4])
+{
+	struct mbed_key *self;
+	mbedtls_rsa_context *rsa;
+	u8 dummy[0x200];
+	if(mod_size > sizeof(dummy)) return NNC_R_INVALID_CERT;
+	if(!(self = malloc(sizeof(struct mbed_key))))
+		return NNC_R_NOMEM;
+	mbedtls_pk_init(&self->pk);
+	if(mbedtls_pk_setup(&self->pk, mbedtls_pk_info_from_type(MBEDTLS_PK_RSA)) != 0)
+	{
+		free(self);
+		return NNC_R_NOMEM;
+	}
+	rsa = mbedtls_pk_rsa(self->pk);
+	mbedtls_mpi_read_binary(&rsa->ACCESS_PRIV(N), mod, mod_size);
+	mbedtls_mpi_read_binary(&rsa->ACCESS_PRIV(E), exp, 0x4);
+	rsa->ACCESS_PRIV(len) = mod_size;
+	self->sig_size = mod_size;
+
+	/* mbedtls stores a value it needs for the public key operation in the
+	 * context the first time it's used, do that now so the context is only
+	 * read from afterwards and can be used by several threads */
+	memset(dummy, 0x00, mod_size);
+	dummy[mod_size - 1] = 1;
+	mbedtls_pk_verify(&self->pk, MBEDTLS_MD_SHA256, dummy, sizeof(nnc_sha256_hash), dummy, mod_size);
+
+	*key = self;
+	return NNC_R_OK;
+}
+
+static result mbed_ecdsa_key_new(void **key, const u8 pubkey[0x3C])
+{
+	/* mbedtls has no support for binary field curves like sect233r1 */
+	(void) key; (void) pubkey;
+	return NNC_R_UNSUPPORTED;
+}
+
+static result mbed_key_verify(void *key, enum nnc_crypto_hash md, const u8 *hash, const u8 *sig)
+{
+	struct mbed_key *self = key;
+	return mbedtls_pk_verify(&self->pk, md == NNC_CRYPTO_SHA1 ? MBEDTLS_MD_SHA1 : MBEDTLS_MD_SHA256,
+		hash, HASH_SIZE(md), sig, self->sig_size) == 0 ? NNC_R_OK : NNC_R_BAD_SIG;
+}
+
+static void mbed_key_free(void *key)
+{
+	mbedtls_pk_free(&((struct mbed_key *) key)->pk);
+	free(key);
+}
+
+const nnc_crypto_backend nnc_crypto_mbedtls = {
+	.type          = NNC_CRYPTO_BACKEND_MBEDTLS,
+	.name          = "mbedtls",
+	.aes_new       = mbed_aes_new,
+	.aes_free      = mbed_aes_free,
+	.aes_ctr       = mbed_aes_ctr,
+	.aes_cbc       = mbed_aes_cbc,
+	.aes_shareable = true,
+	.hash_new      = mbed_hash_new,
+	.hash_reset    = mbed_hash_reset,
+	.hash_update   = mbed_hash_update,
+	.hash_finish   = mbed_hash_finish,
+	.hash_free     = mbed_hash_free,
+	.rsa_key_new   = mbed_rsa_key_new,
+	.ecdsa_key_new = mbed_ecdsa_key_new,
+	.key_verify    = mbed_key_verify,
+	.key_free      = mbed_key_free,
+};
+
+#endif
+
@@ -0,0 +1,296 @@
+
+#include "./crypto_backend.h"
+#if NNC_CRYPTO_OPENSSL
+
+/* the EC_KEY interface we need for ECDSA is deprecated in OpenSSL 3
+ * but still the only way to build a key from raw coordinates in 1.1 */
+#define OPENSSL_API_COMPAT 0x10100000L
+#include <openssl/evp.h>
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/obj_mac.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./internal.h"
+
+/* EVP takes int sizes */
+#define EVP_CHUNK 0x40000000
+
+/* every call sets the IV or counter on the EVP context so
+ * one context can't be used by several streams at once */
+struct ossl_aes {
+	EVP_CIPHER_CTX *ctr; /* encrypt only */
+	EVP_CIPHER_CTX *ecb; /* encrypt only, for the partial blocks in CTR mode */
+	EVP_CIPHER_CTX *cbc;
+	bool decrypt;
+};
+
+static void ossl_aes_free(void *aes)
+{
+	struct ossl_aes *self = aes;
+	EVP_CIPHER_CTX_free(self->ctr);
+	EVP_CIPHER_CTX_free(self->ecb);
+	EVP_CIPHER_CTX_free(self->cbc);
+	free(self);
+}
+
+static void *ossl_aes_new(const u8 key[0x10], bool decrypt)
+{
+	struct ossl_aes *self = calloc(1, sizeof(struct ossl_aes));
+	if(!self) return NULL;
+	self->decrypt = decrypt;
+	if(!(self->cbc = EVP_CIPHER_CTX_new()) || EVP_CipherInit_ex(self->cbc,
+			EVP_aes_128_cbc(), NULL, key, NULL, decrypt ? 0 : 1) != 1)
+		goto fail;
+	EVP_CIPHER_CTX_set_padding(self->cbc, 0);
+	if(!decrypt)
+	{
+		if(!(self->ctr = EVP_CIPHER_CTX_new()) || EVP_EncryptInit_ex(self->ctr,
+				EVP_aes_128_ctr(), NULL, key, NULL) != 1)
+			goto fail;
+		if(!(self->ecb = EVP_CIPHER_CTX_new()) || EVP_EncryptInit_ex(self->ecb,
+				EVP_aes_128_ecb(), NULL, key, NULL) != 1)
+			goto fail;
+		EVP_CIPHER_CTX_set_padding(self->ecb, 0);
+	}
+	return self;
+fail:
+	ossl_aes_free(self);
+	return NULL;
+}
+
+static void ctr_increment(u8 ctr[0x10], u32 blocks)
+{
+	for(int i = 0xF; i >= 0 && blocks; --i)
+	{
+		blocks += ctr[i];
+		ctr[i] = blocks & 0xFF;
+		blocks >>= 8;
+	}
+}
+
+static void ossl_aes_ctr(void *aes, u32 size, u8 *offset, u8 ctr[0x10],
+	u8 stream_block[0x10], const u8 *in, u8 *out)
+{
+	struct ossl_aes *self = aes;
+	u32 of = *offset, next;
+	int len;
+	/* use up the keystream left over from last time */
+	while(size && of != 0)
+	{
+		*out++ = *in++ ^ stream_block[of];
+		of = (of + 1) % 0x10;
+		--size;
+	}
+	while(size >= 0x10)
+	{
+		next = MIN(ALIGN_DOWN(size, 0x10), EVP_CHUNK);
+		EVP_EncryptInit_ex(self->ctr, NULL, NULL, NULL, ctr);
+		EVP_EncryptUpdate(self->ctr, out, &len, in, next);
+		ctr_increment(ctr, next / 0x10);
+		in += next;
+		out += next;
+		size -= next;
+	}
+	if(size)
+	{
+		EVP_EncryptUpdate(self->ecb, stream_block, &len, ctr, 0x10);
+		ctr_increment(ctr, 1);
+		for(of = 0; of < size; ++of)
+			out[of] = in[of] ^ stream_block[of];
+	}
+	*offset = of;
+}
+
+static void ossl_aes_cbc(void *aes, u32 size, u8 iv[0x10], const u8 *in, u8 *out)
+{
+	struct ossl_aes *self = aes;
+	u8 next_iv[0x10];
+	u32 next;
+	int len;
+	while(size != 0)
+	{
+		next = MIN(size, EVP_CHUNK);
+		/* when decrypting in place the last ciphertext block is gone afterwards */
+		if(self->decrypt) memcpy(next_iv, in + next - 0x10, 0x10);
+		EVP_CipherInit_ex(self->cbc, NULL, NULL, NULL, iv, -1);
+		EVP_CipherUpdate(self->cbc, out, &len, in, next);
+		memcpy(iv, self->decrypt ? next_iv : out + next - 0x10, 0x10);
+		in += next;
+		out += next;
+		size -= next;
+	}
+}
+
+struct ossl_hash {
+	EVP_MD_CTX *ctx;
+	const EVP_MD *md;
+};
+
+static void ossl_hash_reset(void *hash)
+{
+	struct ossl_hash *self = hash;
+	EVP_DigestInit_ex(self->ctx, self->md, NULL);
+}
+
+static void *ossl_hash_new(enum nnc_crypto_hash type)
+{
+	struct ossl_hash *self = malloc(sizeof(struct ossl_hash));
+	if(!self) return NULL;
+	if(!(self->ctx = EVP_MD_CTX_new()))
+	{
+		free(self);
+		return NULL;
+	}
+	self->md = type == NNC_CRYPTO_SHA1 ? EVP_sha1() : EVP_sha256();
+	ossl_hash_reset(self);
+	return self;
+}
+
+static void ossl_hash_update(void *hash, const u8 *data, u32 size)
+{
+	EVP_DigestUpdate(((struct ossl_hash *) hash)->ctx, data, size);
+}
+
+static void ossl_hash_finish(void *hash, u8 *digest)
+{
+	EVP_DigestFinal_ex(((struct ossl_hash *) hash)->ctx, digest, NULL);
+}
+
+static void ossl_hash_free(void *hash)
+{
+	EVP_MD_CTX_free(((struct ossl_hash *) hash)->ctx);
+	free(hash);
+}
+
+struct ossl_key {
+	bool ecdsa;
+	u32 size;
+	BIGNUM *n, *e;
+	BN_MONT_CTX *mont; /* precomputed for n */
+	EC_KEY *ec;
+};
+
+static void ossl_key_free(void *key)
+{
+	struct ossl_key *self = key;
+	BN_free(self->n);
+	BN_free(self->e);
+	BN_MONT_CTX_free(self->mont);
+	EC_KEY_free(self->ec);
+	free(self);
+}
+
+static result ossl_rsa_key_new(void **key, const u8 *mod, u32 mod_size, const u8 exp[4])
+{
+	struct ossl_key *self = calloc(1, sizeof(struct ossl_key));
+	BN_CTX *ctx = BN_CTX_new();
+	result ret = NNC_R_NOMEM;
+	if(!self || !ctx) goto fail;
+	self->size = mod_size;
+	if(!(self->n = BN_bin2bn(mod, mod_size, NULL)) || !(self->e = BN_bin2bn(exp, 4, NULL))
+			|| !(self->mont = BN_MONT_CTX_new()))
+		goto fail;
+	ret = NNC_R_INVALID_CERT;
+	if(mod_size > 0x200 || BN_MONT_CTX_set(self->mont, self->n, ctx) != 1)
+		goto fail;
+	BN_CTX_free(ctx);
+	*key = self;
+	return NNC_R_OK;
+fail:
+	BN_CTX_free(ctx);
+	if(self) ossl_key_free(self);
+	return ret;
+}
+
+static result ossl_ecdsa_key_new(void **key, const u8 pubkey[0x3C])
+{
+	struct ossl_key *self = calloc(1, sizeof(struct ossl_key));
+	BIGNUM *x = BN_bin2bn(pubkey, 0x1E, NULL), *y = BN_bin2bn(pubkey + 0x1E, 0x1E, NULL);
+	result ret = NNC_R_NOMEM;
+	if(!self || !x || !y) goto fail;
+	self->ecdsa = true;
+	/* some distributions build OpenSSL without binary curves */
+	ret = NNC_R_UNSUPPORTED;
+	if(!(self->ec = EC_KEY_new_by_curve_name(NID_sect233r1)))
+		goto fail;
+	ret = NNC_R_INVALID_CERT;
+	if(EC_KEY_set_public_key_affine_coordinates(self->ec, x, y) != 1)
+		goto fail;
+	BN_free(x);
+	BN_free(y);
+	*key = self;
+	return NNC_R_OK;
+fail:
+	BN_free(x);
+	BN_free(y);
+	if(self) ossl_key_free(self);
+	return ret;
+}
+
+static result ossl_rsa_verify(struct ossl_key *self, enum nnc_crypto_hash md, const u8 *hash, const u8 *sig)
+{
+	BN_CTX *ctx = BN_CTX_new();
+	BIGNUM *s = BN_bin2bn(sig, self->size, NULL), *m = BN_new();
+	u8 em[0x200];
+	result ret = NNC_R_NOMEM;
+	if(!ctx || !s || !m)
+		goto out;
+	ret = NNC_R_BAD_SIG;
+	if(BN_cmp(s, self->n) >= 0 || BN_mod_exp_mont(m, s, self->e, self->n, ctx, self->mont) != 1
+			|| BN_bn2binpad(m, em, self->size) != (int) self->size)
+		goto out;
+	ret = nnc_crypto_pkcs1_check(em, self->size, md, hash);
+out:
+	BN_free(s);
+	BN_free(m);
+	BN_CTX_free(ctx);
+	return ret;
+}
+
+static result ossl_ecdsa_verify(struct ossl_key *self, enum nnc_crypto_hash md, const u8 *hash, const u8 *sig)
+{
+	BIGNUM *r = BN_bin2bn(sig, 0x1E, NULL), *s = BN_bin2bn(sig + 0x1E, 0x1E, NULL);
+	ECDSA_SIG *esig = ECDSA_SIG_new();
+	result ret = NNC_R_NOMEM;
+	if(!r || !s || !esig)
+		goto out;
+	ECDSA_SIG_set0(esig, r, s);
+	r = s = NULL; /* owned by esig now */
+	ret = ECDSA_do_verify(hash, HASH_SIZE(md), esig, self->ec) == 1 ? NNC_R_OK : NNC_R_BAD_SIG;
+out:
+	BN_free(r);
+	BN_free(s);
+	ECDSA_SIG_free(esig);
+	return ret;
+}
+
+static result ossl_key_verify(void *key, enum nnc_crypto_hash md, const u8 *hash, const u8 *sig)
+{
+	struct ossl_key *self = key;
+	return self->ecdsa ? ossl_ecdsa_verify(self, md, hash, sig)
+	                   : ossl_rsa_verify(self, md, hash, sig);
+}
+
+const nnc_crypto_backend nnc_crypto_openssl = {
+	.type          = NNC_CRYPTO_BACKEND_OPENSSL,
+	.name          = "openssl",
+	.aes_new       = ossl_aes_new,
+	.aes_free      = ossl_aes_free,
+	.aes_ctr       = ossl_aes_ctr,
+	.aes_cbc       = ossl_aes_cbc,
+	.aes_shareable = false, /* EVP contexts hold the IV and counter */
+	.hash_new      = ossl_hash_new,
+	.hash_reset    = ossl_hash_reset,
+	.hash_update   = ossl_hash_update,
+	.hash_finish   = ossl_hash_finish,
+	.hash_free     = ossl_hash_free,
+	.rsa_key_new   = ossl_rsa_key_new,
+	.ecdsa_key_new = ossl_ecdsa_key_new,
+	.key_verify    = ossl_key_verify,
+	.key_free      = ossl_key_free,
+};
+
+#endif
+
@@ -131,6 +131,7 @@ const char *nnc_strerror(nnc_result res)
 	case NNC_R_OPEN: return "already open";
 	case NNC_R_OS: return "OS error";
 	case NNC_R_INTERNAL: return "internal nnc error";
+	case NNC_R_BAD_HASH: return "hash verification failed";
 	}
 	return NULL;
 }
@@ -206,6 +207,17 @@ bool nnc_find_support_file(const char *name, char *output)
 #undef CHECK
 }
 
+static void *default_alloc(void *user, size_t size) { (void) user; return malloc(size); }
+static void *default_realloc(void *user, void *ptr, size_t size) { (void) user; return realloc(ptr, size); }
+static void default_free(void *user, void *ptr) { (void) user; free(ptr); }
+
+const nnc_allocator nnc_default_allocator = {
+	.alloc   = default_alloc,
+	.realloc = default_realloc,
+	.free    = default_free,
+	.user    = NULL,
+};
+
 char *nnc_strdup(const char *s)
 {
 	if(!s) return NULL;
@@ -231,7 +243,9 @@ nnc_result nnc_dynbuf_push(struct dynbuf *db, u8 *data, u32 len)
 	u32 new_used = db->used + len;
 	if(new_used >= db->alloc)
 	{
-		u32 new_alloc = db->alloc * 2;
+		u32 new_alloc = db->alloc ? db->alloc * 2 : 64;
+		while(new_alloc <= new_used)
+			new_alloc *= 2;
 		u8 *new_buf = realloc(db->buffer, new_alloc);
 		if(!new_buf) return NNC_R_NOMEM;
 		db->buffer = new_buf;
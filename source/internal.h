@@ -4,6 +4,23 @@
 
 #include <nnc/base.h>
 
+#if defined(_WIN32) /* || defined(__MINGW32__) || defined(__CYGWIN__) // though these are technically windows, winapi should not be used */
+	#define NNC_PLATFORM_WINDOWS 1
+#endif
+#if defined(__APPLE__)
+	#define NNC_PLATFORM_APPLE 1
+	#define NNC_PLATFORM_UNIX 1
+#elif defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+	#define NNC_PLATFORM_UNIX 1
+#elif defined(_3DS) || defined(__3DS__)
+	#define NNC_PLATFORM_3DS 1
+#endif
+
+/* system headers that need to be included before the short type names below */
+#if NNC_PLATFORM_UNIX
+	#include <pthread.h>
+#endif
+
 #define BLOCK_SZ 0x10000
 
 #define MIN(a,b) ((a)<(b)?(a):(b))
@@ -78,20 +95,9 @@ nnc_u32 nnc_bswap32(nnc_u32 a);
 nnc_u64 nnc_bswap64(nnc_u64 a);
 #endif
 
-#if defined(_WIN32) /* || defined(__MINGW32__) || defined(__CYGWIN__) // though these are technically windows, winapi should not be used */
-	#define NNC_PLATFORM_WINDOWS 1
-#endif
-#if defined(__APPLE__)
-	#define NNC_PLATFORM_APPLE 1
-	#define NNC_PLATFORM_UNIX 1
-#elif defined(__unix__) || defined(__linux__) || defined(__APPLE__)
-	#define NNC_PLATFORM_UNIX 1
-#elif defined(_3DS) || defined(__3DS__)
-	#define NNC_PLATFORM_3DS 1
-#endif
-
 /* forward declaration from stream.h */
 struct nnc_rstream;
+struct nnc_wstream;
 #define read_at_exact nnc_read_at_exact
 result nnc_read_at_exact(struct nnc_rstream *rs, u32 offset, u8 *data, u32 dsize);
 #define read_exact nnc_read_exact
@@ -104,6 +110,32 @@ void nnc_dumpmem(void *mem, u32 len);
 bool nnc_find_support_file(const char *name, char *output);
 #define strdup nnc_strdup
 char *nnc_strdup(const char *s);
+/* zlib's CRC32, in crypto.c, start with crc = 0 */
+#define crc32_update nnc_crc32_update
+u32 nnc_crc32_update(u32 crc, const u8 *data, u32 size);
+
+/* malloc(), realloc() and free(), used unless a context says otherwise */
+#define default_allocator nnc_default_allocator
+extern const nnc_allocator nnc_default_allocator;
+#define al_alloc(al, size)        ((al)->alloc((al)->user, (size)))
+#define al_realloc(al, ptr, size) ((al)->realloc((al)->user, (ptr), (size)))
+#define al_free(al, ptr)          ((al)->free((al)->user, (ptr)))
+
+/* allocator aware versions of public functions for context.c, memory
+ * they allocate must be freed with the same allocator */
+struct nnc_seeddb;
+struct nnc_certchain;
+struct nnc_keypair_cache;
+#define seeds_seeddb_al nnc_seeds_seeddb_al
+result nnc_seeds_seeddb_al(struct nnc_rstream *rs, struct nnc_seeddb *seeddb, const nnc_allocator *al);
+#define read_certchain_al nnc_read_certchain_al
+result nnc_read_certchain_al(struct nnc_rstream *rs, struct nnc_certchain *chain, bool extend, const nnc_allocator *al);
+/* unlike nnc_scan_certchains() this can add to an existing chain
+ * and reports running out of memory */
+#define scan_certchains_al nnc_scan_certchains_al
+result nnc_scan_certchains_al(struct nnc_certchain *chain, bool extend, const nnc_allocator *al);
+#define keypair_cache_init_al nnc_keypair_cache_init_al
+result nnc_keypair_cache_init_al(struct nnc_keypair_cache *cache, u32 capacity, const nnc_allocator *al);
 
 union nnc_f32_converter {
 	f32 flt;
@@ -134,5 +166,93 @@ nnc_result nnc_dynbuf_push(struct dynbuf *db, u8 *data, u32 len);
 #define dynbuf_free nnc_dynbuf_free
 void nnc_dynbuf_free(struct dynbuf *db);
 
+/* stream.c; writes what `func` writes to a stream that can't seek by calling it twice.
+ * The first call only records the bytes that are written over earlier data, like
+ * headers that are filled in last, the second writes everything front to back with
+ * those bytes already in place. `func` must write the same both times and may seek
+ * backwards but not past the end of what it wrote. */
+typedef result (*nnc_seeking_writer)(void *udata, struct nnc_wstream *ws);
+#define write_single_pass nnc_write_single_pass
+result nnc_write_single_pass(nnc_seeking_writer func, void *udata, struct nnc_wstream *ws);
+
+/* stream.c; succeeds if the directory already exists */
+#define make_directory nnc_make_directory
+result nnc_make_directory(const char *path);
+
+/* thread.c; on platforms without thread support locking does nothing */
+#if NNC_PLATFORM_UNIX
+	typedef pthread_mutex_t nnc_mutex;
+	#define NNC_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#elif NNC_PLATFORM_WINDOWS
+	/* layout compatible with SRWLOCK so we don't need windows.h everywhere */
+	typedef struct { void *ptr; } nnc_mutex;
+	#define NNC_MUTEX_INIT { NULL }
+#elif NNC_PLATFORM_3DS
+	/* layout compatible with libctru's LightLock, which is unlocked at 1 */
+	typedef nnc_i32 nnc_mutex;
+	#define NNC_MUTEX_INIT 1
+#else
+	typedef char nnc_mutex;
+	#define NNC_MUTEX_INIT 0
+#endif
+#define mutex_init nnc_mutex_init
+result nnc_mutex_init(nnc_mutex *mtx);
+#define mutex_lock nnc_mutex_lock
+void nnc_mutex_lock(nnc_mutex *mtx);
+#define mutex_unlock nnc_mutex_unlock
+void nnc_mutex_unlock(nnc_mutex *mtx);
+#define mutex_destroy nnc_mutex_destroy
+void nnc_mutex_destroy(nnc_mutex *mtx);
+
+#if NNC_PLATFORM_UNIX
+	typedef pthread_cond_t nnc_cond;
+#elif NNC_PLATFORM_WINDOWS
+	/* layout compatible with CONDITION_VARIABLE */
+	typedef struct { void *ptr; } nnc_cond;
+#elif NNC_PLATFORM_3DS
+	/* layout compatible with CondVar */
+	typedef nnc_i32 nnc_cond;
+#else
+	typedef char nnc_cond;
+#endif
+#define cond_init nnc_cond_init
+result nnc_cond_init(nnc_cond *cond);
+/* mtx must be locked, it is locked again when this returns */
+#define cond_wait nnc_cond_wait
+void nnc_cond_wait(nnc_cond *cond, nnc_mutex *mtx);
+#define cond_broadcast nnc_cond_broadcast
+void nnc_cond_broadcast(nnc_cond *cond);
+#define cond_destroy nnc_cond_destroy
+void nnc_cond_destroy(nnc_cond *cond);
+
+#if NNC_PLATFORM_UNIX
+	typedef pthread_t nnc_thread;
+#elif NNC_PLATFORM_WINDOWS
+	typedef void *nnc_thread; /* HANDLE */
+#elif NNC_PLATFORM_3DS
+	typedef void *nnc_thread; /* Thread */
+#else
+	typedef char nnc_thread;
+#endif
+typedef void (*nnc_thread_func)(void *arg);
+/* returns NNC_R_UNSUPPORTED on platforms without threads, callers should
+ * then just do the work themselves */
+#define thread_create nnc_thread_create
+result nnc_thread_create(nnc_thread *thread, nnc_thread_func func, void *arg);
+#define thread_join nnc_thread_join
+void nnc_thread_join(nnc_thread *thread);
+
+/* stream.c; reads the contents of VFS nodes on another thread ahead of the
+ * writer, at most `budget` bytes in flight. Copy the nodes in the order given,
+ * without threads or with a budget of 0 every copy just reads its node. */
+struct nnc_vfs_file_node;
+typedef struct nnc_prefetch nnc_prefetch;
+#define prefetch_start nnc_prefetch_start
+result nnc_prefetch_start(nnc_prefetch **self, struct nnc_vfs_file_node **nodes, u32 count, u32 budget);
+#define prefetch_copy nnc_prefetch_copy
+result nnc_prefetch_copy(nnc_prefetch *self, struct nnc_wstream *ws, u32 *copied);
+#define prefetch_stop nnc_prefetch_stop
+void nnc_prefetch_stop(nnc_prefetch *self);
+
 #endif
 
@@ -24,7 +24,8 @@ nnc_result nnc_read_ivfc_header(nnc_rstream *rs, nnc_ivfc *ivfc, nnc_u32 expecte
 {
 	if(expected_levels > NNC_IVFC_MAX_LEVELS)
 		return NNC_R_INVAL;
-	u32 max_levels = MIN(expected_levels == 0 ? NNC_IVFC_MAX_LEVELS : expected_levels + 1, NNC_IVFC_MAX_LEVELS);
+	/* the header size follows the last descriptor, so only the expected ones may be read */
+	u32 max_levels = expected_levels == 0 ? NNC_IVFC_MAX_LEVELS : expected_levels;
 
 	u8 data[IVFC_MAX_HEADER_SIZE_CONST];
 	result ret;
@@ -46,20 +47,30 @@ nnc_result nnc_read_ivfc_header(nnc_rstream *rs, nnc_ivfc *ivfc, nnc_u32 expecte
 	return i == 0 || (expected_levels != 0 && ivfc->number_levels != expected_levels) ? NNC_R_CORRUPT : NNC_R_OK;
 }
 
+/* makes sure block_hashes has room for at least `blocks` hashes */
+static result nnc_ivfc_reserve_hashes(nnc_ivfc_writer *self, u32 blocks)
+{
+	if(blocks <= self->blocks_allocated)
+		return NNC_R_OK;
+	/* block_hashes always grows by whole blocks: (block_size / sizeof(nnc_sha256_hash)) * sizeof(nnc_sha256_hash) = block_size */
+	u32 per_block = self->block_size / sizeof(nnc_sha256_hash);
+	u32 new_allocated = ALIGN(blocks, per_block);
+	u64 real_old_size = self->blocks_allocated * sizeof(nnc_sha256_hash);
+	u64 real_new_size = new_allocated * sizeof(nnc_sha256_hash);
+	u8 *new_hashes = realloc(self->block_hashes, real_new_size);
+	if(new_hashes == NULL) return NNC_R_NOMEM;
+	/* we need to clear the new area */
+	memset(new_hashes + real_old_size, 0x00, real_new_size - real_old_size);
+	self->block_hashes = (nnc_sha256_hash *) new_hashes;
+	self->blocks_allocated = new_allocated;
+	return NNC_R_OK;
+}
+
 static result nnc_ivfc_finish_block(nnc_ivfc_writer *self)
 {
+	result ret;
 	/* if there is no space left for another block, we need to allocate another block of hashes */
-	if(self->blocks_hashed == self->blocks_allocated)
-	{
-		u64 real_old_size = self->blocks_allocated * sizeof(nnc_sha256_hash);
-		/* (block_size / sizeof(nnc_sha256_hash)) * sizeof(nnc_sha256_hash) = block_size */
-		u8 *new_hashes = realloc(self->block_hashes, real_old_size + self->block_size);
-		if(new_hashes == NULL) return NNC_R_NOMEM;
-		/* we need to clear the new area */
-		memset(new_hashes + real_old_size, 0x00, self->block_size);
-		self->block_hashes = (nnc_sha256_hash *) new_hashes;
-		self->blocks_allocated += self->block_size / sizeof(nnc_sha256_hash);
-	}
+	TRY(nnc_ivfc_reserve_hashes(self, self->blocks_hashed + 1));
 
 	nnc_crypto_sha256_finish(self->current_hash, self->block_hashes[self->blocks_hashed++]);
 	/* when we've extracted the digest we need to prepare it for
@@ -69,16 +80,271 @@ static result nnc_ivfc_finish_block(nnc_ivfc_writer *self)
 	return NNC_R_OK;
 }
 
+/* Hashing on other threads: the data is copied into batches of
+ * IVFC_BATCH_BLOCKS blocks which are hashed by the workers into the
+ * slots of the batch. The writer moves finished hashes into block_hashes
+ * itself since that buffer is reallocated as it grows, so the workers never
+ * touch it. Batches are recycled, writing only waits if all of them are
+ * still being hashed. */
+#define IVFC_BATCH_BLOCKS 64
+
+enum ivfc_batch_state {
+	BATCH_FREE,   /* unused or being filled by the writer */
+	BATCH_QUEUED, /* waiting for a worker */
+	BATCH_BUSY,   /* being hashed */
+	BATCH_DONE,   /* hashed, hashes must still be moved to block_hashes */
+};
+
+struct ivfc_batch {
+	u8 *data;
+	nnc_sha256_hash hashes[IVFC_BATCH_BLOCKS];
+	u32 first_block, nblocks;
+	enum ivfc_batch_state state;
+};
+
+struct nnc_ivfc_hash_pool {
+	nnc_mutex lock;
+	nnc_cond work; /* signalled when a batch is queued or on quit */
+	nnc_cond done; /* signalled when a batch is done */
+	struct ivfc_batch *batches;
+	struct ivfc_batch *filling; /* batch the writer is filling, NULL if none */
+	u32 nbatches, nthreads;
+	u32 block_size, filled;
+	u32 next_block;
+	result ret; /* first error of a worker */
+	bool quit;
+	nnc_thread threads[];
+};
+
+static void nnc_ivfc_hash_worker(void *arg)
+{
+	struct nnc_ivfc_hash_pool *pool = arg;
+	mutex_lock(&pool->lock);
+	for(;;)
+	{
+		struct ivfc_batch *batch = NULL;
+		/* take the oldest batch, the writer retires them in any order but
+		 * this keeps the amount of batches in flight low */
+		for(u32 i = 0; i < pool->nbatches; ++i)
+			if(pool->batches[i].state == BATCH_QUEUED && (!batch || pool->batches[i].first_block < batch->first_block))
+				batch = &pool->batches[i];
+		if(!batch)
+		{
+			if(pool->quit) break;
+			cond_wait(&pool->work, &pool->lock);
+			continue;
+		}
+		batch->state = BATCH_BUSY;
+		mutex_unlock(&pool->lock);
+
+		result ret = NNC_R_OK;
+		for(u32 i = 0; i < batch->nblocks && ret == NNC_R_OK; ++i)
+			ret = nnc_crypto_sha256(batch->data + i * pool->block_size, batch->hashes[i], pool->block_size);
+
+		mutex_lock(&pool->lock);
+		if(ret != NNC_R_OK && pool->ret == NNC_R_OK)
+			pool->ret = ret;
+		batch->state = BATCH_DONE;
+		cond_broadcast(&pool->done);
+	}
+	mutex_unlock(&pool->lock);
+}
+
+/* moves the hashes of all finished batches to block_hashes, lock must be held */
+static result nnc_ivfc_pool_retire(nnc_ivfc_writer *self)
+{
+	struct nnc_ivfc_hash_pool *pool = self->pool;
+	result ret;
+	for(u32 i = 0; i < pool->nbatches; ++i)
+	{
+		struct ivfc_batch *batch = &pool->batches[i];
+		if(batch->state != BATCH_DONE)
+			continue;
+		TRY(nnc_ivfc_reserve_hashes(self, batch->first_block + batch->nblocks));
+		memcpy(self->block_hashes[batch->first_block], batch->hashes, batch->nblocks * sizeof(nnc_sha256_hash));
+		self->blocks_hashed = MAX(self->blocks_hashed, batch->first_block + batch->nblocks);
+		batch->state = BATCH_FREE;
+	}
+	return pool->ret;
+}
+
+/* gets a batch to fill, waiting for one to finish if there is none */
+static result nnc_ivfc_pool_acquire(nnc_ivfc_writer *self)
+{
+	struct nnc_ivfc_hash_pool *pool = self->pool;
+	result ret;
+	mutex_lock(&pool->lock);
+	while((ret = nnc_ivfc_pool_retire(self)) == NNC_R_OK)
+	{
+		for(u32 i = 0; i < pool->nbatches && !pool->filling; ++i)
+			if(pool->batches[i].state == BATCH_FREE)
+				pool->filling = &pool->batches[i];
+		if(pool->filling) break;
+		cond_wait(&pool->done, &pool->lock);
+	}
+	mutex_unlock(&pool->lock);
+	pool->filled = 0;
+	return ret;
+}
+
+static void nnc_ivfc_pool_submit(nnc_ivfc_writer *self)
+{
+	struct nnc_ivfc_hash_pool *pool = self->pool;
+	struct ivfc_batch *batch = pool->filling;
+	batch->first_block = pool->next_block;
+	batch->nblocks = pool->filled / pool->block_size;
+	pool->next_block += batch->nblocks;
+	pool->filling = NULL;
+
+	mutex_lock(&pool->lock);
+	batch->state = BATCH_QUEUED;
+	cond_broadcast(&pool->work);
+	mutex_unlock(&pool->lock);
+}
+
+static result nnc_ivfc_pool_write(nnc_ivfc_writer *self, u8 *buf, u32 size)
+{
+	struct nnc_ivfc_hash_pool *pool = self->pool;
+	u32 batch_size = IVFC_BATCH_BLOCKS * pool->block_size;
+	result ret;
+	while(size)
+	{
+		if(!pool->filling)
+			TRY(nnc_ivfc_pool_acquire(self));
+		u32 will_copy = MIN(size, batch_size - pool->filled);
+		memcpy(pool->filling->data + pool->filled, buf, will_copy);
+		pool->filled += will_copy;
+		buf  += will_copy;
+		size -= will_copy;
+		if(pool->filled == batch_size)
+			nnc_ivfc_pool_submit(self);
+	}
+	return NNC_R_OK;
+}
+
+/* submits the last batch and waits until everything is hashed,
+ * the data written must be aligned to the block size by now */
+static result nnc_ivfc_pool_finish(nnc_ivfc_writer *self)
+{
+	struct nnc_ivfc_hash_pool *pool = self->pool;
+	result ret;
+	if(pool->filling && pool->filled)
+		nnc_ivfc_pool_submit(self);
+	mutex_lock(&pool->lock);
+	for(;;)
+	{
+		if((ret = nnc_ivfc_pool_retire(self)) != NNC_R_OK)
+			break;
+		u32 i;
+		for(i = 0; i < pool->nbatches; ++i)
+			if(pool->batches[i].state != BATCH_FREE)
+				break;
+		if(i == pool->nbatches) break;
+		cond_wait(&pool->done, &pool->lock);
+	}
+	mutex_unlock(&pool->lock);
+	return ret;
+}
+
+static void nnc_ivfc_pool_free(nnc_ivfc_writer *self)
+{
+	struct nnc_ivfc_hash_pool *pool = self->pool;
+	if(!pool) return;
+	mutex_lock(&pool->lock);
+	pool->quit = true;
+	cond_broadcast(&pool->work);
+	mutex_unlock(&pool->lock);
+	/* workers finish the batches that are queued before quitting */
+	for(u32 i = 0; i < pool->nthreads; ++i)
+		thread_join(&pool->threads[i]);
+	for(u32 i = 0; i < pool->nbatches; ++i)
+		free(pool->batches[i].data);
+	free(pool->batches);
+	cond_destroy(&pool->done);
+	cond_destroy(&pool->work);
+	mutex_destroy(&pool->lock);
+	free(pool);
+	self->pool = NULL;
+}
+
+nnc_result nnc_ivfc_writer_set_threads(nnc_ivfc_writer *self, nnc_u32 threads)
+{
+	/* the hashes of data already written are in current_hash */
+	if(self->final_lv_size != 0 || self->pool)
+		return NNC_R_INVAL;
+	if(threads == 0)
+		return NNC_R_OK;
+
+	struct nnc_ivfc_hash_pool *pool = malloc(sizeof(struct nnc_ivfc_hash_pool) + threads * sizeof(nnc_thread));
+	if(!pool) return NNC_R_NOMEM;
+	/* enough for every worker to have one batch and the writer to fill the next ones */
+	pool->nbatches = threads * 2 + 1;
+	pool->nthreads = 0;
+	pool->block_size = self->block_size;
+	pool->filling = NULL;
+	pool->filled = 0;
+	pool->next_block = 0;
+	pool->ret = NNC_R_OK;
+	pool->quit = false;
+	if(!(pool->batches = calloc(pool->nbatches, sizeof(struct ivfc_batch))))
+	{
+		free(pool);
+		return NNC_R_NOMEM;
+	}
+	for(u32 i = 0; i < pool->nbatches; ++i)
+		pool->batches[i].state = BATCH_FREE;
+
+	result ret = NNC_R_OK;
+	if(mutex_init(&pool->lock) != NNC_R_OK) ret = NNC_R_OS;
+	else if(cond_init(&pool->work) != NNC_R_OK)
+	{
+		mutex_destroy(&pool->lock);
+		ret = NNC_R_OS;
+	}
+	else if(cond_init(&pool->done) != NNC_R_OK)
+	{
+		cond_destroy(&pool->work);
+		mutex_destroy(&pool->lock);
+		ret = NNC_R_OS;
+	}
+	if(ret != NNC_R_OK)
+	{
+		free(pool->batches);
+		free(pool);
+		return ret;
+	}
+
+	self->pool = pool;
+	for(u32 i = 0; i < pool->nbatches; ++i)
+		if(!(pool->batches[i].data = malloc(IVFC_BATCH_BLOCKS * self->block_size)))
+		{
+			nnc_ivfc_pool_free(self);
+			return NNC_R_NOMEM;
+		}
+	/* if no thread can be started we just keep hashing on the calling thread */
+	for(u32 i = 0; i < threads; ++i, ++pool->nthreads)
+		if(thread_create(&pool->threads[i], nnc_ivfc_hash_worker, pool) != NNC_R_OK)
+			break;
+	if(pool->nthreads == 0)
+		nnc_ivfc_pool_free(self);
+	return NNC_R_OK;
+}
+
 static result nnc_ivfc_wwrite(nnc_ivfc_writer *self, u8 *buf, u32 size)
 {
 	u32 bufptr = 0, sizeleft = size;
 	result ret;
 
 	/* TODO: Check if the new write will fit in the master hash */
-	/* TODO: Optimize this routine, most time in romfs writing is spent here */
+
+	if(self->pool)
+	{
+		TRY(nnc_ivfc_pool_write(self, buf, size));
+		sizeleft = 0;
+	}
 
 	/* if we have some incremental buffer left */
-	if(self->current_hashed_size)
+	if(sizeleft && self->current_hashed_size)
 	{
 		u32 will_hash = self->block_size - self->current_hashed_size;
 		will_hash = MIN(size, will_hash);
@@ -120,6 +386,30 @@ static result nnc_ivfc_wwrite(nnc_ivfc_writer *self, u8 *buf, u32 size)
 	return ret;
 }
 
+result nnc_ivfc_writer_copy_blocks(nnc_ivfc_writer *self, u8 *buf, u32 blocks, nnc_sha256_hash *hashes)
+{
+	u32 first = self->blocks_hashed;
+	result ret;
+	if(self->final_lv_size & (self->block_size - 1))
+		return NNC_R_BAD_ALIGN;
+	if(self->pool)
+	{
+		struct nnc_ivfc_hash_pool *pool = self->pool;
+		/* the blocks before these go in a batch of their own, the
+		 * workers never touch block_hashes so it can be filled here */
+		if(pool->filling && pool->filled)
+			nnc_ivfc_pool_submit(self);
+		first = pool->next_block;
+		pool->next_block += blocks;
+	}
+	TRY(nnc_ivfc_reserve_hashes(self, first + blocks));
+	memcpy(self->block_hashes[first], hashes, blocks * sizeof(nnc_sha256_hash));
+	self->blocks_hashed = MAX(self->blocks_hashed, first + blocks);
+	ret = NNC_WS_PCALL(self->child, write, buf, blocks * self->block_size);
+	if(ret == NNC_R_OK) self->final_lv_size += blocks * self->block_size;
+	return ret;
+}
+
 static result nnc_ivfc_fill_hashbuffer(nnc_ivfc_writer *self, nnc_sha256_hash **output, u8 *data_to_hash, u64 datalen)
 {
 	/* the data must be aligned by the hash size */
@@ -152,12 +442,18 @@ static result nnc_ivfc_wclose(nnc_ivfc_writer *self)
 	nnc_sha256_hash *hash_buffers[NNC_IVFC_MAX_LEVELS - 1] = {0};
 
 	result ret = NNC_R_OK;
+	nnc_sha256_hash* master_hashes = NULL;
 	u64 pad_bytes = ALIGN(self->final_lv_size, self->block_size) - self->final_lv_size;
 	/* We may still need to finish the last hash if it wasn't complete yet, let's just do that right now quickly by padding */
 	TRYLBL(nnc_write_padding(NNC_WSP(self), pad_bytes), out);
 
+	/* all hashes of the last level have to be in before the upper levels can be calculated */
+	if(self->pool)
+	{
+		TRYLBL(nnc_ivfc_pool_finish(self), out);
+		nnc_ivfc_pool_free(self);
+	}
 	hash_buffers[self->levels - 2] = self->block_hashes;
-	nnc_sha256_hash* master_hashes = NULL;
 
 	/* now we'll calculate all sizes of each level */
 	u64 level_sizes[NNC_IVFC_MAX_LEVELS];
@@ -234,7 +530,11 @@ static result nnc_ivfc_wclose(nnc_ivfc_writer *self)
 
 out:
 	/* And finally we can free up our own resources */
+	nnc_ivfc_pool_free(self);
 	nnc_crypto_sha256_free(self->current_hash);
+	/* block_hashes may have been reallocated after it was put here */
+	hash_buffers[self->levels - 2] = self->block_hashes;
+	self->block_hashes = NULL;
 	free(master_hashes);
 	for(u32 i = 0; i < NNC_IVFC_MAX_LEVELS - 1; ++i)
 		free(hash_buffers[i]);
@@ -261,6 +561,8 @@ nnc_result nnc_open_ivfc_writer(nnc_ivfc_writer *self, nnc_wstream *child, nnc_u
 	self->block_size    = block_size;
 	self->final_lv_size = 0;
 	self->header_pos    = child->funcs->tell(child);
+	self->pool          = NULL;
+	self->block_hashes  = NULL;
 
 	if(!child->funcs->seek || block_size == 0 || block_size & (block_size - 1) || levels > NNC_IVFC_MAX_LEVELS)
 		return NNC_R_INVAL;
@@ -280,6 +582,7 @@ nnc_result nnc_open_ivfc_writer(nnc_ivfc_writer *self, nnc_wstream *child, nnc_u
 	if(res != NNC_R_OK)
 	{
 		free(self->block_hashes);
+		self->block_hashes = NULL;
 		return res;
 	}
 
@@ -288,6 +591,405 @@ nnc_result nnc_open_ivfc_writer(nnc_ivfc_writer *self, nnc_wstream *child, nnc_u
 
 void nnc_ivfc_abort_write(nnc_ivfc_writer *self)
 {
+	nnc_ivfc_pool_free(self);
 	nnc_crypto_sha256_free(self->current_hash);
+	free(self->block_hashes);
+	self->block_hashes = NULL;
+}
+
+
+/* Reading with verification: level 1 is small and checked completely when
+ * opening, level 2 is checked a block at a time when a level 3 block needs
+ * one of its hashes. Both are kept in memory, level 3 is read from the child
+ * and a bit is set for every block that matched so it's hashed only once. */
+#define BIT_TEST(map, i) ((map)[(i) >> 3] & (1 << ((i) & 7)))
+#define BIT_SET(map, i)  ((map)[(i) >> 3] |= (1 << ((i) & 7)))
+
+static result nnc_ivfc_check_block(nnc_ivfc_reader *self, u8 *data, u32 size, u8 *expected, u64 offset)
+{
+	nnc_sha256_hash digest;
+	result ret;
+	TRY(nnc_crypto_sha256(data, digest, size));
+	if(memcmp(digest, expected, sizeof(digest)) != 0)
+	{
+		self->bad_offset = offset;
+		return NNC_R_BAD_HASH;
+	}
+	return NNC_R_OK;
 }
 
+static result nnc_ivfc_verify_l3_block(nnc_ivfc_reader *self, u32 block)
+{
+	u32 bs2_log2 = self->ivfc.level[1].block_size_log2, bs3_log2 = self->ivfc.level[2].block_size_log2;
+	u32 bs2 = 1 << bs2_log2, bs3 = 1 << bs3_log2;
+	u64 hash_pos = (u64) block * sizeof(nnc_sha256_hash);
+	u32 l2_block = hash_pos >> bs2_log2;
+	result ret;
+	if(!BIT_TEST(self->l2_verified, l2_block))
+	{
+		u8 *l2_data = self->l2 + ((u64) l2_block << bs2_log2);
+		u64 offset = self->level_offset[1] + ((u64) l2_block << bs2_log2);
+		TRY(read_at_exact(self->child, offset, l2_data, bs2));
+		TRY(nnc_ivfc_check_block(self, l2_data, bs2, self->l1 + (u64) l2_block * sizeof(nnc_sha256_hash), offset));
+		BIT_SET(self->l2_verified, l2_block);
+	}
+	u64 offset = self->level_offset[2] + ((u64) block << bs3_log2);
+	TRY(read_at_exact(self->child, offset, self->block, bs3));
+	TRY(nnc_ivfc_check_block(self, self->block, bs3, self->l2 + hash_pos, offset));
+	BIT_SET(self->l3_verified, block);
+	return NNC_R_OK;
+}
+
+static result nnc_ivfc_rread(nnc_ivfc_reader *self, u8 *buf, u32 max, u32 *totalRead)
+{
+	u32 bs3_log2 = self->ivfc.level[2].block_size_log2;
+	u32 bs3 = 1 << bs3_log2;
+	u64 l3_start = self->level_offset[2], l3_end = l3_start + self->ivfc.level[2].size;
+	result ret;
+	*totalRead = 0;
+	max = MIN(max, self->size - self->pos);
+	while(max)
+	{
+		u64 pos = self->pos;
+		u32 will_read;
+		if(pos < l3_start || pos >= l3_end)
+		{
+			/* headers, hashes and the padding after level 3 aren't checked */
+			will_read = pos < l3_start ? MIN(max, l3_start - pos) : max;
+			TRY(read_at_exact(self->child, pos, buf, will_read));
+		}
+		else
+		{
+			u32 block = (pos - l3_start) >> bs3_log2;
+			u32 in_block = (pos - l3_start) & (bs3 - 1);
+			will_read = MIN(max, MIN(bs3 - in_block, l3_end - pos));
+			if(!BIT_TEST(self->l3_verified, block))
+			{
+				TRY(nnc_ivfc_verify_l3_block(self, block));
+				memcpy(buf, self->block + in_block, will_read);
+			}
+			else
+			{
+				/* read all blocks that were checked before at once */
+				while(will_read < max && pos + will_read < l3_end && BIT_TEST(self->l3_verified, block + 1))
+				{
+					will_read = MIN(max, MIN(will_read + bs3, l3_end - pos));
+					++block;
+				}
+				TRY(read_at_exact(self->child, pos, buf, will_read));
+			}
+		}
+		self->pos  += will_read;
+		*totalRead += will_read;
+		buf += will_read;
+		max -= will_read;
+	}
+	return NNC_R_OK;
+}
+
+static result nnc_ivfc_rseek_abs(nnc_ivfc_reader *self, u32 pos)
+{
+	if(pos >= self->size) return NNC_R_SEEK_RANGE;
+	self->pos = pos;
+	return NNC_R_OK;
+}
+
+static result nnc_ivfc_rseek_rel(nnc_ivfc_reader *self, u32 pos)
+{
+	u32 npos = self->pos + pos;
+	if(npos >= self->size) return NNC_R_SEEK_RANGE;
+	self->pos = npos;
+	return NNC_R_OK;
+}
+
+static u32 nnc_ivfc_rsize(nnc_ivfc_reader *self)
+{
+	return self->size;
+}
+
+static void nnc_ivfc_rclose(nnc_ivfc_reader *self)
+{
+	free(self->l1);
+	free(self->l2);
+	free(self->l2_verified);
+	free(self->l3_verified);
+	free(self->block);
+	self->l1 = self->l2 = self->l2_verified = self->l3_verified = self->block = NULL;
+}
+
+static u32 nnc_ivfc_rtell(nnc_ivfc_reader *self)
+{
+	return self->pos;
+}
+
+static const nnc_rstream_funcs nnc_ivfc_rfuncs = {
+	.read     = (nnc_read_func)     nnc_ivfc_rread,
+	.seek_abs = (nnc_seek_abs_func) nnc_ivfc_rseek_abs,
+	.seek_rel = (nnc_seek_rel_func) nnc_ivfc_rseek_rel,
+	.size     = (nnc_size_func)     nnc_ivfc_rsize,
+	.close    = (nnc_close_func)    nnc_ivfc_rclose,
+	.tell     = (nnc_tell_func)     nnc_ivfc_rtell,
+};
+
+/* offsets, sizes padded to whole blocks and block counts of the levels of a
+ * RomFS IVFC, checks the levels hold enough hashes and fit in `size` */
+struct nnc_ivfc_romfs_layout {
+	u64 offset[3], aligned[3], nblocks[3];
+};
+
+static result nnc_ivfc_romfs_layout(const nnc_ivfc *ivfc, u32 size, struct nnc_ivfc_romfs_layout *layout)
+{
+	if(ivfc->number_levels != NNC_IVFC_LEVELS_ROMFS)
+		return NNC_R_UNSUPPORTED;
+	for(u32 i = 0; i < 3; ++i)
+	{
+		/* a block of 16 MiB is already far beyond anything seen in a RomFS */
+		if(ivfc->level[i].block_size_log2 > 24)
+			return NNC_R_UNSUPPORTED;
+		u64 block_size = (u64) 1 << ivfc->level[i].block_size_log2;
+		layout->aligned[i] = ALIGN(ivfc->level[i].size, block_size);
+		layout->nblocks[i] = layout->aligned[i] / block_size;
+	}
+	/* every level must have a hash for every block of the next */
+	if(layout->nblocks[2] == 0 || ivfc->l0_size / sizeof(nnc_sha256_hash) < layout->nblocks[0]
+			|| ivfc->level[0].size / sizeof(nnc_sha256_hash) < layout->nblocks[1]
+			|| ivfc->level[1].size / sizeof(nnc_sha256_hash) < layout->nblocks[2])
+		return NNC_R_CORRUPT;
+	/* level 3 comes first, then 1 and 2 */
+	layout->offset[2] = ALIGN(0x60 + (u64) ivfc->l0_size, (u64) 1 << ivfc->level[2].block_size_log2);
+	layout->offset[0] = layout->offset[2] + layout->aligned[2];
+	layout->offset[1] = layout->offset[0] + layout->aligned[0];
+	return layout->offset[1] + layout->aligned[1] > size ? NNC_R_CORRUPT : NNC_R_OK;
+}
+
+/* called for every block of a level that doesn't match its hash, the
+ * checking stops unless it returns NNC_R_OK */
+typedef result (*nnc_ivfc_bad_block_func)(void *udata, u64 offset, u32 block);
+
+static result nnc_ivfc_check_level(const u8 *data, u64 nblocks, u32 block_size, const u8 *hashes,
+	u64 offset, nnc_ivfc_bad_block_func bad, void *udata)
+{
+	nnc_sha256_hash digest;
+	result ret;
+	for(u32 i = 0; i < nblocks; ++i)
+	{
+		TRY(nnc_crypto_sha256(data + (u64) i * block_size, digest, block_size));
+		if(memcmp(digest, hashes + (u64) i * sizeof(nnc_sha256_hash), sizeof(digest)) != 0)
+			TRY(bad(udata, offset + (u64) i * block_size, i));
+	}
+	return NNC_R_OK;
+}
+
+/* reads the master hash and level 1 and checks level 1 against it */
+static result nnc_ivfc_read_l1(nnc_rstream *rs, const nnc_ivfc *ivfc, const struct nnc_ivfc_romfs_layout *layout,
+	u8 *l1, nnc_ivfc_bad_block_func bad, void *udata)
+{
+	u8 *master = malloc(ivfc->l0_size);
+	result ret;
+	if(!master) return NNC_R_NOMEM;
+	if((ret = read_at_exact(rs, 0x60, master, ivfc->l0_size)) == NNC_R_OK
+			&& (ret = read_at_exact(rs, layout->offset[0], l1, layout->aligned[0])) == NNC_R_OK)
+		ret = nnc_ivfc_check_level(l1, layout->nblocks[0], 1 << ivfc->level[0].block_size_log2,
+			master, layout->offset[0], bad, udata);
+	free(master);
+	return ret;
+}
+
+static result nnc_ivfc_reader_bad_l1(void *udata, u64 offset, u32 block)
+{
+	(void) block;
+	((nnc_ivfc_reader *) udata)->bad_offset = offset;
+	return NNC_R_BAD_HASH;
+}
+
+nnc_result nnc_open_ivfc_reader(nnc_ivfc_reader *self, nnc_rstream *child)
+{
+	struct nnc_ivfc_romfs_layout layout;
+	nnc_ivfc *ivfc = &self->ivfc;
+	result ret;
+	self->funcs = &nnc_ivfc_rfuncs;
+	self->child = child;
+	self->l1 = self->l2 = self->l2_verified = self->l3_verified = self->block = NULL;
+	self->size = NNC_RS_PCALL0(child, size);
+	self->pos = 0;
+	self->bad_offset = 0;
+
+	TRY(nnc_read_ivfc_header(child, ivfc, NNC_IVFC_LEVELS_ROMFS));
+	TRY(nnc_ivfc_romfs_layout(ivfc, self->size, &layout));
+	memcpy(self->level_offset, layout.offset, sizeof(layout.offset));
+
+	self->l1 = malloc(layout.aligned[0]);
+	self->l2 = malloc(layout.aligned[1]);
+	self->l2_verified = calloc(1, (layout.nblocks[1] + 7) / 8);
+	self->l3_verified = calloc(1, (layout.nblocks[2] + 7) / 8);
+	self->block = malloc((u64) 1 << ivfc->level[2].block_size_log2);
+	if(!self->l1 || !self->l2 || !self->l2_verified || !self->l3_verified || !self->block)
+		ret = NNC_R_NOMEM;
+	else
+		ret = nnc_ivfc_read_l1(child, ivfc, &layout, self->l1, nnc_ivfc_reader_bad_l1, self);
+	if(ret != NNC_R_OK)
+		nnc_ivfc_rclose(self);
+	return ret;
+}
+
+/* Verifying everything: levels 1 and 2 are small and checked on the calling
+ * thread, level 3 is split in a range per thread. The threads share the
+ * stream so reading takes turns, but each reads big chunks at its own
+ * position and hashes them without holding the lock. */
+#define IVFC_VERIFY_CHUNK (1024 * 1024)
+
+struct nnc_ivfc_verify_job {
+	nnc_rstream *rs;
+	const u8 *l2;
+	u8 *bad; /* bitmap of bad level 3 blocks, ranges are a multiple of 8 blocks so they don't share bytes */
+	u64 l3_offset;
+	u32 block_size_log2, chunk_blocks;
+	u64 nblocks, range_blocks;
+	u32 nranges, next_range;
+	nnc_mutex lock; /* protects rs, next_range and ret */
+	result ret;
+};
+
+static result nnc_ivfc_verify_range(struct nnc_ivfc_verify_job *job, u32 range, u8 *buf)
+{
+	u32 bs = 1 << job->block_size_log2;
+	u64 block = range * job->range_blocks, end = MIN(job->nblocks, block + job->range_blocks);
+	nnc_sha256_hash digest;
+	result ret = NNC_R_OK;
+	while(block < end && ret == NNC_R_OK)
+	{
+		u32 now = MIN(end - block, job->chunk_blocks);
+		mutex_lock(&job->lock);
+		ret = job->ret == NNC_R_OK ? read_at_exact(job->rs, job->l3_offset + (block << job->block_size_log2),
+			buf, now << job->block_size_log2) : job->ret;
+		mutex_unlock(&job->lock);
+		for(u32 i = 0; i < now && ret == NNC_R_OK; ++i, ++block)
+			if((ret = nnc_crypto_sha256(buf + (u64) i * bs, digest, bs)) == NNC_R_OK
+					&& memcmp(digest, job->l2 + block * sizeof(nnc_sha256_hash), sizeof(digest)) != 0)
+				BIT_SET(job->bad, block);
+	}
+	return ret;
+}
+
+static void nnc_ivfc_verify_worker(void *arg)
+{
+	struct nnc_ivfc_verify_job *job = arg;
+	u8 *buf = malloc(job->chunk_blocks << job->block_size_log2);
+	result ret = buf ? NNC_R_OK : NNC_R_NOMEM;
+	u32 range;
+	while(ret == NNC_R_OK)
+	{
+		mutex_lock(&job->lock);
+		range = job->ret == NNC_R_OK && job->next_range < job->nranges ? job->next_range++ : UINT32_MAX;
+		mutex_unlock(&job->lock);
+		if(range == UINT32_MAX) break;
+		ret = nnc_ivfc_verify_range(job, range, buf);
+	}
+	free(buf);
+	if(ret != NNC_R_OK)
+	{
+		mutex_lock(&job->lock);
+		if(job->ret == NNC_R_OK) job->ret = ret;
+		mutex_unlock(&job->lock);
+	}
+}
+
+static result nnc_ivfc_report_bad(void *udata, u64 offset, u32 block)
+{
+	(void) offset;
+	return dynbuf_push(udata, (u8 *) &block, sizeof(block));
+}
+
+static result nnc_ivfc_verify_levels(nnc_rstream *rs, const nnc_ivfc *ivfc, const struct nnc_ivfc_romfs_layout *layout,
+	u32 threads, struct dynbuf bad[3])
+{
+	struct nnc_ivfc_verify_job job = { .rs = rs, .l2 = NULL, .bad = NULL, .l3_offset = layout->offset[2],
+		.block_size_log2 = ivfc->level[2].block_size_log2, .nblocks = layout->nblocks[2], .next_range = 0,
+		.ret = NNC_R_OK };
+	nnc_thread *workers = NULL;
+	u8 *l1 = malloc(layout->aligned[0]), *l2 = malloc(layout->aligned[1]);
+	u32 started = 0;
+	result ret;
+
+	if(!l1 || !l2 || !(job.bad = calloc(1, (job.nblocks + 7) / 8)))
+	{
+		ret = NNC_R_NOMEM;
+		goto out;
+	}
+	TRYLBL(nnc_ivfc_read_l1(rs, ivfc, layout, l1, nnc_ivfc_report_bad, &bad[0]), out);
+	TRYLBL(read_at_exact(rs, layout->offset[1], l2, layout->aligned[1]), out);
+	TRYLBL(nnc_ivfc_check_level(l2, layout->nblocks[1], 1 << ivfc->level[1].block_size_log2,
+		l1, layout->offset[1], nnc_ivfc_report_bad, &bad[1]), out);
+
+	/* a chunk is at least a block, ranges are whole chunks */
+	job.l2 = l2;
+	job.chunk_blocks = MAX(IVFC_VERIFY_CHUNK >> job.block_size_log2, 1);
+	if(threads == 0) threads = 1;
+	job.range_blocks = ALIGN((job.nblocks + threads - 1) / threads, (u64) MAX(job.chunk_blocks, 8));
+	job.nranges = (job.nblocks + job.range_blocks - 1) / job.range_blocks;
+	threads = MIN(threads, job.nranges);
+	TRYLBL(mutex_init(&job.lock), out);
+
+	/* the calling thread is one of the workers */
+	if(threads > 1 && (workers = malloc(sizeof(nnc_thread) * (threads - 1))))
+		for(; started < threads - 1; ++started)
+			if(thread_create(&workers[started], nnc_ivfc_verify_worker, &job) != NNC_R_OK)
+				break; /* the remaining ranges are picked up by the threads that did start */
+	nnc_ivfc_verify_worker(&job);
+	for(u32 i = 0; i < started; ++i)
+		thread_join(&workers[i]);
+	free(workers);
+	mutex_destroy(&job.lock);
+	ret = job.ret;
+
+	for(u64 i = 0; i < job.nblocks && ret == NNC_R_OK; ++i)
+		if(BIT_TEST(job.bad, i))
+			ret = nnc_ivfc_report_bad(&bad[2], 0, i);
+
+out:
+	free(l1);
+	free(l2);
+	free(job.bad);
+	return ret;
+}
+
+nnc_result nnc_ivfc_verify_all(nnc_rstream *rs, const nnc_ivfc *header, nnc_u32 threads, nnc_ivfc_verify_report *report)
+{
+	struct nnc_ivfc_romfs_layout layout;
+	struct dynbuf bad[3] = { { NULL, 0, 0 }, { NULL, 0, 0 }, { NULL, 0, 0 } };
+	result ret;
+	for(u32 i = 0; i < 3; ++i)
+	{
+		report->bad_blocks[i] = NULL;
+		report->bad_count[i] = 0;
+		report->blocks[i] = 0;
+	}
+
+	TRY(nnc_ivfc_romfs_layout(header, NNC_RS_PCALL0(rs, size), &layout));
+	for(u32 i = 0; i < 3; ++i)
+		TRYLBL(dynbuf_new(&bad[i], 16 * sizeof(u32)), out);
+	TRYLBL(nnc_ivfc_verify_levels(rs, header, &layout, threads, bad), out);
+
+	for(u32 i = 0; i < 3; ++i)
+	{
+		report->bad_blocks[i] = (u32 *) bad[i].buffer;
+		report->bad_count[i] = bad[i].used / sizeof(u32);
+		report->blocks[i] = layout.nblocks[i];
+		if(report->bad_count[i]) ret = NNC_R_BAD_HASH;
+		bad[i].buffer = NULL;
+	}
+out:
+	for(u32 i = 0; i < 3; ++i)
+		free(bad[i].buffer);
+	return ret;
+}
+
+void nnc_ivfc_free_report(nnc_ivfc_verify_report *report)
+{
+	for(u32 i = 0; i < 3; ++i)
+	{
+		free(report->bad_blocks[i]);
+		report->bad_blocks[i] = NULL;
+		report->bad_count[i] = 0;
+	}
+}
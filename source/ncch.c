@@ -327,6 +327,11 @@ void nnc_condense_ncch(nnc_condensed_ncch_header *cnd, nnc_ncch_header *hdr)
 	strncpy(cnd->maker_code, hdr->maker_code, sizeof(hdr->maker_code));
 }
 
+static result ncch_single_pass_write(void *udata, nnc_wstream *ws)
+{
+	return nnc_write_ncch_from_buildable((nnc_buildable_ncch *) udata, ws);
+}
+
 nnc_result nnc_write_ncch(
 	nnc_condensed_ncch_header *ncch_header,
 	nnc_u8 wflags,
@@ -344,15 +349,19 @@ nnc_result nnc_write_ncch(
 	nnc_header_saver hsaver;
 	u8 header[0x200], exheader_in_use = 0;
 
-	if(!ws->funcs->seek)
-		return NNC_R_INVAL;
-
 #define DO_VALIDATE_FOR(ptr, opt1, opt2) if( (!ptr && (wflags & (opt1 | opt2))) || (ptr && !(wflags & (opt1 | opt2))) || (wflags & (opt1 | opt2)) == (opt1 | opt2)) return NNC_R_INVAL
 	DO_VALIDATE_FOR(exheader, NNC_NCCH_WF_EXHEADER_BUILD, NNC_NCCH_WF_EXHEADER_STREAM);
 	DO_VALIDATE_FOR(romfs, NNC_NCCH_WF_ROMFS_VFS, NNC_NCCH_WF_ROMFS_STREAM);
 	DO_VALIDATE_FOR(exefs, NNC_NCCH_WF_EXEFS_VFS, NNC_NCCH_WF_EXEFS_STREAM);
 #undef DO_VALIDATE_FOR
 
+	/* the header is written last */
+	if(!ws->funcs->seek)
+	{
+		nnc_buildable_ncch bncch = { *ncch_header, exheader, logo, plain, exefs, romfs, wflags };
+		return write_single_pass(ncch_single_pass_write, &bncch, ws);
+	}
+
 	memset(&exheader_hash, 0x00, sizeof(exheader_hash));
 	memset(&logo_hash, 0x00, sizeof(logo_hash));
 	memset(&exefs_super_hash, 0x00, sizeof(exefs_super_hash));
@@ -459,11 +468,13 @@ nnc_result nnc_write_ncch(
 	TRY(NNC_WS_PCALL(ws, seek, header_off));
 
 	/* convert everything to media units... */
-	/* not before normalizing offsets to be inside the ncch of course */
-	logo_off   = NNC_BYTE_TO_MU(logo_off - header_off);
-	plain_off  = NNC_BYTE_TO_MU(plain_off - header_off);
-	exefs_off  = NNC_BYTE_TO_MU(exefs_off - header_off);
-	romfs_off  = NNC_BYTE_TO_MU(romfs_off - header_off);
+	/* not before normalizing offsets to be inside the ncch of course, absent sections stay at 0 */
+#define NORMALIZE(off) ((off) ? NNC_BYTE_TO_MU((off) - header_off) : 0)
+	logo_off   = NORMALIZE(logo_off);
+	plain_off  = NORMALIZE(plain_off);
+	exefs_off  = NORMALIZE(exefs_off);
+	romfs_off  = NORMALIZE(romfs_off);
+#undef NORMALIZE
 	logo_size  = NNC_BYTE_TO_MU(logo_size);
 	plain_size = NNC_BYTE_TO_MU(plain_size);
 	exefs_size = NNC_BYTE_TO_MU(exefs_size);
@@ -475,7 +486,7 @@ nnc_result nnc_write_ncch(
 
 	/* 0x000 */ memset(&header[0x000], 0x00, 0x100);
 	/* 0x100 */ memcpy(&header[0x100], "NCCH", 4);
-	/* 0x104 */ U32P(&header[0x104]) = LE32(romfs_off + romfs_size); /* content size */
+	/* 0x104 */ U32P(&header[0x104]) = LE32(NNC_BYTE_TO_MU(end_off - header_off)); /* content size, also right without a RomFS */
 	/* 0x108 */ U64P(&header[0x108]) = LE64(ncch_header->partition_id);
 	/* 0x110 */ memcpy(&header[0x110], ncch_header->maker_code, 2);
 	/* 0x112 */ U16P(&header[0x112]) = LE16(2);
@@ -224,15 +224,522 @@ static void fill_info_dir(nnc_romfs_ctx *ctx, nnc_romfs_info *info, u32 offset)
 	info->filename = DIR_NAME(dir);
 }
 
-nnc_result nnc_get_info(nnc_romfs_ctx *ctx, nnc_romfs_info *info, const char *path)
+
+/* the index maps full UTF-8 paths without a leading slash ("" for the root,
+ * "dir/file" for the rest) to meta offsets in an open addressing hash table,
+ * the paths are stored back to back in a single buffer, each followed by a NUL */
+struct romfs_index_slot {
+	u32 hash;
+	u32 path;     /* offset in paths */
+	u32 path_len;
+	u32 meta;     /* INVAL for an unused slot */
+	u32 type;     /* NNC_ROMFS_FILE or NNC_ROMFS_DIR */
+};
+
+struct nnc_romfs_index {
+	struct romfs_index_slot *slots;
+	u32 mask;
+	char *paths;
+};
+
+/* only used while building the index or a listing, either may be NULL */
+struct romfs_index_builder {
+	nnc_romfs_ctx *ctx;
+	struct nnc_romfs_index *index;
+	nnc_romfs_listing *list;
+	char *paths;
+	u32 paths_used, paths_alloc;
+	struct romfs_index_dir {
+		u32 offset;
+		u32 parent;         /* offset at first, index in dirs once all are known */
+		u32 path, path_len; /* path is INVAL until resolved */
+	} *dirs;
+	u32 ndirs;
+	u32 *chain;
+	nnc_utf_conversion_buffer cbuf;
+};
+
+static u32 index_hash(const char *path, u32 len)
+{
+	/* FNV-1a */
+	u32 ret = 2166136261U;
+	for(u32 i = 0; i < len; ++i)
+	{
+		ret ^= (u8) path[i];
+		ret *= 16777619U;
+	}
+	return ret;
+}
+
+/* meta entries are variable sized, returns the offset of the next one or INVAL if it's out of bounds */
+static u32 next_meta_entry(const u8 *meta, u32 meta_len, u32 offset, u32 name_off, u32 namelen_off)
+{
+	if(meta_len - offset < name_off)
+		return INVAL;
+	u32 namelen = LE32P(&meta[offset + namelen_off]);
+	if(namelen > meta_len - offset - name_off)
+		return INVAL;
+	return offset + name_off + ALIGN(namelen, 4);
+}
+
+static result index_count_entries(const u8 *meta, u32 meta_len, u32 name_off, u32 namelen_off, u32 *count)
+{
+	u32 offset = 0;
+	*count = 0;
+	while(offset < meta_len)
+	{
+		if((offset = next_meta_entry(meta, meta_len, offset, name_off, namelen_off)) == INVAL)
+			return NNC_R_CORRUPT;
+		++*count;
+	}
+	return NNC_R_OK;
+}
+
+/* dirs is sorted by offset since the table is scanned in order */
+static u32 index_find_dir(struct romfs_index_builder *b, u32 offset)
+{
+	u32 lo = 0, hi = b->ndirs;
+	while(lo < hi)
+	{
+		u32 mid = lo + (hi - lo) / 2;
+		if(b->dirs[mid].offset == offset) return mid;
+		if(b->dirs[mid].offset < offset) lo = mid + 1;
+		else                             hi = mid;
+	}
+	return INVAL;
+}
+
+/* appends the path of a directory + '/' + name, the parent path is
+ * passed as an offset since the buffer may move */
+static result index_push_path(struct romfs_index_builder *b, struct romfs_index_dir *parent,
+	const u16 *name, u32 namelen, u32 *path, u32 *path_len)
+{
+	u32 parent_path = parent->path, parent_len = parent->path_len;
+	u8 *utf8 = nnc_cbuf_utf16_to_utf8(&b->cbuf, name, namelen / sizeof(u16));
+	if(!utf8) return NNC_R_NOMEM;
+	u32 len = b->cbuf.converted_length;
+	u64 total = (u64) parent_len + (parent_len ? 1 : 0) + len;
+	if(b->paths_used + total + 1 > UINT32_MAX)
+		return NNC_R_TOO_LARGE;
+	if(b->paths_used + total + 1 > b->paths_alloc)
+	{
+		u64 nalloc = b->paths_alloc;
+		while(nalloc < b->paths_used + total + 1)
+			nalloc *= 2;
+		if(nalloc > UINT32_MAX) nalloc = UINT32_MAX;
+		char *npaths = realloc(b->paths, nalloc);
+		if(!npaths) return NNC_R_NOMEM;
+		b->paths = npaths;
+		b->paths_alloc = nalloc;
+	}
+	char *out = b->paths + b->paths_used;
+	if(parent_len)
+	{
+		memcpy(out, b->paths + parent_path, parent_len);
+		out[parent_len] = '/';
+		out += parent_len + 1;
+	}
+	memcpy(out, utf8, len);
+	out[len] = '\0';
+	*path = b->paths_used;
+	*path_len = total;
+	b->paths_used += total + 1;
+	return NNC_R_OK;
+}
+
+static void index_insert(struct nnc_romfs_index *index, const char *paths, u32 path, u32 path_len, u32 meta, u32 type)
+{
+	u32 hash = index_hash(paths + path, path_len);
+	u32 i = hash & index->mask;
+	while(index->slots[i].meta != INVAL)
+		i = (i + 1) & index->mask;
+	index->slots[i].hash = hash;
+	index->slots[i].path = path;
+	index->slots[i].path_len = path_len;
+	index->slots[i].meta = meta;
+	index->slots[i].type = type;
+}
+
+/* the parents of a directory must be resolved first, they usually come before
+ * it in the table but that isn't required. The chain is walked up without
+ * recursion since the tree may be deep */
+static result index_resolve_dir(struct romfs_index_builder *b, u32 i)
+{
+	u32 depth = 0;
+	result ret;
+	while(b->dirs[i].path == INVAL)
+	{
+		/* more parents than directories means they form a loop */
+		if(depth == b->ndirs)
+			return NNC_R_CORRUPT;
+		b->chain[depth++] = i;
+		i = b->dirs[i].parent;
+	}
+	while(depth--)
+	{
+		struct romfs_index_dir *dir = &b->dirs[b->chain[depth]];
+		u8 *meta = DIR_META(b->ctx, dir->offset);
+		TRY(index_push_path(b, &b->dirs[dir->parent], DIR_NAME(meta), DIR_NAMELEN(meta),
+			&dir->path, &dir->path_len));
+		if(b->index)
+			index_insert(b->index, b->paths, dir->path, dir->path_len, dir->offset, NNC_ROMFS_DIR);
+	}
+	return NNC_R_OK;
+}
+
+static result index_build(struct romfs_index_builder *b, u32 nfiles)
+{
+	nnc_romfs_ctx *ctx = b->ctx;
+	u32 dir_len = ctx->header.dir_meta.length, file_len = ctx->header.file_meta.length;
+	u32 offset, i, parent, path, path_len;
+	result ret;
+
+	/* the root directory is at offset 0 with an empty name */
+	if(b->ndirs == 0 || DIR_NAMELEN(DIR_META(ctx, 0)) != 0)
+		return NNC_R_CORRUPT;
+	for(offset = 0, i = 0; offset < dir_len; ++i)
+	{
+		b->dirs[i].offset = offset;
+		b->dirs[i].parent = DIR_PARENT(DIR_META(ctx, offset));
+		b->dirs[i].path = INVAL;
+		offset = next_meta_entry(ctx->dir_meta_data, dir_len, offset, DIR_OFF_NAME, DIR_OFF_NAMELEN);
+	}
+	for(i = 0; i < b->ndirs; ++i)
+		if((b->dirs[i].parent = index_find_dir(b, b->dirs[i].parent)) == INVAL)
+			return NNC_R_CORRUPT;
+
+	/* the empty path of the root is the NUL the buffer starts with */
+	b->dirs[0].path = 0;
+	b->dirs[0].path_len = 0;
+	if(b->index)
+		index_insert(b->index, b->paths, 0, 0, 0, NNC_ROMFS_DIR);
+	for(i = 1; i < b->ndirs; ++i)
+		TRY(index_resolve_dir(b, i));
+	if(b->list)
+		for(i = 0; i < b->ndirs; ++i)
+		{
+			b->list->dir_paths[i] = b->dirs[i].path;
+			b->list->dir_parents[i] = b->dirs[i].parent;
+		}
+
+	for(offset = 0, i = 0; i < nfiles; ++i)
+	{
+		u8 *file = FILE_META(ctx, offset);
+		if((parent = index_find_dir(b, FILE_PARENT(file))) == INVAL)
+			return NNC_R_CORRUPT;
+		TRY(index_push_path(b, &b->dirs[parent], FILE_NAME(file), FILE_NAMELEN(file), &path, &path_len));
+		if(b->index)
+			index_insert(b->index, b->paths, path, path_len, offset, NNC_ROMFS_FILE);
+		if(b->list)
+		{
+			b->list->file_paths[i] = path;
+			b->list->file_offsets[i] = FILE_OFFSET(file);
+			b->list->file_sizes[i] = FILE_SIZE(file);
+			b->list->file_parents[i] = parent;
+		}
+		offset = next_meta_entry(ctx->file_meta_data, file_len, offset, FILE_OFF_NAME, FILE_OFF_NAMELEN);
+	}
+	return NNC_R_OK;
+}
+
+static result index_builder_init(struct romfs_index_builder *b, nnc_romfs_ctx *ctx, u32 *nfiles)
+{
+	result ret;
+	TRY(index_count_entries(ctx->dir_meta_data, ctx->header.dir_meta.length, DIR_OFF_NAME, DIR_OFF_NAMELEN, &b->ndirs));
+	TRY(index_count_entries(ctx->file_meta_data, ctx->header.file_meta.length, FILE_OFF_NAME, FILE_OFF_NAMELEN, nfiles));
+	b->ctx = ctx;
+	b->index = NULL;
+	b->list = NULL;
+	b->paths_used = 1;
+	b->paths_alloc = 4096;
+	b->dirs = malloc(b->ndirs * sizeof(struct romfs_index_dir) + 1);
+	b->chain = malloc(b->ndirs * sizeof(u32) + 1);
+	b->paths = malloc(b->paths_alloc);
+	if(!b->dirs || !b->chain || !b->paths || nnc_cbuf_init(&b->cbuf, 0) != NNC_R_OK)
+	{
+		free(b->dirs);
+		free(b->chain);
+		free(b->paths);
+		return NNC_R_NOMEM;
+	}
+	b->paths[0] = '\0';
+	return NNC_R_OK;
+}
+
+/* the paths are left alone, they're handed out on success */
+static void index_builder_free(struct romfs_index_builder *b)
+{
+	free(b->dirs);
+	free(b->chain);
+	nnc_cbuf_free(&b->cbuf);
+}
+
+static void index_free(struct nnc_romfs_index *index)
+{
+	if(!index) return;
+	free(index->slots);
+	free(index->paths);
+	free(index);
+}
+
+result nnc_romfs_build_index(nnc_romfs_ctx *ctx)
+{
+	struct romfs_index_builder b;
+	struct nnc_romfs_index *index;
+	u32 nfiles, slots;
+	result ret;
+
+	if(ctx->index) return NNC_R_OK;
+	TRY(index_builder_init(&b, ctx, &nfiles));
+	/* keep the load factor at or below one half */
+	for(slots = 16; slots < ((u64) b.ndirs + nfiles) * 2; slots *= 2)
+		;
+
+	ret = NNC_R_NOMEM;
+	if(!(index = malloc(sizeof(struct nnc_romfs_index))))
+		goto out;
+	index->mask = slots - 1;
+	index->paths = NULL;
+	if(!(index->slots = malloc(slots * sizeof(struct romfs_index_slot))))
+		goto out;
+	for(u32 i = 0; i < slots; ++i)
+		index->slots[i].meta = INVAL;
+
+	b.index = index;
+	ret = index_build(&b, nfiles);
+
+out:
+	index_builder_free(&b);
+	if(ret == NNC_R_OK)
+	{
+		index->paths = b.paths;
+		ctx->index = index;
+	}
+	else
+	{
+		index_free(index);
+		free(b.paths);
+	}
+	return ret;
+}
+
+result nnc_romfs_list_all(nnc_romfs_ctx *ctx, nnc_romfs_listing *list)
+{
+	struct romfs_index_builder b;
+	u32 nfiles;
+	result ret;
+
+	list->strings = NULL;
+	list->file_paths = list->file_parents = list->dir_paths = list->dir_parents = NULL;
+	list->file_offsets = list->file_sizes = NULL;
+	list->file_count = list->dir_count = 0;
+	TRY(index_builder_init(&b, ctx, &nfiles));
+	list->file_paths = malloc(nfiles * sizeof(u32) + 1);
+	list->file_parents = malloc(nfiles * sizeof(u32) + 1);
+	list->file_offsets = malloc(nfiles * sizeof(u64) + 1);
+	list->file_sizes = malloc(nfiles * sizeof(u64) + 1);
+	list->dir_paths = malloc(b.ndirs * sizeof(u32) + 1);
+	list->dir_parents = malloc(b.ndirs * sizeof(u32) + 1);
+	if(!list->file_paths || !list->file_parents || !list->file_offsets
+			|| !list->file_sizes || !list->dir_paths || !list->dir_parents)
+		ret = NNC_R_NOMEM;
+	else
+	{
+		b.list = list;
+		ret = index_build(&b, nfiles);
+	}
+	index_builder_free(&b);
+	list->strings = b.paths;
+	if(ret != NNC_R_OK)
+	{
+		nnc_romfs_free_listing(list);
+		return ret;
+	}
+	list->file_count = nfiles;
+	list->dir_count = b.ndirs;
+	return NNC_R_OK;
+}
+
+void nnc_romfs_free_listing(nnc_romfs_listing *list)
+{
+	free(list->strings);
+	free(list->file_paths);
+	free(list->file_parents);
+	free(list->file_offsets);
+	free(list->file_sizes);
+	free(list->dir_paths);
+	free(list->dir_parents);
+	list->strings = NULL;
+	list->file_paths = list->file_parents = list->dir_paths = list->dir_parents = NULL;
+	list->file_offsets = list->file_sizes = NULL;
+	list->file_count = list->dir_count = 0;
+}
+
+/* skips one UTF-8 sequence, the arena only holds what the converter produced
+ * so it doesn't have to deal with bad encodings besides not overrunning the NUL */
+static const char *glob_next_char(const char *str)
+{
+	++str;
+	while(((u8) *str & 0xC0) == 0x80)
+		++str;
+	return str;
+}
+
+/* iterative matching with one backtracking point for each kind of star: when
+ * a '*' would have to match a slash only the last '**' can take over. A '**'
+ * that is a whole path component only takes whole directories, including none
+ * at all. `component' tells if pat starts a path component. */
+static bool glob_match(const char *pat, const char *str, bool component)
+{
+	const char *star = NULL, *star_str = NULL, *dstar = NULL, *dstar_str = NULL, *begin = pat;
+	bool dstar_dirs = false;
+	for(;;)
+	{
+		if(pat[0] == '*' && pat[1] == '*')
+		{
+			bool starts_component = pat == begin ? component : pat[-1] == '/';
+			while(*pat == '*') ++pat;
+			dstar_dirs = starts_component && *pat == '/';
+			if(dstar_dirs) ++pat;
+			dstar = pat;
+			dstar_str = str;
+			star = NULL;
+			continue;
+		}
+		if(*pat == '*')
+		{
+			star = ++pat;
+			star_str = str;
+			continue;
+		}
+		if(*str == '\0')
+		{
+			if(*pat == '\0')
+				return true;
+		}
+		else if(*pat == '?' ? *str != '/' : *pat == *str)
+		{
+			str = *pat == '?' ? glob_next_char(str) : str + 1;
+			++pat;
+			continue;
+		}
+		/* mismatch, let the last star eat one more character */
+		if(star && *star_str != '\0' && *star_str != '/')
+		{
+			pat = star;
+			str = star_str = glob_next_char(star_str);
+			continue;
+		}
+		if(dstar && *dstar_str != '\0')
+		{
+			star = NULL;
+			pat = dstar;
+			if(dstar_dirs)
+			{
+				/* skip to the next directory */
+				if(!(dstar_str = strchr(dstar_str, '/')))
+					return false;
+				str = ++dstar_str;
+			}
+			else
+				str = dstar_str = glob_next_char(dstar_str);
+			continue;
+		}
+		return false;
+	}
+}
+
+u32 nnc_romfs_list_glob(const nnc_romfs_listing *list, const char *pattern, u32 *matches)
+{
+	u32 count = 0, lit = 0;
+	while(*pattern == '/') ++pattern;
+	/* the part before the first wildcard is compared directly, most patterns are
+	 * rooted at a directory so most paths are rejected with a memcmp() */
+	while(pattern[lit] && pattern[lit] != '*' && pattern[lit] != '?')
+		++lit;
+	for(u32 i = 0; i < list->file_count; ++i)
+	{
+		const char *path = list->strings + list->file_paths[i];
+		if(strncmp(path, pattern, lit) == 0 && glob_match(pattern + lit, path + lit, lit == 0 || pattern[lit - 1] == '/'))
+			matches[count++] = i;
+	}
+	return count;
+}
+
+u32 nnc_romfs_list_prefix(const nnc_romfs_listing *list, const char *prefix, u32 *matches)
+{
+	u32 count = 0;
+	while(*prefix == '/') ++prefix;
+	size_t len = strlen(prefix);
+	for(u32 i = 0; i < list->file_count; ++i)
+		if(strncmp(list->strings + list->file_paths[i], prefix, len) == 0)
+			matches[count++] = i;
+	return count;
+}
+
+/* same rules as the walk: slashes are collapsed and a trailing one means only
+ * directories match, otherwise a file is preferred over a directory */
+static result index_get_info(nnc_romfs_ctx *ctx, nnc_romfs_info *info, const char *path)
 {
-	if(!nnc_cbuf_utf8_to_utf16(&ctx->cbuf, (u8 *) path, strlen(path)))
+	struct nnc_romfs_index *index = ctx->index;
+	char stackbuf[512], *norm = stackbuf;
+	u32 len = 0, dir_meta = INVAL;
+	bool dir_only = false, found = false;
+	size_t inlen = strlen(path);
+	if(inlen >= UINT32_MAX)
 		return NNC_R_NOT_FOUND;
+	if(inlen >= sizeof(stackbuf) && !(norm = malloc(inlen + 1)))
+		return NNC_R_NOMEM;
+
+	while(*path)
+	{
+		if(*path != '/')
+		{
+			norm[len++] = *path++;
+			continue;
+		}
+		while(*path == '/') ++path;
+		if(*path == '\0') dir_only = true;
+		else if(len) norm[len++] = '/';
+	}
+	/* both "" and "/" refer to the root */
+	if(len == 0) dir_only = true;
+
+	u32 hash = index_hash(norm, len);
+	for(u32 i = hash & index->mask; index->slots[i].meta != INVAL; i = (i + 1) & index->mask)
+	{
+		struct romfs_index_slot *slot = &index->slots[i];
+		if(slot->hash != hash || slot->path_len != len || memcmp(index->paths + slot->path, norm, len) != 0)
+			continue;
+		if(slot->type == NNC_ROMFS_DIR)
+			dir_meta = slot->meta;
+		else if(!dir_only)
+		{
+			fill_info_file(ctx, info, slot->meta);
+			found = true;
+			break;
+		}
+	}
+	if(norm != stackbuf)
+		free(norm);
+	if(!found && dir_meta != INVAL)
+	{
+		fill_info_dir(ctx, info, dir_meta);
+		found = true;
+	}
+	if(found)
+		return NNC_R_OK;
+	info->type = NNC_ROMFS_NONE;
+	return NNC_R_NOT_FOUND;
+}
+
+static result walk_get_info(nnc_romfs_ctx *ctx, nnc_romfs_info *info, const u16 *path, u32 len)
+{
 	const u16 *last_part;
 	u32 last_part_len, rof;
 	int dir_hint;
-	u32 parent_off = get_offset_until_semilast_part(ctx, ctx->cbuf.buffer.utf16, ctx->cbuf.converted_length, &last_part, &last_part_len, &dir_hint);
-	if(parent_off == INVAL) return NNC_R_NOT_FOUND;
+	u32 parent_off = get_offset_until_semilast_part(ctx, path, len, &last_part, &last_part_len, &dir_hint);
+	if(parent_off == INVAL) goto not_found;
 	/* means the root directory was requested */
 	if(last_part == NULL)
 	{
@@ -261,10 +768,40 @@ do_fill_dir:
 		return NNC_R_OK;
 	}
 
+not_found:
 	info->type = NNC_ROMFS_NONE;
 	return NNC_R_NOT_FOUND;
 }
 
+/* most paths fit on the stack, converting on the stack instead
+ * of in ctx->cbuf makes lookups safe to do from multiple threads */
+#define GET_INFO_STACK_LEN 256
+
+nnc_result nnc_get_info(nnc_romfs_ctx *ctx, nnc_romfs_info *info, const char *path)
+{
+	if(ctx->index)
+		return index_get_info(ctx, info, path);
+
+	u16 stackbuf[GET_INFO_STACK_LEN], *utf16 = stackbuf;
+	size_t inlen = strlen(path);
+	size_t len = nnc_utf8_to_utf16(stackbuf, GET_INFO_STACK_LEN, (const u8 *) path, inlen);
+	result ret;
+	if(len >= UINT32_MAX)
+		return NNC_R_NOT_FOUND;
+	/* the conversion only writes the whole string if there is space left for the terminator */
+	if(len >= GET_INFO_STACK_LEN)
+	{
+		if(!(utf16 = malloc((len + 1) * sizeof(u16))))
+			return NNC_R_NOMEM;
+		nnc_utf8_to_utf16(utf16, len + 1, (const u8 *) path, inlen);
+	}
+	utf16[len] = '\0';
+	ret = walk_get_info(ctx, info, utf16, len);
+	if(utf16 != stackbuf)
+		free(utf16);
+	return ret;
+}
+
 const char *nnc_romfs_info_filename(nnc_romfs_ctx *ctx, nnc_romfs_info *info)
 {
 	return (const char *) nnc_cbuf_utf16_to_utf8(&ctx->cbuf, info->filename, info->filename_length);
@@ -361,6 +898,224 @@ result nnc_romfs_to_vfs(nnc_romfs_ctx *ctx, nnc_vfs_directory_node *dir)
 	return nnc_romfs_to_vfs_iterate(ctx, &info, dir);
 }
 
+/* files are extracted in the order their data is in, so the input is read
+ * sequentially instead of jumping around the image for every file */
+#define EXTRACT_CHUNK_SIZE (1024 * 1024)
+
+struct extract_file {
+	u64 offset, size;
+	u32 path; /* offset in extract_job.paths */
+};
+
+struct extract_job {
+	nnc_romfs_ctx *ctx;
+	struct extract_file *files;
+	u32 nfiles, files_alloc;
+	char *paths;
+	u32 paths_used, paths_alloc;
+	/* the files of range i are [range_start[i], range_start[i + 1]) */
+	u32 *range_start;
+	u32 nranges, next_range;
+	nnc_mutex lock; /* protects ctx->rs, next_range and ret */
+	result ret;
+};
+
+static result extract_push_path(struct extract_job *job, const char *path, u32 *offset)
+{
+	u32 len = strlen(path) + 1;
+	if(job->paths_used + len > job->paths_alloc)
+	{
+		u32 nalloc = job->paths_alloc ? job->paths_alloc : 4096;
+		while(nalloc < job->paths_used + len)
+			nalloc *= 2;
+		char *npaths = realloc(job->paths, nalloc);
+		if(!npaths) return NNC_R_NOMEM;
+		job->paths = npaths;
+		job->paths_alloc = nalloc;
+	}
+	memcpy(job->paths + job->paths_used, path, len);
+	*offset = job->paths_used;
+	job->paths_used += len;
+	return NNC_R_OK;
+}
+
+/* names come from the image, they mustn't lead out of the directory we extract to */
+static bool extract_name_ok(const char *name)
+{
+	if(!name[0] || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+		return false;
+	/* separators of any platform and drive prefixes */
+	return !strpbrk(name, "/\\:");
+}
+
+/* creates the directories right away and saves the files for later */
+static result extract_collect(struct extract_job *job, nnc_romfs_info *dir, char **pathbuf, u32 *pathbuf_len, u32 base)
+{
+	nnc_romfs_iterator it = nnc_romfs_mkit(job->ctx, dir);
+	nnc_romfs_info ent;
+	result ret;
+	while(nnc_romfs_next(&it, &ent))
+	{
+		const char *name = nnc_romfs_info_filename(job->ctx, &ent);
+		if(!name) return NNC_R_NOMEM;
+		if(!extract_name_ok(name)) return NNC_R_CORRUPT;
+		u32 namelen = strlen(name);
+		if(base + namelen + 2 > *pathbuf_len)
+		{
+			u32 nlen = (base + namelen + 2) * 2;
+			char *nbuf = realloc(*pathbuf, nlen);
+			if(!nbuf) return NNC_R_NOMEM;
+			*pathbuf = nbuf;
+			*pathbuf_len = nlen;
+		}
+		memcpy(*pathbuf + base, name, namelen + 1);
+		if(ent.type == NNC_ROMFS_DIR)
+		{
+			TRY(make_directory(*pathbuf));
+			(*pathbuf)[base + namelen] = '/';
+			TRY(extract_collect(job, &ent, pathbuf, pathbuf_len, base + namelen + 1));
+			continue;
+		}
+		if(job->nfiles == job->files_alloc)
+		{
+			u32 nalloc = job->files_alloc ? job->files_alloc * 2 : 64;
+			struct extract_file *nfiles = realloc(job->files, nalloc * sizeof(struct extract_file));
+			if(!nfiles) return NNC_R_NOMEM;
+			job->files = nfiles;
+			job->files_alloc = nalloc;
+		}
+		struct extract_file *file = &job->files[job->nfiles];
+		file->offset = ent.u.f.offset;
+		file->size = ent.u.f.size;
+		TRY(extract_push_path(job, *pathbuf, &file->path));
+		++job->nfiles;
+	}
+	return NNC_R_OK;
+}
+
+static int extract_file_cmp(const void *a, const void *b)
+{
+	u64 oa = ((const struct extract_file *) a)->offset;
+	u64 ob = ((const struct extract_file *) b)->offset;
+	return (oa > ob) - (oa < ob);
+}
+
+/* splits the sorted files in ranges of about the same amount of data */
+static result extract_split(struct extract_job *job, u32 ranges)
+{
+	u64 total = 0, done = 0;
+	u32 i, r = 1;
+	if(!(job->range_start = malloc((ranges + 1) * sizeof(u32))))
+		return NNC_R_NOMEM;
+	for(i = 0; i < job->nfiles; ++i)
+		total += job->files[i].size;
+	job->range_start[0] = 0;
+	for(i = 0; i < job->nfiles && r < ranges; ++i)
+	{
+		done += job->files[i].size;
+		if(done >= total / ranges * r)
+			job->range_start[r++] = i + 1;
+	}
+	/* leftover ranges are empty */
+	while(r <= ranges)
+		job->range_start[r++] = job->nfiles;
+	job->nranges = ranges;
+	return NNC_R_OK;
+}
+
+static result extract_one(struct extract_job *job, struct extract_file *file, u8 *buf)
+{
+	u64 pos = job->ctx->header.data_offset + file->offset, left = file->size;
+	u32 now;
+	nnc_wfile out;
+	result ret;
+	TRY(nnc_wfile_open(&out, job->paths + file->path));
+	while(left)
+	{
+		now = MIN(left, EXTRACT_CHUNK_SIZE);
+		mutex_lock(&job->lock);
+		ret = job->ret == NNC_R_OK ? read_at_exact(job->ctx->rs, pos, buf, now) : job->ret;
+		mutex_unlock(&job->lock);
+		if(ret != NNC_R_OK) break;
+		if((ret = NNC_WS_CALL(out, write, buf, now)) != NNC_R_OK) break;
+		pos += now;
+		left -= now;
+	}
+	NNC_WS_CALL0(out, close);
+	return ret;
+}
+
+static void extract_worker(void *arg)
+{
+	struct extract_job *job = arg;
+	u8 *buf = malloc(EXTRACT_CHUNK_SIZE);
+	result ret = buf ? NNC_R_OK : NNC_R_NOMEM;
+	u32 range;
+	while(ret == NNC_R_OK)
+	{
+		mutex_lock(&job->lock);
+		range = job->ret == NNC_R_OK && job->next_range < job->nranges ? job->next_range++ : INVAL;
+		mutex_unlock(&job->lock);
+		if(range == INVAL) break;
+		for(u32 i = job->range_start[range]; i < job->range_start[range + 1] && ret == NNC_R_OK; ++i)
+			ret = extract_one(job, &job->files[i], buf);
+	}
+	free(buf);
+	if(ret != NNC_R_OK)
+	{
+		mutex_lock(&job->lock);
+		if(job->ret == NNC_R_OK) job->ret = ret;
+		mutex_unlock(&job->lock);
+	}
+}
+
+result nnc_romfs_extract_all(nnc_romfs_ctx *ctx, const char *dest_dir, u32 threads)
+{
+	struct extract_job job = { .ctx = ctx, .files = NULL, .nfiles = 0, .files_alloc = 0,
+		.paths = NULL, .paths_used = 0, .paths_alloc = 0, .range_start = NULL,
+		.nranges = 0, .next_range = 0, .ret = NNC_R_OK };
+	u32 pathbuf_len = strlen(dest_dir) + 256, base;
+	char *pathbuf = malloc(pathbuf_len);
+	nnc_thread *workers = NULL;
+	nnc_romfs_info root;
+	u32 started = 0;
+	result ret;
+
+	if(!pathbuf) return NNC_R_NOMEM;
+	strcpy(pathbuf, dest_dir);
+	TRYLBL(make_directory(pathbuf), out);
+	base = strlen(pathbuf);
+	if(base == 0 || pathbuf[base - 1] != '/')
+		pathbuf[base++] = '/';
+	TRYLBL(nnc_get_info(ctx, &root, "/"), out);
+	TRYLBL(extract_collect(&job, &root, &pathbuf, &pathbuf_len, base), out);
+
+	qsort(job.files, job.nfiles, sizeof(struct extract_file), extract_file_cmp);
+	if(threads == 0) threads = 1;
+	threads = MIN(threads, job.nfiles);
+	TRYLBL(extract_split(&job, threads ? threads : 1), out);
+	TRYLBL(mutex_init(&job.lock), out);
+
+	/* the calling thread is one of the workers */
+	if(threads > 1 && (workers = malloc(sizeof(nnc_thread) * (threads - 1))))
+		for(; started < threads - 1; ++started)
+			if(thread_create(&workers[started], extract_worker, &job) != NNC_R_OK)
+				break; /* the remaining ranges are picked up by the threads that did start */
+	extract_worker(&job);
+	for(u32 i = 0; i < started; ++i)
+		thread_join(&workers[i]);
+	free(workers);
+	mutex_destroy(&job.lock);
+	ret = job.ret;
+
+out:
+	free(pathbuf);
+	free(job.files);
+	free(job.paths);
+	free(job.range_start);
+	return ret;
+}
+
 result nnc_init_romfs(nnc_rstream *rs, nnc_romfs_ctx *ctx)
 {
 	result ret;
@@ -368,6 +1123,7 @@ result nnc_init_romfs(nnc_rstream *rs, nnc_romfs_ctx *ctx)
 
 	ctx->file_meta_data = ctx->dir_meta_data = NULL;
 	ctx->file_hash_tab = ctx->dir_hash_tab = NULL;
+	ctx->index = NULL;
 
 	TRY(nnc_cbuf_init(&ctx->cbuf, 0));
 
@@ -404,6 +1160,8 @@ void nnc_free_romfs(nnc_romfs_ctx *ctx)
 	free(ctx->file_hash_tab);
 	free(ctx->dir_meta_data);
 	free(ctx->dir_hash_tab);
+	index_free(ctx->index);
+	ctx->index = NULL;
 	nnc_cbuf_free(&ctx->cbuf);
 }
 
@@ -442,12 +1200,14 @@ static u32 nnc_romfs_table_length(u32 entries)
 struct romfs_writer_ctx
 {
 	u32          *dir_hash, *file_hash;
+	u32          *dir_hash_tail, *file_hash_tail; /* last entry in the chain of every bucket */
 	struct dynbuf dir_meta,  file_meta;
 	nnc_utf_conversion_buffer cbuf;
 	u32 dir_hashtab_len;
 	u32 file_hashtab_len;
 	/* state */
-	u64 current_file_data_offset; /* incremented as we go */
+	const u64 *data_offsets; /* of every file in the order of nnc_romfs_collect_file_nodes() */
+	u32 file_index;          /* incremented as we go */
 };
 
 static result nnc_romfs_convert_to_utf16(struct romfs_writer_ctx *ctx, const char *utf8)
@@ -456,53 +1216,37 @@ static result nnc_romfs_convert_to_utf16(struct romfs_writer_ctx *ctx, const cha
 		? NNC_R_OK : NNC_R_NOMEM;
 }
 
-static inline void nnc_romfs_add_to_hash_to_offset_table(struct romfs_writer_ctx *ctx, u32 parent_offset, u32 offset, u32 *hash_table, u32 hashtablen, u8 *meta_table, u32 next_bucket_offset)
+static inline void nnc_romfs_add_to_hash_to_offset_table(struct romfs_writer_ctx *ctx, u32 parent_offset, u32 offset, u32 *hash_table, u32 *tails, u32 hashtablen, u8 *meta_table, u32 next_bucket_offset)
 {
 	u32 index = hash_func(ctx->cbuf.buffer.utf16, ctx->cbuf.converted_length, parent_offset) % hashtablen;
-	u32 initial_offset = hash_table[index];
-	if(initial_offset == INVAL)
+	/* new entries go at the back of the chain, with the tail known that's just one write */
+	if(hash_table[index] == INVAL)
 		hash_table[index] = offset;
 	else
-	{
-		u32 coffset, noffset = initial_offset;
-		/* we have to walk the linked list and insert our offset at the back */
-		do {
-			coffset = noffset;
-			noffset = LE32P(meta_table + coffset + next_bucket_offset);
-		} while(noffset != INVAL);
-		/* we can now write our offset in coffset's NEXTBUCKET field */
-		U32P(meta_table + coffset + next_bucket_offset) = LE32(offset);
-	}
+		U32P(meta_table + tails[index] + next_bucket_offset) = LE32(offset);
+	tails[index] = offset;
 }
 
-static inline void nnc_romfs_add_to_parent_directory(struct romfs_writer_ctx *ctx, u32 parent_offset, u32 offset, u8 *meta_table, u32 children_offset, u32 next_sibling_offset)
+/* prev is the previous child of the same type, which the caller keeps
+ * track of so the sibling list doesn't have to be walked */
+static inline void nnc_romfs_add_to_parent_directory(struct romfs_writer_ctx *ctx, u32 parent_offset, u32 prev, u32 offset, u8 *meta_table, u32 children_offset, u32 next_sibling_offset)
 {
-	/* dir meta is hardcoded since we should always add to the directory metadata obviously */
-	u32 parent_child_offset = LE32P(ctx->dir_meta.buffer + parent_offset + children_offset);
-	if(parent_child_offset == INVAL)
+	if(prev == INVAL)
+		/* dir meta is hardcoded since we should always add to the directory metadata obviously */
 		U32P(ctx->dir_meta.buffer + parent_offset + children_offset) = LE32(offset);
 	else
-	{
-		/* we need to put ourselves at the end of the siblings list of the first child */
-		u32 coffset, noffset = parent_child_offset;
-		do {
-			coffset = noffset;
-			/* however here we should use the meta table, since the sibling pointer
-			 * is stored in the appropriate meta table */
-			noffset = LE32P(meta_table + coffset + next_sibling_offset);
-		} while(noffset != INVAL);
-		U32P(meta_table + coffset + next_sibling_offset) = LE32(offset);
-	}
+		/* however the sibling pointer is stored in the appropriate meta table */
+		U32P(meta_table + prev + next_sibling_offset) = LE32(offset);
 }
 
-static result nnc_romfs_write_directory(struct romfs_writer_ctx *ctx, const char *vdirname, u32 parent_offset, u32 *new_parent_offset)
+static result nnc_romfs_write_directory(struct romfs_writer_ctx *ctx, const char *vdirname, u32 parent_offset, u32 prev_sibling, u32 *new_parent_offset)
 {
 	nnc_result ret = nnc_romfs_convert_to_utf16(ctx, vdirname ? vdirname : "");
 	if(ret != NNC_R_OK) return ret;
 	u32 actual_string_length = ctx->cbuf.converted_length * 2;
 
 	u32 meta_offset = ctx->dir_meta.used;
-	nnc_romfs_add_to_hash_to_offset_table(ctx, parent_offset, meta_offset, ctx->dir_hash, ctx->dir_hashtab_len, ctx->dir_meta.buffer, DIR_OFF_NEXTBUCKET);
+	nnc_romfs_add_to_hash_to_offset_table(ctx, parent_offset, meta_offset, ctx->dir_hash, ctx->dir_hash_tail, ctx->dir_hashtab_len, ctx->dir_meta.buffer, DIR_OFF_NEXTBUCKET);
 
 	u8 mbuf[DIR_OFF_NAMELEN + 4];
 
@@ -518,21 +1262,21 @@ static result nnc_romfs_write_directory(struct romfs_writer_ctx *ctx, const char
 
 	/* we have to add ourselves to some lists! */
 	if(vdirname) /* can't add to the root */
-		nnc_romfs_add_to_parent_directory(ctx, parent_offset, meta_offset, ctx->dir_meta.buffer, DIR_OFF_DCHILDREN, DIR_OFF_SIBLING);
+		nnc_romfs_add_to_parent_directory(ctx, parent_offset, prev_sibling, meta_offset, ctx->dir_meta.buffer, DIR_OFF_DCHILDREN, DIR_OFF_SIBLING);
 
 	*new_parent_offset = meta_offset;
 
 	return NNC_R_OK;
 }
 
-static result nnc_romfs_write_file_meta(struct romfs_writer_ctx *ctx, nnc_vfs_file_node *node, u32 parent_offset)
+static result nnc_romfs_write_file_meta(struct romfs_writer_ctx *ctx, nnc_vfs_file_node *node, u32 parent_offset, u32 prev_sibling, u32 *new_offset)
 {
 	nnc_result ret = nnc_romfs_convert_to_utf16(ctx, node->vname);
 	if(ret != NNC_R_OK) return ret;
 	u32 actual_string_length = ctx->cbuf.converted_length * 2;
 
 	u32 meta_offset = ctx->file_meta.used;
-	nnc_romfs_add_to_hash_to_offset_table(ctx, parent_offset, meta_offset, ctx->file_hash, ctx->file_hashtab_len, ctx->file_meta.buffer, FILE_OFF_NEXTBUCKET);
+	nnc_romfs_add_to_hash_to_offset_table(ctx, parent_offset, meta_offset, ctx->file_hash, ctx->file_hash_tail, ctx->file_hashtab_len, ctx->file_meta.buffer, FILE_OFF_NEXTBUCKET);
 
 	u8 mbuf[FILE_OFF_NAMELEN + 4];
 
@@ -540,7 +1284,7 @@ static result nnc_romfs_write_file_meta(struct romfs_writer_ctx *ctx, nnc_vfs_fi
 
 	U32P(&mbuf[FILE_OFF_PARENT]) = LE32(parent_offset);
 	U32P(&mbuf[FILE_OFF_SIBLING]) = LE32(INVAL); /* initialize to invalid since we do not know this yet */
-	U64P(&mbuf[FILE_OFF_OFFSET]) = LE64(ctx->current_file_data_offset);
+	U64P(&mbuf[FILE_OFF_OFFSET]) = LE64(ctx->data_offsets[ctx->file_index++]);
 	U64P(&mbuf[FILE_OFF_SIZE]) = LE64(filesize);
 	U32P(&mbuf[FILE_OFF_NEXTBUCKET]) = LE32(INVAL);
 	U32P(&mbuf[FILE_OFF_NAMELEN]) = LE32(actual_string_length);
@@ -549,10 +1293,9 @@ static result nnc_romfs_write_file_meta(struct romfs_writer_ctx *ctx, nnc_vfs_fi
 	TRY(dynbuf_push(&ctx->file_meta, (u8 *) ctx->cbuf.buffer.utf16, ALIGN(actual_string_length, 4)));
 
 	/* we now need to add ourselves to the directory */
-	nnc_romfs_add_to_parent_directory(ctx, parent_offset, meta_offset, ctx->file_meta.buffer, DIR_OFF_FCHILDREN, FILE_OFF_SIBLING);
+	nnc_romfs_add_to_parent_directory(ctx, parent_offset, prev_sibling, meta_offset, ctx->file_meta.buffer, DIR_OFF_FCHILDREN, FILE_OFF_SIBLING);
 
-	ctx->current_file_data_offset += filesize;
-	ctx->current_file_data_offset = ALIGN(ctx->current_file_data_offset, 16);
+	*new_offset = meta_offset;
 
 	return NNC_R_OK;
 }
@@ -560,122 +1303,1214 @@ static result nnc_romfs_write_file_meta(struct romfs_writer_ctx *ctx, nnc_vfs_fi
 static result nnc_romfs_write_meta(struct romfs_writer_ctx *ctx, nnc_vfs_directory_node *dir, u32 parent_offset)
 {
 	nnc_vfs_directory_node *ndir;
-	u32 new_parent_offset;
+	u32 new_parent_offset = INVAL, new_offset = INVAL;
 	result ret;
 	for(unsigned i = 0; i < dir->filecount; ++i)
-		TRY(nnc_romfs_write_file_meta(ctx, &dir->file_children[i], parent_offset));
+		TRY(nnc_romfs_write_file_meta(ctx, &dir->file_children[i], parent_offset, new_offset, &new_offset));
 	for(unsigned i = 0; i < dir->dircount; ++i)
 	{
 		ndir = &dir->directory_children[i];
 		/* first write this directory */
-		TRY(nnc_romfs_write_directory(ctx, ndir->vname, parent_offset, &new_parent_offset));
+		TRY(nnc_romfs_write_directory(ctx, ndir->vname, parent_offset, new_parent_offset, &new_parent_offset));
 		/* and then recurse further into this directory */
 		TRY(nnc_romfs_write_meta(ctx, ndir, new_parent_offset));
 	}
 	return NNC_R_OK;
 }
 
-static result nnc_romfs_write_file_data(nnc_wstream *ws, nnc_vfs_directory_node *dir)
+/* lists the files in the order their data is written, the same order as in nnc_romfs_write_meta(),
+ * with nodes NULL they're only counted */
+static void nnc_romfs_collect_file_nodes(nnc_vfs_directory_node *dir, nnc_vfs_file_node **nodes, u32 *count)
 {
-	u32 copied, padding;
-	nnc_vfs_stream stream;
-	result ret;
-
-	/* write all files... */
-	for(unsigned i = 0; i < dir->filecount; ++i)
-	{
-		TRY(nnc_vfs_open_node(&dir->file_children[i], &stream));
-		ret = nnc_copy((nnc_rstream *) &stream, ws, &copied);
-		nnc_rs_close(&stream);
-		if(ret != NNC_R_OK)
-			return ret;
-		padding = ALIGN(copied, 16) - copied;
-		TRY(nnc_write_padding(ws, padding));
-	}
-	/* and recurse into directories */
+	for(unsigned i = 0; i < dir->filecount; ++i, ++*count)
+		if(nodes) nodes[*count] = &dir->file_children[i];
 	for(unsigned i = 0; i < dir->dircount; ++i)
-		TRY(nnc_romfs_write_file_data(ws, &dir->directory_children[i]));
-
-	return NNC_R_OK;
+		nnc_romfs_collect_file_nodes(&dir->directory_children[i], nodes, count);
 }
 
-result nnc_write_romfs(nnc_vfs *vfs, nnc_wstream *ws)
+#define ROMFS_WRITER_CTX_INIT { NULL, NULL, NULL, NULL, {NULL}, {NULL}, {0,0,{NULL}},  0, 0, NULL, 0 }
+
+/* builds the metadata & offset by hash lookup tables for both files and directories,
+ * data_offsets has to be set already */
+static result nnc_romfs_build_meta(struct romfs_writer_ctx *ctx, nnc_vfs *vfs)
 {
-	nnc_result ret = NNC_R_OK;
-
-	/* first we start building the metadata & offset by hash lookup tables for both files and directories */
+	u32 root_directory_offset;
+	result ret;
 
 	/* dir count starts at one due to the root dir / */
-	struct romfs_writer_ctx ctx = { NULL, NULL, {NULL}, {NULL}, {0,0,{NULL}},  0, 0, 0 };
-	nnc_ivfc_writer writer = { NULL };
-
-	ctx.dir_hashtab_len = nnc_romfs_table_length(vfs->totaldirs);
-	ctx.file_hashtab_len = nnc_romfs_table_length(vfs->totalfiles);
+	ctx->dir_hashtab_len = nnc_romfs_table_length(vfs->totaldirs);
+	ctx->file_hashtab_len = nnc_romfs_table_length(vfs->totalfiles);
 
-	u32 file_hashtab_size = ctx.file_hashtab_len * sizeof(u32);
-	u32 dir_hashtab_size = ctx.dir_hashtab_len * sizeof(u32);
+	u32 file_hashtab_size = ctx->file_hashtab_len * sizeof(u32);
+	u32 dir_hashtab_size = ctx->dir_hashtab_len * sizeof(u32);
 
-	TRY(dynbuf_new(&ctx.dir_meta, 8192));
-	TRYLBL(dynbuf_new(&ctx.file_meta, 8192), out);
+	TRY(dynbuf_new(&ctx->dir_meta, 8192));
+	TRY(dynbuf_new(&ctx->file_meta, 8192));
 
-	ctx.file_hash = malloc(file_hashtab_size);
-	ctx.dir_hash = malloc(dir_hashtab_size);
-	if(!ctx.file_hash || !ctx.dir_hash)
-		goto out;
+	ctx->file_hash = malloc(file_hashtab_size);
+	ctx->dir_hash = malloc(dir_hashtab_size);
+	ctx->file_hash_tail = malloc(file_hashtab_size);
+	ctx->dir_hash_tail = malloc(dir_hashtab_size);
+	if(!ctx->file_hash || !ctx->dir_hash || !ctx->file_hash_tail || !ctx->dir_hash_tail)
+		return NNC_R_NOMEM;
 
-	memset(ctx.file_hash, 0xFF, file_hashtab_size);
-	memset(ctx.dir_hash, 0xFF, dir_hashtab_size);
+	memset(ctx->file_hash, 0xFF, file_hashtab_size);
+	memset(ctx->dir_hash, 0xFF, dir_hashtab_size);
 
-	TRYLBL(nnc_cbuf_init(&ctx.cbuf, 0), out);
+	TRY(nnc_cbuf_init(&ctx->cbuf, 0));
 
 	/* first we have to write the root directory */
-	u32 root_directory_offset;
-	TRYLBL(nnc_romfs_write_directory(&ctx, NULL, 0, &root_directory_offset), out);
+	TRY(nnc_romfs_write_directory(ctx, NULL, 0, INVAL, &root_directory_offset));
 
 	/* first walk to add all metadata, and later we walk again but to add all file data */
-	TRYLBL(nnc_romfs_write_meta(&ctx, &vfs->root_directory, root_directory_offset), out);
+	return nnc_romfs_write_meta(ctx, &vfs->root_directory, root_directory_offset);
+}
 
-	TRYLBL(nnc_open_ivfc_writer(&writer, ws, NNC_IVFC_LEVELS_ROMFS, NNC_IVFC_ID_ROMFS, NNC_IVFC_BLOCKSIZE_ROMFS), out);
+static void nnc_romfs_free_meta(struct romfs_writer_ctx *ctx)
+{
+	nnc_dynbuf_free(&ctx->file_meta);
+	nnc_dynbuf_free(&ctx->dir_meta);
+	nnc_cbuf_free(&ctx->cbuf);
+	free(ctx->file_hash);
+	free(ctx->dir_hash);
+	free(ctx->file_hash_tail);
+	free(ctx->dir_hash_tail);
+}
+
+/* size of the level 3 header and the tables after it */
+static u32 nnc_romfs_tables_size(struct romfs_writer_ctx *ctx)
+{
+	return 0x28 + (ctx->dir_hashtab_len + ctx->file_hashtab_len) * sizeof(u32)
+		+ ctx->dir_meta.used + ctx->file_meta.used;
+}
 
+/* writes the level 3 header and the tables, then pads up to data_offset */
+static result nnc_romfs_write_tables(struct romfs_writer_ctx *ctx, nnc_wstream *ws, u32 data_offset)
+{
+	u32 file_hashtab_size = ctx->file_hashtab_len * sizeof(u32);
+	u32 dir_hashtab_size = ctx->dir_hashtab_len * sizeof(u32);
 	u8 romfs_header_buf[0x28];
+	result ret;
 
 	U32P(&romfs_header_buf[0x00]) = LE32(sizeof(romfs_header_buf)); /* header size */
 	U32P(&romfs_header_buf[0x04]) = LE32(sizeof(romfs_header_buf)); /* offset/size pairs no w*/
 	U32P(&romfs_header_buf[0x08]) = LE32(dir_hashtab_size);
 	U32P(&romfs_header_buf[0x0C]) = LE32(sizeof(romfs_header_buf) + dir_hashtab_size);
-	U32P(&romfs_header_buf[0x10]) = LE32(ctx.dir_meta.used);
-	U32P(&romfs_header_buf[0x14]) = LE32(sizeof(romfs_header_buf) + dir_hashtab_size + ctx.dir_meta.used);
+	U32P(&romfs_header_buf[0x10]) = LE32(ctx->dir_meta.used);
+	U32P(&romfs_header_buf[0x14]) = LE32(sizeof(romfs_header_buf) + dir_hashtab_size + ctx->dir_meta.used);
 	U32P(&romfs_header_buf[0x18]) = LE32(file_hashtab_size);
-	U32P(&romfs_header_buf[0x1C]) = LE32(sizeof(romfs_header_buf) + dir_hashtab_size + ctx.dir_meta.used + file_hashtab_size);
-	U32P(&romfs_header_buf[0x20]) = LE32(ctx.file_meta.used);
-	U32P(&romfs_header_buf[0x24]) = ALIGN(LE32(sizeof(romfs_header_buf) + dir_hashtab_size + ctx.dir_meta.used + file_hashtab_size + ctx.file_meta.used), 0x10);
+	U32P(&romfs_header_buf[0x1C]) = LE32(sizeof(romfs_header_buf) + dir_hashtab_size + ctx->dir_meta.used + file_hashtab_size);
+	U32P(&romfs_header_buf[0x20]) = LE32(ctx->file_meta.used);
+	U32P(&romfs_header_buf[0x24]) = LE32(data_offset);
 
-	TRYLBL(NNC_WS_CALL(writer, write, romfs_header_buf, sizeof(romfs_header_buf)), out);
+	TRY(NNC_WS_PCALL(ws, write, romfs_header_buf, sizeof(romfs_header_buf)));
 
 	/* now we can dump our tables and afterwards ... */
-	TRYLBL(NNC_WS_CALL(writer, write, (u8 *) ctx.dir_hash, dir_hashtab_size), out);
-	TRYLBL(NNC_WS_CALL(writer, write, (u8 *) ctx.dir_meta.buffer, ctx.dir_meta.used), out);
-	TRYLBL(NNC_WS_CALL(writer, write, (u8 *) ctx.file_hash, file_hashtab_size), out);
-	TRYLBL(NNC_WS_CALL(writer, write, (u8 *) ctx.file_meta.buffer, ctx.file_meta.used), out);
+	TRY(NNC_WS_PCALL(ws, write, (u8 *) ctx->dir_hash, dir_hashtab_size));
+	TRY(NNC_WS_PCALL(ws, write, (u8 *) ctx->dir_meta.buffer, ctx->dir_meta.used));
+	TRY(NNC_WS_PCALL(ws, write, (u8 *) ctx->file_hash, file_hashtab_size));
+	TRY(NNC_WS_PCALL(ws, write, (u8 *) ctx->file_meta.buffer, ctx->file_meta.used));
+
+	return nnc_write_padding(ws, data_offset - nnc_romfs_tables_size(ctx));
+}
+
+#define DEDUPE_CHUNK (64 * 1024)
+
+struct dedupe_entry {
+	u64 size;
+	u32 crc;
+	u32 index;
+};
+
+static int dedupe_entry_cmp(const void *a, const void *b)
+{
+	const struct dedupe_entry *ea = a, *eb = b;
+	if(ea->size != eb->size) return (ea->size > eb->size) - (ea->size < eb->size);
+	if(ea->crc != eb->crc) return (ea->crc > eb->crc) - (ea->crc < eb->crc);
+	return (ea->index > eb->index) - (ea->index < eb->index);
+}
+
+/* seeks before every chunk since nodes made from the same reader share its position */
+static result dedupe_read_chunk(nnc_vfs_stream *rs, u64 pos, u8 *buf, u32 size)
+{
+	result ret;
+	TRY(nnc_rs_seek_abs(rs, pos));
+	return read_exact(NNC_RSP(rs), buf, size);
+}
+
+static result dedupe_crc(nnc_vfs_file_node *node, u64 size, u8 *buf, u32 *crc)
+{
+	nnc_vfs_stream rs;
+	result ret;
+	TRY(nnc_vfs_open_node(node, &rs));
+	*crc = 0;
+	for(u64 pos = 0; pos < size; pos += DEDUPE_CHUNK)
+	{
+		u32 len = MIN(size - pos, DEDUPE_CHUNK);
+		TRYLBL(dedupe_read_chunk(&rs, pos, buf, len), out);
+		*crc = crc32_update(*crc, buf, len);
+	}
+out:
+	nnc_rs_close(&rs);
+	return ret;
+}
+
+static result dedupe_equal(nnc_vfs_file_node *a, nnc_vfs_file_node *b, u64 size, u8 *buf, bool *equal)
+{
+	nnc_vfs_stream rsa, rsb;
+	result ret;
+	TRY(nnc_vfs_open_node(a, &rsa));
+	TRYLBL(nnc_vfs_open_node(b, &rsb), out_a);
+	*equal = true;
+	for(u64 pos = 0; pos < size && *equal; pos += DEDUPE_CHUNK)
+	{
+		u32 len = MIN(size - pos, DEDUPE_CHUNK);
+		TRYLBL(dedupe_read_chunk(&rsa, pos, buf, len), out);
+		TRYLBL(dedupe_read_chunk(&rsb, pos, buf + DEDUPE_CHUNK, len), out);
+		*equal = memcmp(buf, buf + DEDUPE_CHUNK, len) == 0;
+	}
+out:
+	nnc_rs_close(&rsb);
+out_a:
+	nnc_rs_close(&rsa);
+	return ret;
+}
+
+/* sets dup_of[i] to the index of the first file with the same contents as nodes[i] or INVAL if there is none.
+ * Only files of which the size isn't unique are hashed and only files with the same hash are compared */
+static result nnc_romfs_dedupe(nnc_vfs_file_node **nodes, u32 count, u32 *dup_of, u64 *saved)
+{
+	struct dedupe_entry *entries = malloc(MAX(count, 1) * sizeof(struct dedupe_entry));
+	u8 *buf = malloc(DEDUPE_CHUNK * 2);
+	u32 used = 0, i, j, k, end, run;
+	result ret = NNC_R_OK;
+	bool equal;
+
+	*saved = 0;
+	for(i = 0; i < count; ++i)
+		dup_of[i] = INVAL;
+	if(!entries || !buf)
+	{
+		ret = NNC_R_NOMEM;
+		goto out;
+	}
+
+	/* empty files take up no space anyway */
+	for(i = 0; i < count; ++i)
+	{
+		u64 size = nnc_vfs_node_size(nodes[i]);
+		if(size)
+		{
+			entries[used].size = size;
+			entries[used].crc = 0;
+			entries[used].index = i;
+			++used;
+		}
+	}
+	qsort(entries, used, sizeof(struct dedupe_entry), dedupe_entry_cmp);
+
+	for(i = 0; i < used; i = end)
+	{
+		for(end = i + 1; end < used && entries[end].size == entries[i].size; ++end)
+			;
+		if(end - i < 2) continue;
+		for(j = i; j < end; ++j)
+			TRYLBL(dedupe_crc(nodes[entries[j].index], entries[j].size, buf, &entries[j].crc), out);
+		qsort(&entries[i], end - i, sizeof(struct dedupe_entry), dedupe_entry_cmp);
+
+		/* within a run of equal hashes the entries are in file order, so the first of a kind comes first */
+		for(j = i + 1, run = i; j < end; ++j)
+		{
+			if(entries[j].crc != entries[run].crc)
+			{
+				run = j;
+				continue;
+			}
+			for(k = run; k < j; ++k)
+			{
+				if(dup_of[entries[k].index] != INVAL) continue;
+				TRYLBL(dedupe_equal(nodes[entries[k].index], nodes[entries[j].index], entries[j].size, buf, &equal), out);
+				if(equal)
+				{
+					dup_of[entries[j].index] = entries[k].index;
+					*saved += ALIGN(entries[j].size, 16);
+					break;
+				}
+			}
+		}
+	}
+
+out:
+	free(entries);
+	free(buf);
+	return ret;
+}
+
+/* finds a file by a path like "/dir/file" */
+static nnc_vfs_file_node *nnc_romfs_vfs_lookup(nnc_vfs_directory_node *dir, const char *path)
+{
+	const char *slash;
+	unsigned i;
+	if(*path == '/') ++path;
+	while((slash = strchr(path, '/')))
+	{
+		size_t len = slash - path;
+		for(i = 0; i < dir->dircount; ++i)
+			if(strncmp(dir->directory_children[i].vname, path, len) == 0 && dir->directory_children[i].vname[len] == '\0')
+				break;
+		if(i == dir->dircount) return NULL;
+		dir = &dir->directory_children[i];
+		path = slash + 1;
+	}
+	for(i = 0; i < dir->filecount; ++i)
+		if(strcmp(dir->file_children[i].vname, path) == 0)
+			return &dir->file_children[i];
+	return NULL;
+}
+
+struct node_index {
+	nnc_vfs_file_node *node;
+	u32 index;
+};
+
+static int node_index_cmp(const void *a, const void *b)
+{
+	uintptr_t na = (uintptr_t) ((const struct node_index *) a)->node;
+	uintptr_t nb = (uintptr_t) ((const struct node_index *) b)->node;
+	return (na > nb) - (na < nb);
+}
+
+/* order gets the indices of the files in the order their data should be in: first the files
+ * from the hint in that order and then the rest in the order of the metadata */
+static result nnc_romfs_data_order(nnc_vfs *vfs, nnc_vfs_file_node **nodes, u32 count, const char **paths, u32 npaths, u32 *order)
+{
+	struct node_index *lookup, key, *found;
+	bool *placed;
+	u32 i, n = 0;
+
+	if(npaths == 0)
+	{
+		for(i = 0; i < count; ++i)
+			order[i] = i;
+		return NNC_R_OK;
+	}
+
+	lookup = malloc(MAX(count, 1) * sizeof(struct node_index));
+	placed = calloc(MAX(count, 1), sizeof(bool));
+	if(!lookup || !placed)
+	{
+		free(lookup);
+		free(placed);
+		return NNC_R_NOMEM;
+	}
+	for(i = 0; i < count; ++i)
+	{
+		lookup[i].node = nodes[i];
+		lookup[i].index = i;
+	}
+	qsort(lookup, count, sizeof(struct node_index), node_index_cmp);
+
+	/* paths that aren't in the VFS or come up again are skipped */
+	for(i = 0; i < npaths; ++i)
+	{
+		if(!(key.node = nnc_romfs_vfs_lookup(&vfs->root_directory, paths[i])))
+			continue;
+		found = bsearch(&key, lookup, count, sizeof(struct node_index), node_index_cmp);
+		if(found && !placed[found->index])
+		{
+			placed[found->index] = true;
+			order[n++] = found->index;
+		}
+	}
+	for(i = 0; i < count; ++i)
+		if(!placed[i])
+			order[n++] = i;
+
+	free(lookup);
+	free(placed);
+	return NNC_R_OK;
+}
 
-	/* and now the long-awaited files, which we first need to put at an aligned offset obviously */
-	u32 now_off = NNC_WS_CALL0(writer, tell);
-	TRYLBL(nnc_write_padding(NNC_WSP(&writer), ALIGN(now_off, 0x10) - now_off), out);
-	TRYLBL(nnc_romfs_write_file_data(NNC_WSP(&writer), &vfs->root_directory), out);
+/* alignment of the data of a file, empty files never need more than the usual */
+static u64 nnc_romfs_data_align(const nnc_romfs_write_options *opts, u64 size)
+{
+	return size && size >= opts->data_align_min_size ? opts->data_align : 16;
+}
+
+/* gives every file its data offset, going through the files in `order`. A file that is a duplicate
+ * (dup_of may be NULL) uses the data of the file it duplicates, which is put where the first of
+ * them is in `order`. data_nodes gets the files of which the data is written, in that order,
+ * and data_starts where their data goes */
+static void nnc_romfs_layout(nnc_vfs_file_node **nodes, u32 count, const u32 *order, const u32 *dup_of,
+	const nnc_romfs_write_options *opts, u64 *offsets, nnc_vfs_file_node **data_nodes, u64 *data_starts, u32 *data_count)
+{
+	u64 cursor = 0, size;
+	u32 i;
+	*data_count = 0;
+	for(i = 0; i < count; ++i)
+		offsets[i] = UINT64_MAX;
+	for(i = 0; i < count; ++i)
+	{
+		u32 file = order[i];
+		u32 data = dup_of && dup_of[file] != INVAL ? dup_of[file] : file;
+		if(offsets[data] == UINT64_MAX)
+		{
+			size = nnc_vfs_node_size(nodes[data]);
+			offsets[data] = ALIGN(cursor, nnc_romfs_data_align(opts, size));
+			cursor = offsets[data] + size;
+			data_starts[*data_count] = offsets[data];
+			data_nodes[(*data_count)++] = nodes[data];
+		}
+		offsets[file] = offsets[data];
+	}
+}
+
+static result nnc_romfs_write_file_data(nnc_wstream *ws, nnc_prefetch *prefetch, const u64 *data_starts, u32 count)
+{
+	u64 pos = 0;
+	u32 copied;
+	result ret;
+
+	for(u32 i = 0; i < count; ++i)
+	{
+		/* a file that grew since the layout was made would run into the next one */
+		if(pos > data_starts[i])
+			return NNC_R_MISMATCH;
+		TRY(nnc_write_padding(ws, data_starts[i] - pos));
+		TRY(prefetch_copy(prefetch, ws, &copied));
+		pos = data_starts[i] + copied;
+	}
+
+	return nnc_write_padding(ws, ALIGN(pos, 16) - pos);
+}
+
+void nnc_romfs_write_options_init(nnc_romfs_write_options *opts)
+{
+	opts->hash_threads = 0;
+	opts->prefetch_bytes = 0;
+	opts->dedupe = false;
+	opts->dedupe_saved = NULL;
+	opts->data_order = NULL;
+	opts->data_order_count = 0;
+	opts->data_align = 16;
+	opts->data_align_min_size = 0;
+}
+
+result nnc_write_romfs(nnc_vfs *vfs, nnc_wstream *ws)
+{
+	return nnc_write_romfs_ex(vfs, ws, NULL);
+}
+
+struct romfs_single_pass {
+	nnc_vfs *vfs;
+	const nnc_romfs_write_options *opts;
+};
+
+static result romfs_single_pass_write(void *udata, nnc_wstream *ws)
+{
+	struct romfs_single_pass *args = udata;
+	return nnc_write_romfs_ex(args->vfs, ws, args->opts);
+}
+
+result nnc_write_romfs_ex(nnc_vfs *vfs, nnc_wstream *ws, const nnc_romfs_write_options *opts)
+{
+	nnc_romfs_write_options defaults;
+	nnc_result ret = NNC_R_OK;
+	if(!opts)
+	{
+		nnc_romfs_write_options_init(&defaults);
+		opts = &defaults;
+	}
+	if(opts->data_align < 16 || opts->data_align & (opts->data_align - 1))
+		return NNC_R_INVAL;
+	/* the IVFC writer fills in the header and master hash last */
+	if(!ws->funcs->seek)
+	{
+		struct romfs_single_pass args = { vfs, opts };
+		return write_single_pass(romfs_single_pass_write, &args, ws);
+	}
+
+	struct romfs_writer_ctx ctx = ROMFS_WRITER_CTX_INIT;
+	nnc_ivfc_writer writer = { NULL };
+	nnc_vfs_file_node **file_nodes = NULL;
+	nnc_vfs_file_node **data_nodes = NULL;
+	nnc_prefetch *prefetch = NULL;
+	u32 *dup_of = NULL, *order = NULL;
+	u64 *data_offsets = NULL, *data_starts = NULL;
+	u32 file_count = 0, data_count;
+	u64 saved = 0;
+
+	nnc_romfs_collect_file_nodes(&vfs->root_directory, NULL, &file_count);
+	file_nodes = malloc(MAX(file_count, 1) * sizeof(nnc_vfs_file_node *));
+	data_nodes = malloc(MAX(file_count, 1) * sizeof(nnc_vfs_file_node *));
+	data_offsets = malloc(MAX(file_count, 1) * sizeof(u64));
+	data_starts = malloc(MAX(file_count, 1) * sizeof(u64));
+	order = malloc(MAX(file_count, 1) * sizeof(u32));
+	if(!file_nodes || !data_nodes || !data_offsets || !data_starts || !order)
+	{
+		ret = NNC_R_NOMEM;
+		goto out;
+	}
+	file_count = 0;
+	nnc_romfs_collect_file_nodes(&vfs->root_directory, file_nodes, &file_count);
+
+	/* duplicates have to be known before the metadata is made since they don't get their own offset */
+	if(opts->dedupe)
+	{
+		if(!(dup_of = malloc(MAX(file_count, 1) * sizeof(u32))))
+		{
+			ret = NNC_R_NOMEM;
+			goto out;
+		}
+		TRYLBL(nnc_romfs_dedupe(file_nodes, file_count, dup_of, &saved), out);
+	}
+	TRYLBL(nnc_romfs_data_order(vfs, file_nodes, file_count, opts->data_order, opts->data_order_count, order), out);
+	nnc_romfs_layout(file_nodes, file_count, order, dup_of, opts, data_offsets, data_nodes, data_starts, &data_count);
+
+	ctx.data_offsets = data_offsets;
+	TRYLBL(nnc_romfs_build_meta(&ctx, vfs), out);
+
+	/* the file data can already be read while the metadata is written */
+	TRYLBL(prefetch_start(&prefetch, data_nodes, data_count, opts->prefetch_bytes), out);
+
+	TRYLBL(nnc_open_ivfc_writer(&writer, ws, NNC_IVFC_LEVELS_ROMFS, NNC_IVFC_ID_ROMFS, NNC_IVFC_BLOCKSIZE_ROMFS), out);
+	TRYLBL(nnc_ivfc_writer_set_threads(&writer, opts->hash_threads), out);
+
+	/* and after the tables the long-awaited files, which we first need to put at an aligned offset obviously,
+	 * level 3 starts at a block boundary so this also aligns the data in the whole RomFS */
+	TRYLBL(nnc_romfs_write_tables(&ctx, NNC_WSP(&writer), ALIGN(nnc_romfs_tables_size(&ctx), opts->data_align)), out);
+	TRYLBL(nnc_romfs_write_file_data(NNC_WSP(&writer), prefetch, data_starts, data_count), out);
 
 	/* and this close writes the IVFC hashes and headers and such */
 	ret = NNC_WS_CALL0(writer, close);
 	writer.funcs = NULL; /* just so we don't abort twice */
+	if(ret == NNC_R_OK && opts->dedupe_saved)
+		*opts->dedupe_saved = saved;
+
+out:
+	if(writer.funcs && ret != NNC_R_OK)
+		nnc_ivfc_abort_write(&writer);
+	nnc_prefetch_stop(prefetch);
+	free(file_nodes);
+	free(data_nodes);
+	free(dup_of);
+	free(order);
+	free(data_offsets);
+	free(data_starts);
+	nnc_romfs_free_meta(&ctx);
+
+	return ret;
+}
+
+/* Incremental rebuilds keep the file data of the base at the same position
+ * relative to the start of the data, and the start of the data only moves
+ * by whole blocks. Every level 3 block that isn't touched by a change then
+ * has the same contents as in the base, so it's copied along with its hash
+ * from the base. Only the blocks with the tables and the changed files are
+ * hashed again, and the upper levels when the IVFC writer is closed. */
+
+#define INCREMENTAL_NO_SLOT UINT64_MAX
+#define INCREMENTAL_CHUNK_BLOCKS 64
+
+struct incremental_file {
+	nnc_romfs_ctx *base;
+	nnc_vfs_file_node *change; /* NULL if the file of the base is kept */
+	u64 offset, size;          /* data in the base, offset is INCREMENTAL_NO_SLOT for new files */
+};
+
+static nnc_result incremental_initialize(nnc_vfs_generator_data *udata, va_list va)
+{
+	struct incremental_file *file = malloc(sizeof(struct incremental_file));
+	if(!file) return NNC_R_NOMEM;
+	*file = *va_arg(va, struct incremental_file *);
+	*udata = file;
+	return NNC_R_OK;
+}
+
+static nnc_result incremental_make_reader(nnc_vfs_generator_data udata, nnc_vfs_stream *out)
+{
+	struct incremental_file *file = udata;
+	if(file->change)
+		return nnc_vfs_open_node(file->change, out);
+	nnc_subview *sv = malloc(sizeof(nnc_subview));
+	if(!sv) return NNC_R_NOMEM;
+	nnc_subview_open(sv, file->base->rs, file->base->header.data_offset + file->offset, file->size);
+	nnc_vfs_open_stream(out, NNC_RSP(sv), NNC_VFS_STREAM_FREE_ON_CLOSE);
+	return NNC_R_OK;
+}
+
+static u64 incremental_node_size(nnc_vfs_generator_data udata)
+{
+	struct incremental_file *file = udata;
+	return file->change ? nnc_vfs_node_size(file->change) : file->size;
+}
+
+static void incremental_delete_data(nnc_vfs_generator_data udata)
+{
+	free(udata);
+}
+
+static const nnc_vfs_reader_generator incremental_generator = {
+	.initialize  = incremental_initialize,
+	.make_reader = incremental_make_reader,
+	.node_size   = incremental_node_size,
+	.delete_data = incremental_delete_data,
+};
+
+#define INC_FILE(node) ((struct incremental_file *) (node)->data)
+
+/* adds the files and directories of the base to the VFS, data_end is set to the end of the last file */
+static result incremental_add_base(nnc_romfs_ctx *base, nnc_romfs_info *info, nnc_vfs_directory_node *dir, u64 *data_end)
+{
+	nnc_romfs_iterator it = nnc_romfs_mkit(base, info);
+	nnc_vfs_directory_node *ndir;
+	nnc_romfs_info ent;
+	result ret;
+
+	while(nnc_romfs_next(&it, &ent))
+	{
+		const char *name = nnc_romfs_info_filename(base, &ent);
+		if(ent.type == NNC_ROMFS_DIR)
+		{
+			TRY(nnc_vfs_add_directory(dir, name, &ndir));
+			TRY(incremental_add_base(base, &ent, ndir, data_end));
+		}
+		else
+		{
+			struct incremental_file file = { base, NULL, ent.u.f.offset, ent.u.f.size };
+			TRY(nnc_vfs_add_file(dir, name, &incremental_generator, &file));
+			if(ent.u.f.size)
+				*data_end = MAX(*data_end, ALIGN(ent.u.f.offset + ent.u.f.size, 16));
+		}
+	}
+
+	return NNC_R_OK;
+}
+
+/* replaces or adds the files of changes, the nodes of changes are borrowed */
+static result incremental_overlay(nnc_romfs_ctx *base, nnc_vfs_directory_node *dir, nnc_vfs_directory_node *changes)
+{
+	nnc_vfs_directory_node *ndir;
+	unsigned i, j;
+	result ret;
+
+	for(i = 0; i < changes->filecount; ++i)
+	{
+		nnc_vfs_file_node *change = &changes->file_children[i];
+		for(j = 0; j < dir->filecount && strcmp(dir->file_children[j].vname, change->vname) != 0; ++j)
+			;
+		if(j < dir->filecount)
+			INC_FILE(&dir->file_children[j])->change = change;
+		else
+		{
+			struct incremental_file file = { base, change, INCREMENTAL_NO_SLOT, 0 };
+			TRY(nnc_vfs_add_file(dir, change->vname, &incremental_generator, &file));
+		}
+	}
+	for(i = 0; i < changes->dircount; ++i)
+	{
+		nnc_vfs_directory_node *cdir = &changes->directory_children[i];
+		for(j = 0; j < dir->dircount && strcmp(dir->directory_children[j].vname, cdir->vname) != 0; ++j)
+			;
+		if(j < dir->dircount)
+			ndir = &dir->directory_children[j];
+		else
+			TRY(nnc_vfs_add_directory(dir, cdir->vname, &ndir));
+		TRY(incremental_overlay(base, ndir, cdir));
+	}
+
+	return NNC_R_OK;
+}
+
+struct incremental_range {
+	u64 start, end;
+	u32 index;
+};
+
+static int incremental_range_cmp(const void *a, const void *b)
+{
+	const struct incremental_range *ra = a, *rb = b;
+	return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+/* decides where the data of every file goes: kept files stay where they are, changed files
+ * are written over their old data if they fit and no other file shares it, the rest goes after
+ * the data of the base. Changed files that are written in place are put in `inplace` sorted by offset */
+static result incremental_layout(nnc_vfs_file_node **nodes, u32 count, u64 data_end, u64 *offsets, u32 *inplace, u32 *ninplace)
+{
+	struct incremental_range *ranges = malloc(MAX(count, 1) * sizeof(struct incremental_range));
+	bool *exclusive = calloc(MAX(count, 1), sizeof(bool));
+	u64 cursor = data_end, max_end = 0;
+	u32 nranges = 0, i;
+
+	*ninplace = 0;
+	if(!ranges || !exclusive)
+	{
+		free(ranges);
+		free(exclusive);
+		return NNC_R_NOMEM;
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		struct incremental_file *file = INC_FILE(nodes[i]);
+		if(file->offset != INCREMENTAL_NO_SLOT && file->size)
+		{
+			ranges[nranges].start = file->offset;
+			ranges[nranges].end = ALIGN(file->offset + file->size, 16);
+			ranges[nranges].index = i;
+			++nranges;
+		}
+	}
+	qsort(ranges, nranges, sizeof(struct incremental_range), incremental_range_cmp);
+	for(i = 0; i < nranges; ++i)
+	{
+		exclusive[ranges[i].index] = (i == 0 || max_end <= ranges[i].start)
+			&& (i + 1 == nranges || ranges[i + 1].start >= ranges[i].end);
+		max_end = MAX(max_end, ranges[i].end);
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		struct incremental_file *file = INC_FILE(nodes[i]);
+		u64 size = nnc_vfs_node_size(nodes[i]);
+		if(!file->change)
+			offsets[i] = file->offset;
+		else if(size && exclusive[i] && size <= ALIGN(file->size, 16))
+			offsets[i] = file->offset;
+		else
+		{
+			offsets[i] = cursor;
+			cursor = ALIGN(cursor + size, 16);
+		}
+	}
+	/* the ranges are sorted already */
+	for(i = 0; i < nranges; ++i)
+	{
+		nnc_vfs_file_node *node = nodes[ranges[i].index];
+		if(INC_FILE(node)->change && offsets[ranges[i].index] == INC_FILE(node)->offset)
+			inplace[(*ninplace)++] = ranges[i].index;
+	}
+
+	free(ranges);
+	free(exclusive);
+	return NNC_R_OK;
+}
+
+struct incremental_ctx {
+	nnc_romfs_ctx *base;
+	nnc_ivfc_writer *writer;
+	u8 *buf;
+	nnc_sha256_hash *hashes;
+	u64 base_l2_offset;   /* offset of the hashes of the base level 3 blocks */
+	u64 base_data_offset; /* start of the data in the base level 3 */
+	u64 data_offset;      /* start of the data in the new level 3 */
+	u64 pos;              /* amount of level 3 written */
+	u32 block_size;
+	bool reuse;           /* false if the hashes of the base can't be used */
+};
+
+/* copies data of the base, whole blocks are copied with their hash */
+static result incremental_copy_base(struct incremental_ctx *ic, u64 from, u64 len)
+{
+	nnc_rstream *rs = ic->base->rs;
+	result ret;
+	while(len)
+	{
+		u32 in_block = ic->pos & (ic->block_size - 1);
+		u64 base_pos = ic->base->header.data_offset + from;
+		if(ic->reuse && in_block == 0 && len >= ic->block_size)
+		{
+			u32 blocks = MIN(len / ic->block_size, INCREMENTAL_CHUNK_BLOCKS);
+			u64 block = (ic->base_data_offset + from) / ic->block_size;
+			TRY(read_at_exact(rs, base_pos, ic->buf, blocks * ic->block_size));
+			TRY(read_at_exact(rs, ic->base_l2_offset + block * sizeof(nnc_sha256_hash),
+				(u8 *) ic->hashes, blocks * sizeof(nnc_sha256_hash)));
+			TRY(nnc_ivfc_writer_copy_blocks(ic->writer, ic->buf, blocks, ic->hashes));
+			from += blocks * ic->block_size;
+			len -= blocks * ic->block_size;
+			ic->pos += blocks * ic->block_size;
+			continue;
+		}
+		/* up to the next block boundary so that the blocks after can be copied */
+		u32 size = MIN(len, ic->reuse ? ic->block_size - in_block : INCREMENTAL_CHUNK_BLOCKS * ic->block_size);
+		TRY(read_at_exact(rs, base_pos, ic->buf, size));
+		TRY(NNC_WS_PCALL(ic->writer, write, ic->buf, size));
+		from += size;
+		len -= size;
+		ic->pos += size;
+	}
+	return NNC_R_OK;
+}
+
+/* writes a changed file and pads it up to `slot` */
+static result incremental_write_change(struct incremental_ctx *ic, nnc_vfs_file_node *node, u64 slot)
+{
+	u64 size = nnc_vfs_node_size(node);
+	nnc_vfs_stream rs;
+	u32 copied;
+	result ret;
+	TRY(nnc_vfs_open_node(node, &rs));
+	ret = nnc_copy(NNC_RSP(&rs), NNC_WSP(ic->writer), &copied);
+	nnc_rs_close(&rs);
+	if(ret != NNC_R_OK) return ret;
+	/* the metadata already has the size */
+	if(copied != size) return NNC_R_MISMATCH;
+	ic->pos += slot;
+	return nnc_write_padding(NNC_WSP(ic->writer), slot - copied);
+}
+
+/* where the level 3 data and the hashes of its blocks are in a RomFS as written by nnc or Nintendo */
+struct romfs_hash_layout {
+	u64 l3_offset;  /* start of level 3 in the RomFS stream */
+	u64 l2_offset;  /* start of level 2, the hashes of the level 3 blocks */
+	u64 blocks;     /* amount of level 3 blocks */
+	u32 block_size;
+};
+
+static result romfs_hash_layout(nnc_rstream *rs, struct romfs_hash_layout *layout)
+{
+	nnc_ivfc ivfc;
+	result ret;
+	TRY(nnc_read_ivfc_header(rs, &ivfc, NNC_IVFC_LEVELS_ROMFS));
+	if(ivfc.level[0].block_size_log2 > 31 || ivfc.level[2].block_size_log2 > 31)
+		return NNC_R_CORRUPT;
+	u64 l3_block_size = (u64) 1 << ivfc.level[2].block_size_log2;
+	layout->block_size = l3_block_size;
+	layout->l3_offset = ALIGN(0x60 + ivfc.l0_size, l3_block_size);
+	layout->l2_offset = layout->l3_offset + ALIGN(ivfc.level[2].size, l3_block_size)
+		+ ALIGN(ivfc.level[0].size, (u64) 1 << ivfc.level[0].block_size_log2);
+	layout->blocks = ALIGN(ivfc.level[2].size, l3_block_size) / l3_block_size;
+	if(ivfc.level[1].size / sizeof(nnc_sha256_hash) < layout->blocks)
+		return NNC_R_CORRUPT;
+	return NNC_R_OK;
+}
+
+/* the base has to be a RomFS as written by nnc or Nintendo for the hashes to be reused */
+static result incremental_open_base(struct incremental_ctx *ic)
+{
+	struct romfs_hash_layout layout;
+	result ret;
+	ic->reuse = false;
+	TRY(romfs_hash_layout(ic->base->rs, &layout));
+	if(ic->base->header.data_offset < layout.l3_offset)
+		return NNC_R_CORRUPT;
+	ic->base_data_offset = ic->base->header.data_offset - layout.l3_offset;
+	/* the data keeps its position within blocks, so that has to be the same */
+	ic->reuse = layout.block_size == ic->block_size;
+	ic->base_l2_offset = layout.l2_offset;
+	return NNC_R_OK;
+}
+
+struct romfs_incremental_args {
+	nnc_romfs_ctx *base;
+	nnc_vfs *changes;
+	const nnc_romfs_write_options *opts;
+};
+
+static result romfs_incremental_single_pass(void *udata, nnc_wstream *ws)
+{
+	struct romfs_incremental_args *args = udata;
+	return nnc_write_romfs_incremental(args->base, args->changes, ws, args->opts);
+}
+
+result nnc_write_romfs_incremental(nnc_romfs_ctx *base, nnc_vfs *changes, nnc_wstream *ws, const nnc_romfs_write_options *opts)
+{
+	nnc_romfs_write_options defaults;
+	if(!opts)
+	{
+		nnc_romfs_write_options_init(&defaults);
+		opts = &defaults;
+	}
+	if(!ws->funcs->seek)
+	{
+		struct romfs_incremental_args args = { base, changes, opts };
+		return write_single_pass(romfs_incremental_single_pass, &args, ws);
+	}
+
+	struct romfs_writer_ctx ctx = ROMFS_WRITER_CTX_INIT;
+	struct incremental_ctx ic;
+	nnc_ivfc_writer writer = { NULL };
+	nnc_vfs_file_node **file_nodes = NULL;
+	nnc_romfs_info root;
+	u64 *offsets = NULL, data_end = 0, pos;
+	u32 *inplace = NULL, file_count = 0, ninplace, i;
+	nnc_vfs merged;
+	result ret;
+
+	ic.base = base;
+	ic.writer = &writer;
+	ic.block_size = NNC_IVFC_BLOCKSIZE_ROMFS;
+	ic.pos = 0;
+	ic.buf = NULL;
+	ic.hashes = NULL;
+	TRY(incremental_open_base(&ic));
+	TRY(nnc_get_info(base, &root, "/"));
+	TRY(nnc_vfs_init(&merged));
+	TRYLBL(incremental_add_base(base, &root, &merged.root_directory, &data_end), out);
+	TRYLBL(incremental_overlay(base, &merged.root_directory, &changes->root_directory), out);
+
+	nnc_romfs_collect_file_nodes(&merged.root_directory, NULL, &file_count);
+	file_nodes = malloc(MAX(file_count, 1) * sizeof(nnc_vfs_file_node *));
+	offsets = malloc(MAX(file_count, 1) * sizeof(u64));
+	inplace = malloc(MAX(file_count, 1) * sizeof(u32));
+	ic.buf = malloc(INCREMENTAL_CHUNK_BLOCKS * ic.block_size);
+	ic.hashes = malloc(INCREMENTAL_CHUNK_BLOCKS * sizeof(nnc_sha256_hash));
+	if(!file_nodes || !offsets || !inplace || !ic.buf || !ic.hashes)
+	{
+		ret = NNC_R_NOMEM;
+		goto out;
+	}
+	file_count = 0;
+	nnc_romfs_collect_file_nodes(&merged.root_directory, file_nodes, &file_count);
+	TRYLBL(incremental_layout(file_nodes, file_count, data_end, offsets, inplace, &ninplace), out);
+
+	ctx.data_offsets = offsets;
+	TRYLBL(nnc_romfs_build_meta(&ctx, &merged), out);
+
+	/* if the tables grew past the data it moves back by whole blocks */
+	u64 tables_size = ALIGN(nnc_romfs_tables_size(&ctx), 0x10);
+	ic.data_offset = ic.base_data_offset;
+	if(tables_size > ic.data_offset)
+		ic.data_offset += ALIGN(tables_size - ic.data_offset, ic.block_size);
+	if(ic.data_offset > UINT32_MAX)
+	{
+		ret = NNC_R_TOO_LARGE;
+		goto out;
+	}
+
+	TRYLBL(nnc_open_ivfc_writer(&writer, ws, NNC_IVFC_LEVELS_ROMFS, NNC_IVFC_ID_ROMFS, ic.block_size), out);
+	TRYLBL(nnc_ivfc_writer_set_threads(&writer, opts->hash_threads), out);
+	TRYLBL(nnc_romfs_write_tables(&ctx, NNC_WSP(&writer), ic.data_offset), out);
+	ic.pos = ic.data_offset;
+
+	/* the data of the base with the changes that fit in it... */
+	pos = 0;
+	for(i = 0; i < ninplace; ++i)
+	{
+		struct incremental_file *file = INC_FILE(file_nodes[inplace[i]]);
+		TRYLBL(incremental_copy_base(&ic, pos, file->offset - pos), out);
+		TRYLBL(incremental_write_change(&ic, file_nodes[inplace[i]], ALIGN(file->size, 16)), out);
+		pos = file->offset + ALIGN(file->size, 16);
+	}
+	TRYLBL(incremental_copy_base(&ic, pos, data_end - pos), out);
+	/* ...and then the ones that didn't, in the order they were given an offset */
+	for(i = 0; i < file_count; ++i)
+		if(offsets[i] >= data_end && nnc_vfs_node_size(file_nodes[i]))
+			TRYLBL(incremental_write_change(&ic, file_nodes[i], ALIGN(nnc_vfs_node_size(file_nodes[i]), 16)), out);
+
+	ret = NNC_WS_CALL0(writer, close);
+	writer.funcs = NULL;
 
 out:
 	if(writer.funcs && ret != NNC_R_OK)
 		nnc_ivfc_abort_write(&writer);
+	nnc_romfs_free_meta(&ctx);
+	nnc_vfs_free(&merged);
+	free(file_nodes);
+	free(offsets);
+	free(inplace);
+	free(ic.buf);
+	free(ic.hashes);
+	return ret;
+}
+
+/* diffing two RomFS images */
+
+#define DIFF_CHUNK (64 * 1024)
+#define DIFF_MERGE_GAP 32
+
+struct diff_side {
+	nnc_romfs_ctx *ctx;
+	nnc_romfs_listing *list;
+	nnc_sha256_hash *hashes; /* NULL if they can't be used */
+	struct romfs_hash_layout layout;
+	u8 *buf;
+};
+
+struct diff_ctx {
+	struct diff_side a, b;
+	struct dynbuf entries, ranges;
+	u64 bytes_read;
+};
+
+/* changed ranges are collected here and merged with the ones close before them */
+struct diff_range_state {
+	struct dynbuf *out;
+	nnc_romfs_range cur;
+	bool open;
+};
+
+static result diff_range_flush(struct diff_range_state *rs)
+{
+	if(!rs->open) return NNC_R_OK;
+	rs->open = false;
+	return dynbuf_push(rs->out, (u8 *) &rs->cur, sizeof(rs->cur));
+}
+
+static result diff_range_add(struct diff_range_state *rs, u64 start, u64 end)
+{
+	result ret;
+	if(rs->open && start <= rs->cur.offset + rs->cur.size + DIFF_MERGE_GAP)
+	{
+		rs->cur.size = end - rs->cur.offset;
+		return NNC_R_OK;
+	}
+	TRY(diff_range_flush(rs));
+	rs->cur.offset = start;
+	rs->cur.size = end - start;
+	rs->open = true;
+	return NNC_R_OK;
+}
+
+static result diff_open_side(struct diff_side *side, nnc_romfs_ctx *ctx, nnc_romfs_listing *list)
+{
+	result ret;
+	side->ctx = ctx;
+	side->list = list;
+	side->hashes = NULL;
+	if(!(side->buf = malloc(DIFF_CHUNK)))
+		return NNC_R_NOMEM;
+	TRY(nnc_romfs_list_all(ctx, list));
+	/* without hashes everything is compared byte for byte */
+	if(romfs_hash_layout(ctx->rs, &side->layout) != NNC_R_OK || side->layout.block_size > DIFF_CHUNK
+			|| ctx->header.data_offset < side->layout.l3_offset
+			|| side->layout.blocks > UINT32_MAX / sizeof(nnc_sha256_hash))
+		return NNC_R_OK;
+	if(!(side->hashes = malloc(side->layout.blocks * sizeof(nnc_sha256_hash) + 1)))
+		return NNC_R_NOMEM;
+	return read_at_exact(ctx->rs, side->layout.l2_offset, (u8 *) side->hashes,
+		side->layout.blocks * sizeof(nnc_sha256_hash));
+}
+
+/* compares the first `size` bytes of file ia in a and file ib in b, if `ranges`
+ * is NULL this stops at the first difference */
+static result diff_data(struct diff_ctx *dc, u32 ia, u32 ib, u64 size, struct diff_range_state *ranges, bool *equal)
+{
+	struct diff_side *a = &dc->a, *b = &dc->b;
+	u64 pa = a->ctx->header.data_offset + a->list->file_offsets[ia];
+	u64 pb = b->ctx->header.data_offset + b->list->file_offsets[ib];
+	u32 bs = a->layout.block_size;
+	/* the hashes can only be compared if the blocks hold the same part of the file */
+	bool blocks = a->hashes && b->hashes && bs == b->layout.block_size
+		&& (pa - a->layout.l3_offset) % bs == (pb - b->layout.l3_offset) % bs;
+	result ret;
 
-	nnc_dynbuf_free(&ctx.file_meta);
-	nnc_dynbuf_free(&ctx.dir_meta);
-	nnc_cbuf_free(&ctx.cbuf);
-	free(ctx.file_hash);
-	free(ctx.dir_hash);
+	*equal = true;
+	for(u64 pos = 0, len; pos < size; pos += len)
+	{
+		u64 la = pa + pos - a->layout.l3_offset, lb = pb + pos - b->layout.l3_offset;
+		if(!blocks)
+			len = MIN(size - pos, DIFF_CHUNK);
+		else if(la % bs != 0 || size - pos < bs)
+			/* up to the next block boundary, this block also holds other data */
+			len = MIN(size - pos, bs - la % bs);
+		else
+		{
+			u64 ba = la / bs, bb = lb / bs, n = MIN((size - pos) / bs, DIFF_CHUNK / bs), same = 0;
+			n = MIN(n, MIN(a->layout.blocks - MIN(ba, a->layout.blocks), b->layout.blocks - MIN(bb, b->layout.blocks)));
+			while(same < n && memcmp(a->hashes[ba + same], b->hashes[bb + same], sizeof(nnc_sha256_hash)) == 0)
+				++same;
+			if(same)
+			{
+				len = same * bs;
+				continue;
+			}
+			/* read all blocks that differ at once */
+			for(len = 1; len < n && memcmp(a->hashes[ba + len], b->hashes[bb + len], sizeof(nnc_sha256_hash)) != 0; ++len)
+				;
+			len = n ? len * bs : MIN(size - pos, bs);
+		}
 
+		TRY(read_at_exact(a->ctx->rs, pa + pos, a->buf, len));
+		TRY(read_at_exact(b->ctx->rs, pb + pos, b->buf, len));
+		dc->bytes_read += len * 2;
+		if(memcmp(a->buf, b->buf, len) == 0)
+			continue;
+		*equal = false;
+		if(!ranges)
+			return NNC_R_OK;
+		for(u64 i = 0; i < len; )
+		{
+			if(a->buf[i] == b->buf[i])
+			{
+				++i;
+				continue;
+			}
+			u64 start = i;
+			while(i < len && a->buf[i] != b->buf[i])
+				++i;
+			TRY(diff_range_add(ranges, pos + start, pos + i));
+		}
+	}
+	return NNC_R_OK;
+}
+
+static result diff_push_entry(struct diff_ctx *dc, enum nnc_romfs_change change, u32 ia, u32 ib)
+{
+	nnc_romfs_diff_entry ent;
+	ent.change = change;
+	ent.path_a = ia == INVAL ? NULL : dc->a.list->strings + dc->a.list->file_paths[ia];
+	ent.path_b = ib == INVAL ? NULL : dc->b.list->strings + dc->b.list->file_paths[ib];
+	ent.size_a = ia == INVAL ? 0 : dc->a.list->file_sizes[ia];
+	ent.size_b = ib == INVAL ? 0 : dc->b.list->file_sizes[ib];
+	ent.first_range = dc->ranges.used / sizeof(nnc_romfs_range);
+	ent.range_count = 0;
+	return dynbuf_push(&dc->entries, (u8 *) &ent, sizeof(ent));
+}
+
+/* both files are in a and b, only adds an entry if they differ */
+static result diff_file(struct diff_ctx *dc, u32 ia, u32 ib)
+{
+	u64 size_a = dc->a.list->file_sizes[ia], size_b = dc->b.list->file_sizes[ib];
+	u32 first = dc->ranges.used / sizeof(nnc_romfs_range);
+	struct diff_range_state rs = { &dc->ranges, { 0, 0 }, false };
+	bool equal;
+	result ret;
+	TRY(diff_data(dc, ia, ib, MIN(size_a, size_b), &rs, &equal));
+	if(size_a != size_b)
+		TRY(diff_range_add(&rs, MIN(size_a, size_b), MAX(size_a, size_b)));
+	TRY(diff_range_flush(&rs));
+	if(equal && size_a == size_b)
+		return NNC_R_OK;
+	/* the ranges were already added, the entry points back at them */
+	u32 count = dc->ranges.used / sizeof(nnc_romfs_range) - first;
+	TRY(diff_push_entry(dc, NNC_ROMFS_MODIFIED, ia, ib));
+	nnc_romfs_diff_entry *ent = (nnc_romfs_diff_entry *) (dc->entries.buffer + dc->entries.used) - 1;
+	ent->first_range = first;
+	ent->range_count = count;
+	return NNC_R_OK;
+}
+
+struct diff_path {
+	const char *path;
+	u32 index;
+};
+
+static int diff_path_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct diff_path *) a)->path, ((const struct diff_path *) b)->path);
+}
+
+static struct diff_path *diff_sorted_paths(nnc_romfs_listing *list)
+{
+	struct diff_path *paths = malloc(list->file_count * sizeof(struct diff_path) + 1);
+	if(!paths) return NULL;
+	for(u32 i = 0; i < list->file_count; ++i)
+	{
+		paths[i].path = list->strings + list->file_paths[i];
+		paths[i].index = i;
+	}
+	qsort(paths, list->file_count, sizeof(struct diff_path), diff_path_cmp);
+	return paths;
+}
+
+/* an added file with the same data as a removed file turns the removed entry into
+ * a move and drops the added one, `ia` and `ib` map entries back to file indices */
+static result diff_find_moves(struct diff_ctx *dc, const u32 *ia, const u32 *ib)
+{
+	nnc_romfs_diff_entry *ents = (nnc_romfs_diff_entry *) dc->entries.buffer;
+	u32 count = dc->entries.used / sizeof(nnc_romfs_diff_entry), kept = 0;
+	bool equal;
+	result ret;
+	for(u32 i = 0; i < count; ++i)
+	{
+		if(ents[i].change != NNC_ROMFS_ADDED)
+			continue;
+		for(u32 j = 0; j < count; ++j)
+		{
+			if(ents[j].change != NNC_ROMFS_REMOVED || ents[j].size_a != ents[i].size_b)
+				continue;
+			TRY(diff_data(dc, ia[j], ib[i], ents[i].size_b, NULL, &equal));
+			if(!equal) continue;
+			ents[j].change = NNC_ROMFS_MOVED;
+			ents[j].path_b = ents[i].path_b;
+			ents[j].size_b = ents[i].size_b;
+			ents[i].path_b = NULL;
+			break;
+		}
+	}
+	for(u32 i = 0; i < count; ++i)
+		if(ents[i].path_a || ents[i].path_b)
+			ents[kept++] = ents[i];
+	dc->entries.used = kept * sizeof(nnc_romfs_diff_entry);
+	return NNC_R_OK;
+}
+
+result nnc_romfs_diff(nnc_romfs_ctx *a, nnc_romfs_ctx *b, nnc_romfs_diff_report *diff)
+{
+	struct diff_path *pa = NULL, *pb = NULL;
+	u32 *map_a = NULL, *map_b = NULL;
+	struct diff_ctx dc;
+	result ret;
+
+	memset(diff, 0, sizeof(*diff));
+	dc.a.buf = dc.b.buf = NULL;
+	dc.a.hashes = dc.b.hashes = NULL;
+	dc.entries.buffer = dc.ranges.buffer = NULL;
+	dc.bytes_read = 0;
+	TRYLBL(dynbuf_new(&dc.entries, 64 * sizeof(nnc_romfs_diff_entry)), out);
+	TRYLBL(dynbuf_new(&dc.ranges, 64 * sizeof(nnc_romfs_range)), out);
+	TRYLBL(diff_open_side(&dc.a, a, &diff->a), out);
+	TRYLBL(diff_open_side(&dc.b, b, &diff->b), out);
+
+	ret = NNC_R_NOMEM;
+	u32 na = diff->a.file_count, nb = diff->b.file_count, i = 0, j = 0;
+	/* every entry has at most one file of each */
+	map_a = malloc(((u64) na + nb) * sizeof(u32) + 1);
+	map_b = malloc(((u64) na + nb) * sizeof(u32) + 1);
+	if(!(pa = diff_sorted_paths(&diff->a)) || !(pb = diff_sorted_paths(&diff->b)) || !map_a || !map_b)
+		goto out;
+
+	while(i < na || j < nb)
+	{
+		int cmp = i == na ? 1 : j == nb ? -1 : strcmp(pa[i].path, pb[j].path);
+		u32 before = dc.entries.used, ia = cmp <= 0 ? pa[i].index : INVAL, ib = cmp >= 0 ? pb[j].index : INVAL;
+		if(cmp < 0)      ret = diff_push_entry(&dc, NNC_ROMFS_REMOVED, ia, INVAL);
+		else if(cmp > 0) ret = diff_push_entry(&dc, NNC_ROMFS_ADDED, INVAL, ib);
+		else             ret = diff_file(&dc, ia, ib);
+		if(ret != NNC_R_OK) goto out;
+		if(dc.entries.used != before)
+		{
+			map_a[before / sizeof(nnc_romfs_diff_entry)] = ia;
+			map_b[before / sizeof(nnc_romfs_diff_entry)] = ib;
+		}
+		if(cmp <= 0) ++i;
+		if(cmp >= 0) ++j;
+	}
+	TRYLBL(diff_find_moves(&dc, map_a, map_b), out);
+
+	diff->entries = (nnc_romfs_diff_entry *) dc.entries.buffer;
+	diff->count = dc.entries.used / sizeof(nnc_romfs_diff_entry);
+	diff->ranges = (nnc_romfs_range *) dc.ranges.buffer;
+	diff->range_count = dc.ranges.used / sizeof(nnc_romfs_range);
+	diff->bytes_read = dc.bytes_read;
+	dc.entries.buffer = dc.ranges.buffer = NULL;
+	ret = NNC_R_OK;
+
+out:
+	free(pa);
+	free(pb);
+	free(map_a);
+	free(map_b);
+	free(dc.a.buf);
+	free(dc.b.buf);
+	free(dc.a.hashes);
+	free(dc.b.hashes);
+	free(dc.entries.buffer);
+	free(dc.ranges.buffer);
+	if(ret != NNC_R_OK)
+		nnc_romfs_free_diff(diff);
 	return ret;
 }
+
+void nnc_romfs_free_diff(nnc_romfs_diff_report *diff)
+{
+	free(diff->entries);
+	free(diff->ranges);
+	nnc_romfs_free_listing(&diff->a);
+	nnc_romfs_free_listing(&diff->b);
+	diff->entries = NULL;
+	diff->ranges = NULL;
+	diff->count = diff->range_count = 0;
+}
@@ -1,18 +1,10 @@
 
-#include <mbedtls/version.h>
 #include <nnc/sigcert.h>
-#include <mbedtls/pk.h>
 #include <string.h>
 #include <stdlib.h>
+#include "./crypto_backend.h"
 #include "./internal.h"
 
-/* In MbedTLS version 3 struct members are now accessed with MBEDTLS_PRIVATE */
-#if MBEDTLS_VERSION_MAJOR == 3
-	#define ACCESS_PRIV(name) MBEDTLS_PRIVATE(name)
-#else
-	#define ACCESS_PRIV(name) name
-#endif
-
 #define NNC_SIGTYPE_IS_NONE(s) ((s) >= NNC_SIG_NONE && (s) <= NNC_SIG_NONE + NNC_SIG_ECDSA_SHA256)
 
 #define SIGN_MAX 5
@@ -105,14 +97,7 @@ const char *nnc_sigstr(enum nnc_sigtype sig)
 	return NULL;
 }
 
-static void import_rsa(mbedtls_rsa_context *ctx, u8 *mod, u16 mod_size, u8 *exp)
-{
-	mbedtls_mpi_read_binary(&ctx->ACCESS_PRIV(N), mod, mod_size);
-	mbedtls_mpi_read_binary(&ctx->ACCESS_PRIV(E), exp, 0x4);
-	ctx->ACCESS_PRIV(len) = mod_size;
-}
-
-static bool setup_pk(nnc_certchain *chain, nnc_signature *sig, mbedtls_pk_context *ctx)
+static nnc_certificate *find_cert(nnc_certchain *chain, nnc_signature *sig)
 {
 	nnc_certificate *cert;
 	/* (usually?) in the form (issuer user)-(certificate used to verify certificate)-(certificate name) */
@@ -124,82 +109,224 @@ static bool setup_pk(nnc_certchain *chain, nnc_signature *sig, mbedtls_pk_contex
 		cert = &chain->certs[i];
 		if(strcmp(cert->name, signame) == 0)
 		{
-			/* found cert we want to import */
 			switch(cert->type)
 			{
 			case NNC_CERT_RSA_2048:
 				if(!(sig->type == NNC_SIG_RSA_2048_SHA1 || sig->type == NNC_SIG_RSA_2048_SHA256))
 					continue; /* invalid cert/sig pair */
-				import_rsa(mbedtls_pk_rsa(*ctx), cert->data.rsa2048.modulus,
-					0x100, cert->data.rsa2048.exp);
-				return true;
+				return cert;
 			case NNC_CERT_RSA_4096:
 				if(!(sig->type == NNC_SIG_RSA_4096_SHA1 || sig->type == NNC_SIG_RSA_4096_SHA256))
 					continue; /* invalid cert/sig pair */
-				import_rsa(mbedtls_pk_rsa(*ctx), cert->data.rsa4096.modulus,
-					0x200, cert->data.rsa4096.exp);
-				return true;
+				return cert;
 			case NNC_CERT_ECDSA:
 				if(!(sig->type == NNC_SIG_ECDSA_SHA1 || sig->type == NNC_SIG_ECDSA_SHA256))
 					continue; /* invalid cert/sig pair */
-				/* TODO: implement ECDSA certificates */
-				continue;
+				return cert;
 			}
 		}
 	}
-	return false;
+	return NULL;
 }
 
-result nnc_verify_signature(nnc_certchain *chain, nnc_signature *sig, nnc_sha_hash hash)
+/* parsed public keys are kept around, the same few CA, CP and XS certificates
+ * are used to verify pretty much everything. Keys are matched on the name and
+ * the full key material so a different certificate with the same name can
+ * never be mistaken for a cached one. */
+
+struct pubkey {
+	const nnc_crypto_backend *backend;
+	void *key;
+	struct pubkey *next;
+	enum nnc_certificate_type type;
+	char name[0x41];
+	union nnc_certificate_data data;
+	u32 refs;
+};
+
+/* amount of unused keys we keep around */
+#define PUBKEY_MAX_IDLE 16
+
+static nnc_mutex pubkeys_lock = NNC_MUTEX_INIT;
+static struct pubkey *pubkeys; /* most recently used first */
+static u32 pubkeys_idle;
+
+static u32 pubkey_data_size(enum nnc_certificate_type type)
 {
-	const mbedtls_pk_info_t *pkinfo;
-	switch(sig->type)
+	switch(type)
 	{
-	case NNC_SIG_RSA_4096_SHA1:
-	case NNC_SIG_RSA_2048_SHA1:
-	case NNC_SIG_RSA_4096_SHA256:
-	case NNC_SIG_RSA_2048_SHA256:
-		pkinfo = mbedtls_pk_info_from_type(MBEDTLS_PK_RSA);
+	case NNC_CERT_RSA_2048: return sizeof(struct nnc_certificate_rsa2048);
+	case NNC_CERT_RSA_4096: return sizeof(struct nnc_certificate_rsa4096);
+	case NNC_CERT_ECDSA: return sizeof(struct nnc_certificate_ecdsa);
+	}
+	return 0;
+}
+
+static result pubkey_get(nnc_certificate *cert, struct pubkey **out)
+{
+	const nnc_crypto_backend *backend = CRYPTO;
+	u32 data_size = pubkey_data_size(cert->type);
+	struct pubkey *pk, **link;
+	result ret;
+	if(!data_size) return NNC_R_INVALID_CERT;
+
+	mutex_lock(&pubkeys_lock);
+	for(link = &pubkeys; (pk = *link); link = &pk->next)
+	{
+		if(pk->backend == backend && pk->type == cert->type && strcmp(pk->name, cert->name) == 0
+			&& memcmp(&pk->data, &cert->data, data_size) == 0)
+		{
+			if(pk->refs++ == 0) --pubkeys_idle;
+			/* move to the front */
+			*link = pk->next;
+			pk->next = pubkeys;
+			pubkeys = pk;
+			mutex_unlock(&pubkeys_lock);
+			*out = pk;
+			return NNC_R_OK;
+		}
+	}
+	mutex_unlock(&pubkeys_lock);
+
+	/* not found, parse the key without holding the lock */
+	if(!(pk = malloc(sizeof(struct pubkey))))
+		return NNC_R_NOMEM;
+	switch(cert->type)
+	{
+	case NNC_CERT_RSA_2048:
+		ret = backend->rsa_key_new(&pk->key, cert->data.rsa2048.modulus, 0x100, cert->data.rsa2048.exp);
 		break;
-	case NNC_SIG_ECDSA_SHA1:
-	case NNC_SIG_ECDSA_SHA256:
-		pkinfo = mbedtls_pk_info_from_type(MBEDTLS_PK_ECDSA);
+	case NNC_CERT_RSA_4096:
+		ret = backend->rsa_key_new(&pk->key, cert->data.rsa4096.modulus, 0x200, cert->data.rsa4096.exp);
 		break;
 	default:
-		pkinfo = NULL;
+		ret = backend->ecdsa_key_new(&pk->key, cert->data.ecdsa.pubkey);
 		break;
 	}
-	if(!pkinfo) return NNC_R_INVALID_SIG;
-
-	mbedtls_pk_context ctx;
-	mbedtls_pk_init(&ctx);
-	mbedtls_pk_setup(&ctx, pkinfo);
-	if(!setup_pk(chain, sig, &ctx))
+	if(ret != NNC_R_OK)
 	{
-		mbedtls_pk_free(&ctx);
-		return NNC_R_CERT_NOT_FOUND;
+		free(pk);
+		return ret;
 	}
+	pk->backend = backend;
+	pk->type = cert->type;
+	strcpy(pk->name, cert->name);
+	memcpy(&pk->data, &cert->data, data_size);
+	pk->refs = 1;
+
+	mutex_lock(&pubkeys_lock);
+	pk->next = pubkeys;
+	pubkeys = pk;
+	mutex_unlock(&pubkeys_lock);
+	*out = pk;
+	return NNC_R_OK;
+}
 
-	bool ret;
+static void pubkey_put(struct pubkey *pk)
+{
+	struct pubkey *victim = NULL, **link, **victim_link = NULL;
+	mutex_lock(&pubkeys_lock);
+	if(--pk->refs == 0 && ++pubkeys_idle > PUBKEY_MAX_IDLE)
+	{
+		/* too many unused keys, get rid of the least recently used one */
+		for(link = &pubkeys; *link; link = &(*link)->next)
+			if((*link)->refs == 0)
+				victim_link = link;
+		victim = *victim_link;
+		*victim_link = victim->next;
+		--pubkeys_idle;
+	}
+	mutex_unlock(&pubkeys_lock);
+	if(victim)
+	{
+		victim->backend->key_free(victim->key);
+		free(victim);
+	}
+}
 
+result nnc_verify_signature(nnc_certchain *chain, nnc_signature *sig, nnc_sha_hash hash)
+{
+	enum nnc_crypto_hash md;
 	switch(sig->type)
 	{
 	case NNC_SIG_RSA_4096_SHA1:
 	case NNC_SIG_RSA_2048_SHA1:
 	case NNC_SIG_ECDSA_SHA1:
-		ret = mbedtls_pk_verify(&ctx, MBEDTLS_MD_SHA1, hash, sizeof(nnc_sha1_hash), sig->data, nnc_sig_dsize(sig->type)) == 0;
+		md = NNC_CRYPTO_SHA1;
 		break;
 	case NNC_SIG_RSA_4096_SHA256:
 	case NNC_SIG_RSA_2048_SHA256:
 	case NNC_SIG_ECDSA_SHA256:
-		ret = mbedtls_pk_verify(&ctx, MBEDTLS_MD_SHA256, hash, sizeof(nnc_sha256_hash), sig->data, nnc_sig_dsize(sig->type)) == 0;
+		md = NNC_CRYPTO_SHA256;
 		break;
 	default:
-		ret = false;
+		return NNC_R_INVALID_SIG;
 	}
 
-	mbedtls_pk_free(&ctx);
-	return ret ? NNC_R_OK : NNC_R_BAD_SIG;
+	nnc_certificate *cert = find_cert(chain, sig);
+	if(!cert) return NNC_R_CERT_NOT_FOUND;
+
+	struct pubkey *pk;
+	result ret;
+	TRY(pubkey_get(cert, &pk));
+	ret = pk->backend->key_verify(pk->key, md, hash, sig->data);
+	pubkey_put(pk);
+	return ret;
+}
+
+struct verify_batch {
+	nnc_certchain *chain;
+	nnc_signature_check *checks;
+	u32 count, next;
+	nnc_mutex lock;
+};
+
+static void verify_batch_worker(void *arg)
+{
+	struct verify_batch *batch = arg;
+	nnc_signature_check *check;
+	nnc_memory mem;
+	for(;;)
+	{
+		mutex_lock(&batch->lock);
+		check = batch->next < batch->count ? &batch->checks[batch->next++] : NULL;
+		mutex_unlock(&batch->lock);
+		if(!check) break;
+
+		if(check->data)
+		{
+			nnc_mem_open(&mem, check->data, check->size);
+			check->status = nnc_sighash(NNC_RSP(&mem), check->sig->type, check->hash, check->size);
+			if(check->status != NNC_R_OK) continue;
+		}
+		check->status = nnc_verify_signature(batch->chain, check->sig, check->hash);
+	}
+}
+
+result nnc_verify_signatures_batch(nnc_certchain *chain, nnc_signature_check *checks, u32 count, u32 threads)
+{
+	struct verify_batch batch = { .chain = chain, .checks = checks, .count = count, .next = 0 };
+	nnc_thread *workers = NULL;
+	u32 started = 0;
+	result ret;
+	TRY(mutex_init(&batch.lock));
+
+	/* the calling thread is one of the workers */
+	threads = MIN(threads, count);
+	if(threads > 1 && (workers = malloc(sizeof(nnc_thread) * (threads - 1))))
+		for(; started < threads - 1; ++started)
+			if(thread_create(&workers[started], verify_batch_worker, &batch) != NNC_R_OK)
+				break; /* we'll just have to do with less threads */
+	verify_batch_worker(&batch);
+	for(u32 i = 0; i < started; ++i)
+		thread_join(&workers[i]);
+	free(workers);
+	mutex_destroy(&batch.lock);
+
+	for(u32 i = 0; i < count; ++i)
+		if(checks[i].status != NNC_R_OK)
+			return checks[i].status;
+	return NNC_R_OK;
 }
 
 nnc_result nnc_sighash(nnc_rstream *rs, enum nnc_sigtype sig, nnc_sha_hash digest, u32 size)
@@ -221,6 +348,11 @@ nnc_result nnc_sighash(nnc_rstream *rs, enum nnc_sigtype sig, nnc_sha_hash diges
 }
 
 nnc_result nnc_read_certchain(nnc_rstream *rs, nnc_certchain *chain, bool extend)
+{
+	return read_certchain_al(rs, chain, extend, &default_allocator);
+}
+
+result nnc_read_certchain_al(nnc_rstream *rs, nnc_certchain *chain, bool extend, const nnc_allocator *al)
 {
 	NNC_RS_PCALL(rs, seek_abs, 0);
 	u32 size = NNC_RS_PCALL0(rs, size);
@@ -229,11 +361,13 @@ nnc_result nnc_read_certchain(nnc_rstream *rs, nnc_certchain *chain, bool extend
 	result res;
 
 	u32 len = 0;
+	nnc_certificate *grown;
 	if(chain)
 	{
-		if(extend) chain->certs = realloc(chain->certs, sizeof(nnc_certificate) * (chain->len + 3));
-		else { chain->certs = malloc(sizeof(nnc_certificate) * 3); chain->len = 0; }
-		if(!chain->certs) return NNC_R_NOMEM;
+		if(extend) grown = al_realloc(al, chain->certs, sizeof(nnc_certificate) * (chain->len + 3));
+		else { grown = al_alloc(al, sizeof(nnc_certificate) * 3); chain->len = 0; }
+		if(!grown) return NNC_R_NOMEM;
+		chain->certs = grown;
 		len = chain->len;
 	}
 
@@ -244,8 +378,12 @@ nnc_result nnc_read_certchain(nnc_rstream *rs, nnc_certchain *chain, bool extend
 		/* we need to allocate more */
 		if(chain && !left)
 		{
-			chain->certs = realloc(chain->certs, sizeof(nnc_certificate) * (len + 3));
-			if(!chain->certs) return NNC_R_NOMEM;
+			if(!(grown = al_realloc(al, chain->certs, sizeof(nnc_certificate) * (len + 3))))
+			{
+				res = NNC_R_NOMEM;
+				goto err;
+			}
+			chain->certs = grown;
 			left = 3;
 		}
 		--left;
@@ -291,21 +429,29 @@ nnc_result nnc_read_certchain(nnc_rstream *rs, nnc_certchain *chain, bool extend
 	return NNC_R_OK;
 err:
 	if(chain && !extend)
-		free(chain->certs);
+	{
+		al_free(al, chain->certs);
+		chain->certs = NULL;
+	}
 	return res;
 }
 
 void nnc_scan_certchains(nnc_certchain *chain)
 {
 	chain->len = 0;
-	bool extend = false;
+	scan_certchains_al(chain, false, &default_allocator);
+}
+
+result nnc_scan_certchains_al(nnc_certchain *chain, bool extend, const nnc_allocator *al)
+{
 	char path[SUP_FILE_NAME_LEN];
 	nnc_file file;
+	result ret = NNC_R_OK;
 #define DOFILE(name) \
-	if(find_support_file(name, path)) \
+	if(ret != NNC_R_NOMEM && find_support_file(name, path)) \
 		if(nnc_file_open(&file, path) == NNC_R_OK) { \
-			nnc_read_certchain(NNC_RSP(&file), chain, extend); \
-			extend = true; \
+			ret = read_certchain_al(NNC_RSP(&file), chain, extend, al); \
+			extend = extend || ret == NNC_R_OK; \
 			NNC_RS_CALL0(file, close); \
 		} \
 	/* Certificate usually used for TMDs */
@@ -319,6 +465,8 @@ void nnc_scan_certchains(nnc_certchain *chain)
 	/* Certificate used as a combination of all certificates */
 	DOFILE("cert_bundle.bin");
 #undef DOFILE
+	/* missing or bad chains are skipped, only running out of memory is fatal */
+	return ret == NNC_R_NOMEM ? ret : NNC_R_OK;
 }
 
 void nnc_free_certchain(nnc_certchain *chain)
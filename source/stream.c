@@ -9,12 +9,14 @@
 
 #if NNC_PLATFORM_UNIX
 	#include <unistd.h>
+	#include <fcntl.h>
 #endif
 
 #include <nnc/crypto.h>
 #include <nnc/stream.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #define FILE_SIZE_NULL ((u32) -1)
 
@@ -218,7 +220,7 @@ nnc_result nnc_open_header_saver(nnc_header_saver *self, nnc_wstream *child, nnc
 
 static result mem_read(nnc_memory *self, u8 *buf, u32 max, u32 *totalRead)
 {
-	*totalRead = MIN(max, self->size);
+	*totalRead = MIN(max, self->size - self->pos);
 	memcpy(buf, ((u8 *) self->un.ptr_const) + self->pos, *totalRead);
 	self->pos += *totalRead;
 	return NNC_R_OK;
@@ -517,6 +519,18 @@ nnc_result nnc_vfs_add_directory(nnc_vfs_directory_node *dir, const char *vname,
 	#define WINDOWS_API 1
 #endif
 
+result nnc_make_directory(const char *path)
+{
+#if DIRENT_API
+	return mkdir(path, 0777) == 0 || errno == EEXIST ? NNC_R_OK : NNC_R_OS;
+#elif WINDOWS_API
+	return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS ? NNC_R_OK : NNC_R_OS;
+#else
+	(void) path;
+	return NNC_R_UNSUPPORTED;
+#endif
+}
+
 struct filename_builder {
 	char *buf;
 	unsigned alloc, basepos;
@@ -946,7 +960,9 @@ nnc_result nnc_copy(nnc_rstream *from, nnc_wstream *to, u32 *copied)
 	u8 block[BLOCK_SZ];
 	u32 left = NNC_RS_PCALL0(from, size), next, actual;
 	result ret;
-	TRY(NNC_RS_PCALL(from, seek_abs, 0));
+	/* streams don't allow seeking to their end, so an empty one can't be rewound */
+	if(left != 0)
+		TRY(NNC_RS_PCALL(from, seek_abs, 0));
 
 	if(copied) *copied = left;
 	while(left != 0)
@@ -963,23 +979,381 @@ nnc_result nnc_copy(nnc_rstream *from, nnc_wstream *to, u32 *copied)
 
 nnc_result nnc_write_padding(nnc_wstream *self, nnc_u32 count)
 {
-	u8 buffer[4096];
-	/* if count < sizeof(buffer) it makes no sense to completely fill it with 0s */
-	memset(buffer, 0x00, MIN(count, sizeof(buffer)));
+	/* never written to, so this doesn't have to be cleared for every call */
+	static u8 zeros[4096];
 
 	nnc_u32 left = count, to_do;
 	nnc_result ret;
 
 	while(left)
 	{
-		to_do = MIN(left, sizeof(buffer));
-		TRY(self->funcs->write(self, buffer, to_do));
+		to_do = MIN(left, sizeof(zeros));
+		TRY(self->funcs->write(self, zeros, to_do));
 		left -= to_do;
 	}
 
 	return NNC_R_OK;
 }
 
+/* Prefetching: one thread opens and reads the nodes in order into a ring
+ * buffer while the writer empties it. Only the prefetch thread touches the
+ * node streams so streams shared between nodes are still read one at a time.
+ * Real files are opened a few nodes ahead so the kernel can start reading
+ * them before their turn comes. */
+#define PREFETCH_CHUNK (256 * 1024)
+#define PREFETCH_OPEN_AHEAD 8
+
+struct nnc_prefetch {
+	nnc_vfs_file_node **nodes;
+	u32 count;
+	u32 next;        /* node the writer copies next */
+	nnc_mutex lock;
+	nnc_cond cond;   /* signalled on any progress of either side */
+	u8 *ring;
+	u32 ring_size;
+	u64 produced, consumed;
+	u64 *ends;       /* ends[i] is the value of produced after node i, valid below nodes_done */
+	u32 nodes_done;
+	result ret;      /* why node nodes_done failed if failed is set */
+	bool failed, quit, threaded;
+	nnc_thread thread;
+};
+
+static void prefetch_advise(nnc_vfs_stream *stream)
+{
+#if NNC_PLATFORM_UNIX && defined(POSIX_FADV_WILLNEED)
+	if(stream->substream->funcs == &file_funcs)
+		posix_fadvise(fileno(((nnc_file *) stream->substream)->f), 0, 0, POSIX_FADV_WILLNEED);
+#else
+	(void) stream;
+#endif
+}
+
+/* reads all of a node into the ring, returns NNC_R_OK early on quit */
+static result prefetch_read_node(nnc_prefetch *self, nnc_vfs_stream *stream)
+{
+	u32 left = nnc_rs_size(stream), next, actual;
+	result ret;
+	/* streams don't allow seeking to their end, so an empty one can't be rewound */
+	if(left != 0)
+		TRY(nnc_rs_seek_abs(stream, 0));
+	while(left != 0)
+	{
+		mutex_lock(&self->lock);
+		while(!self->quit && self->produced - self->consumed == self->ring_size)
+			cond_wait(&self->cond, &self->lock);
+		u32 pos = self->produced % self->ring_size;
+		next = self->ring_size - (self->produced - self->consumed);
+		bool quit = self->quit;
+		mutex_unlock(&self->lock);
+		if(quit) return NNC_R_OK;
+
+		next = MIN(MIN(next, self->ring_size - pos), MIN(left, PREFETCH_CHUNK));
+		TRY(NNC_RS_CALL(*stream, read, self->ring + pos, next, &actual));
+		if(actual != next) return NNC_R_TOO_SMALL;
+
+		mutex_lock(&self->lock);
+		self->produced += next;
+		cond_broadcast(&self->cond);
+		mutex_unlock(&self->lock);
+		left -= next;
+	}
+	return NNC_R_OK;
+}
+
+static void prefetch_worker(void *arg)
+{
+	nnc_prefetch *self = arg;
+	nnc_vfs_stream open[PREFETCH_OPEN_AHEAD];
+	u32 opened = 0, closed = 0; /* nodes in [closed, opened) are open */
+	result ret = NNC_R_OK;
+
+	for(u32 i = 0; i < self->count && ret == NNC_R_OK; ++i)
+	{
+		if(opened == i)
+		{
+			if((ret = nnc_vfs_open_node(self->nodes[i], &open[i % PREFETCH_OPEN_AHEAD])) != NNC_R_OK)
+				break;
+			++opened;
+		}
+		/* other streams may be shared between nodes, so only files are opened early.
+		 * A file that fails to open is opened again when it's its turn, that reports the error */
+		while(opened < self->count && opened < i + PREFETCH_OPEN_AHEAD
+			&& self->nodes[opened]->generator == &nnc__internal_vfs_generator_file
+			&& nnc_vfs_open_node(self->nodes[opened], &open[opened % PREFETCH_OPEN_AHEAD]) == NNC_R_OK)
+			prefetch_advise(&open[opened++ % PREFETCH_OPEN_AHEAD]);
+
+		ret = prefetch_read_node(self, &open[i % PREFETCH_OPEN_AHEAD]);
+		nnc_rs_close(&open[i % PREFETCH_OPEN_AHEAD]);
+		closed = i + 1;
+
+		mutex_lock(&self->lock);
+		if(self->quit) ret = NNC_R_INVAL;
+		else if(ret == NNC_R_OK)
+		{
+			self->ends[i] = self->produced;
+			self->nodes_done = i + 1;
+			cond_broadcast(&self->cond);
+		}
+		mutex_unlock(&self->lock);
+	}
+	/* on failure or quit the nodes that were opened early are still open */
+	for(; closed < opened; ++closed)
+		nnc_rs_close(&open[closed % PREFETCH_OPEN_AHEAD]);
+
+	mutex_lock(&self->lock);
+	if(ret != NNC_R_OK)
+	{
+		self->ret = ret;
+		self->failed = true;
+		cond_broadcast(&self->cond);
+	}
+	mutex_unlock(&self->lock);
+}
+
+result nnc_prefetch_start(nnc_prefetch **out, nnc_vfs_file_node **nodes, u32 count, u32 budget)
+{
+	nnc_prefetch *self = calloc(1, sizeof(nnc_prefetch));
+	if(!self) return NNC_R_NOMEM;
+	self->nodes = nodes;
+	self->count = count;
+	*out = self;
+	if(budget == 0 || count == 0)
+		return NNC_R_OK;
+
+	self->ring_size = budget;
+	if(!(self->ring = malloc(budget)) || !(self->ends = malloc(count * sizeof(u64))))
+		goto nomem;
+	if(mutex_init(&self->lock) != NNC_R_OK)
+		goto nomem;
+	if(cond_init(&self->cond) != NNC_R_OK)
+	{
+		mutex_destroy(&self->lock);
+		goto nomem;
+	}
+	if(thread_create(&self->thread, prefetch_worker, self) == NNC_R_OK)
+	{
+		self->threaded = true;
+		return NNC_R_OK;
+	}
+	/* without a thread every node is read when it's copied */
+	cond_destroy(&self->cond);
+	mutex_destroy(&self->lock);
+	free(self->ring);
+	free(self->ends);
+	self->ring = NULL;
+	self->ends = NULL;
+	return NNC_R_OK;
+nomem:
+	free(self->ring);
+	free(self->ends);
+	free(self);
+	*out = NULL;
+	return NNC_R_NOMEM;
+}
+
+result nnc_prefetch_copy(nnc_prefetch *self, nnc_wstream *ws, u32 *copied)
+{
+	nnc_vfs_stream stream;
+	result ret = NNC_R_OK;
+	u32 node = self->next++, total = 0;
+	if(node >= self->count)
+		return NNC_R_INVAL;
+	if(!self->threaded)
+	{
+		TRY(nnc_vfs_open_node(self->nodes[node], &stream));
+		ret = nnc_copy((nnc_rstream *) &stream, ws, copied);
+		nnc_rs_close(&stream);
+		return ret;
+	}
+
+	mutex_lock(&self->lock);
+	for(;;)
+	{
+		bool done = self->nodes_done > node;
+		u64 avail = (done ? self->ends[node] : self->produced) - self->consumed;
+		if(avail == 0)
+		{
+			if(done) break;
+			if(self->failed)
+			{
+				ret = self->ret;
+				break;
+			}
+			cond_wait(&self->cond, &self->lock);
+			continue;
+		}
+		u32 pos = self->consumed % self->ring_size;
+		u32 next = MIN(MIN(avail, self->ring_size - pos), PREFETCH_CHUNK);
+		/* the prefetcher doesn't touch this part of the ring until consumed is moved past it */
+		mutex_unlock(&self->lock);
+		ret = NNC_WS_PCALL(ws, write, self->ring + pos, next);
+		mutex_lock(&self->lock);
+		if(ret != NNC_R_OK) break;
+		self->consumed += next;
+		total += next;
+		cond_broadcast(&self->cond);
+	}
+	mutex_unlock(&self->lock);
+	if(copied) *copied = total;
+	return ret;
+}
+
+void nnc_prefetch_stop(nnc_prefetch *self)
+{
+	if(!self) return;
+	if(self->threaded)
+	{
+		mutex_lock(&self->lock);
+		self->quit = true;
+		cond_broadcast(&self->cond);
+		mutex_unlock(&self->lock);
+		thread_join(&self->thread);
+		cond_destroy(&self->cond);
+		mutex_destroy(&self->lock);
+	}
+	free(self->ring);
+	free(self->ends);
+	free(self);
+}
+
+/* Single pass writing: the planning stream keeps only what is written
+ * below the furthest position reached, the replaying stream forwards
+ * everything up to that position once and puts those patches over it. */
+struct write_patch {
+	u32 pos, size;
+	u32 data; /* offset in single_pass_writer.bytes */
+};
+
+typedef struct single_pass_writer {
+	const nnc_wstream_funcs *funcs;
+	nnc_wstream *child; /* only used when replaying */
+	u32 pos, end;       /* end is the furthest position written */
+	struct write_patch *patches;
+	u32 npatches, apatches;
+	struct dynbuf bytes;
+} single_pass_writer;
+
+static result plan_record(single_pass_writer *self, u8 *buf, u32 size)
+{
+	struct write_patch *last = self->npatches ? &self->patches[self->npatches - 1] : NULL;
+	result ret;
+	/* headers are usually written in several pieces, those end up in one patch */
+	if(last && last->pos + last->size == self->pos && last->data + last->size == self->bytes.used)
+	{
+		TRY(dynbuf_push(&self->bytes, buf, size));
+		last->size += size;
+		return NNC_R_OK;
+	}
+	if(self->npatches == self->apatches)
+	{
+		u32 nalloc = self->apatches ? self->apatches * 2 : 8;
+		struct write_patch *npatches = realloc(self->patches, nalloc * sizeof(struct write_patch));
+		if(!npatches) return NNC_R_NOMEM;
+		self->patches = npatches;
+		self->apatches = nalloc;
+	}
+	self->patches[self->npatches].pos = self->pos;
+	self->patches[self->npatches].size = size;
+	self->patches[self->npatches].data = self->bytes.used;
+	TRY(dynbuf_push(&self->bytes, buf, size));
+	++self->npatches;
+	return NNC_R_OK;
+}
+
+static result plan_write(single_pass_writer *self, u8 *buf, u32 size)
+{
+	result ret;
+	if(self->pos < self->end)
+		TRY(plan_record(self, buf, MIN(size, self->end - self->pos)));
+	self->pos += size;
+	self->end = MAX(self->end, self->pos);
+	return NNC_R_OK;
+}
+
+static result single_pass_seek(single_pass_writer *self, u32 pos)
+{
+	/* nothing can be written past the end without writing what is before it */
+	if(pos > self->end) return NNC_R_SEEK_RANGE;
+	self->pos = pos;
+	return NNC_R_OK;
+}
+
+static u32 single_pass_tell(single_pass_writer *self) { return self->pos; }
+static result single_pass_close(single_pass_writer *self) { (void) self; return NNC_R_OK; }
+
+static const nnc_wstream_funcs plan_funcs = {
+	.write = (nnc_write_func)  plan_write,
+	.close = (nnc_wclose_func) single_pass_close,
+	.seek  = (nnc_wseek_func)  single_pass_seek,
+	.tell  = (nnc_wtell_func)  single_pass_tell,
+};
+
+static result replay_write(single_pass_writer *self, u8 *buf, u32 size)
+{
+	u8 block[BLOCK_SZ];
+	result ret;
+	/* this part was already written with the patches in place */
+	if(self->pos < self->end)
+	{
+		u32 skip = MIN(size, self->end - self->pos);
+		self->pos += skip;
+		buf  += skip;
+		size -= skip;
+	}
+	while(size)
+	{
+		u32 next = size, start = self->pos;
+		bool patched = false;
+		for(u32 i = 0; i < self->npatches && !patched; ++i)
+			patched = self->patches[i].pos < start + size && start < self->patches[i].pos + self->patches[i].size;
+		if(patched)
+		{
+			/* later patches were written later so they go on top */
+			next = MIN(size, BLOCK_SZ);
+			memcpy(block, buf, next);
+			for(u32 i = 0; i < self->npatches; ++i)
+			{
+				struct write_patch *p = &self->patches[i];
+				u32 from = MAX(p->pos, start), to = MIN(p->pos + p->size, start + next);
+				if(from < to)
+					memcpy(block + (from - start), self->bytes.buffer + p->data + (from - p->pos), to - from);
+			}
+		}
+		TRY(NNC_WS_PCALL(self->child, write, patched ? block : buf, next));
+		self->pos += next;
+		self->end = self->pos;
+		buf  += next;
+		size -= next;
+	}
+	return NNC_R_OK;
+}
+
+static const nnc_wstream_funcs replay_funcs = {
+	.write = (nnc_write_func)  replay_write,
+	.close = (nnc_wclose_func) single_pass_close,
+	.seek  = (nnc_wseek_func)  single_pass_seek,
+	.tell  = (nnc_wtell_func)  single_pass_tell,
+};
+
+result nnc_write_single_pass(nnc_seeking_writer func, void *udata, nnc_wstream *ws)
+{
+	single_pass_writer self = { &plan_funcs, NULL, 0, 0, NULL, 0, 0, { NULL, 0, 0 } };
+	result ret;
+	TRY(dynbuf_new(&self.bytes, 0x1000));
+	TRYLBL(func(udata, NNC_WSP(&self)), out);
+
+	self.funcs = &replay_funcs;
+	self.child = ws;
+	self.pos = self.end = 0;
+	ret = func(udata, NNC_WSP(&self));
+
+out:
+	free(self.patches);
+	dynbuf_free(&self.bytes);
+	return ret;
+}
+
 /* wrapper funcs */
 
 nnc_result nnc_rs_read_(nnc_rstream *rs, nnc_u8 *buf, nnc_u32 max, nnc_u32 *totalRead)
@@ -0,0 +1,278 @@
+/* for mmap() and fstat() under -std=c99, this has to come before internal.h
+ * detects the platform and is harmless everywhere else */
+#define _DEFAULT_SOURCE
+
+#include "./internal.h"
+
+#if NNC_PLATFORM_UNIX
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#elif NNC_PLATFORM_WINDOWS
+	#include <windows.h>
+#endif
+
+#include <nnc/support.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Blob layout, all little endian, sections are aligned to NNC_SUPPORT_ALIGN:
+ *  0x00  "NNCS"
+ *  0x04  u16 version, u16 header size
+ *  0x08  u32 total size
+ *  0x0C  u32 CRC32 of everything after this field
+ *  0x10  u16 sizeof(nnc_keyset), u16 sizeof(struct nnc_seeddb_entry),
+ *        u16 sizeof(nnc_certificate), u16 reserved
+ *  0x18  u32 keyset offset (0 if absent)
+ *  0x1C  u32 seed entries offset, u32 seed count
+ *  0x24  u32 certificates offset, u32 certificate count
+ *  0x2C  u32 reserved
+ * The sections contain the structs exactly as they are in memory so nothing
+ * has to be converted when opening a blob, the sizes in the header catch
+ * blobs made by a build with a different layout. */
+#define SUPPORT_MAGIC "NNCS"
+#define SUPPORT_VERSION 1
+#define SUPPORT_HEADER_SIZE 0x30
+
+#define ENTRY_SIZE sizeof(struct nnc_seeddb_entry)
+
+result nnc_support_open_memory(nnc_support *self, const void *data, u32 size)
+{
+	const u8 *blob = data;
+	u32 keyset_off, seeds_off, seeds_count, certs_off, certs_count;
+	self->data = blob;
+	self->size = size;
+	self->keyset = NULL;
+	self->seeddb.entries = NULL;
+	self->seeddb.size = 0;
+	self->certs.certs = NULL;
+	self->certs.len = 0;
+	self->mapping = NULL;
+
+	if(IS_UNALIGNED((uintptr_t) blob, NNC_SUPPORT_ALIGN))
+		return NNC_R_BAD_ALIGN;
+	if(size < SUPPORT_HEADER_SIZE || memcmp(blob, SUPPORT_MAGIC, 4) != 0
+			|| LE16P(&blob[0x04]) != SUPPORT_VERSION || LE16P(&blob[0x06]) != SUPPORT_HEADER_SIZE
+			|| LE32P(&blob[0x08]) != size)
+		return NNC_R_CORRUPT;
+	if(crc32_update(0, blob + 0x10, size - 0x10) != LE32P(&blob[0x0C]))
+		return NNC_R_CORRUPT;
+	if(LE16P(&blob[0x10]) != sizeof(nnc_keyset) || LE16P(&blob[0x12]) != ENTRY_SIZE
+			|| LE16P(&blob[0x14]) != sizeof(nnc_certificate))
+		return NNC_R_UNSUPPORTED;
+
+	keyset_off  = LE32P(&blob[0x18]);
+	seeds_off   = LE32P(&blob[0x1C]);
+	seeds_count = LE32P(&blob[0x20]);
+	certs_off   = LE32P(&blob[0x24]);
+	certs_count = LE32P(&blob[0x28]);
+	/* the checksum only protects against damage, not against a bogus blob */
+	if((keyset_off && (keyset_off > size || size - keyset_off < sizeof(nnc_keyset)))
+			|| seeds_off > size || seeds_count > (size - seeds_off) / ENTRY_SIZE
+			|| certs_off > size || certs_count > (size - certs_off) / sizeof(nnc_certificate)
+			|| certs_count > INT32_MAX
+			|| IS_UNALIGNED(keyset_off | seeds_off | certs_off, NNC_SUPPORT_ALIGN))
+		return NNC_R_CORRUPT;
+
+	if(keyset_off)
+		self->keyset = (nnc_keyset *) (blob + keyset_off);
+	if(seeds_count)
+	{
+		self->seeddb.entries = (struct nnc_seeddb_entry *) (blob + seeds_off);
+		self->seeddb.size = seeds_count;
+	}
+	if(certs_count)
+	{
+		self->certs.certs = (nnc_certificate *) (blob + certs_off);
+		self->certs.len = certs_count;
+	}
+	return NNC_R_OK;
+}
+
+/* how the blob of an opened file is released */
+struct support_mapping {
+#if NNC_PLATFORM_UNIX
+	bool mapped;
+#elif NNC_PLATFORM_WINDOWS
+	HANDLE map;
+#endif
+	void *data;
+	u32 size;
+};
+
+static void release_mapping(struct support_mapping *mapping)
+{
+#if NNC_PLATFORM_UNIX
+	if(mapping->mapped) munmap(mapping->data, mapping->size);
+	else free(mapping->data);
+#elif NNC_PLATFORM_WINDOWS
+	UnmapViewOfFile(mapping->data);
+	CloseHandle(mapping->map);
+#else
+	free(mapping->data);
+#endif
+	free(mapping);
+}
+
+/* fallback for when a file can't be mapped */
+static result read_whole_file(const char *path, struct support_mapping *mapping)
+{
+	nnc_file f;
+	result ret;
+	TRY(nnc_file_open(&f, path));
+	mapping->size = NNC_RS_CALL0(f, size);
+	/* malloc() memory is aligned well enough */
+	if(!(mapping->data = malloc(mapping->size ? mapping->size : 1)))
+		ret = NNC_R_NOMEM;
+	else if((ret = read_exact(NNC_RSP(&f), mapping->data, mapping->size)) != NNC_R_OK)
+	{
+		free(mapping->data);
+		mapping->data = NULL;
+	}
+	NNC_RS_CALL0(f, close);
+	return ret;
+}
+
+static result map_file(const char *path, struct support_mapping *mapping)
+{
+#if NNC_PLATFORM_UNIX
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	if(fd == -1) return NNC_R_FAIL_OPEN;
+	if(fstat(fd, &st) != 0 || st.st_size > UINT32_MAX)
+	{
+		close(fd);
+		return NNC_R_FAIL_OPEN;
+	}
+	mapping->size = st.st_size;
+	mapping->data = st.st_size ? mmap(NULL, mapping->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if(mapping->data != MAP_FAILED)
+	{
+		mapping->mapped = true;
+		return NNC_R_OK;
+	}
+	mapping->mapped = false;
+	return read_whole_file(path, mapping);
+#elif NNC_PLATFORM_WINDOWS
+	LARGE_INTEGER size;
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE) return NNC_R_FAIL_OPEN;
+	if(!GetFileSizeEx(file, &size) || size.QuadPart == 0 || size.QuadPart > UINT32_MAX)
+	{
+		CloseHandle(file);
+		return NNC_R_FAIL_OPEN;
+	}
+	mapping->size = (u32) size.QuadPart;
+	mapping->map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if(!mapping->map) return NNC_R_FAIL_OPEN;
+	if(!(mapping->data = MapViewOfFile(mapping->map, FILE_MAP_READ, 0, 0, 0)))
+	{
+		CloseHandle(mapping->map);
+		return NNC_R_FAIL_OPEN;
+	}
+	return NNC_R_OK;
+#else
+	return read_whole_file(path, mapping);
+#endif
+}
+
+result nnc_support_open_file(nnc_support *self, const char *path)
+{
+	struct support_mapping *mapping = malloc(sizeof(struct support_mapping));
+	result ret;
+	self->mapping = NULL;
+	if(!mapping) return NNC_R_NOMEM;
+	if((ret = map_file(path, mapping)) != NNC_R_OK)
+	{
+		free(mapping);
+		return ret;
+	}
+	if((ret = nnc_support_open_memory(self, mapping->data, mapping->size)) != NNC_R_OK)
+	{
+		release_mapping(mapping);
+		return ret;
+	}
+	self->mapping = mapping;
+	return NNC_R_OK;
+}
+
+result nnc_support_scan(nnc_support *self)
+{
+	char path[SUP_FILE_NAME_LEN];
+	self->mapping = NULL;
+	if(!find_support_file(NNC_SUPPORT_FILE_NAME, path))
+		return NNC_R_NOT_FOUND;
+	return nnc_support_open_file(self, path);
+}
+
+void nnc_support_close(nnc_support *self)
+{
+	if(self->mapping) release_mapping(self->mapping);
+	self->mapping = NULL;
+	self->data = NULL;
+	self->keyset = NULL;
+	self->seeddb.entries = NULL;
+	self->seeddb.size = 0;
+	self->certs.certs = NULL;
+	self->certs.len = 0;
+}
+
+static int seed_entry_cmp(const void *a, const void *b)
+{
+	u64 ta = ((const struct nnc_seeddb_entry *) a)->title_id;
+	u64 tb = ((const struct nnc_seeddb_entry *) b)->title_id;
+	return (ta > tb) - (ta < tb);
+}
+
+result nnc_write_support(nnc_wstream *ws, nnc_keyset *ks, nnc_seeddb *seeddb, nnc_certchain *chain)
+{
+	u32 seeds_count = seeddb ? seeddb->size : 0;
+	u32 certs_count = chain && chain->len > 0 ? chain->len : 0;
+	u64 keyset_off = 0, seeds_off, certs_off, size = SUPPORT_HEADER_SIZE;
+	if(ks)
+	{
+		keyset_off = size;
+		size = ALIGN(size + sizeof(nnc_keyset), NNC_SUPPORT_ALIGN);
+	}
+	seeds_off = seeds_count ? size : 0;
+	size = ALIGN(size + (u64) seeds_count * ENTRY_SIZE, NNC_SUPPORT_ALIGN);
+	certs_off = certs_count ? size : 0;
+	size = ALIGN(size + (u64) certs_count * sizeof(nnc_certificate), NNC_SUPPORT_ALIGN);
+	if(size > UINT32_MAX)
+		return NNC_R_TOO_LARGE;
+
+	u8 *blob = calloc(1, size);
+	if(!blob) return NNC_R_NOMEM;
+	memcpy(blob, SUPPORT_MAGIC, 4);
+	U16P(&blob[0x04]) = LE16(SUPPORT_VERSION);
+	U16P(&blob[0x06]) = LE16(SUPPORT_HEADER_SIZE);
+	U32P(&blob[0x08]) = LE32(size);
+	U16P(&blob[0x10]) = LE16(sizeof(nnc_keyset));
+	U16P(&blob[0x12]) = LE16(ENTRY_SIZE);
+	U16P(&blob[0x14]) = LE16(sizeof(nnc_certificate));
+	U32P(&blob[0x18]) = LE32(keyset_off);
+	U32P(&blob[0x1C]) = LE32(seeds_off);
+	U32P(&blob[0x20]) = LE32(seeds_count);
+	U32P(&blob[0x24]) = LE32(certs_off);
+	U32P(&blob[0x28]) = LE32(certs_count);
+
+	if(ks)
+		memcpy(blob + keyset_off, ks, sizeof(nnc_keyset));
+	if(seeds_count)
+	{
+		/* nnc_get_seed() needs them sorted, don't trust the caller on that */
+		memcpy(blob + seeds_off, seeddb->entries, seeds_count * ENTRY_SIZE);
+		qsort(blob + seeds_off, seeds_count, ENTRY_SIZE, seed_entry_cmp);
+	}
+	if(certs_count)
+		memcpy(blob + certs_off, chain->certs, certs_count * sizeof(nnc_certificate));
+
+	U32P(&blob[0x0C]) = LE32(crc32_update(0, blob + 0x10, size - 0x10));
+	result ret = NNC_WS_PCALL(ws, write, blob, size);
+	free(blob);
+	return ret;
+}
+
@@ -0,0 +1,190 @@
+
+#if defined(_WIN32)
+	#include <windows.h>
+#elif defined(_3DS) || defined(__3DS__)
+	#include <3ds.h>
+#endif
+#include <stdlib.h>
+#include "./internal.h"
+
+/* On platforms we don't know how to do threading on these are all no-ops,
+ * which is fine as nothing can run concurrently there anyway. */
+
+result nnc_mutex_init(nnc_mutex *mtx)
+{
+#if NNC_PLATFORM_UNIX
+	return pthread_mutex_init(mtx, NULL) == 0 ? NNC_R_OK : NNC_R_OS;
+#elif NNC_PLATFORM_WINDOWS
+	InitializeSRWLock((PSRWLOCK) mtx);
+	return NNC_R_OK;
+#elif NNC_PLATFORM_3DS
+	LightLock_Init((LightLock *) mtx);
+	return NNC_R_OK;
+#else
+	*mtx = 0;
+	return NNC_R_OK;
+#endif
+}
+
+void nnc_mutex_lock(nnc_mutex *mtx)
+{
+#if NNC_PLATFORM_UNIX
+	pthread_mutex_lock(mtx);
+#elif NNC_PLATFORM_WINDOWS
+	AcquireSRWLockExclusive((PSRWLOCK) mtx);
+#elif NNC_PLATFORM_3DS
+	LightLock_Lock((LightLock *) mtx);
+#else
+	(void) mtx;
+#endif
+}
+
+void nnc_mutex_unlock(nnc_mutex *mtx)
+{
+#if NNC_PLATFORM_UNIX
+	pthread_mutex_unlock(mtx);
+#elif NNC_PLATFORM_WINDOWS
+	ReleaseSRWLockExclusive((PSRWLOCK) mtx);
+#elif NNC_PLATFORM_3DS
+	LightLock_Unlock((LightLock *) mtx);
+#else
+	(void) mtx;
+#endif
+}
+
+void nnc_mutex_destroy(nnc_mutex *mtx)
+{
+#if NNC_PLATFORM_UNIX
+	pthread_mutex_destroy(mtx);
+#else
+	/* SRW locks and LightLocks don't need to be destroyed */
+	(void) mtx;
+#endif
+}
+
+result nnc_cond_init(nnc_cond *cond)
+{
+#if NNC_PLATFORM_UNIX
+	return pthread_cond_init(cond, NULL) == 0 ? NNC_R_OK : NNC_R_OS;
+#elif NNC_PLATFORM_WINDOWS
+	InitializeConditionVariable((PCONDITION_VARIABLE) cond);
+	return NNC_R_OK;
+#elif NNC_PLATFORM_3DS
+	CondVar_Init((CondVar *) cond);
+	return NNC_R_OK;
+#else
+	*cond = 0;
+	return NNC_R_OK;
+#endif
+}
+
+void nnc_cond_wait(nnc_cond *cond, nnc_mutex *mtx)
+{
+#if NNC_PLATFORM_UNIX
+	pthread_cond_wait(cond, mtx);
+#elif NNC_PLATFORM_WINDOWS
+	SleepConditionVariableSRW((PCONDITION_VARIABLE) cond, (PSRWLOCK) mtx, INFINITE, 0);
+#elif NNC_PLATFORM_3DS
+	CondVar_Wait((CondVar *) cond, (LightLock *) mtx);
+#else
+	/* nothing can signal us, callers don't wait without threads */
+	(void) cond; (void) mtx;
+#endif
+}
+
+void nnc_cond_broadcast(nnc_cond *cond)
+{
+#if NNC_PLATFORM_UNIX
+	pthread_cond_broadcast(cond);
+#elif NNC_PLATFORM_WINDOWS
+	WakeAllConditionVariable((PCONDITION_VARIABLE) cond);
+#elif NNC_PLATFORM_3DS
+	CondVar_Broadcast((CondVar *) cond);
+#else
+	(void) cond;
+#endif
+}
+
+void nnc_cond_destroy(nnc_cond *cond)
+{
+#if NNC_PLATFORM_UNIX
+	pthread_cond_destroy(cond);
+#else
+	/* condition variables don't need to be destroyed */
+	(void) cond;
+#endif
+}
+
+
+/* the native thread functions have different signatures */
+struct thread_start {
+	nnc_thread_func func;
+	void *arg;
+};
+
+#if NNC_PLATFORM_UNIX || NNC_PLATFORM_WINDOWS
+static void run_thread_start(void *arg)
+{
+	struct thread_start start = *(struct thread_start *) arg;
+	free(arg);
+	start.func(start.arg);
+}
+#endif
+
+#if NNC_PLATFORM_UNIX
+static void *thread_trampoline(void *arg) { run_thread_start(arg); return NULL; }
+#elif NNC_PLATFORM_WINDOWS
+static DWORD WINAPI thread_trampoline(LPVOID arg) { run_thread_start(arg); return 0; }
+#endif
+
+#if NNC_PLATFORM_3DS
+/* workers may nnc_copy, which keeps a BLOCK_SZ buffer on the stack */
+#define THREAD_STACK_SIZE (4 * BLOCK_SZ)
+#endif
+
+result nnc_thread_create(nnc_thread *thread, nnc_thread_func func, void *arg)
+{
+#if NNC_PLATFORM_3DS
+	/* libctru's entry point has the same signature so no trampoline is needed,
+	 * the new thread gets the priority of the caller on the application core */
+	s32 prio = 0x30;
+	svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+	return (*thread = threadCreate(func, arg, THREAD_STACK_SIZE, prio, -2, false)) != NULL
+		? NNC_R_OK : NNC_R_OS;
+#elif NNC_PLATFORM_UNIX || NNC_PLATFORM_WINDOWS
+	struct thread_start *start = malloc(sizeof(struct thread_start));
+	bool ok;
+	if(!start) return NNC_R_NOMEM;
+	start->func = func;
+	start->arg = arg;
+	#if NNC_PLATFORM_UNIX
+		ok = pthread_create(thread, NULL, thread_trampoline, start) == 0;
+	#else
+		ok = (*thread = CreateThread(NULL, 0, thread_trampoline, start, 0, NULL)) != NULL;
+	#endif
+	if(!ok)
+	{
+		free(start);
+		return NNC_R_OS;
+	}
+	return NNC_R_OK;
+#else
+	(void) thread; (void) func; (void) arg;
+	return NNC_R_UNSUPPORTED;
+#endif
+}
+
+void nnc_thread_join(nnc_thread *thread)
+{
+#if NNC_PLATFORM_UNIX
+	pthread_join(*thread, NULL);
+#elif NNC_PLATFORM_WINDOWS
+	WaitForSingleObject(*thread, INFINITE);
+	CloseHandle(*thread);
+#elif NNC_PLATFORM_3DS
+	threadJoin(*thread, U64_MAX);
+	threadFree(*thread);
+#else
+	(void) thread;
+#endif
+}
@@ -64,9 +64,9 @@ static void write_utf16(u16 *out, size_t outlen, size_t *outptr, u32 cp)
 			out[*outptr] = cp;
 		*outptr = n;
 	}
-	else if(cp < 0x11000)
+	else if(cp < 0x110000)
 	{
-		cp &= ~0x10000;
+		cp -= 0x10000;
 		size_t n = *outptr + 2;
 		if(n < outlen)
 		{
@@ -78,27 +78,156 @@ static void write_utf16(u16 *out, size_t outlen, size_t *outptr, u32 cp)
 	else { } /* invalid codepoint */
 }
 
+/* Names are mostly ASCII, so runs of it are converted a block at a time with
+ * SIMD where available and everything else goes through the code above. These
+ * return the length of the run of non-NUL ASCII at the start of in, in whole
+ * blocks of at most len units, and copy it to out unless that is NULL. */
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define UTF_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+	#include <emmintrin.h>
+	#define UTF_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	#include <arm_neon.h>
+	#define UTF_NEON 1
+#endif
+
+static size_t ascii_run_utf16(u8 *out, const u16 *in, size_t len)
+{
+	size_t i = 0;
+#if UTF_AVX2
+	const __m256i hibits32 = _mm256_set1_epi16((short) 0xFF80), zero32 = _mm256_setzero_si256();
+	for(; len - i >= 32; i += 32)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i *) &in[i]);
+		__m256i b = _mm256_loadu_si256((const __m256i *) &in[i + 16]);
+		if(!_mm256_testz_si256(_mm256_or_si256(a, b), hibits32)
+				|| _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi16(a, zero32), _mm256_cmpeq_epi16(b, zero32))))
+			break;
+		/* packing works per 128 bit lane, the permute puts the halves back in order */
+		if(out) _mm256_storeu_si256((__m256i *) &out[i], _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+	}
+#endif
+#if UTF_SSE2
+	const __m128i hibits = _mm_set1_epi16((short) 0xFF80), zero = _mm_setzero_si128();
+	for(; len - i >= 16; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *) &in[i]);
+		__m128i b = _mm_loadu_si128((const __m128i *) &in[i + 8]);
+		if(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(a, b), hibits), zero)) != 0xFFFF
+				|| _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(a, zero), _mm_cmpeq_epi16(b, zero))))
+			break;
+		if(out) _mm_storeu_si128((__m128i *) &out[i], _mm_packus_epi16(a, b));
+	}
+#elif UTF_NEON
+	for(; len - i >= 16; i += 16)
+	{
+		uint16x8_t a = vld1q_u16(&in[i]), b = vld1q_u16(&in[i + 8]);
+		if(vmaxvq_u16(vorrq_u16(a, b)) >= 0x80 || vminvq_u16(vminq_u16(a, b)) == 0)
+			break;
+		if(out) vst1q_u8(&out[i], vcombine_u8(vmovn_u16(a), vmovn_u16(b)));
+	}
+#else
+	(void) out; (void) in; (void) len;
+#endif
+	return i;
+}
+
+static size_t ascii_run_utf8(u16 *out, const u8 *in, size_t len)
+{
+	size_t i = 0;
+#if UTF_AVX2
+	const __m256i zero32 = _mm256_setzero_si256();
+	for(; len - i >= 32; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *) &in[i]);
+		if(_mm256_movemask_epi8(v) | _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero32)))
+			break;
+		if(out)
+		{
+			_mm256_storeu_si256((__m256i *) &out[i], _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+			_mm256_storeu_si256((__m256i *) &out[i + 16], _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+		}
+	}
+#endif
+#if UTF_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for(; len - i >= 16; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) &in[i]);
+		if(_mm_movemask_epi8(v) | _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)))
+			break;
+		if(out)
+		{
+			_mm_storeu_si128((__m128i *) &out[i], _mm_unpacklo_epi8(v, zero));
+			_mm_storeu_si128((__m128i *) &out[i + 8], _mm_unpackhi_epi8(v, zero));
+		}
+	}
+#elif UTF_NEON
+	for(; len - i >= 16; i += 16)
+	{
+		uint8x16_t v = vld1q_u8(&in[i]);
+		if(vmaxvq_u8(v) >= 0x80 || vminvq_u8(v) == 0)
+			break;
+		if(out)
+		{
+			vst1q_u16(&out[i], vmovl_u8(vget_low_u8(v)));
+			vst1q_u16(&out[i + 8], vmovl_high_u8(v));
+		}
+	}
+#else
+	(void) out; (void) in; (void) len;
+#endif
+	return i;
+}
+
+/* how many units can be written at outptr, the writers above always keep one free */
+static size_t room_left(size_t outlen, size_t outptr)
+{
+	return outptr + 1 < outlen ? outlen - outptr - 1 : 0;
+}
+
 /* should there be a BE version of this? */
 size_t nnc_utf16_to_utf8(u8 *out, size_t outlen, const u16 *in, size_t inlen)
 {
-	size_t outptr = 0;
-	for(size_t i = 0; i < inlen; ++i)
+	size_t outptr = 0, i = 0;
+	while(i < inlen)
 	{
 		u16 p1 = LE16(in[i]);
 		if(p1 == '\0')
 			break; /* finished */
-		else if(p1 < 0xD800 || p1 > 0xE000)
+		else if(p1 < 0x80)
+		{
+			size_t room = room_left(outlen, outptr), run;
+			/* once the output is full only the length is counted */
+			if(room == 0) run = ascii_run_utf16(NULL, &in[i], inlen - i);
+			else          run = ascii_run_utf16(&out[outptr], &in[i], MIN(room, inlen - i));
+			if(run == 0)
+			{
+				write_utf8(out, outlen, &outptr, p1);
+				run = 1;
+			}
+			else outptr += run;
+			i += run;
+		}
+		else if(p1 < 0xD800 || p1 >= 0xE000)
+		{
 			write_utf8(out, outlen, &outptr, p1);
+			++i;
+		}
 		/* surrogate pair */
-		else
+		else if(p1 < 0xDC00 && i + 1 < inlen && (LE16(in[i + 1]) & 0xFC00) == 0xDC00)
 		{
-			u16 p2 = LE16(in[i + 1]);
-			u16 w1 = p1 & 0x3FF;
-			u16 w2 = p2 & 0x3FF;
-			u32 cp = 0x10000 | (w1 << 10) | w2;
-			write_utf8(out, outlen, &outptr, cp);
-			++i; /* since we moved ahead 2 for the pair */
+			u32 w1 = p1 & 0x3FF;
+			u32 w2 = LE16(in[i + 1]) & 0x3FF;
+			write_utf8(out, outlen, &outptr, 0x10000 + ((w1 << 10) | w2));
+			i += 2; /* since we moved ahead 2 for the pair */
 		}
+		/* unpaired surrogates are skipped */
+		else ++i;
 	}
 	return outptr;
 }
@@ -113,9 +242,21 @@ size_t nnc_utf8_to_utf16(u16 *out, size_t outlen, const u8 *in, size_t inlen)
 			break; /* finished */
 		else if(p1 < 0x80)
 		{
-			write_utf16(out, outlen, &outptr, in[i]);
+			size_t room = room_left(outlen, outptr), run;
+			if(room == 0) run = ascii_run_utf8(NULL, &in[i], inlen - i);
+			else          run = ascii_run_utf8(&out[outptr], &in[i], MIN(room, inlen - i));
+			if(run == 0)
+				write_utf16(out, outlen, &outptr, in[i]);
+			else
+			{
+				outptr += run;
+				i += run - 1;
+			}
 			continue;
 		}
+		/* a continuation byte without a start or a byte that never starts a sequence */
+		else if(p1 < 0xC0 || p1 >= 0xF5)
+			continue;
 #define INCCHK(n) if(!((i + n) < inlen)) break
 		INCCHK(1);
 		if(p1 < 0xE0)
@@ -137,22 +278,27 @@ size_t nnc_utf8_to_utf16(u16 *out, size_t outlen, const u8 *in, size_t inlen)
 			continue;
 		}
 		INCCHK(3);
-		if(p1 < 0xF5)
-		{
-			u32 cp = ((p1 & 0x7) << 18)
-			       | ((in[i + 1] & 0x3F) << 12)
-			       | ((in[i + 2] & 0x3F) << 6)
-			       | (in[i + 3] & 0x3F);
-			write_utf16(out, outlen, &outptr, cp);
-			i += 3;
-			continue;
-		}
+		u32 cp = ((p1 & 0x7) << 18)
+		       | ((in[i + 1] & 0x3F) << 12)
+		       | ((in[i + 2] & 0x3F) << 6)
+		       | (in[i + 3] & 0x3F);
+		write_utf16(out, outlen, &outptr, cp);
+		i += 3;
 #undef INCCHK
-		/* invalid... */
 	}
 	return outptr;
 }
 
+size_t nnc_utf16_to_utf8_length(const u16 *in, size_t inlen)
+{
+	return nnc_utf16_to_utf8(NULL, 0, in, inlen);
+}
+
+size_t nnc_utf8_to_utf16_length(const u8 *in, size_t inlen)
+{
+	return nnc_utf8_to_utf16(NULL, 0, in, inlen);
+}
+
 nnc_result nnc_cbuf_init(nnc_utf_conversion_buffer *buf, size_t initial_length)
 {
 	if(!initial_length) initial_length = 128;
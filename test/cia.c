@@ -2,6 +2,7 @@
 #include <nnc/stream.h>
 #include <nnc/romfs.h>
 #include <nnc/ncch.h>
+#include <nnc/ticket.h>
 #include <sys/stat.h>
 #include <inttypes.h>
 #include <nnc/cia.h>
@@ -12,6 +13,7 @@
 #include <errno.h>
 
 void die(const char *fmt, ...);
+bool same_file(const char *a, const char *b); /* romfs.c */
 
 
 static void extract(nnc_rstream *rs, const char *to, const char *type, nnc_sha256_hash hash)
@@ -199,3 +201,213 @@ int rewrite_cia_main(int argc, char *argv[])
 	return 0;
 }
 
+/* forwards to a file but can't seek or read back, like a pipe */
+typedef struct pipe_writer {
+	const nnc_wstream_funcs *funcs;
+	nnc_wfile file;
+} pipe_writer;
+
+static nnc_result pipe_write(pipe_writer *self, nnc_u8 *buf, nnc_u32 size) { return NNC_WS_CALL(self->file, write, buf, size); }
+static nnc_result pipe_close(pipe_writer *self) { return NNC_WS_CALL0(self->file, close); }
+static nnc_u32 pipe_tell(pipe_writer *self) { return NNC_WS_CALL0(self->file, tell); }
+
+static const nnc_wstream_funcs pipe_funcs = {
+	.write = (nnc_write_func)  pipe_write,
+	.close = (nnc_wclose_func) pipe_close,
+	.tell  = (nnc_wtell_func)  pipe_tell,
+};
+
+enum single_pass_kind { SP_ROMFS, SP_NCCH, SP_CIA };
+
+struct single_pass_test {
+	nnc_vfs vfs;
+	nnc_buildable_ncch ncch;
+	nnc_memory certchain, ticket, stream_content;
+	nnc_tmd_header tmd;
+	nnc_cia_writable_ncch contents[2];
+};
+
+static nnc_result write_single_pass_test(struct single_pass_test *t, enum single_pass_kind kind, nnc_wstream *ws)
+{
+	switch(kind)
+	{
+	case SP_ROMFS:
+		return nnc_write_romfs(&t->vfs, ws);
+	case SP_NCCH:
+		return nnc_write_ncch_from_buildable(&t->ncch, ws);
+	case SP_CIA:
+		return nnc_write_cia(NNC_CIA_WF_CERTCHAIN_STREAM | NNC_CIA_WF_TICKET_STREAM | NNC_CIA_WF_TMD_BUILD,
+			&t->certchain, &t->ticket, &t->tmd, 2, t->contents, ws);
+	}
+	return NNC_R_INVAL;
+}
+
+/* writes t->contents encrypted, checks it decrypts to the same data and returns the amount of failures */
+static int test_encrypted_cia(struct single_pass_test *t, const char *names[2], const char *prog)
+{
+	nnc_cia_content_reader reader;
+	nnc_cia_content_stream content;
+	nnc_chunk_record *chunk;
+	nnc_sha256_hash hash, expected;
+	nnc_cia_header hdr;
+	nnc_ticket tik;
+	nnc_memory aligned;
+	nnc_result res;
+	nnc_file f;
+	int failures = 0;
+	nnc_u8 flags = NNC_CIA_WF_CERTCHAIN_STREAM | NNC_CIA_WF_TICKET_BUILD | NNC_CIA_WF_TMD_BUILD | NNC_CIA_WF_ENCRYPT_CONTENTS;
+
+	memset(&tik, 0, sizeof(tik));
+	tik.sig.type = NNC_SIG_NONE + NNC_SIG_RSA_2048_SHA256;
+	strcpy(tik.sig.issuer, "Root-CA00000003-XS0000000c");
+	memcpy(tik.title_key, "nnc-test-titlekey", 0x10);
+	tik.title_id = t->tmd.title_id;
+	/* CBC can only encrypt whole blocks */
+	nnc_mem_open(&aligned, t->stream_content.un.ptr, t->stream_content.size & ~0xF);
+	t->contents[1].ncch = &aligned;
+
+	for(int i = 0; i < 2; ++i)
+	{
+		nnc_wfile wf;
+		pipe_writer pipe = { .funcs = &pipe_funcs };
+		nnc_wstream *ws = i ? NNC_WSP(&pipe) : NNC_WSP(&wf);
+		if(nnc_wfile_open(i ? &pipe.file : &wf, names[i]) != NNC_R_OK)
+			die("failed to create output files");
+		if((res = nnc_write_cia(flags, &t->certchain, &tik, &t->tmd, 2, t->contents, ws)) != NNC_R_OK)
+			die("%s: writing encrypted CIA: %s", prog, nnc_strerror(res));
+		NNC_WS_PCALL0(ws, close);
+	}
+	if(!same_file(names[0], names[1]))
+	{
+		fprintf(stderr, "%s: encrypted CIA written without seeking differs\n", prog);
+		++failures;
+	}
+
+	if(nnc_file_open(&f, names[1]) != NNC_R_OK)
+		die("failed to open '%s'", names[1]);
+	if((res = nnc_read_cia_header(NNC_RSP(&f), &hdr)) != NNC_R_OK
+			|| (res = nnc_cia_make_reader(&hdr, NNC_RSP(&f), nnc_get_default_keyset(), &reader)) != NNC_R_OK)
+		die("%s: reading encrypted CIA: %s", prog, nnc_strerror(res));
+	for(nnc_u16 i = 0; i < 2; ++i)
+	{
+		if((res = nnc_cia_open_content(&reader, i, &content, &chunk)) != NNC_R_OK)
+			die("%s: opening encrypted content %d: %s", prog, i, nnc_strerror(res));
+		if((res = nnc_crypto_sha256_stream(NNC_RSP(&content), hash)) != NNC_R_OK)
+			die("%s: hashing encrypted content %d: %s", prog, i, nnc_strerror(res));
+		NNC_RS_CALL0(content, close);
+		/* the built NCCH is checked against its chunk record, the stream against its source */
+		if(i == 1 && (NNC_RS_CALL(aligned, seek_abs, 0) != NNC_R_OK || nnc_crypto_sha256_stream(NNC_RSP(&aligned), expected) != NNC_R_OK))
+			die("failed to hash content stream");
+		if(!(chunk->flags & NNC_CHUNKF_ENCRYPTED) || !nnc_crypto_hasheq(hash, chunk->hash)
+				|| (i == 1 && !nnc_crypto_hasheq(hash, expected)))
+		{
+			fprintf(stderr, "%s: encrypted content %d doesn't decrypt to what was written\n", prog, i);
+			++failures;
+		}
+	}
+	nnc_cia_free_reader(&reader);
+	NNC_RS_CALL0(f, close);
+
+	/* a partial block can't be encrypted without changing the content */
+	t->contents[1].ncch = &t->stream_content;
+	nnc_wfile wf;
+	if(nnc_wfile_open(&wf, names[0]) != NNC_R_OK)
+		die("failed to create output files");
+	if((res = nnc_write_cia(flags, &t->certchain, &tik, &t->tmd, 2, t->contents, NNC_WSP(&wf))) != NNC_R_BAD_ALIGN)
+	{
+		fprintf(stderr, "%s: encrypting an unaligned content: %s\n", prog, nnc_strerror(res));
+		++failures;
+	}
+	NNC_WS_CALL0(wf, close);
+
+	return failures;
+}
+
+int single_pass_test_main(int argc, char *argv[])
+{
+	(void) argc;
+	static const char *names[] = { "nnc-test-seekable.bin", "nnc-test-pipe.bin" };
+	static const char *kinds[] = { "RomFS", "NCCH", "CIA" };
+	static nnc_u8 data[300000];
+	struct single_pass_test t;
+	nnc_result res;
+	char name[16];
+	int failures = 0;
+
+	for(nnc_u32 i = 0, x = 7; i < sizeof(data); ++i)
+	{
+		x = x * 1103515245 + 12345;
+		data[i] = x >> 24;
+	}
+	if(nnc_vfs_init(&t.vfs) != NNC_R_OK)
+		die("failed to init VFS");
+	for(int i = 0; i < 5; ++i)
+	{
+		nnc_memory mem;
+		sprintf(name, "file%d", i);
+		nnc_mem_open(&mem, data + i * 1000, 30000 + i * 50000);
+		if(nnc_vfs_add_file(&t.vfs.root_directory, name, NNC_VFS_READER_COPY(mem, NNC_VFS_STREAM_NONE)) != NNC_R_OK)
+			die("failed to add '%s' to VFS", name);
+	}
+
+	memset(&t.ncch, 0, sizeof(t.ncch));
+	t.ncch.chdr.partition_id = t.ncch.chdr.title_id = 0x0004000000123400;
+	strcpy(t.ncch.chdr.product_code, "CTR-P-NNCT");
+	strcpy(t.ncch.chdr.maker_code, "00");
+	t.ncch.romfs = &t.vfs;
+	t.ncch.wflags = NNC_NCCH_WF_ROMFS_VFS;
+
+	memset(&t.tmd, 0, sizeof(t.tmd));
+	t.tmd.version = 1;
+	t.tmd.title_id = t.ncch.chdr.title_id;
+	t.tmd.content_count = 2;
+	nnc_mem_open(&t.certchain, data, 0x1000);
+	nnc_mem_open(&t.ticket, data + 0x1000, 0x350);
+	nnc_mem_open(&t.stream_content, data + 0x2000, 0x12345);
+	t.contents[0].ncch = &t.ncch;
+	t.contents[0].type = NNC_CIA_NCCHBUILD_BUILD;
+	t.contents[1].ncch = &t.stream_content;
+	t.contents[1].type = NNC_CIA_NCCHBUILD_STREAM;
+
+	/* the CIA is hashed through readback when seeking and while writing otherwise */
+	for(int kind = SP_ROMFS; kind <= SP_CIA; ++kind)
+	{
+		nnc_wfile wf;
+		pipe_writer pipe = { .funcs = &pipe_funcs };
+		if(nnc_wfile_open(&wf, names[0]) != NNC_R_OK || nnc_wfile_open(&pipe.file, names[1]) != NNC_R_OK)
+			die("failed to create output files");
+		if((res = write_single_pass_test(&t, kind, NNC_WSP(&wf))) != NNC_R_OK)
+			die("%s: writing %s: %s", argv[0], kinds[kind], nnc_strerror(res));
+		NNC_WS_CALL0(wf, close);
+		if((res = write_single_pass_test(&t, kind, NNC_WSP(&pipe))) != NNC_R_OK)
+			die("%s: writing %s without seeking: %s", argv[0], kinds[kind], nnc_strerror(res));
+		NNC_WS_CALL0(pipe, close);
+		if(!same_file(names[0], names[1]))
+		{
+			fprintf(stderr, "%s: %s written without seeking differs\n", argv[0], kinds[kind]);
+			++failures;
+		}
+	}
+
+	/* and the result has to be a CIA, not just the same bytes */
+	nnc_file f;
+	nnc_cia_header hdr;
+	if(nnc_file_open(&f, names[1]) != NNC_R_OK)
+		die("failed to open '%s'", names[1]);
+	if(nnc_read_cia_header(NNC_RSP(&f), &hdr) != NNC_R_OK || hdr.cert_chain_size != 0x1000
+			|| hdr.ticket_size != 0x350 || (hdr.content_index[0] & 0xC0) != 0xC0)
+	{
+		fprintf(stderr, "%s: bad CIA header\n", argv[0]);
+		++failures;
+	}
+	NNC_RS_CALL0(f, close);
+
+	failures += test_encrypted_cia(&t, names, argv[0]);
+
+	nnc_vfs_free(&t.vfs);
+	remove(names[0]);
+	remove(names[1]);
+	if(failures) die("%d check(s) failed", failures);
+	puts("single pass: done");
+	return 0;
+}
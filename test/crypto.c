@@ -0,0 +1,649 @@
+
+#include <nnc/context.h>
+#include <nnc/support.h>
+#include <nnc/sigcert.h>
+#include <nnc/crypto.h>
+#include <nnc/ncch.h>
+#include <nnc/stream.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdio.h>
+
+void die(const char *fmt, ...);
+
+/* generated with openssl: a 2048 bit RSA key (exponent 65537) and a
+ * sect233r1 key, both used to sign the SHA256 of "nnc" */
+
+static const nnc_u8 rsa_modulus[0x100] = {
+	0xB7, 0xC8, 0x80, 0x40, 0x6D, 0xD9, 0xE4, 0xAD, 0xB0, 0x4E, 0xB3, 0x24, 0x9E, 0xFF, 0x59, 0x16,
+	0xD2, 0x49, 0x6B, 0xA6, 0xC7, 0x51, 0x54, 0xF6, 0xAB, 0x89, 0xDB, 0xF1, 0x2B, 0xDC, 0xCC, 0x74,
+	0x88, 0x73, 0x8F, 0xE6, 0x85, 0xB5, 0x43, 0xF8, 0xA2, 0xDB, 0x39, 0x44, 0xF1, 0x27, 0x92, 0x11,
+	0xE5, 0x3D, 0x13, 0xEF, 0x7D, 0xE4, 0x5E, 0x68, 0xDA, 0xEA, 0xC1, 0x05, 0xC9, 0x43, 0xFC, 0xA9,
+	0x47, 0x8A, 0x05, 0xBD, 0x21, 0x5A, 0x7A, 0x60, 0x4A, 0x42, 0x45, 0xD4, 0x42, 0xDD, 0xF3, 0xA2,
+	0x27, 0xE5, 0xF1, 0x88, 0x2C, 0x10, 0xC4, 0x46, 0x51, 0x90, 0xFA, 0xF8, 0x0D, 0x2E, 0x0F, 0xC4,
+	0x7C, 0xB7, 0x59, 0xB0, 0x3C, 0x81, 0xDE, 0xC0, 0xFD, 0x93, 0xD1, 0x08, 0x75, 0x39, 0x9F, 0xB6,
+	0x99, 0x1B, 0xC8, 0x6C, 0x02, 0x9E, 0xC2, 0xB9, 0x9C, 0xD6, 0x71, 0x1E, 0x92, 0xAD, 0x21, 0x8E,
+	0x82, 0x86, 0xF6, 0x39, 0xF6, 0xFE, 0x5C, 0x0B, 0x3C, 0x23, 0xC2, 0xEA, 0xEC, 0xD2, 0xF4, 0xD0,
+	0xBB, 0x82, 0x11, 0xD0, 0x96, 0xBB, 0x7E, 0x74, 0xE4, 0xB1, 0x76, 0x73, 0x0F, 0xD6, 0xB8, 0x73,
+	0xCB, 0x45, 0xBB, 0x9B, 0x39, 0x6C, 0x2A, 0x90, 0x0B, 0x5A, 0x01, 0x9A, 0xE8, 0x87, 0x01, 0x74,
+	0xEB, 0x6F, 0x3F, 0x40, 0x78, 0xE8, 0x0D, 0xBB, 0x86, 0xB0, 0xC9, 0x20, 0xC3, 0x73, 0x40, 0x09,
+	0x50, 0x24, 0xB6, 0x00, 0x97, 0xD0, 0x2C, 0xB5, 0x5B, 0xE5, 0x98, 0xE1, 0x49, 0x3F, 0x52, 0x30,
+	0xED, 0x6C, 0x37, 0x1B, 0x65, 0x68, 0xCE, 0xC9, 0x83, 0xA8, 0xB0, 0x10, 0x99, 0x26, 0xC4, 0x1F,
+	0x31, 0x8E, 0x7B, 0xD0, 0xCA, 0x6B, 0xD4, 0x38, 0x8A, 0x27, 0x72, 0x4B, 0x5D, 0xA3, 0xE6, 0x52,
+	0x1A, 0xDE, 0x16, 0x65, 0xDF, 0xE4, 0xE0, 0x5E, 0xB6, 0x6D, 0x14, 0xD2, 0x79, 0xB1, 0xA5, 0x4F,
+};
+
+static const nnc_u8 rsa_signature[0x100] = {
+	0x74, 0xEF, 0xDA, 0xE3, 0xE7, 0xB0, 0x85, 0xF4, 0xBC, 0xC2, 0xDD, 0xE2, 0x30, 0x3F, 0x09, 0x46,
+	0x89, 0x12, 0x12, 0xCC, 0x0C, 0xFB, 0xDF, 0xB7, 0xF6, 0xD0, 0x45, 0x98, 0xDD, 0x94, 0xC1, 0xF7,
+	0x97, 0x34, 0x2B, 0x5D, 0x71, 0xA2, 0x90, 0x77, 0xB0, 0x78, 0x5A, 0xA9, 0xCE, 0x9A, 0x7A, 0xA6,
+	0xA8, 0xE4, 0x46, 0xE0, 0xB2, 0x12, 0x18, 0x26, 0xAE, 0x6A, 0x33, 0xB6, 0x51, 0xD1, 0x7F, 0x6D,
+	0xB5, 0x0B, 0x13, 0x09, 0xB1, 0x4A, 0xBA, 0x40, 0xE1, 0x8C, 0x81, 0xAA, 0xAB, 0xDE, 0xFA, 0x8A,
+	0x47, 0x01, 0x9C, 0xC1, 0x2B, 0xFC, 0xFA, 0x15, 0xFE, 0x3F, 0x2D, 0x75, 0xF0, 0xD7, 0xC1, 0xDC,
+	0xB7, 0x70, 0xA2, 0x8D, 0xEF, 0x8F, 0x21, 0xB1, 0x8C, 0x71, 0x5C, 0x03, 0x54, 0xC5, 0xEF, 0xF9,
+	0x60, 0x23, 0x71, 0x58, 0x19, 0x99, 0xDB, 0x4D, 0xD5, 0x4E, 0xB4, 0x4D, 0x0D, 0x8A, 0xAF, 0xEB,
+	0x6D, 0xBD, 0x06, 0x5C, 0xA3, 0x85, 0x16, 0xF6, 0x50, 0xDD, 0xED, 0xAC, 0x1A, 0xFA, 0x50, 0x19,
+	0x8C, 0x49, 0x80, 0xFD, 0xBC, 0x77, 0xC0, 0x5C, 0x9D, 0x91, 0x48, 0x9D, 0xFA, 0x1D, 0x60, 0xCA,
+	0x1E, 0x5A, 0xC6, 0xD0, 0xDC, 0x0A, 0x93, 0xB3, 0x54, 0xB1, 0xD9, 0x4F, 0x92, 0x58, 0x76, 0x2A,
+	0x23, 0x94, 0xE4, 0x68, 0xAD, 0x77, 0x19, 0xB7, 0xAF, 0xA7, 0xD5, 0x18, 0x1A, 0x67, 0xC5, 0x88,
+	0x39, 0x04, 0xDA, 0xB9, 0xB7, 0x45, 0xB5, 0x6C, 0xAA, 0x36, 0x91, 0xFA, 0xCF, 0x78, 0x25, 0x02,
+	0x28, 0xE4, 0xCD, 0x9D, 0xC9, 0x9C, 0xDD, 0x0C, 0x87, 0x5C, 0x3C, 0x7D, 0x43, 0xA9, 0x13, 0x4A,
+	0x0F, 0xA3, 0x22, 0x55, 0x3B, 0x2B, 0x92, 0xC2, 0x61, 0x16, 0x8B, 0x78, 0x87, 0xC6, 0x09, 0xFB,
+	0x49, 0xA3, 0x32, 0xF2, 0x0D, 0xA7, 0x4D, 0x65, 0x3C, 0xD9, 0xCA, 0xD5, 0x4E, 0x16, 0xE6, 0x32,
+};
+
+static const nnc_u8 ecdsa_pubkey[0x3C] = {
+	0x01, 0xC6, 0xD4, 0xE7, 0xB0, 0xCC, 0x83, 0x65, 0x62, 0x1A, 0x78, 0x3F, 0x33, 0xC5, 0x79, 0xB8,
+	0x3B, 0x80, 0xAE, 0x7B, 0x5B, 0x08, 0xFA, 0x96, 0x9D, 0x41, 0x07, 0x6A, 0xFC, 0xFD, 0x00, 0xEE,
+	0xC2, 0x34, 0x4A, 0xA6, 0x15, 0xC4, 0x34, 0xB7, 0xE7, 0x96, 0xBC, 0x1B, 0x48, 0x37, 0x11, 0x2E,
+	0x0F, 0x2C, 0x36, 0x5B, 0xB6, 0x13, 0x04, 0xE0, 0xF5, 0xEB, 0x01, 0xFB,
+};
+
+static const nnc_u8 ecdsa_signature[0x3C] = {
+	0x00, 0x10, 0x41, 0xE0, 0x2D, 0xEC, 0xEA, 0xB2, 0x57, 0xBA, 0xE8, 0xC0, 0xFF, 0x06, 0x8C, 0x95,
+	0xC1, 0xAA, 0x07, 0x05, 0x91, 0x08, 0x34, 0x57, 0xFD, 0xE0, 0xE1, 0x62, 0xA8, 0x07, 0x00, 0x46,
+	0x0C, 0x1E, 0x12, 0x40, 0x63, 0x1E, 0x73, 0xD1, 0x87, 0x53, 0x8E, 0xE3, 0xCD, 0xDB, 0x96, 0x8F,
+	0xFD, 0x95, 0x51, 0xF2, 0x46, 0xB7, 0xC4, 0x10, 0x40, 0x96, 0x4C, 0x88,
+};
+
+/* NIST SP 800-38A F.2.1 and F.5.1, first block */
+static const nnc_u8 nist_key[0x10] = {
+	0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C,
+};
+static const nnc_u8 nist_plain[0x10] = {
+	0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96, 0xE9, 0x3D, 0x7E, 0x11, 0x73, 0x93, 0x17, 0x2A,
+};
+static const nnc_u8 nist_cbc_iv[0x10] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+};
+static const nnc_u8 nist_cbc_cipher[0x10] = {
+	0x76, 0x49, 0xAB, 0xAC, 0x81, 0x19, 0xB2, 0x46, 0xCE, 0xE9, 0x8E, 0x9B, 0x12, 0xE9, 0x19, 0x7D,
+};
+static const nnc_u8 nist_ctr_iv[0x10] = {
+	0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF,
+};
+static const nnc_u8 nist_ctr_cipher[0x10] = {
+	0x87, 0x4D, 0x61, 0x91, 0xB6, 0x20, 0xE3, 0x26, 0x1B, 0xEF, 0x68, 0x64, 0x99, 0x0D, 0xB6, 0xCE,
+};
+
+/* SHA256("abc") and SHA1("abc") */
+static const nnc_u8 abc_sha256[0x20] = {
+	0xBA, 0x78, 0x16, 0xBF, 0x8F, 0x01, 0xCF, 0xEA, 0x41, 0x41, 0x40, 0xDE, 0x5D, 0xAE, 0x22, 0x23,
+	0xB0, 0x03, 0x61, 0xA3, 0x96, 0x17, 0x7A, 0x9C, 0xB4, 0x10, 0xFF, 0x61, 0xF2, 0x00, 0x15, 0xAD,
+};
+static const nnc_u8 abc_sha1[20] = {
+	0xA9, 0x99, 0x3E, 0x36, 0x47, 0x06, 0x81, 0x6A, 0xBA, 0x3E, 0x25, 0x71, 0x78, 0x50, 0xC2, 0x6C,
+	0x9C, 0xD0, 0xD8, 0x9D,
+};
+
+/* deliberately not a multiple of the AES block size */
+#define DATA_SIZE 0x30011
+
+typedef struct crypto_results {
+	nnc_sha256_hash sha256;
+	nnc_sha1_hash sha1;
+	nnc_u32 crc32;
+	nnc_u8 *ctr;
+	nnc_u8 *cbc;
+} crypto_results;
+
+static int failures;
+
+#define CHECK(cond, what) do { if(!(cond)) { fprintf(stderr, "%s: %s failed\n", name, what); ++failures; } } while(0)
+
+static nnc_result read_all(nnc_rstream *rs, nnc_u8 *out, nnc_u32 size)
+{
+	/* odd read sizes to exercise the partial block handling */
+	static const nnc_u32 sizes[] = { 1, 0x10, 7, 0x1003, 0x20, 0x4000, 33 };
+	nnc_u32 pos = 0, next, got;
+	nnc_result ret;
+	for(int i = 0; pos != size; i = (i + 1) % (sizeof(sizes) / sizeof(sizes[0])))
+	{
+		next = sizes[i] < size - pos ? sizes[i] : size - pos;
+		if((ret = NNC_RS_PCALL(rs, read, out + pos, next, &got)) != NNC_R_OK)
+			return ret;
+		if(got != next) return NNC_R_TOO_SMALL;
+		pos += next;
+	}
+	return NNC_R_OK;
+}
+
+/* write stream that only counts what is written to it */
+typedef struct count_writer {
+	const nnc_wstream_funcs *funcs;
+	nnc_u32 written;
+} count_writer;
+
+static nnc_result count_write(count_writer *self, nnc_u8 *buf, nnc_u32 size) { (void) buf; self->written += size; return NNC_R_OK; }
+static nnc_result count_close(count_writer *self) { (void) self; return NNC_R_OK; }
+static nnc_u32 count_tell(count_writer *self) { return self->written; }
+
+static const nnc_wstream_funcs count_funcs = {
+	.write = (nnc_write_func)  count_write,
+	.close = (nnc_wclose_func) count_close,
+	.tell  = (nnc_wtell_func)  count_tell,
+};
+
+static void run_backend(const char *name, const nnc_u8 *data, crypto_results *res)
+{
+	nnc_sha256_hash sha256, inc256;
+	nnc_sha1_hash sha1;
+	nnc_memory mem;
+	nnc_u8 block[0x10];
+	nnc_u8 key[0x10], iv[0x10];
+	nnc_u128 key128;
+
+	/* hashing */
+	nnc_crypto_sha256((const nnc_u8 *) "abc", sha256, 3);
+	CHECK(memcmp(sha256, abc_sha256, sizeof(sha256)) == 0, "SHA256 known answer");
+	nnc_mem_open(&mem, "abc", 3);
+	CHECK(nnc_crypto_sha1_part(NNC_RSP(&mem), sha1, 3) == NNC_R_OK
+		&& memcmp(sha1, abc_sha1, sizeof(sha1)) == 0, "SHA1 known answer");
+
+	nnc_sha256_incremental_hash hash;
+	CHECK(nnc_crypto_sha256_incremental(&hash) == NNC_R_OK, "incremental hash");
+	for(nnc_u32 pos = 0, next; pos != DATA_SIZE; pos += next)
+	{
+		next = DATA_SIZE - pos < 7777 ? DATA_SIZE - pos : 7777;
+		nnc_crypto_sha256_feed(hash, (nnc_u8 *) data + pos, next);
+	}
+	nnc_crypto_sha256_finish(hash, inc256);
+	nnc_crypto_sha256_free(hash);
+	nnc_crypto_sha256(data, res->sha256, DATA_SIZE);
+	CHECK(memcmp(inc256, res->sha256, sizeof(inc256)) == 0, "incremental SHA256");
+	nnc_mem_open(&mem, data, DATA_SIZE);
+	CHECK(nnc_crypto_sha1_part(NNC_RSP(&mem), res->sha1, DATA_SIZE) == NNC_R_OK, "SHA1");
+
+	nnc_digests digests;
+	nnc_mem_open(&mem, "abc", 3);
+	CHECK(nnc_crypto_multi_hash_stream(NNC_RSP(&mem), NNC_DIGEST_SHA1 | NNC_DIGEST_SHA256, &digests) == NNC_R_OK
+		&& memcmp(digests.sha1, abc_sha1, sizeof(digests.sha1)) == 0
+		&& memcmp(digests.sha256, abc_sha256, sizeof(digests.sha256)) == 0, "multi-digest known answer");
+	nnc_mem_open(&mem, "123456789", 9);
+	CHECK(nnc_crypto_multi_hash_part(NNC_RSP(&mem), NNC_DIGEST_CRC32, &digests, 9) == NNC_R_OK
+		&& digests.crc32 == 0xCBF43926, "CRC32 known answer");
+	nnc_mem_open(&mem, data, DATA_SIZE);
+	CHECK(nnc_crypto_multi_hash_part(NNC_RSP(&mem), NNC_DIGEST_SHA1 | NNC_DIGEST_SHA256 | NNC_DIGEST_CRC32, &digests, DATA_SIZE) == NNC_R_OK
+		&& memcmp(digests.sha1, res->sha1, sizeof(digests.sha1)) == 0
+		&& memcmp(digests.sha256, res->sha256, sizeof(digests.sha256)) == 0, "multi-digest hash");
+	res->crc32 = digests.crc32;
+
+	count_writer sink = { &count_funcs, 0 };
+	nnc_multi_hasher_writer mhw;
+	CHECK(nnc_open_multi_hasher_writer(&mhw, (nnc_wstream *) &sink, NNC_DIGEST_SHA256 | NNC_DIGEST_CRC32, 0) == NNC_R_OK, "multi-digest writer");
+	for(nnc_u32 pos = 0, next; pos != DATA_SIZE; pos += next)
+	{
+		next = DATA_SIZE - pos < 5555 ? DATA_SIZE - pos : 5555;
+		NNC_WS_CALL(mhw, write, (nnc_u8 *) data + pos, next);
+	}
+	nnc_multi_hasher_writer_digest(&mhw, &digests);
+	CHECK(sink.written == DATA_SIZE && digests.types == (NNC_DIGEST_SHA256 | NNC_DIGEST_CRC32)
+		&& memcmp(digests.sha256, res->sha256, sizeof(digests.sha256)) == 0
+		&& digests.crc32 == res->crc32, "multi-digest writer hash");
+
+	/* AES */
+	nnc_aes_ctr ctr;
+	nnc_aes_cbc cbc;
+	memcpy(key, nist_key, sizeof(key));
+
+	key128 = nnc_u128_import_be(key);
+	memcpy(iv, nist_ctr_iv, sizeof(iv));
+	nnc_mem_open(&mem, nist_ctr_cipher, sizeof(nist_ctr_cipher));
+	CHECK(nnc_aes_ctr_open(&ctr, NNC_RSP(&mem), &key128, iv) == NNC_R_OK
+		&& read_all(NNC_RSP(&ctr), block, sizeof(block)) == NNC_R_OK
+		&& memcmp(block, nist_plain, sizeof(block)) == 0, "AES-CTR known answer");
+	NNC_RS_CALL0(ctr, close);
+
+	memcpy(iv, nist_cbc_iv, sizeof(iv));
+	nnc_mem_open(&mem, nist_cbc_cipher, sizeof(nist_cbc_cipher));
+	CHECK(nnc_aes_cbc_open(&cbc, NNC_RSP(&mem), key, iv) == NNC_R_OK
+		&& read_all(NNC_RSP(&cbc), block, sizeof(block)) == NNC_R_OK
+		&& memcmp(block, nist_plain, sizeof(block)) == 0, "AES-CBC known answer");
+	NNC_RS_CALL0(cbc, close);
+
+	nnc_mem_open(&mem, data, DATA_SIZE);
+	CHECK(nnc_aes_ctr_open(&ctr, NNC_RSP(&mem), &key128, iv) == NNC_R_OK
+		&& read_all(NNC_RSP(&ctr), res->ctr, DATA_SIZE) == NNC_R_OK, "AES-CTR");
+	NNC_RS_CALL0(ctr, close);
+
+	/* a first read at the end mustn't shrink the window for the reads after it */
+	nnc_u8 *tail = malloc(DATA_SIZE);
+	nnc_mem_open(&mem, data, DATA_SIZE);
+	CHECK(tail && nnc_aes_ctr_open(&ctr, NNC_RSP(&mem), &key128, iv) == NNC_R_OK
+		&& NNC_RS_CALL(ctr, seek_abs, DATA_SIZE - 5) == NNC_R_OK
+		&& read_all(NNC_RSP(&ctr), tail + DATA_SIZE - 5, 5) == NNC_R_OK
+		&& NNC_RS_CALL(ctr, seek_abs, 0) == NNC_R_OK
+		&& read_all(NNC_RSP(&ctr), tail, DATA_SIZE - 5) == NNC_R_OK
+		&& memcmp(tail, res->ctr, DATA_SIZE) == 0
+		&& ctr.window_size == NNC_CRYPTO_WINDOW_DEFAULT && ctr.window_alloc == NNC_CRYPTO_WINDOW_DEFAULT, "AES-CTR window");
+	NNC_RS_CALL0(ctr, close);
+	free(tail);
+
+	/* OpenSSL keeps the counter in its context, so streams may only share it once it's idle */
+	nnc_aes_ctr ctr2;
+	void *first;
+	nnc_mem_open(&mem, data, DATA_SIZE);
+	CHECK(nnc_aes_ctr_open(&ctr, NNC_RSP(&mem), &key128, iv) == NNC_R_OK
+		&& nnc_aes_ctr_open(&ctr2, NNC_RSP(&mem), &key128, iv) == NNC_R_OK
+		&& (ctr.crypto_ctx == ctr2.crypto_ctx) == (strcmp(name, "openssl") != 0), "AES schedule sharing");
+	first = ctr.crypto_ctx;
+	NNC_RS_CALL0(ctr, close);
+	CHECK(nnc_aes_ctr_open(&ctr, NNC_RSP(&mem), &key128, iv) == NNC_R_OK
+		&& ctr.crypto_ctx == first, "AES schedule reuse");
+	NNC_RS_CALL0(ctr, close);
+	NNC_RS_CALL0(ctr2, close);
+
+	nnc_mem_open(&mem, data, DATA_SIZE);
+	CHECK(nnc_aes_cbc_open(&cbc, NNC_RSP(&mem), key, iv) == NNC_R_OK
+		&& read_all(NNC_RSP(&cbc), res->cbc, DATA_SIZE) == NNC_R_OK, "AES-CBC");
+	NNC_RS_CALL0(cbc, close);
+
+	/* signatures */
+	nnc_certificate cert;
+	nnc_certchain chain = { &cert, 1 };
+	nnc_signature sig;
+	nnc_sha_hash msg_hash;
+	nnc_crypto_sha256((const nnc_u8 *) "nnc", msg_hash, 3);
+
+	memset(&cert, 0, sizeof(cert));
+	cert.type = NNC_CERT_RSA_2048;
+	strcpy(cert.name, "CP00000004");
+	memcpy(cert.data.rsa2048.modulus, rsa_modulus, sizeof(rsa_modulus));
+	memcpy(cert.data.rsa2048.exp, "\x00\x01\x00\x01", 4);
+	sig.type = NNC_SIG_RSA_2048_SHA256;
+	strcpy(sig.issuer, "Root-CA00000003-CP00000004");
+	memcpy(sig.data, rsa_signature, sizeof(rsa_signature));
+	CHECK(nnc_verify_signature(&chain, &sig, msg_hash) == NNC_R_OK, "RSA verification");
+	msg_hash[5] ^= 1;
+	CHECK(nnc_verify_signature(&chain, &sig, msg_hash) == NNC_R_BAD_SIG, "RSA rejection");
+	msg_hash[5] ^= 1;
+
+	/* every third check has the wrong data */
+	nnc_signature_check checks[24];
+	for(int i = 0; i < 24; ++i)
+	{
+		checks[i].sig = &sig;
+		checks[i].data = (const nnc_u8 *) (i % 3 == 2 ? "nnd" : "nnc");
+		checks[i].size = 3;
+	}
+	CHECK(nnc_verify_signatures_batch(&chain, checks, 24, 4) == NNC_R_BAD_SIG, "batch RSA verification");
+	for(int i = 0; i < 24; ++i)
+		CHECK(checks[i].status == (i % 3 == 2 ? NNC_R_BAD_SIG : NNC_R_OK), "batch RSA result");
+	checks[2].data = checks[5].data = checks[8].data = checks[11].data = (const nnc_u8 *) "nnc";
+	checks[14].data = checks[17].data = checks[20].data = checks[23].data = (const nnc_u8 *) "nnc";
+	CHECK(nnc_verify_signatures_batch(&chain, checks, 24, 1) == NNC_R_OK, "single threaded batch RSA verification");
+
+	cert.type = NNC_CERT_ECDSA;
+	strcpy(cert.name, "XS00000003");
+	memcpy(cert.data.ecdsa.pubkey, ecdsa_pubkey, sizeof(ecdsa_pubkey));
+	sig.type = NNC_SIG_ECDSA_SHA256;
+	strcpy(sig.issuer, "Root-CA00000003-XS00000003");
+	memcpy(sig.data, ecdsa_signature, sizeof(ecdsa_signature));
+	nnc_result ret = nnc_verify_signature(&chain, &sig, msg_hash);
+	/* not all backends (or builds of OpenSSL) have binary field curves */
+	if(ret == NNC_R_UNSUPPORTED)
+		printf("%s: ECDSA unsupported\n", name);
+	else
+	{
+		CHECK(ret == NNC_R_OK, "ECDSA verification");
+		msg_hash[5] ^= 1;
+		CHECK(nnc_verify_signature(&chain, &sig, msg_hash) == NNC_R_BAD_SIG, "ECDSA rejection");
+	}
+}
+
+/* allocator that keeps track of how many allocations are live */
+static nnc_u32 ctx_live;
+static void *ctx_alloc(void *user, size_t size) { ++*(nnc_u32 *) user; return malloc(size); }
+static void *ctx_realloc(void *user, void *ptr, size_t size) { if(!ptr) ++*(nnc_u32 *) user; return realloc(ptr, size); }
+static void ctx_free(void *user, void *ptr) { if(ptr) --*(nnc_u32 *) user; free(ptr); }
+
+static void run_context(void)
+{
+	const char *name = "context";
+	nnc_allocator al = { ctx_alloc, ctx_realloc, ctx_free, &ctx_live };
+	nnc_u8 seeddb[0x10 + 2 * 0x20], chain[0x300];
+	nnc_memory mem;
+	nnc_ctx ctx;
+
+	CHECK(nnc_ctx_init(&ctx, &al, 0) == NNC_R_OK, "context init");
+	CHECK(ctx.has_cache && ctx_live != 0, "context allocations");
+
+	/* two seeds out of order */
+	memset(seeddb, 0, sizeof(seeddb));
+	seeddb[0x00] = 2;
+	seeddb[0x10] = 0x02; memset(&seeddb[0x18], 0xBB, 0x10);
+	seeddb[0x30] = 0x01; memset(&seeddb[0x38], 0xAA, 0x10);
+	nnc_mem_open(&mem, seeddb, sizeof(seeddb));
+	CHECK(nnc_ctx_load_seeddb(&ctx, NNC_RSP(&mem)) == NNC_R_OK, "context seeddb");
+	CHECK(ctx.seeddb.size == 2 && nnc_get_seed(&ctx.seeddb, 1) && nnc_get_seed(&ctx.seeddb, 1)[0] == 0xAA
+		&& nnc_get_seed(&ctx.seeddb, 2)[0] == 0xBB, "context seed lookup");
+
+	/* a certificate chain with the RSA key, signed with nothing in particular */
+	memset(chain, 0, sizeof(chain));
+	chain[0x001] = 0x01; chain[0x003] = NNC_SIG_RSA_2048_SHA256;
+	strcpy((char *) &chain[0x140], "Root-CA00000003");
+	chain[0x183] = NNC_CERT_RSA_2048;
+	strcpy((char *) &chain[0x184], "CP00000004");
+	memcpy(&chain[0x1C8], rsa_modulus, sizeof(rsa_modulus));
+	memcpy(&chain[0x2C8], "\x00\x01\x00\x01", 4);
+	nnc_mem_open(&mem, chain, 0x300);
+	CHECK(nnc_ctx_load_certchain(&ctx, NNC_RSP(&mem)) == NNC_R_OK && ctx.certs.len == 1, "context certificate chain");
+
+	nnc_signature sig;
+	nnc_sha_hash msg_hash;
+	nnc_crypto_sha256((const nnc_u8 *) "nnc", msg_hash, 3);
+	sig.type = NNC_SIG_RSA_2048_SHA256;
+	strcpy(sig.issuer, "Root-CA00000003-CP00000004");
+	memcpy(sig.data, rsa_signature, sizeof(rsa_signature));
+	CHECK(nnc_ctx_verify_signature(&ctx, &sig, msg_hash) == NNC_R_OK, "context RSA verification");
+
+	/* the same data as a support blob */
+	static const char *blob_name = "nnc-test-support.bin";
+	nnc_support sup;
+	nnc_wfile wf;
+	CHECK(nnc_wfile_open(&wf, blob_name) == NNC_R_OK, "support blob create");
+	CHECK(nnc_write_support(NNC_WSP(&wf), &ctx.keyset, &ctx.seeddb, &ctx.certs) == NNC_R_OK, "support blob write");
+	NNC_WS_CALL0(wf, close);
+	CHECK(nnc_support_open_file(&sup, blob_name) == NNC_R_OK, "support blob open");
+	CHECK(sup.keyset && memcmp(sup.keyset, &ctx.keyset, sizeof(ctx.keyset)) == 0, "support blob keyset");
+	CHECK(nnc_get_seed(&sup.seeddb, 2) && nnc_get_seed(&sup.seeddb, 2)[0] == 0xBB, "support blob seed lookup");
+	CHECK(nnc_verify_signature(&sup.certs, &sig, msg_hash) == NNC_R_OK, "support blob RSA verification");
+
+	nnc_ctx ctx2;
+	CHECK(nnc_ctx_init(&ctx2, &al, NNC_CTX_NO_CACHE | NNC_CTX_DEV_KEYS) == NNC_R_OK
+		&& nnc_ctx_load_support(&ctx2, &sup) == NNC_R_OK, "context from support blob");
+	CHECK(memcmp(&ctx2.keyset, &ctx.keyset, sizeof(ctx.keyset)) == 0 && ctx2.seeddb.size == 2
+		&& nnc_ctx_verify_signature(&ctx2, &sig, msg_hash) == NNC_R_OK, "context from support blob contents");
+	nnc_ctx_free(&ctx2);
+
+	/* damage and misalignment are caught */
+	nnc_u64 *copy = malloc(sup.size + 8);
+	if(!copy) die("out of memory");
+	memcpy(copy, sup.data, sup.size);
+	((nnc_u8 *) copy)[sup.size - 1] ^= 1;
+	nnc_support bad;
+	CHECK(nnc_support_open_memory(&bad, copy, sup.size) == NNC_R_CORRUPT, "support blob checksum");
+	memcpy((nnc_u8 *) copy + 4, sup.data, sup.size);
+	CHECK(nnc_support_open_memory(&bad, (nnc_u8 *) copy + 4, sup.size) == NNC_R_BAD_ALIGN, "support blob alignment");
+	free(copy);
+	nnc_support_close(&sup);
+	remove(blob_name);
+
+	nnc_ctx_free(&ctx);
+	CHECK(ctx_live == 0, "context free");
+	printf("%s: done\n", name);
+}
+
+/* an NCCH header with only the fields keypair derivation looks at */
+static void make_ncch(struct nnc_ncch_header *ncch, nnc_u64 tid, nnc_u32 keyy, const nnc_u8 *seed)
+{
+	nnc_u8 buf[0x18];
+	nnc_sha_hash hash;
+	memset(ncch, 0, sizeof(*ncch));
+	memset(buf, 0, 0x10);
+	buf[0x0C] = keyy >> 24; buf[0x0D] = keyy >> 16;
+	buf[0x0E] = keyy >> 8; buf[0x0F] = keyy;
+	ncch->keyy = nnc_u128_import_be(buf);
+	ncch->title_id = tid;
+	if(seed)
+	{
+		/* first u32 of SHA256(seed || title id in little endian) */
+		memcpy(buf, seed, NNC_SEED_SIZE);
+		for(int i = 0; i < 8; ++i)
+			buf[0x10 + i] = tid >> (i * 8);
+		nnc_crypto_sha256(buf, hash, sizeof(buf));
+		memcpy(ncch->seed_hash, hash, sizeof(ncch->seed_hash));
+		ncch->flags |= NNC_NCCH_USES_SEED;
+	}
+}
+
+static int same_pair(const nnc_keypair *a, const nnc_keypair *b)
+{
+	return memcmp(a, b, sizeof(nnc_keypair)) == 0;
+}
+
+#define CACHE_THREADS 4
+#define CACHE_SHARED  4
+#define CACHE_OWN     4
+
+struct cache_thread {
+	nnc_keypair_cache *cache;
+	nnc_keyset *ks;
+	struct nnc_ncch_header ncchs[CACHE_SHARED + CACHE_OWN];
+	nnc_keypair expect[CACHE_SHARED + CACHE_OWN];
+	int failures;
+};
+
+static void *cache_thread(void *arg)
+{
+	struct cache_thread *t = arg;
+	nnc_keypair pair;
+	/* the shared titles are looked up by every thread, the others only by this one */
+	for(int round = 0; round < 64; ++round)
+		for(int i = 0; i < CACHE_SHARED + CACHE_OWN; ++i)
+		{
+			if(nnc_fill_keypair_cached(&pair, t->ks, NULL, &t->ncchs[i], t->cache) != NNC_R_OK
+					|| !same_pair(&pair, &t->expect[i]))
+				++t->failures;
+		}
+	return NULL;
+}
+
+static void run_keypair_cache(void)
+{
+	const char *name = "keypair cache";
+	nnc_keyset *ks = nnc_get_default_keyset();
+	struct nnc_seeddb_entry entries[2], other_entries[2];
+	nnc_seeddb seeddb = { 2, entries }, other_seeddb = { 2, other_entries };
+	struct nnc_ncch_header plain, seeded, ncch, batch[5];
+	nnc_keypair expect, pair, first, outputs[5];
+	nnc_result results[5];
+	nnc_keypair_cache cache;
+	int ok;
+
+	entries[0].title_id = 0x0004000000100000; memset(entries[0].seed, 0xAA, NNC_SEED_SIZE);
+	entries[1].title_id = 0x0004000000100100; memset(entries[1].seed, 0xBB, NNC_SEED_SIZE);
+	/* the same titles with a different seed for the second one */
+	memcpy(other_entries, entries, sizeof(entries));
+	memset(other_entries[1].seed, 0xCC, NNC_SEED_SIZE);
+
+	CHECK(nnc_keypair_cache_init(&cache, 8) == NNC_R_OK, "init");
+
+	/* cached and uncached derivation agree, both on a miss and on a hit */
+	make_ncch(&plain, 0x0004000000100000, 0x1234, NULL);
+	make_ncch(&seeded, 0x0004000000100100, 0x1234, entries[1].seed);
+	CHECK(nnc_fill_keypair(&expect, ks, &seeddb, &plain) == NNC_R_OK, "unseeded keypair");
+	CHECK(nnc_fill_keypair_cached(&pair, ks, &seeddb, &plain, &cache) == NNC_R_OK && same_pair(&pair, &expect), "unseeded miss");
+	CHECK(nnc_fill_keypair_cached(&pair, ks, &seeddb, &plain, &cache) == NNC_R_OK && same_pair(&pair, &expect), "unseeded hit");
+	CHECK(nnc_fill_keypair(&expect, ks, &seeddb, &seeded) == NNC_R_OK, "seeded keypair");
+	CHECK(nnc_fill_keypair_cached(&pair, ks, &seeddb, &seeded, &cache) == NNC_R_OK && same_pair(&pair, &expect), "seeded miss");
+	CHECK(nnc_fill_keypair_cached(&pair, ks, &seeddb, &seeded, &cache) == NNC_R_OK && same_pair(&pair, &expect), "seeded hit");
+
+	/* only the keyY differs */
+	nnc_fill_keypair_cached(&first, ks, &seeddb, &plain, &cache);
+	make_ncch(&ncch, 0x0004000000100000, 0x1235, NULL);
+	CHECK(nnc_fill_keypair(&expect, ks, &seeddb, &ncch) == NNC_R_OK && !same_pair(&expect, &first), "other keyY keypair");
+	CHECK(nnc_fill_keypair_cached(&pair, ks, &seeddb, &ncch, &cache) == NNC_R_OK && same_pair(&pair, &expect), "other keyY");
+
+	/* only the seed differs */
+	nnc_fill_keypair_cached(&first, ks, &seeddb, &seeded, &cache);
+	make_ncch(&ncch, 0x0004000000100100, 0x1234, other_entries[1].seed);
+	CHECK(nnc_fill_keypair(&expect, ks, &other_seeddb, &ncch) == NNC_R_OK && !same_pair(&expect, &first), "other seed keypair");
+	CHECK(nnc_fill_keypair_cached(&pair, ks, &other_seeddb, &ncch, &cache) == NNC_R_OK && same_pair(&pair, &expect), "other seed");
+	/* a seed mismatching the hash isn't cached as a valid keypair */
+	CHECK(nnc_fill_keypair_cached(&pair, ks, &seeddb, &ncch, &cache) == NNC_R_CORRUPT, "seed hash mismatch");
+
+	/* way more keys than slots: nothing grows and nothing goes stale */
+	struct nnc_keypair_cache_entry *slots = cache.entries;
+	ok = 1;
+	for(int round = 0; round < 2; ++round)
+		for(nnc_u32 i = 0; i < 100; ++i)
+		{
+			if(i % 3 == 0)
+				make_ncch(&ncch, entries[0].title_id, 0x10000 + i, entries[0].seed);
+			else
+				make_ncch(&ncch, 0x0004000000200000 + (i % 10), 0x10000 + i, NULL);
+			if(nnc_fill_keypair(&expect, ks, &seeddb, &ncch) != NNC_R_OK
+					|| nnc_fill_keypair_cached(&pair, ks, &seeddb, &ncch, &cache) != NNC_R_OK
+					|| !same_pair(&pair, &expect))
+				ok = 0;
+		}
+	CHECK(ok, "over capacity");
+	CHECK(cache.entries == slots && cache.capacity == 8, "over capacity size");
+
+	/* the same through a context, where every allocation is counted */
+	nnc_allocator al = { ctx_alloc, ctx_realloc, ctx_free, &ctx_live };
+	nnc_ctx ctx;
+	CHECK(nnc_ctx_init(&ctx, &al, 0) == NNC_R_OK && ctx.has_cache, "context init");
+	nnc_u32 live = ctx_live;
+	ok = 1;
+	for(nnc_u32 i = 0; i < 4 * NNC_CTX_KEYPAIR_CACHE_SIZE; ++i)
+	{
+		make_ncch(&ncch, 0x0004000000300000 + i, i, NULL);
+		if(nnc_fill_keypair(&expect, ks, NULL, &ncch) != NNC_R_OK
+				|| nnc_ctx_fill_keypair(&pair, &ctx, &ncch) != NNC_R_OK
+				|| !same_pair(&pair, &expect))
+			ok = 0;
+	}
+	CHECK(ok && ctx_live == live, "context over capacity");
+	nnc_ctx_free(&ctx);
+	CHECK(ctx_live == 0, "context free");
+	nnc_keypair_cache_free(&cache);
+
+	/* concurrent lookups with more keys than slots, so evictions race with hits */
+	static struct cache_thread threads[CACHE_THREADS];
+	pthread_t handles[CACHE_THREADS];
+	CHECK(nnc_keypair_cache_init(&cache, 8) == NNC_R_OK, "init");
+	for(int i = 0; i < CACHE_THREADS; ++i)
+	{
+		threads[i].cache = &cache;
+		threads[i].ks = ks;
+		threads[i].failures = 0;
+		for(int j = 0; j < CACHE_SHARED; ++j)
+			make_ncch(&threads[i].ncchs[j], 0x0004000000400000 + j, 0x400 + j, NULL);
+		for(int j = 0; j < CACHE_OWN; ++j)
+			make_ncch(&threads[i].ncchs[CACHE_SHARED + j], 0x0004000000500000 + i * CACHE_OWN + j, 0x500 + j, NULL);
+		for(int j = 0; j < CACHE_SHARED + CACHE_OWN; ++j)
+			if(nnc_fill_keypair(&threads[i].expect[j], ks, NULL, &threads[i].ncchs[j]) != NNC_R_OK)
+				die("failed to derive keypair");
+	}
+	for(int i = 0; i < CACHE_THREADS; ++i)
+		if(pthread_create(&handles[i], NULL, cache_thread, &threads[i]) != 0)
+			die("failed to create thread");
+	ok = 1;
+	for(int i = 0; i < CACHE_THREADS; ++i)
+	{
+		pthread_join(handles[i], NULL);
+		if(threads[i].failures) ok = 0;
+	}
+	CHECK(ok, "concurrent lookups");
+
+	/* a batch reports every entry, the middle one fails */
+	make_ncch(&batch[0], entries[0].title_id, 0x600, NULL);
+	make_ncch(&batch[1], entries[0].title_id, 0x601, entries[0].seed);
+	make_ncch(&batch[2], entries[0].title_id, 0x602, NULL);
+	batch[2].crypt_method = 0x55;
+	make_ncch(&batch[3], entries[1].title_id, 0x603, entries[1].seed);
+	make_ncch(&batch[4], entries[1].title_id, 0x604, NULL);
+	batch[4].crypt_method = 0x01;
+	for(int round = 0; round < 2; ++round)
+	{
+		CHECK(nnc_fill_keypairs(outputs, results, ks, &seeddb, batch, 5, round ? &cache : NULL) == NNC_R_NOT_FOUND, "batch");
+		for(int i = 0; i < 5; ++i)
+			CHECK(results[i] == (i == 2 ? NNC_R_NOT_FOUND : NNC_R_OK)
+				&& (i == 2 || (nnc_fill_keypair(&expect, ks, &seeddb, &batch[i]) == NNC_R_OK
+					&& same_pair(&outputs[i], &expect))), "batch result");
+	}
+	/* a missing seed in the middle */
+	make_ncch(&batch[2], entries[1].title_id, 0x602, entries[1].seed);
+	make_ncch(&batch[3], entries[1].title_id, 0x603, NULL);
+	seeddb.size = 1;
+	CHECK(nnc_fill_keypairs(outputs, results, ks, &seeddb, batch, 5, &cache) == NNC_R_SEED_NOT_FOUND, "batch missing seed");
+	for(int i = 0; i < 5; ++i)
+		CHECK(results[i] == (i == 2 ? NNC_R_SEED_NOT_FOUND : NNC_R_OK)
+			&& (i == 2 || (nnc_fill_keypair(&expect, ks, &seeddb, &batch[i]) == NNC_R_OK
+				&& same_pair(&outputs[i], &expect))), "batch missing seed result");
+	CHECK(nnc_fill_keypairs(outputs, NULL, ks, &seeddb, batch, 2, &cache) == NNC_R_OK, "batch without results");
+
+	nnc_keypair_cache_free(&cache);
+	printf("%s: done\n", name);
+}
+
+int crypto_main(int argc, char *argv[])
+{
+	(void) argc; (void) argv;
+	static const enum nnc_crypto_backend_type types[] = {
+		NNC_CRYPTO_BACKEND_MBEDTLS,
+		NNC_CRYPTO_BACKEND_OPENSSL,
+		NNC_CRYPTO_BACKEND_BUILTIN,
+	};
+	enum nnc_crypto_backend_type orig = nnc_get_crypto_backend();
+	crypto_results ref, res;
+	const char *ref_name = NULL, *name;
+	nnc_u8 *data = malloc(DATA_SIZE);
+	ref.ctr = malloc(DATA_SIZE); ref.cbc = malloc(DATA_SIZE);
+	res.ctr = malloc(DATA_SIZE); res.cbc = malloc(DATA_SIZE);
+	if(!data || !ref.ctr || !ref.cbc || !res.ctr || !res.cbc)
+		die("out of memory");
+
+	nnc_u32 state = 0x6E6E63;
+	for(nnc_u32 i = 0; i < DATA_SIZE; ++i)
+	{
+		state = state * 1103515245 + 12345;
+		data[i] = state >> 16;
+	}
+
+	for(unsigned i = 0; i < sizeof(types) / sizeof(types[0]); ++i)
+	{
+		name = nnc_crypto_backend_name(types[i]);
+		if(nnc_set_crypto_backend(types[i]) != NNC_R_OK)
+		{
+			printf("%s: not available\n", name);
+			continue;
+		}
+		run_backend(name, data, ref_name ? &res : &ref);
+		if(!ref_name)
+		{
+			ref_name = name;
+			printf("%s: done\n", name);
+			continue;
+		}
+		/* everything should match the first backend bit for bit */
+		CHECK(memcmp(ref.sha256, res.sha256, sizeof(ref.sha256)) == 0, "SHA256 comparison");
+		CHECK(memcmp(ref.sha1, res.sha1, sizeof(ref.sha1)) == 0, "SHA1 comparison");
+		CHECK(ref.crc32 == res.crc32, "CRC32 comparison");
+		CHECK(memcmp(ref.ctr, res.ctr, DATA_SIZE) == 0, "AES-CTR comparison");
+		CHECK(memcmp(ref.cbc, res.cbc, DATA_SIZE) == 0, "AES-CBC comparison");
+		printf("%s: done, compared against %s\n", name, ref_name);
+	}
+
+	nnc_set_crypto_backend(orig);
+	run_context();
+	run_keypair_cache();
+	free(data);
+	free(ref.ctr); free(ref.cbc);
+	free(res.ctr); free(res.cbc);
+	if(failures) die("%d check(s) failed", failures);
+	return 0;
+}
@@ -6,7 +6,7 @@
 
 #define BUILD_OPTS "build exefs | build romfs"
 
-#define DIE_USAGE() die("usage: [ extract-exefs | exheader-info | extract-romfs | romfs-info | ncch-info | tmd-info | smdh-info | test-u128 | tik-info | cia-unpack | " BUILD_OPTS " ]")
+#define DIE_USAGE() die("usage: [ extract-exefs | exheader-info | extract-romfs | romfs-info | ncch-info | tmd-info | smdh-info | test-u128 | test-crypto | test-romfs | bench-romfs | bench-ivfc | test-utf | test-single-pass | tik-info | cia-unpack | " BUILD_OPTS " ]")
 #define DIE_BUILD_USAGE() die("usage: [ " BUILD_OPTS " ]")
 
 static const char *opt = "nnc-test";
@@ -37,11 +37,17 @@ int xromfs_main(int argc, char *argv[]); /* romfs.c */
 int romfs_main(int argc, char *argv[]); /* romfs.c */
 int smdh_main(int argc, char *argv[]); /* smdh.c */
 int u128_main(int argc, char *argv[]); /* u128.c */
+int crypto_main(int argc, char *argv[]); /* crypto.c */
 int tik_main(int argc, char *argv[]); /* tik.c */
 int cia_main(int argc, char *argv[]); /* cia.c */
 
 int build_exefs_main(int argc, char *argv[]); /* exefs.c */
 int bromfs_main(int argc, char *argv[]); /* romfs.c */
+int romfs_test_main(int argc, char *argv[]); /* romfs.c */
+int romfs_bench_main(int argc, char *argv[]); /* romfs.c */
+int ivfc_bench_main(int argc, char *argv[]); /* romfs.c */
+int single_pass_test_main(int argc, char *argv[]); /* cia.c */
+int utf_test_main(int argc, char *argv[]); /* utf.c */
 
 static int build_main(int argc, char *argv[])
 {
@@ -71,6 +77,12 @@ int main(int argc, char *argv[])
 	CASE("tmd-info", tmd_info_main);
 	CASE("smdh-info", smdh_main);
 	CASE("test-u128", u128_main);
+	CASE("test-crypto", crypto_main);
+	CASE("test-romfs", romfs_test_main);
+	CASE("bench-romfs", romfs_bench_main);
+	CASE("bench-ivfc", ivfc_bench_main);
+	CASE("test-single-pass", single_pass_test_main);
+	CASE("test-utf", utf_test_main);
 	CASE("tik-info", tik_main);
 	CASE("cia-unpack", cia_main);
 	CASE("rewrite-cia", rewrite_cia_main);
@@ -1,14 +1,17 @@
 
+/* for clock_gettime() */
+#define _DEFAULT_SOURCE
 #include <nnc/stream.h>
 #include <nnc/romfs.h>
-#include <sys/stat.h>
+#include <nnc/crypto.h>
+#include <nnc/ivfc.h>
 #include <inttypes.h>
 #include <nnc/utf.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
-#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <time.h>
 
 void die(const char *fmt, ...);
 
@@ -69,59 +72,12 @@ int romfs_main(int argc, char *argv[])
 	return 0;
 }
 
-static void extract_dir(nnc_romfs_ctx *ctx, nnc_romfs_info *info, const char *path, int baselen)
-{
-	if(access(path, F_OK) != 0 && mkdir(path, 0777) != 0)
-		die("failed to create directory '%s': %s", path, strerror(errno));
-	printf("%s/\n", path + baselen);
-	nnc_romfs_iterator it = nnc_romfs_mkit(ctx, info);
-	nnc_romfs_info ent;
-	char pathbuf[2048];
-	int len = strlen(path);
-	strcpy(pathbuf, path);
-	pathbuf[len++] = '/';
-	while(nnc_romfs_next(&it, &ent))
-	{
-		strcpy(pathbuf + len, nnc_romfs_info_filename(ctx, &ent));
-		if(ent.type == NNC_ROMFS_DIR)
-			extract_dir(ctx, &ent, pathbuf, baselen);
-		else
-		{
-			puts(pathbuf + baselen);
-			FILE *out = fopen(pathbuf, "w");
-			/* empty files just need to be touched */
-			if(ent.u.f.size)
-			{
-				/* slurping the file is a bit inefficient for large
-				 * files but it's fine for this test */
-				nnc_u8 *cbuf = malloc(ent.u.f.size);
-				nnc_subview sv;
-				if(nnc_romfs_open_subview(ctx, &sv, &ent) != NNC_R_OK)
-					goto file_fail;
-				nnc_u32 r;
-				if(NNC_RS_CALL(sv, read, cbuf, ent.u.f.size, &r) != NNC_R_OK)
-					goto file_fail;
-				if(r != ent.u.f.size) goto file_fail;
-				if(fwrite(cbuf, ent.u.f.size, 1, out) != 1)
-					goto file_fail;
-out:
-				fclose(out);
-				free(cbuf);
-				continue;
-file_fail:
-				fprintf(stderr, "fail: ");
-				goto out;
-			}
-			fclose(out);
-		}
-	}
-}
-
 int xromfs_main(int argc, char *argv[])
 {
-	if(argc != 3) die("usage: %s <file> <output-directory>", argv[0]);
+	if(argc != 3 && argc != 4) die("usage: %s <file> <output-directory> [threads]", argv[0]);
 	const char *romfs_file = argv[1];
 	const char *output = argv[2];
+	unsigned threads = argc == 4 ? atoi(argv[3]) : 4;
 
 	nnc_file f;
 	if(nnc_file_open(&f, romfs_file) != NNC_R_OK)
@@ -131,10 +87,9 @@ int xromfs_main(int argc, char *argv[])
 	if(nnc_init_romfs(NNC_RSP(&f), &ctx) != NNC_R_OK)
 		die("nnc_init_romfs() failed");
 
-	nnc_romfs_info info;
-	if(nnc_get_info(&ctx, &info, "/") != NNC_R_OK)
-		die("failed root directory info");
-	extract_dir(&ctx, &info, output, strlen(output));
+	nnc_result res = nnc_romfs_extract_all(&ctx, output, threads);
+	if(res != NNC_R_OK)
+		die("failed to extract to '%s': %s", output, nnc_strerror(res));
 
 	nnc_free_romfs(&ctx);
 
@@ -144,10 +99,15 @@ int xromfs_main(int argc, char *argv[])
 
 int bromfs_main(int argc, char *argv[])
 {
-	if(argc != 3) die("usage: %s <input-directory> <output-file>", argv[0]);
+	if(argc < 3 || argc > 5) die("usage: %s <input-directory> <output-file> [hash-threads [prefetch-bytes]]", argv[0]);
 	const char *input_dir = argv[1];
 	const char *output = argv[2];
 
+	nnc_romfs_write_options opts;
+	nnc_romfs_write_options_init(&opts);
+	if(argc >= 4) opts.hash_threads = atoi(argv[3]);
+	if(argc == 5) opts.prefetch_bytes = atoi(argv[4]);
+
 	nnc_wfile wf;
 	nnc_vfs vfs;
 
@@ -171,7 +131,7 @@ int bromfs_main(int argc, char *argv[])
 		fprintf(stderr, "failed to open output file '%s': %s\n", output, nnc_strerror(res));
 		return 1;
 	}
-	res = nnc_write_romfs(&vfs, NNC_WSP(&wf));
+	res = nnc_write_romfs_ex(&vfs, NNC_WSP(&wf), &opts);
 	wf.funcs->close(NNC_WSP(&wf));
 	nnc_vfs_free(&vfs);
 
@@ -184,3 +144,1262 @@ int bromfs_main(int argc, char *argv[])
 	return 0;
 }
 
+
+/* self contained checks on a RomFS built from memory */
+
+static const char *test_files[] = {
+	"a.txt", "dup/inner", "dir/b.bin", "dir/sub/c", "dir/sub/d",
+	"x/y/z/deep", "\xC3\xBC" "ber/\xC3\xA4" "nderung",
+	/* longer than what nnc_get_info() converts on the stack */
+	"long/"
+		"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+		"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa/"
+		"bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb"
+		"bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb/end",
+};
+
+#define TEST_GENERATED_FILES 400
+#define TEST_THREADS 4
+
+struct romfs_test {
+	nnc_romfs_ctx walk, index;
+	char **paths;
+	int npaths;
+	int failures;
+};
+
+static int failures;
+#define CHECK(cond, what) do { if(!(cond)) { fprintf(stderr, "romfs: %s failed\n", what); ++failures; } } while(0)
+
+static nnc_result add_test_file(nnc_vfs_directory_node *dir, const char *path)
+{
+	const char *slash;
+	nnc_result res;
+	char name[512];
+	while((slash = strchr(path, '/')))
+	{
+		nnc_vfs_directory_node *next = NULL;
+		sprintf(name, "%.*s", (int) (slash - path), path);
+		for(unsigned i = 0; i < dir->dircount; ++i)
+			if(strcmp(dir->directory_children[i].vname, name) == 0)
+				next = &dir->directory_children[i];
+		if(!next && (res = nnc_vfs_add_directory(dir, name, &next)) != NNC_R_OK)
+			return res;
+		dir = next;
+		path = slash + 1;
+	}
+	/* the file contains its own name */
+	nnc_memory mem;
+	nnc_mem_open(&mem, path, strlen(path));
+	return nnc_vfs_add_file(dir, path, NNC_VFS_READER_COPY(mem, NNC_VFS_STREAM_NONE));
+}
+
+static void collect_paths(struct romfs_test *t, nnc_romfs_info *dir, const char *prefix)
+{
+	nnc_romfs_iterator it = nnc_romfs_mkit(&t->walk, dir);
+	nnc_romfs_info ent;
+	while(nnc_romfs_next(&it, &ent))
+	{
+		const char *name = nnc_romfs_info_filename(&t->walk, &ent);
+		char *path = malloc(strlen(prefix) + strlen(name) + 3);
+		sprintf(path, "%s/%s%s", prefix, name, ent.type == NNC_ROMFS_DIR ? "/" : "");
+		t->paths = realloc(t->paths, (t->npaths + 1) * sizeof(char *));
+		t->paths[t->npaths++] = path;
+		if(ent.type == NNC_ROMFS_DIR)
+		{
+			/* recurse without the trailing slash */
+			path[strlen(path) - 1] = '\0';
+			collect_paths(t, &ent, path);
+			path[strlen(path)] = '/';
+		}
+	}
+}
+
+static bool same_info(nnc_romfs_info *a, nnc_romfs_info *b)
+{
+	if(a->type != b->type || a->filename_length != b->filename_length)
+		return false;
+	if(memcmp(a->filename, b->filename, a->filename_length * sizeof(nnc_u16)) != 0)
+		return false;
+	if(a->type == NNC_ROMFS_FILE)
+		return a->u.f.offset == b->u.f.offset && a->u.f.size == b->u.f.size;
+	return a->u.d.parent == b->u.d.parent && a->u.d.fchildren == b->u.d.fchildren;
+}
+
+static void *lookup_thread(void *arg)
+{
+	struct romfs_test *t = arg;
+	nnc_romfs_info a, b;
+	/* every thread looks up every path in both contexts */
+	for(int round = 0; round < 8; ++round)
+		for(int i = 0; i < t->npaths; ++i)
+		{
+			if(nnc_get_info(&t->walk, &a, t->paths[i]) != NNC_R_OK
+					|| nnc_get_info(&t->index, &b, t->paths[i]) != NNC_R_OK
+					|| !same_info(&a, &b))
+				++t->failures;
+		}
+	return NULL;
+}
+
+static bool has_path(struct romfs_test *t, const char *path)
+{
+	for(int i = 0; i < t->npaths; ++i)
+		if(strcmp(t->paths[i], path) == 0)
+			return true;
+	return false;
+}
+
+/* the listing must have the same entries as the walk, with correct paths, parents and data */
+static void test_listing(struct romfs_test *t)
+{
+	nnc_romfs_listing list;
+	nnc_romfs_info info;
+	char path[1024];
+	nnc_u32 *matches;
+	int bad = 0;
+
+	CHECK(nnc_romfs_list_all(&t->walk, &list) == NNC_R_OK, "listing");
+	CHECK(list.file_count + list.dir_count == (nnc_u32) t->npaths + 1 && list.strings[list.dir_paths[0]] == '\0',
+		"listing entry count");
+	for(nnc_u32 i = 1; i < list.dir_count; ++i)
+	{
+		const char *dpath = list.strings + list.dir_paths[i], *ppath = list.strings + list.dir_paths[list.dir_parents[i]];
+		sprintf(path, "/%s/", dpath);
+		if(!has_path(t, path) || strncmp(dpath, ppath, strlen(ppath)) != 0)
+			++bad;
+	}
+	for(nnc_u32 i = 0; i < list.file_count; ++i)
+	{
+		const char *fpath = list.strings + list.file_paths[i], *ppath = list.strings + list.dir_paths[list.file_parents[i]];
+		sprintf(path, "/%s", fpath);
+		if(!has_path(t, path) || strncmp(fpath, ppath, strlen(ppath)) != 0
+				|| strchr(fpath + strlen(ppath) + (*ppath ? 1 : 0), '/') != NULL
+				|| nnc_get_info(&t->walk, &info, path) != NNC_R_OK
+				|| info.u.f.offset != list.file_offsets[i] || info.u.f.size != list.file_sizes[i])
+			++bad;
+	}
+	CHECK(bad == 0, "listed paths");
+
+	int gen_file1 = 0;
+	for(int i = 0; i < TEST_GENERATED_FILES; ++i)
+	{
+		sprintf(path, "%d", i);
+		if(i % 37 < 10 && path[0] == '1') ++gen_file1;
+	}
+	static const struct {
+		const char *pattern;
+		int count;
+	} globs[] = {
+		{ "*",                             1 },
+		{ "*.txt",                         1 },
+		{ "/dir/*",                        1 },
+		{ "dir/**",                        3 },
+		{ "dir/sub/?",                     2 },
+		{ "d*/*",                          2 },
+		{ "*/*/?",                         2 },
+		{ "**/deep",                       1 },
+		{ "x/**/deep",                     1 },
+		{ "x/y/**/z/deep",                 1 },
+		{ "x/y/z/**/deep",                 1 },
+		{ "**/a.txt",                      1 },
+		{ "dir/**/?",                      2 },
+		{ "dir/**/b.bin",                  1 },
+		{ "dir/**b.bin",                   1 },
+		{ "x/y**/deep",                    1 },
+		{ "x/*/deep",                      0 },
+		{ "**/c",                          1 },
+		{ "\xC3\xBC" "ber/?nderung",       1 },
+		{ "long/*/*/end",                  1 },
+		{ "gen/*/file39?",                 10 },
+		{ "**",                            TEST_GENERATED_FILES + sizeof(test_files) / sizeof(test_files[0]) },
+		{ "nope/**",                       0 },
+		{ "a.txt?",                        0 },
+	};
+	matches = malloc(list.file_count * sizeof(nnc_u32) + 1);
+	for(unsigned i = 0; i < sizeof(globs) / sizeof(globs[0]); ++i)
+		CHECK(nnc_romfs_list_glob(&list, globs[i].pattern, matches) == (nnc_u32) globs[i].count, globs[i].pattern);
+	CHECK(nnc_romfs_list_glob(&list, "gen/0?/file1*", matches) == (nnc_u32) gen_file1, "gen/0?/file1*");
+	bad = 0;
+	for(nnc_u32 i = 0, n = nnc_romfs_list_glob(&list, "gen/*/file39?", matches); i < n; ++i)
+		if(strncmp(list.strings + list.file_paths[matches[i]], "gen/", 4) != 0 || list.file_sizes[matches[i]] != 7)
+			++bad;
+	CHECK(bad == 0, "glob match indices");
+
+	CHECK(nnc_romfs_list_prefix(&list, "dir/", matches) == 3, "prefix dir/");
+	CHECK(nnc_romfs_list_prefix(&list, "/d", matches) == 4, "prefix /d");
+	CHECK(nnc_romfs_list_prefix(&list, "gen/", matches) == TEST_GENERATED_FILES, "prefix gen/");
+	CHECK(nnc_romfs_list_prefix(&list, "", matches) == list.file_count, "empty prefix");
+
+	free(matches);
+	nnc_romfs_free_listing(&list);
+}
+
+static nnc_result write_test_romfs_ex(nnc_vfs *vfs, const char *name, nnc_romfs_write_options *opts)
+{
+	nnc_result res;
+	nnc_wfile wf;
+	if((res = nnc_wfile_open(&wf, name)) != NNC_R_OK)
+		return res;
+	res = nnc_write_romfs_ex(vfs, NNC_WSP(&wf), opts);
+	NNC_WS_CALL0(wf, close);
+	return res;
+}
+
+static nnc_result write_test_romfs(nnc_vfs *vfs, const char *name, nnc_u32 hash_threads, nnc_u32 prefetch_bytes)
+{
+	nnc_romfs_write_options opts;
+	nnc_romfs_write_options_init(&opts);
+	opts.hash_threads = hash_threads;
+	opts.prefetch_bytes = prefetch_bytes;
+	return write_test_romfs_ex(vfs, name, &opts);
+}
+
+/* also used by cia.c */
+bool same_file(const char *a, const char *b)
+{
+	FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+	bool same = fa && fb;
+	char ba[4096], bb[4096];
+	size_t ga, gb;
+	while(same && (ga = fread(ba, 1, sizeof(ba), fa)) | (gb = fread(bb, 1, sizeof(bb), fb)))
+		same = ga == gb && memcmp(ba, bb, ga) == 0;
+	if(fa) fclose(fa);
+	if(fb) fclose(fb);
+	return same;
+}
+
+/* the options may only change how fast a RomFS is written, not what is written */
+static void test_write_options(void)
+{
+	static const char *names[] = { "nnc-test-romfs-st.bin", "nnc-test-romfs-mt.bin", "nnc-test-romfs-src.bin" };
+	/* big enough for the IVFC writer to use many batches */
+	static const nnc_u32 sizes[] = { 700001, 1048576 + 123, 5, 4096 * 64 };
+	static nnc_u8 data[1048576 + 123 + 4];
+	nnc_romfs_ctx ctx;
+	nnc_romfs_info info;
+	nnc_file f;
+	nnc_vfs vfs;
+	char name[32];
+	FILE *src;
+
+	for(nnc_u32 i = 0, x = 1; i < sizeof(data); ++i)
+	{
+		x = x * 1103515245 + 12345;
+		data[i] = x >> 24;
+	}
+	/* files on disk are opened ahead when prefetching */
+	if(!(src = fopen(names[2], "wb")) || fwrite(data, 1, 100000, src) != 100000 || fclose(src) != 0)
+		die("failed to create '%s'", names[2]);
+	if(nnc_vfs_init(&vfs) != NNC_R_OK)
+		die("failed to init VFS");
+	for(unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	{
+		nnc_memory mem;
+		sprintf(name, "big%u", i);
+		nnc_mem_open(&mem, data + i, sizes[i]);
+		if(nnc_vfs_add_file(&vfs.root_directory, name, NNC_VFS_READER_COPY(mem, NNC_VFS_STREAM_NONE)) != NNC_R_OK)
+			die("failed to add '%s' to VFS", name);
+		sprintf(name, "disk%u", i);
+		if(nnc_vfs_add_file(&vfs.root_directory, name, NNC_VFS_FILE(names[2])) != NNC_R_OK)
+			die("failed to add '%s' to VFS", name);
+	}
+	CHECK(write_test_romfs(&vfs, names[0], 0, 0) == NNC_R_OK, "writing without options");
+	CHECK(write_test_romfs(&vfs, names[1], 4, 0) == NNC_R_OK, "writing with hash threads");
+	CHECK(same_file(names[0], names[1]), "hashing on threads gives the same RomFS");
+	/* a budget that is no multiple of anything wraps around the ring at odd places */
+	CHECK(write_test_romfs(&vfs, names[1], 0, 10007) == NNC_R_OK, "writing with prefetching");
+	CHECK(same_file(names[0], names[1]), "prefetching gives the same RomFS");
+	CHECK(write_test_romfs(&vfs, names[1], 3, 4 * 1024 * 1024) == NNC_R_OK, "writing with hash threads and prefetching");
+	CHECK(same_file(names[0], names[1]), "hash threads and prefetching give the same RomFS");
+
+	if(nnc_file_open(&f, names[1]) != NNC_R_OK || nnc_init_romfs(NNC_RSP(&f), &ctx) != NNC_R_OK)
+		die("failed to open '%s'", names[1]);
+	CHECK(nnc_get_info(&ctx, &info, "/big1") == NNC_R_OK && info.u.f.size == sizes[1], "reading a RomFS written with options");
+	nnc_free_romfs(&ctx);
+	NNC_RS_CALL0(f, close);
+
+	/* errors of files read ahead must still come out */
+	remove(names[2]);
+	CHECK(write_test_romfs(&vfs, names[1], 2, 65536) == NNC_R_FAIL_OPEN, "prefetching a missing file");
+	nnc_vfs_free(&vfs);
+	remove(names[0]);
+	remove(names[1]);
+}
+
+static long file_size(const char *name)
+{
+	FILE *f = fopen(name, "rb");
+	long size = -1;
+	if(f && fseek(f, 0, SEEK_END) == 0)
+		size = ftell(f);
+	if(f) fclose(f);
+	return size;
+}
+
+static bool romfs_file_is(nnc_romfs_ctx *ctx, const char *path, const nnc_u8 *expected, nnc_u32 size, nnc_u64 *offset)
+{
+	static nnc_u8 buf[65536];
+	nnc_romfs_info info;
+	nnc_subview sv;
+	nnc_u32 got;
+	if(nnc_get_info(ctx, &info, path) != NNC_R_OK || info.type != NNC_ROMFS_FILE || info.u.f.size != size || size > sizeof(buf))
+		return false;
+	*offset = info.u.f.offset;
+	if(nnc_romfs_open_subview(ctx, &sv, &info) != NNC_R_OK)
+		return false;
+	return NNC_RS_CALL(sv, read, buf, size, &got) == NNC_R_OK && got == size && memcmp(buf, expected, size) == 0;
+}
+
+/* files with the same contents share their data, files that only look alike don't */
+static void test_dedupe(void)
+{
+	static const char *names[] = { "nnc-test-romfs-full.bin", "nnc-test-romfs-dedupe.bin", "nnc-test-romfs-dsrc.bin" };
+	static const char *paths[] = { "/a", "/copy/a", "/disk", "/other", "/other-copy", "/empty", "/empty-copy", "/short" };
+	nnc_vfs_directory_node *dirs[2];
+	enum { SIZE = 5000 };
+	static nnc_u8 data[SIZE], other[SIZE];
+	/* which buffer each path has and how many bytes of it */
+	const nnc_u8 *contents[] = { data, data, data, other, other, data, data, data };
+	const nnc_u32 sizes[] = { SIZE, SIZE, SIZE, SIZE, SIZE, 0, 0, SIZE - 1 };
+	nnc_romfs_write_options opts;
+	nnc_u64 saved = 1, offsets[8];
+	nnc_romfs_ctx ctx;
+	nnc_vfs vfs;
+	nnc_file f;
+	FILE *src;
+
+	for(nnc_u32 i = 0; i < SIZE; ++i)
+		data[i] = other[i] = i * 7 + (i >> 8);
+	other[SIZE - 1] ^= 1;
+	if(!(src = fopen(names[2], "wb")) || fwrite(data, 1, SIZE, src) != SIZE || fclose(src) != 0)
+		die("failed to create '%s'", names[2]);
+	if(nnc_vfs_init(&vfs) != NNC_R_OK || nnc_vfs_add_directory(&vfs.root_directory, "copy", &dirs[1]) != NNC_R_OK)
+		die("failed to init VFS");
+	dirs[0] = &vfs.root_directory;
+	for(unsigned i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i)
+	{
+		nnc_vfs_directory_node *dir = dirs[i == 1];
+		const char *name = strrchr(paths[i], '/') + 1;
+		nnc_result res;
+		nnc_memory mem;
+		nnc_mem_open(&mem, contents[i], sizes[i]);
+		if(i == 2) res = nnc_vfs_add_file(dir, name, NNC_VFS_FILE(names[2]));
+		else res = nnc_vfs_add_file(dir, name, NNC_VFS_READER_COPY(mem, NNC_VFS_STREAM_NONE));
+		if(res != NNC_R_OK)
+			die("failed to add '%s' to VFS", paths[i]);
+	}
+
+	nnc_romfs_write_options_init(&opts);
+	opts.dedupe_saved = &saved;
+	CHECK(write_test_romfs_ex(&vfs, names[0], &opts) == NNC_R_OK && saved == 0, "writing without dedupe");
+	opts.dedupe = true;
+	opts.hash_threads = 2;
+	opts.prefetch_bytes = 4096;
+	CHECK(write_test_romfs_ex(&vfs, names[1], &opts) == NNC_R_OK, "writing with dedupe");
+	/* /copy/a and /disk are the same as /a, /other-copy is the same as /other */
+	CHECK(saved == 3 * ((SIZE + 15) & ~15), "bytes saved by dedupe");
+	CHECK(file_size(names[1]) < file_size(names[0]), "dedupe makes the RomFS smaller");
+
+	if(nnc_file_open(&f, names[1]) != NNC_R_OK || nnc_init_romfs(NNC_RSP(&f), &ctx) != NNC_R_OK)
+		die("failed to open '%s'", names[1]);
+	for(unsigned i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i)
+		CHECK(romfs_file_is(&ctx, paths[i], contents[i], sizes[i], &offsets[i]), paths[i]);
+	CHECK(offsets[1] == offsets[0] && offsets[2] == offsets[0], "duplicates share data");
+	CHECK(offsets[4] == offsets[3], "duplicates of a second file share data");
+	CHECK(offsets[3] != offsets[0] && offsets[7] != offsets[0], "different files with the same size or a prefix don't share data");
+	nnc_free_romfs(&ctx);
+	NNC_RS_CALL0(f, close);
+
+	nnc_vfs_free(&vfs);
+	for(unsigned i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+		remove(names[i]);
+}
+
+static bool read_fully(nnc_file *f, nnc_u32 pos, nnc_u8 *buf, nnc_u32 size)
+{
+	nnc_u32 got;
+	return nnc_rs_read_at(f, pos, buf, size, &got) == NNC_R_OK && got == size;
+}
+
+/* checks every hash of a RomFS against the level below it */
+static bool ivfc_verifies(const char *name)
+{
+	nnc_u8 *levels[3] = { NULL, NULL, NULL }, *master = NULL;
+	nnc_u64 offsets[3], sizes[3];
+	nnc_sha256_hash hash;
+	bool ok = false;
+	nnc_ivfc ivfc;
+	nnc_file f;
+
+	if(nnc_file_open(&f, name) != NNC_R_OK)
+		return false;
+	if(nnc_read_ivfc_header(NNC_RSP(&f), &ivfc, NNC_IVFC_LEVELS_ROMFS) != NNC_R_OK)
+		goto out;
+	/* level 3 comes first, then 1 and 2 */
+	nnc_u32 bs = 1 << ivfc.level[2].block_size_log2;
+	offsets[2] = (0x60 + ivfc.l0_size + bs - 1) & ~(nnc_u64) (bs - 1);
+	offsets[0] = offsets[2] + ((ivfc.level[2].size + bs - 1) & ~(nnc_u64) (bs - 1));
+	offsets[1] = offsets[0] + ((ivfc.level[0].size + bs - 1) & ~(nnc_u64) (bs - 1));
+	for(int i = 0; i < 3; ++i)
+	{
+		sizes[i] = (ivfc.level[i].size + bs - 1) & ~(nnc_u64) (bs - 1);
+		if(!(levels[i] = malloc(sizes[i])) || !read_fully(&f, offsets[i], levels[i], sizes[i]))
+			goto out;
+	}
+	if(!(master = malloc(ivfc.l0_size)) || !read_fully(&f, 0x60, master, ivfc.l0_size))
+		goto out;
+	ok = true;
+	for(int i = 2; i >= 0; --i)
+	{
+		const nnc_u8 *hashes = i == 0 ? master : levels[i - 1];
+		for(nnc_u64 block = 0; block * bs < ivfc.level[i].size && ok; ++block)
+		{
+			nnc_crypto_sha256(levels[i] + block * bs, hash, bs);
+			ok = memcmp(hash, hashes + block * sizeof(hash), sizeof(hash)) == 0;
+		}
+	}
+out:
+	for(int i = 0; i < 3; ++i)
+		free(levels[i]);
+	free(master);
+	NNC_RS_CALL0(f, close);
+	return ok;
+}
+
+struct generated_file {
+	const char *path;
+	nnc_u32 seed, size;
+};
+
+static nnc_u8 *generated_data(nnc_u32 seed, nnc_u32 size)
+{
+	static nnc_u8 buf[65536];
+	for(nnc_u32 i = 0, x = seed; i < size; ++i)
+	{
+		x = x * 1103515245 + 12345;
+		buf[i] = x >> 24;
+	}
+	return buf;
+}
+
+static void add_generated_files(nnc_vfs *vfs, const struct generated_file *files, int count, nnc_u8 **store)
+{
+	for(int i = 0; i < count; ++i)
+	{
+		nnc_vfs_directory_node *dir = &vfs->root_directory;
+		const char *slash = strchr(files[i].path + 1, '/');
+		nnc_memory mem;
+		if(slash)
+		{
+			char dname[64];
+			nnc_vfs_directory_node *found = NULL;
+			sprintf(dname, "%.*s", (int) (slash - files[i].path - 1), files[i].path + 1);
+			for(unsigned j = 0; j < dir->dircount; ++j)
+				if(strcmp(dir->directory_children[j].vname, dname) == 0)
+					found = &dir->directory_children[j];
+			if(!found && nnc_vfs_add_directory(dir, dname, &found) != NNC_R_OK)
+				die("failed to add '%s' to VFS", dname);
+			dir = found;
+		}
+		store[i] = malloc(files[i].size + 1);
+		memcpy(store[i], generated_data(files[i].seed, files[i].size), files[i].size);
+		nnc_mem_open(&mem, store[i], files[i].size);
+		if(nnc_vfs_add_file(dir, strrchr(files[i].path, '/') + 1, NNC_VFS_READER_COPY(mem, NNC_VFS_STREAM_NONE)) != NNC_R_OK)
+			die("failed to add '%s' to VFS", files[i].path);
+	}
+}
+
+/* an incremental rebuild must give a valid RomFS with the changes and keep the rest where it was */
+static void test_incremental(void)
+{
+	static const char *names[] = { "nnc-test-romfs-base.bin", "nnc-test-romfs-inc.bin", "nnc-test-romfs-inc-mt.bin" };
+	static const struct generated_file base_files[] = {
+		{ "/a", 1, 20000 }, { "/dir/b", 2, 9000 }, { "/dir/c", 3, 30000 }, { "/d", 4, 100 }, { "/e", 5, 50000 }, { "/empty", 6, 0 },
+	};
+	/* b shrinks and stays, d grows and moves, f is new */
+	static const struct generated_file changes[] = {
+		{ "/dir/b", 7, 8990 }, { "/d", 8, 5000 }, { "/new/f", 9, 7000 },
+	};
+	nnc_u8 *base_store[6], *change_store[3];
+	nnc_romfs_write_options opts;
+	nnc_romfs_ctx base, out;
+	nnc_vfs vfs, cvfs;
+	nnc_file bf, of;
+	nnc_wfile wf;
+
+	if(nnc_vfs_init(&vfs) != NNC_R_OK || nnc_vfs_init(&cvfs) != NNC_R_OK)
+		die("failed to init VFS");
+	add_generated_files(&vfs, base_files, 6, base_store);
+	add_generated_files(&cvfs, changes, 3, change_store);
+	CHECK(write_test_romfs(&vfs, names[0], 0, 0) == NNC_R_OK, "writing the base RomFS");
+	if(nnc_file_open(&bf, names[0]) != NNC_R_OK || nnc_init_romfs(NNC_RSP(&bf), &base) != NNC_R_OK)
+		die("failed to open '%s'", names[0]);
+
+	nnc_romfs_write_options_init(&opts);
+	for(int i = 1; i < 3; ++i)
+	{
+		opts.hash_threads = i == 1 ? 0 : 3;
+		if(nnc_wfile_open(&wf, names[i]) != NNC_R_OK)
+			die("failed to open '%s'", names[i]);
+		CHECK(nnc_write_romfs_incremental(&base, &cvfs, NNC_WSP(&wf), &opts) == NNC_R_OK, "incremental rebuild");
+		NNC_WS_CALL0(wf, close);
+	}
+	CHECK(same_file(names[1], names[2]), "incremental rebuild with hash threads gives the same RomFS");
+	CHECK(ivfc_verifies(names[0]), "base RomFS hashes");
+	CHECK(ivfc_verifies(names[1]), "incremental RomFS hashes");
+
+	if(nnc_file_open(&of, names[1]) != NNC_R_OK || nnc_init_romfs(NNC_RSP(&of), &out) != NNC_R_OK)
+		die("failed to open '%s'", names[1]);
+	nnc_u64 old_offset, new_offset, data_end = 0;
+	for(int i = 0; i < 6; ++i)
+	{
+		bool changed = false;
+		for(int j = 0; j < 3; ++j)
+			changed |= strcmp(changes[j].path, base_files[i].path) == 0;
+		CHECK(romfs_file_is(&base, base_files[i].path, base_store[i], base_files[i].size, &old_offset), "base file");
+		if(old_offset + base_files[i].size > data_end) data_end = old_offset + base_files[i].size;
+		if(!changed)
+			CHECK(romfs_file_is(&out, base_files[i].path, base_store[i], base_files[i].size, &new_offset)
+				&& (base_files[i].size == 0 || new_offset == old_offset), "kept file");
+	}
+	for(int i = 0; i < 3; ++i)
+	{
+		nnc_romfs_info info;
+		CHECK(romfs_file_is(&out, changes[i].path, change_store[i], changes[i].size, &new_offset), changes[i].path);
+		if(i == 0)
+			CHECK(nnc_get_info(&base, &info, changes[i].path) == NNC_R_OK && info.u.f.offset == new_offset,
+				"a changed file that fits stays in place");
+		else
+			CHECK(new_offset >= data_end, "a changed file that doesn't fit goes after the data");
+	}
+	nnc_free_romfs(&out);
+	NNC_RS_CALL0(of, close);
+
+	nnc_free_romfs(&base);
+	NNC_RS_CALL0(bf, close);
+	nnc_vfs_free(&vfs);
+	nnc_vfs_free(&cvfs);
+	for(int i = 0; i < 6; ++i) free(base_store[i]);
+	for(int i = 0; i < 3; ++i) free(change_store[i]);
+	for(int i = 0; i < 3; ++i) remove(names[i]);
+}
+
+/* the data of the hinted files comes first, everything else about the RomFS stays the same */
+static void test_data_order(void)
+{
+	static const char *names[] = { "nnc-test-romfs-walk.bin", "nnc-test-romfs-order.bin" };
+	static const struct generated_file files[] = {
+		{ "/a", 1, 3000 }, { "/dir/b", 2, 100 }, { "/dir/c", 3, 7000 }, { "/z", 4, 20 },
+	};
+	static const char *hint[] = { "/z", "/missing", "/dir/c", "/z" };
+	/* the order the data should end up in */
+	static const int expected[] = { 3, 2, 0, 1 };
+	nnc_romfs_write_options opts;
+	nnc_romfs_ctx ctx[2];
+	nnc_u8 *store[4];
+	nnc_u64 offsets[4];
+	nnc_file f[2];
+	nnc_vfs vfs;
+
+	if(nnc_vfs_init(&vfs) != NNC_R_OK)
+		die("failed to init VFS");
+	add_generated_files(&vfs, files, 4, store);
+	nnc_romfs_write_options_init(&opts);
+	CHECK(write_test_romfs_ex(&vfs, names[0], &opts) == NNC_R_OK, "writing without a data order");
+	opts.data_order = hint;
+	opts.data_order_count = sizeof(hint) / sizeof(hint[0]);
+	CHECK(write_test_romfs_ex(&vfs, names[1], &opts) == NNC_R_OK, "writing with a data order");
+
+	for(int i = 0; i < 2; ++i)
+		if(nnc_file_open(&f[i], names[i]) != NNC_R_OK || nnc_init_romfs(NNC_RSP(&f[i]), &ctx[i]) != NNC_R_OK)
+			die("failed to open '%s'", names[i]);
+#define SAME_OFLEN(field) (ctx[0].header.field.offset == ctx[1].header.field.offset && ctx[0].header.field.length == ctx[1].header.field.length)
+	CHECK(SAME_OFLEN(dir_hash) && SAME_OFLEN(dir_meta) && SAME_OFLEN(file_hash) && SAME_OFLEN(file_meta)
+		&& ctx[0].header.data_offset == ctx[1].header.data_offset, "a data order keeps the header");
+#undef SAME_OFLEN
+	CHECK(memcmp(ctx[0].dir_meta_data, ctx[1].dir_meta_data, ctx[0].header.dir_meta.length) == 0
+		&& memcmp(ctx[0].dir_hash_tab, ctx[1].dir_hash_tab, ctx[0].header.dir_hash.length) == 0
+		&& memcmp(ctx[0].file_hash_tab, ctx[1].file_hash_tab, ctx[0].header.file_hash.length) == 0,
+		"a data order keeps the tables");
+	for(int i = 0; i < 4; ++i)
+		CHECK(romfs_file_is(&ctx[1], files[i].path, store[i], files[i].size, &offsets[i]), files[i].path);
+	for(int i = 1; i < 4; ++i)
+		CHECK(offsets[expected[i - 1]] < offsets[expected[i]], "data is in the hinted order");
+	CHECK(offsets[expected[0]] == 0, "the first hinted file comes first");
+
+	for(int i = 0; i < 2; ++i)
+	{
+		nnc_free_romfs(&ctx[i]);
+		NNC_RS_CALL0(f[i], close);
+		remove(names[i]);
+	}
+	nnc_vfs_free(&vfs);
+	for(int i = 0; i < 4; ++i)
+		free(store[i]);
+}
+
+/* unchanged data is compared by hash, changes are found with their ranges and renamed files as moves */
+static void test_diff(void)
+{
+	static const char *names[] = { "nnc-test-romfs-diff-a.bin", "nnc-test-romfs-diff-b.bin", "nnc-test-romfs-diff-c.bin" };
+	static const struct generated_file files[] = {
+		{ "/big", 1, 60000 }, { "/dir/b", 2, 9000 }, { "/dir/c", 3, 40000 }, { "/d", 4, 100 }, { "/e", 5, 50000 },
+	};
+	/* dir/b loses its last 10 bytes, big gets changed in place */
+	static const struct generated_file changes[] = { { "/dir/b", 2, 8990 }, { "/new/f", 9, 7000 } };
+	static const struct generated_file renamed[] = {
+		{ "/big", 1, 60000 }, { "/dir/b", 2, 9000 }, { "/dir/c", 3, 40000 }, { "/moved/e", 5, 50000 },
+	};
+	nnc_u8 *store[5], *change_store[2], *renamed_store[4], *big;
+	nnc_romfs_ctx ctx[3];
+	nnc_vfs vfs, cvfs, rvfs;
+	nnc_romfs_diff_report diff;
+	nnc_memory mem;
+	nnc_file f[3];
+	nnc_wfile wf;
+
+	if(nnc_vfs_init(&vfs) != NNC_R_OK || nnc_vfs_init(&cvfs) != NNC_R_OK || nnc_vfs_init(&rvfs) != NNC_R_OK)
+		die("failed to init VFS");
+	add_generated_files(&vfs, files, 5, store);
+	add_generated_files(&cvfs, changes, 2, change_store);
+	add_generated_files(&rvfs, renamed, 4, renamed_store);
+	big = malloc(60000);
+	memcpy(big, store[0], 60000);
+	for(int i = 30000; i < 30010; ++i)
+		big[i] ^= 0xFF;
+	big[45000] ^= 1;
+	nnc_mem_open(&mem, big, 60000);
+	if(nnc_vfs_add_file(&cvfs.root_directory, "big", NNC_VFS_READER_COPY(mem, NNC_VFS_STREAM_NONE)) != NNC_R_OK)
+		die("failed to add 'big' to VFS");
+
+	CHECK(write_test_romfs(&vfs, names[0], 0, 0) == NNC_R_OK, "writing the RomFS to diff against");
+	CHECK(write_test_romfs(&rvfs, names[2], 0, 0) == NNC_R_OK, "writing the RomFS with a rename");
+	if(nnc_file_open(&f[0], names[0]) != NNC_R_OK || nnc_init_romfs(NNC_RSP(&f[0]), &ctx[0]) != NNC_R_OK)
+		die("failed to open '%s'", names[0]);
+	/* an incremental rebuild keeps the data where it was so the hashes line up */
+	if(nnc_wfile_open(&wf, names[1]) != NNC_R_OK)
+		die("failed to open '%s'", names[1]);
+	CHECK(nnc_write_romfs_incremental(&ctx[0], &cvfs, NNC_WSP(&wf), NULL) == NNC_R_OK, "writing the changed RomFS");
+	NNC_WS_CALL0(wf, close);
+	for(int i = 1; i < 3; ++i)
+		if(nnc_file_open(&f[i], names[i]) != NNC_R_OK || nnc_init_romfs(NNC_RSP(&f[i]), &ctx[i]) != NNC_R_OK)
+			die("failed to open '%s'", names[i]);
+
+	CHECK(nnc_romfs_diff(&ctx[0], &ctx[0], &diff) == NNC_R_OK && diff.count == 0, "diffing a RomFS with itself");
+	nnc_romfs_free_diff(&diff);
+
+	CHECK(nnc_romfs_diff(&ctx[0], &ctx[1], &diff) == NNC_R_OK && diff.count == 3, "diffing changes");
+	if(diff.count == 3)
+	{
+		nnc_romfs_diff_entry *e = diff.entries;
+		nnc_romfs_range *r = diff.ranges;
+		CHECK(e[0].change == NNC_ROMFS_MODIFIED && strcmp(e[0].path_a, "big") == 0 && strcmp(e[0].path_b, "big") == 0
+			&& e[0].range_count == 2 && r[e[0].first_range].offset == 30000 && r[e[0].first_range].size == 10
+			&& r[e[0].first_range + 1].offset == 45000 && r[e[0].first_range + 1].size == 1, "modified in place");
+		CHECK(e[1].change == NNC_ROMFS_MODIFIED && strcmp(e[1].path_a, "dir/b") == 0 && e[1].size_a == 9000
+			&& e[1].size_b == 8990 && e[1].range_count == 1 && r[e[1].first_range].offset == 8990
+			&& r[e[1].first_range].size == 10, "modified size");
+		CHECK(e[2].change == NNC_ROMFS_ADDED && !e[2].path_a && strcmp(e[2].path_b, "new/f") == 0
+			&& e[2].size_b == 7000, "added");
+		/* only the blocks that differ and the ones shared with other files are read */
+		CHECK(diff.bytes_read < 60000 + 9000 + 40000 + 100 + 50000, "skipping data with the same hash");
+	}
+	nnc_romfs_free_diff(&diff);
+
+	CHECK(nnc_romfs_diff(&ctx[0], &ctx[2], &diff) == NNC_R_OK && diff.count == 2, "diffing a rename");
+	if(diff.count == 2)
+	{
+		nnc_romfs_diff_entry *e = diff.entries;
+		CHECK(e[0].change == NNC_ROMFS_REMOVED && strcmp(e[0].path_a, "d") == 0 && !e[0].path_b, "removed");
+		CHECK(e[1].change == NNC_ROMFS_MOVED && strcmp(e[1].path_a, "e") == 0 && strcmp(e[1].path_b, "moved/e") == 0
+			&& e[1].size_a == 50000 && e[1].size_b == 50000, "moved");
+	}
+	nnc_romfs_free_diff(&diff);
+
+	for(int i = 0; i < 3; ++i)
+	{
+		nnc_free_romfs(&ctx[i]);
+		NNC_RS_CALL0(f[i], close);
+		remove(names[i]);
+	}
+	nnc_vfs_free(&vfs);
+	nnc_vfs_free(&cvfs);
+	nnc_vfs_free(&rvfs);
+	for(int i = 0; i < 5; ++i) free(store[i]);
+	for(int i = 0; i < 2; ++i) free(change_store[i]);
+	for(int i = 0; i < 4; ++i) free(renamed_store[i]);
+	free(big);
+}
+
+static nnc_result read_romfs_file(nnc_romfs_ctx *ctx, const char *path, nnc_u8 *buf, nnc_u32 size)
+{
+	nnc_romfs_info info;
+	nnc_subview sv;
+	nnc_result res;
+	nnc_u32 got;
+	if((res = nnc_get_info(ctx, &info, path)) != NNC_R_OK || (res = nnc_romfs_open_subview(ctx, &sv, &info)) != NNC_R_OK)
+		return res;
+	return NNC_RS_CALL(sv, read, buf, size, &got);
+}
+
+/* a damaged block is reported where it is, everything else stays readable */
+static void test_ivfc_reader(void)
+{
+	static const char *name = "nnc-test-romfs-verify.bin";
+	static const struct generated_file files[] = { { "/a", 1, 20000 }, { "/b", 2, 20000 }, { "/c", 3, 30000 } };
+	static nnc_u8 buf[30000];
+	nnc_u8 *store[3], *image = NULL, *copy = NULL;
+	nnc_ivfc_reader reader;
+	nnc_romfs_ctx ctx;
+	nnc_romfs_info info;
+	nnc_u64 offset, level_offset[3], bad;
+	nnc_memory mem;
+	nnc_file f;
+	nnc_vfs vfs;
+	long size;
+
+	if(nnc_vfs_init(&vfs) != NNC_R_OK)
+		die("failed to init VFS");
+	add_generated_files(&vfs, files, 3, store);
+	CHECK(write_test_romfs(&vfs, name, 0, 0) == NNC_R_OK, "writing the RomFS to verify");
+	if((size = file_size(name)) <= 0 || !(image = malloc(size)) || !(copy = malloc(size))
+			|| nnc_file_open(&f, name) != NNC_R_OK)
+		die("failed to load '%s'", name);
+	if(!read_fully(&f, 0, image, size))
+		die("failed to read '%s'", name);
+	NNC_RS_CALL0(f, close);
+
+	nnc_mem_open(&mem, image, size);
+	CHECK(nnc_open_ivfc_reader(&reader, NNC_RSP(&mem)) == NNC_R_OK, "opening an intact RomFS");
+	if(nnc_init_romfs(NNC_RSP(&reader), &ctx) != NNC_R_OK)
+		die("nnc_init_romfs() failed on a verified stream");
+	/* the second time around the blocks are known to be good */
+	for(int pass = 0; pass < 2; ++pass)
+		for(int i = 0; i < 3; ++i)
+			CHECK(romfs_file_is(&ctx, files[i].path, store[i], files[i].size, &offset), files[i].path);
+	if(nnc_get_info(&ctx, &info, "/b") != NNC_R_OK)
+		die("failed to find '/b'");
+	/* somewhere in the middle of b so no other file shares the block */
+	bad = ctx.header.data_offset + info.u.f.offset + 10000;
+	memcpy(level_offset, reader.level_offset, sizeof(level_offset));
+	bad = level_offset[2] + ((bad - level_offset[2]) & ~(nnc_u64) 0xFFF);
+	nnc_free_romfs(&ctx);
+	NNC_RS_CALL0(reader, close);
+
+	memcpy(copy, image, size);
+	copy[bad + 123] ^= 0x80;
+	nnc_mem_open(&mem, copy, size);
+	CHECK(nnc_open_ivfc_reader(&reader, NNC_RSP(&mem)) == NNC_R_OK, "opening a RomFS with bad data");
+	if(nnc_init_romfs(NNC_RSP(&reader), &ctx) != NNC_R_OK)
+		die("nnc_init_romfs() failed on a verified stream");
+	for(int pass = 0; pass < 2; ++pass)
+		CHECK(read_romfs_file(&ctx, "/b", buf, files[1].size) == NNC_R_BAD_HASH && reader.bad_offset == bad,
+			"reading a damaged block");
+	CHECK(romfs_file_is(&ctx, "/a", store[0], files[0].size, &offset)
+		&& romfs_file_is(&ctx, "/c", store[2], files[2].size, &offset), "reading around a damaged block");
+	nnc_free_romfs(&ctx);
+	NNC_RS_CALL0(reader, close);
+
+	/* level 1 is checked when opening, level 2 when a hash in it is used */
+	memcpy(copy, image, size);
+	copy[level_offset[0]] ^= 1;
+	nnc_mem_open(&mem, copy, size);
+	CHECK(nnc_open_ivfc_reader(&reader, NNC_RSP(&mem)) == NNC_R_BAD_HASH && reader.bad_offset == level_offset[0],
+		"opening a RomFS with a bad level 1");
+	memcpy(copy, image, size);
+	copy[level_offset[1] + 1] ^= 1;
+	nnc_mem_open(&mem, copy, size);
+	CHECK(nnc_open_ivfc_reader(&reader, NNC_RSP(&mem)) == NNC_R_OK
+		&& nnc_init_romfs(NNC_RSP(&reader), &ctx) == NNC_R_BAD_HASH && reader.bad_offset == level_offset[1],
+		"reading a RomFS with a bad level 2");
+	NNC_RS_CALL0(reader, close);
+
+	nnc_vfs_free(&vfs);
+	for(int i = 0; i < 3; ++i)
+		free(store[i]);
+	free(image);
+	free(copy);
+	remove(name);
+}
+
+/* bad blocks all over level 3 are found with any amount of threads */
+static void test_verify_all(void)
+{
+	static const char *name = "nnc-test-romfs-verify-all.bin";
+	enum { FILES = 64, SIZE = 50000 };
+	static struct generated_file files[FILES];
+	static char paths[FILES][16];
+	static const nnc_u32 thread_counts[] = { 1, 3, 8 };
+	nnc_u8 *store[FILES], *image = NULL;
+	nnc_ivfc_verify_report report;
+	nnc_ivfc_reader reader;
+	nnc_u32 expected[3];
+	nnc_memory mem;
+	nnc_ivfc ivfc;
+	nnc_file f;
+	nnc_vfs vfs;
+	long size;
+
+	/* a few MiB so there's more than one range to split */
+	for(int i = 0; i < FILES; ++i)
+	{
+		sprintf(paths[i], "/f%02d", i);
+		files[i].path = paths[i];
+		files[i].seed = i + 100;
+		files[i].size = SIZE;
+	}
+	if(nnc_vfs_init(&vfs) != NNC_R_OK)
+		die("failed to init VFS");
+	add_generated_files(&vfs, files, FILES, store);
+	CHECK(write_test_romfs(&vfs, name, 0, 0) == NNC_R_OK, "writing the RomFS to verify completely");
+	if((size = file_size(name)) <= 0 || !(image = malloc(size)) || nnc_file_open(&f, name) != NNC_R_OK)
+		die("failed to load '%s'", name);
+	if(!read_fully(&f, 0, image, size))
+		die("failed to read '%s'", name);
+	NNC_RS_CALL0(f, close);
+	nnc_mem_open(&mem, image, size);
+	if(nnc_open_ivfc_reader(&reader, NNC_RSP(&mem)) != NNC_R_OK)
+		die("failed to open an intact RomFS");
+	ivfc = reader.ivfc;
+	NNC_RS_CALL0(reader, close);
+
+	for(unsigned t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); ++t)
+	{
+		CHECK(nnc_ivfc_verify_all(NNC_RSP(&mem), &ivfc, thread_counts[t], &report) == NNC_R_OK
+			&& report.bad_count[0] == 0 && report.bad_count[1] == 0 && report.bad_count[2] == 0
+			&& report.blocks[2] == (ivfc.level[2].size + 0xFFF) / 0x1000, "verifying an intact RomFS");
+		nnc_ivfc_free_report(&report);
+	}
+
+	/* the first, last and a block in the middle of level 3 */
+	expected[0] = 0;
+	expected[1] = report.blocks[2] / 2 + 1;
+	expected[2] = report.blocks[2] - 1;
+	for(int i = 0; i < 3; ++i)
+		image[reader.level_offset[2] + expected[i] * 0x1000 + 100] ^= 0x10;
+	for(unsigned t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); ++t)
+	{
+		CHECK(nnc_ivfc_verify_all(NNC_RSP(&mem), &ivfc, thread_counts[t], &report) == NNC_R_BAD_HASH
+			&& report.bad_count[0] == 0 && report.bad_count[1] == 0 && report.bad_count[2] == 3
+			&& memcmp(report.bad_blocks[2], expected, sizeof(expected)) == 0, "finding bad level 3 blocks");
+		nnc_ivfc_free_report(&report);
+	}
+
+	image[reader.level_offset[1] + 0x1000] ^= 0x10;
+	CHECK(nnc_ivfc_verify_all(NNC_RSP(&mem), &ivfc, 2, &report) == NNC_R_BAD_HASH
+		&& report.bad_count[1] == 1 && report.bad_blocks[1][0] == 1, "finding a bad level 2 block");
+	nnc_ivfc_free_report(&report);
+
+	nnc_vfs_free(&vfs);
+	for(int i = 0; i < FILES; ++i)
+		free(store[i]);
+	free(image);
+	remove(name);
+}
+
+/* big files start at a page in the image, the rest stays packed, readers don't notice */
+static void test_data_align(void)
+{
+	static const char *name = "nnc-test-romfs-align.bin";
+	static const struct generated_file files[] = {
+		{ "/a", 1, 40000 }, { "/b", 2, 1000 }, { "/c", 3, 65536 }, { "/dir/d", 4, 33000 },
+		{ "/e", 5, 10 }, { "/f", 6, 0 }, { "/g", 7, 32768 }, { "/dir/h", 8, 31 },
+	};
+	enum { COUNT = sizeof(files) / sizeof(files[0]) };
+	nnc_romfs_write_options opts;
+	nnc_ivfc_verify_report report;
+	nnc_ivfc_reader reader;
+	nnc_u8 *store[COUNT];
+	nnc_romfs_ctx ctx;
+	nnc_u64 offset;
+	nnc_file f;
+	nnc_vfs vfs;
+
+	if(nnc_vfs_init(&vfs) != NNC_R_OK)
+		die("failed to init VFS");
+	add_generated_files(&vfs, files, COUNT, store);
+	nnc_romfs_write_options_init(&opts);
+	opts.data_align = 24;
+	CHECK(write_test_romfs_ex(&vfs, name, &opts) == NNC_R_INVAL, "an alignment that isn't a power of 2");
+
+	/* once only for the big files, once for all of them */
+	for(int pass = 0; pass < 2; ++pass)
+	{
+		nnc_u64 min_size = pass == 0 ? 32768 : 0;
+		opts.data_align = 4096;
+		opts.data_align_min_size = min_size;
+		CHECK(write_test_romfs_ex(&vfs, name, &opts) == NNC_R_OK, "writing with aligned data");
+		CHECK(ivfc_verifies(name), "aligned data is hashed correctly");
+		if(nnc_file_open(&f, name) != NNC_R_OK || nnc_open_ivfc_reader(&reader, NNC_RSP(&f)) != NNC_R_OK
+				|| nnc_init_romfs(NNC_RSP(&reader), &ctx) != NNC_R_OK)
+			die("failed to open '%s'", name);
+		int misaligned = 0;
+		for(int i = 0; i < COUNT; ++i)
+		{
+			CHECK(romfs_file_is(&ctx, files[i].path, store[i], files[i].size, &offset), files[i].path);
+			/* where the file is in the image */
+			offset += reader.level_offset[2] + ctx.header.data_offset;
+			if(files[i].size && files[i].size >= min_size ? offset % 4096 : offset % 16)
+				++misaligned;
+		}
+		CHECK(misaligned == 0, "file data alignment");
+		CHECK(nnc_ivfc_verify_all(NNC_RSP(&f), &reader.ivfc, 2, &report) == NNC_R_OK, "verifying aligned data");
+		nnc_ivfc_free_report(&report);
+		nnc_free_romfs(&ctx);
+		NNC_RS_CALL0(reader, close);
+		NNC_RS_CALL0(f, close);
+	}
+
+	nnc_vfs_free(&vfs);
+	for(int i = 0; i < COUNT; ++i)
+		free(store[i]);
+	remove(name);
+}
+
+/* a crafted image must not get extract_all to write outside of its directory */
+static void test_extract_traversal(void)
+{
+	static const char *name = "nnc-test-romfs-evil.bin";
+	static const char *out = "nnc-test-romfs-evil";
+	static const struct generated_file files[] = { { "/qz/nnc-test-escaped", 1, 100 } };
+	/* replacements for the directory name "qz", names are stored as UTF-16 */
+	static const char *evil[] = { "..", "/.", "\\.", "C:" };
+	nnc_u8 *store[1], *image = NULL;
+	nnc_romfs_ctx ctx;
+	nnc_memory mem;
+	nnc_file f;
+	nnc_vfs vfs;
+	long size, at;
+
+	if(nnc_vfs_init(&vfs) != NNC_R_OK)
+		die("failed to init VFS");
+	add_generated_files(&vfs, files, 1, store);
+	CHECK(write_test_romfs(&vfs, name, 0, 0) == NNC_R_OK, "writing the RomFS to tamper with");
+	if((size = file_size(name)) <= 0 || !(image = malloc(size)) || nnc_file_open(&f, name) != NNC_R_OK)
+		die("failed to load '%s'", name);
+	if(!read_fully(&f, 0, image, size))
+		die("failed to read '%s'", name);
+	NNC_RS_CALL0(f, close);
+	for(at = 0; at + 4 <= size && memcmp(image + at, "q\0z\0", 4) != 0; ++at)
+		;
+	if(at + 4 > size)
+		die("directory name not found in '%s'", name);
+
+	for(unsigned i = 0; i < sizeof(evil) / sizeof(evil[0]); ++i)
+	{
+		image[at] = evil[i][0];
+		image[at + 2] = evil[i][1];
+		nnc_mem_open(&mem, image, size);
+		if(nnc_init_romfs(NNC_RSP(&mem), &ctx) != NNC_R_OK)
+			die("failed to open the tampered RomFS");
+		CHECK(nnc_romfs_extract_all(&ctx, out, 1) == NNC_R_CORRUPT, evil[i]);
+		nnc_free_romfs(&ctx);
+		FILE *escaped = fopen("nnc-test-escaped", "rb");
+		CHECK(!escaped, "extracting outside of the destination");
+		if(escaped)
+		{
+			fclose(escaped);
+			remove("nnc-test-escaped");
+		}
+	}
+
+	remove(out);
+	nnc_vfs_free(&vfs);
+	free(store[0]);
+	free(image);
+	remove(name);
+}
+
+int romfs_test_main(int argc, char *argv[])
+{
+	(void) argc; (void) argv;
+	static const char *romfs_name = "nnc-test-romfs.bin";
+	struct romfs_test t = { .paths = NULL, .npaths = 0, .failures = 0 };
+	/* the VFS reads the contents when writing, so they have to stay around */
+	static char gen_names[TEST_GENERATED_FILES][32];
+	nnc_romfs_info a, b;
+	nnc_wfile wf;
+	nnc_file f;
+	nnc_vfs vfs;
+
+	if(nnc_vfs_init(&vfs) != NNC_R_OK)
+		die("failed to init VFS");
+	for(unsigned i = 0; i < sizeof(test_files) / sizeof(test_files[0]); ++i)
+		if(add_test_file(&vfs.root_directory, test_files[i]) != NNC_R_OK)
+			die("failed to add '%s' to VFS", test_files[i]);
+	/* enough entries for plenty of collisions in both hash tables */
+	for(int i = 0; i < TEST_GENERATED_FILES; ++i)
+	{
+		sprintf(gen_names[i], "gen/%02d/file%d", i % 37, i);
+		if(add_test_file(&vfs.root_directory, gen_names[i]) != NNC_R_OK)
+			die("failed to add '%s' to VFS", gen_names[i]);
+	}
+	if(nnc_wfile_open(&wf, romfs_name) != NNC_R_OK)
+		die("failed to create '%s'", romfs_name);
+	CHECK(nnc_write_romfs(&vfs, NNC_WSP(&wf)) == NNC_R_OK, "writing");
+	NNC_WS_CALL0(wf, close);
+	nnc_vfs_free(&vfs);
+
+	if(nnc_file_open(&f, romfs_name) != NNC_R_OK)
+		die("failed to open '%s'", romfs_name);
+	if(nnc_init_romfs(NNC_RSP(&f), &t.walk) != NNC_R_OK || nnc_init_romfs(NNC_RSP(&f), &t.index) != NNC_R_OK)
+		die("nnc_init_romfs() failed");
+	CHECK(nnc_romfs_build_index(&t.index) == NNC_R_OK && t.index.index, "building the index");
+
+	if(nnc_get_info(&t.walk, &a, "/") != NNC_R_OK)
+		die("failed root directory info");
+	collect_paths(&t, &a, "");
+	/* all files and the 11 + 37 directories they are in */
+	CHECK(t.npaths == sizeof(test_files) / sizeof(test_files[0]) + TEST_GENERATED_FILES + 11 + 37, "collecting paths");
+
+	/* both ways of looking up have to agree on everything, also when used from multiple threads */
+	pthread_t threads[TEST_THREADS];
+	for(int i = 0; i < TEST_THREADS; ++i)
+		if(pthread_create(&threads[i], NULL, lookup_thread, &t) != 0)
+			die("failed to create thread");
+	for(int i = 0; i < TEST_THREADS; ++i)
+		pthread_join(threads[i], NULL);
+	CHECK(t.failures == 0, "concurrent lookups");
+	test_listing(&t);
+
+	static const struct {
+		const char *path;
+		enum nnc_romfs_type type;
+	} cases[] = {
+		{ "",                NNC_ROMFS_DIR  },
+		{ "///",             NNC_ROMFS_DIR  },
+		{ "dup",             NNC_ROMFS_DIR  },
+		{ "/dup/",           NNC_ROMFS_DIR  },
+		{ "//dup//inner",    NNC_ROMFS_FILE },
+		{ "dir/sub",         NNC_ROMFS_DIR  },
+		{ "/a.txt/",         NNC_ROMFS_NONE },
+		{ "/dir/sub/e",      NNC_ROMFS_NONE },
+		{ "/nope/c",         NNC_ROMFS_NONE },
+		{ "/x/y/z/deep/",    NNC_ROMFS_NONE },
+		{ "/\xC3\xBC" "ber", NNC_ROMFS_DIR  },
+	};
+	for(unsigned i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+	{
+		nnc_result expect = cases[i].type == NNC_ROMFS_NONE ? NNC_R_NOT_FOUND : NNC_R_OK;
+		a.type = b.type = NNC_ROMFS_FILE;
+		CHECK(nnc_get_info(&t.walk, &a, cases[i].path) == expect && a.type == cases[i].type, cases[i].path);
+		CHECK(nnc_get_info(&t.index, &b, cases[i].path) == expect && b.type == cases[i].type, cases[i].path);
+		CHECK(expect != NNC_R_OK || same_info(&a, &b), cases[i].path);
+	}
+
+	/* and the file data must be where the entry says it is */
+	nnc_subview sv;
+	char data[64];
+	nnc_u32 got;
+	CHECK(nnc_get_info(&t.index, &a, "/dir/sub/c") == NNC_R_OK
+		&& nnc_romfs_open_subview(&t.index, &sv, &a) == NNC_R_OK
+		&& NNC_RS_CALL(sv, read, (nnc_u8 *) data, sizeof(data), &got) == NNC_R_OK
+		&& got == 1 && data[0] == 'c', "reading a file found through the index");
+
+	/* every file contains its own name, the directories are removed in reverse order once they're empty */
+	static const char *extract_dir = "nnc-test-romfs-out";
+	char path[1024];
+	CHECK(nnc_romfs_extract_all(&t.index, extract_dir, 3) == NNC_R_OK, "extracting");
+	int bad = 0;
+	for(int i = t.npaths - 1; i >= 0; --i)
+	{
+		sprintf(path, "%s%s", extract_dir, t.paths[i]);
+		size_t len = strlen(path);
+		if(path[len - 1] != '/')
+		{
+			const char *name = strrchr(path, '/') + 1;
+			FILE *ef = fopen(path, "rb");
+			size_t got = ef ? fread(data, 1, sizeof(data), ef) : 0;
+			if(!ef || got != strlen(name) || memcmp(data, name, got) != 0)
+				++bad;
+			if(ef) fclose(ef);
+		}
+		if(remove(path) != 0)
+			++bad;
+	}
+	CHECK(bad == 0, "extracted files");
+	remove(extract_dir);
+
+	for(int i = 0; i < t.npaths; ++i)
+		free(t.paths[i]);
+	free(t.paths);
+	nnc_free_romfs(&t.walk);
+	nnc_free_romfs(&t.index);
+	NNC_RS_CALL0(f, close);
+	remove(romfs_name);
+
+	test_write_options();
+	test_dedupe();
+	test_incremental();
+	test_data_order();
+	test_diff();
+	test_ivfc_reader();
+	test_verify_all();
+	test_data_align();
+	test_extract_traversal();
+
+	if(failures) die("%d check(s) failed", failures);
+	puts("romfs: done");
+	return 0;
+}
+
+/* discards everything but keeps track of the position, nnc_write_romfs() needs to seek */
+typedef struct null_writer {
+	const nnc_wstream_funcs *funcs;
+	nnc_u32 pos, size;
+} null_writer;
+
+static nnc_result null_write(null_writer *self, nnc_u8 *buf, nnc_u32 size)
+{
+	(void) buf;
+	self->pos += size;
+	if(self->pos > self->size) self->size = self->pos;
+	return NNC_R_OK;
+}
+static nnc_result null_close(null_writer *self) { (void) self; return NNC_R_OK; }
+static nnc_result null_seek(null_writer *self, nnc_u32 pos) { self->pos = pos; return NNC_R_OK; }
+static nnc_u32 null_tell(null_writer *self) { return self->pos; }
+
+static const nnc_wstream_funcs null_funcs = {
+	.write = (nnc_write_func)  null_write,
+	.close = (nnc_wclose_func) null_close,
+	.seek  = (nnc_wseek_func)  null_seek,
+	.tell  = (nnc_wtell_func)  null_tell,
+};
+
+#define BENCH_DIRS 8
+
+int romfs_bench_main(int argc, char *argv[])
+{
+	static const unsigned default_counts[] = { 10000, 100000, 1000000 };
+	unsigned ncounts = argc > 1 ? (unsigned) argc - 1 : sizeof(default_counts) / sizeof(default_counts[0]);
+	nnc_vfs_directory_node *dirs[BENCH_DIRS];
+	char name[32];
+	nnc_memory empty;
+	nnc_result res;
+	nnc_vfs vfs;
+
+	/* a few directories with a lot of files each, like big titles have */
+	nnc_mem_open(&empty, "", 0);
+	for(unsigned c = 0; c < ncounts; ++c)
+	{
+		unsigned count = argc > 1 ? (unsigned) atoi(argv[c + 1]) : default_counts[c];
+		if(nnc_vfs_init(&vfs) != NNC_R_OK)
+			die("failed to init VFS");
+		for(int i = 0; i < BENCH_DIRS; ++i)
+		{
+			sprintf(name, "dir%d", i);
+			if(nnc_vfs_add_directory(&vfs.root_directory, name, &dirs[i]) != NNC_R_OK)
+				die("failed to add directory");
+		}
+		for(unsigned i = 0; i < count; ++i)
+		{
+			sprintf(name, "file%u.bin", i);
+			if(nnc_vfs_add_file(dirs[i % BENCH_DIRS], name, NNC_VFS_READER_COPY(empty, NNC_VFS_STREAM_NONE)) != NNC_R_OK)
+				die("failed to add file");
+		}
+
+		null_writer ws = { &null_funcs, 0, 0 };
+		clock_t start = clock();
+		res = nnc_write_romfs(&vfs, NNC_WSP(&ws));
+		double secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+		nnc_vfs_free(&vfs);
+		if(res != NNC_R_OK)
+			die("failed to write romfs: %s", nnc_strerror(res));
+		printf("%8u files: %8.3f s, %u bytes\n", count, secs, ws.size);
+	}
+	return 0;
+}
+
+/* pseudo random data that is made as it's read, a different seed gives different data */
+typedef struct gen_stream {
+	const nnc_rstream_funcs *funcs;
+	nnc_u32 seed, pos, size;
+} gen_stream;
+
+static nnc_result gen_read(gen_stream *self, nnc_u8 *buf, nnc_u32 max, nnc_u32 *totalRead)
+{
+	max = max < self->size - self->pos ? max : self->size - self->pos;
+	for(nnc_u32 i = 0; i < max; ++i, ++self->pos)
+		buf[i] = ((self->seed + (self->pos >> 2)) * 2654435761u) >> ((self->pos & 3) * 8);
+	*totalRead = max;
+	return NNC_R_OK;
+}
+static nnc_result gen_seek_abs(gen_stream *self, nnc_u32 pos) { self->pos = pos; return NNC_R_OK; }
+static nnc_result gen_seek_rel(gen_stream *self, nnc_u32 pos) { self->pos += pos; return NNC_R_OK; }
+static nnc_u32 gen_size(gen_stream *self) { return self->size; }
+static void gen_close(gen_stream *self) { (void) self; }
+static nnc_u32 gen_tell(gen_stream *self) { return self->pos; }
+
+static const nnc_rstream_funcs gen_funcs = {
+	.read     = (nnc_read_func)     gen_read,
+	.seek_abs = (nnc_seek_abs_func) gen_seek_abs,
+	.seek_rel = (nnc_seek_rel_func) gen_seek_rel,
+	.size     = (nnc_size_func)     gen_size,
+	.close    = (nnc_close_func)    gen_close,
+	.tell     = (nnc_tell_func)     gen_tell,
+};
+
+static double wall_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define BENCH_IVFC_FILE_SIZE (16 * 1024 * 1024)
+
+int ivfc_bench_main(int argc, char *argv[])
+{
+	static const nnc_u32 default_threads[] = { 1, 2, 4, 8 };
+	static const char *name = "nnc-bench-ivfc.bin";
+	nnc_u32 mib = argc > 1 ? (nnc_u32) atoi(argv[1]) : 1024;
+	unsigned nthreads = argc > 2 ? (unsigned) argc - 2 : sizeof(default_threads) / sizeof(default_threads[0]);
+	nnc_romfs_write_options opts;
+	nnc_ivfc_verify_report report;
+	char fname[32];
+	nnc_result res;
+	nnc_ivfc ivfc;
+	nnc_file f;
+	nnc_vfs vfs;
+
+	if(mib == 0 || mib >= 4000)
+		die("usage: %s [size in MiB] [threads...]", argv[0]);
+	/* a synthetic RomFS of big files, it's written to disk so it's read like a real one */
+	if(nnc_vfs_init(&vfs) != NNC_R_OK)
+		die("failed to init VFS");
+	for(nnc_u32 i = 0, left = mib * 1024 * 1024; left; ++i)
+	{
+		gen_stream gen = { &gen_funcs, i, 0, left < BENCH_IVFC_FILE_SIZE ? left : BENCH_IVFC_FILE_SIZE };
+		sprintf(fname, "file%u.bin", i);
+		if(nnc_vfs_add_file(&vfs.root_directory, fname, NNC_VFS_READER_COPY(gen, NNC_VFS_STREAM_NONE)) != NNC_R_OK)
+			die("failed to add file");
+		left -= gen.size;
+	}
+	nnc_romfs_write_options_init(&opts);
+	opts.hash_threads = 4;
+	double start = wall_clock();
+	res = write_test_romfs_ex(&vfs, name, &opts);
+	nnc_vfs_free(&vfs);
+	if(res != NNC_R_OK)
+		die("failed to write romfs: %s", nnc_strerror(res));
+	printf("writing %u MiB: %8.3f s\n", mib, wall_clock() - start);
+
+	if(nnc_file_open(&f, name) != NNC_R_OK || nnc_read_ivfc_header(NNC_RSP(&f), &ivfc, NNC_IVFC_LEVELS_ROMFS) != NNC_R_OK)
+		die("failed to open '%s'", name);
+	for(unsigned t = 0; t < nthreads; ++t)
+	{
+		nnc_u32 threads = argc > 2 ? (nnc_u32) atoi(argv[t + 2]) : default_threads[t];
+		start = wall_clock();
+		res = nnc_ivfc_verify_all(NNC_RSP(&f), &ivfc, threads, &report);
+		double secs = wall_clock() - start;
+		nnc_ivfc_free_report(&report);
+		if(res != NNC_R_OK)
+			die("failed to verify: %s", nnc_strerror(res));
+		printf("%2u thread(s): %8.3f s, %8.1f MiB/s\n", threads, secs, mib / secs);
+	}
+	NNC_RS_CALL0(f, close);
+	remove(name);
+	return 0;
+}
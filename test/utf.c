@@ -0,0 +1,214 @@
+
+#include <nnc/utf.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+void die(const char *fmt, ...);
+
+/* one code point at a time, how the conversions behave without any fast paths */
+
+static void ref_put8(nnc_u8 *out, size_t outlen, size_t *outptr, nnc_u32 cp)
+{
+	nnc_u8 seq[4];
+	int n;
+	if(cp < 0x80) { seq[0] = cp; n = 1; }
+	else if(cp < 0x800) { seq[0] = 0xC0 | (cp >> 6); seq[1] = 0x80 | (cp & 0x3F); n = 2; }
+	else if(cp < 0x10000) { seq[0] = 0xE0 | (cp >> 12); seq[1] = 0x80 | ((cp >> 6) & 0x3F); seq[2] = 0x80 | (cp & 0x3F); n = 3; }
+	else { seq[0] = 0xF0 | (cp >> 18); seq[1] = 0x80 | ((cp >> 12) & 0x3F); seq[2] = 0x80 | ((cp >> 6) & 0x3F); seq[3] = 0x80 | (cp & 0x3F); n = 4; }
+	if(*outptr + n < outlen)
+		memcpy(&out[*outptr], seq, n);
+	*outptr += n;
+}
+
+static void ref_put16(nnc_u16 *out, size_t outlen, size_t *outptr, nnc_u32 cp)
+{
+	if(cp >= 0x110000)
+		return;
+	if(cp < 0x10000)
+	{
+		if(*outptr + 1 < outlen) out[*outptr] = cp;
+		*outptr += 1;
+		return;
+	}
+	cp -= 0x10000;
+	if(*outptr + 2 < outlen)
+	{
+		out[*outptr] = 0xD800 | (cp >> 10);
+		out[*outptr + 1] = 0xDC00 | (cp & 0x3FF);
+	}
+	*outptr += 2;
+}
+
+static size_t ref_utf16_to_utf8(nnc_u8 *out, size_t outlen, const nnc_u16 *in, size_t inlen)
+{
+	size_t outptr = 0;
+	for(size_t i = 0; i < inlen && in[i] != 0; ++i)
+	{
+		nnc_u16 u = in[i];
+		if(u < 0xD800 || u >= 0xE000)
+			ref_put8(out, outlen, &outptr, u);
+		else if(u < 0xDC00 && i + 1 < inlen && in[i + 1] >= 0xDC00 && in[i + 1] < 0xE000)
+		{
+			ref_put8(out, outlen, &outptr, 0x10000 + ((u - 0xD800) << 10) + (in[i + 1] - 0xDC00));
+			++i;
+		}
+	}
+	return outptr;
+}
+
+static size_t ref_utf8_to_utf16(nnc_u16 *out, size_t outlen, const nnc_u8 *in, size_t inlen)
+{
+	size_t outptr = 0;
+	for(size_t i = 0; i < inlen && in[i] != 0; ++i)
+	{
+		nnc_u8 c = in[i];
+		nnc_u32 cp;
+		size_t extra;
+		if(c < 0x80)      { cp = c;        extra = 0; }
+		else if(c < 0xC0) continue;
+		else if(c < 0xE0) { cp = c & 0x1F; extra = 1; }
+		else if(c < 0xF0) { cp = c & 0x0F; extra = 2; }
+		else if(c < 0xF5) { cp = c & 0x07; extra = 3; }
+		else continue;
+		if(i + extra >= inlen)
+			break;
+		for(size_t j = 1; j <= extra; ++j)
+			cp = (cp << 6) | (in[i + j] & 0x3F);
+		i += extra;
+		ref_put16(out, outlen, &outptr, cp);
+	}
+	return outptr;
+}
+
+static nnc_u32 rng_state;
+
+static nnc_u32 rng(void)
+{
+	/* xorshift32 */
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+#define FUZZ_MAX 600
+#define FUZZ_GUARD 64
+
+/* long ASCII runs so the fast paths are used, broken up by everything else */
+static size_t fuzz_utf16(nnc_u16 *buf)
+{
+	size_t len = 0, target = rng() % FUZZ_MAX;
+	while(len < target)
+	{
+		switch(rng() % 8)
+		{
+		case 0: case 1: case 2:
+			for(nnc_u32 n = rng() % 80; n && len < FUZZ_MAX; --n)
+				buf[len++] = 0x20 + rng() % 0x5F;
+			break;
+		case 3: buf[len++] = 0x80 + rng() % 0xD780; break;
+		case 4:
+			buf[len++] = 0xD800 + rng() % 0x400;
+			if(len < FUZZ_MAX) buf[len++] = 0xDC00 + rng() % 0x400;
+			break;
+		case 5: buf[len++] = 0xD800 + rng() % 0x800; break;
+		case 6: buf[len++] = rng() % 0x10 == 0 ? 0 : rng() & 0x7F; break;
+		default: buf[len++] = rng(); break;
+		}
+	}
+	return len < FUZZ_MAX ? len : FUZZ_MAX;
+}
+
+static size_t fuzz_utf8(nnc_u8 *buf)
+{
+	size_t len = 0, target = rng() % FUZZ_MAX;
+	while(len + 4 < target)
+	{
+		switch(rng() % 8)
+		{
+		case 0: case 1: case 2:
+			for(nnc_u32 n = rng() % 80; n && len < FUZZ_MAX; --n)
+				buf[len++] = 0x20 + rng() % 0x5F;
+			break;
+		case 3: case 4:
+		{
+			/* a valid sequence of any length */
+			size_t got = ref_utf16_to_utf8(&buf[len], 5, (nnc_u16[]) { 0xD800 + rng() % 0x400, 0xDC00 + rng() % 0x400 }, 2);
+			if(rng() % 2) got = ref_utf16_to_utf8(&buf[len], 5, (nnc_u16[]) { 0x80 + rng() % 0xD780 }, 1);
+			len += got;
+			break;
+		}
+		case 5: buf[len++] = rng() % 0x10 == 0 ? 0 : rng() & 0x7F; break;
+		default: buf[len++] = rng(); break;
+		}
+	}
+	return len;
+}
+
+static size_t fuzz_outlen(size_t needed)
+{
+	switch(rng() % 4)
+	{
+	case 0: return needed + 1;
+	case 1: return 0;
+	case 2: return rng() % (needed + 2);
+	default: return needed + 1 + rng() % 40;
+	}
+}
+
+int utf_test_main(int argc, char *argv[])
+{
+	static nnc_u16 in16[FUZZ_MAX + 8], out16[2][FUZZ_MAX * 2 + FUZZ_GUARD];
+	static nnc_u8 in8[FUZZ_MAX + 8], out8[2][FUZZ_MAX * 4 + FUZZ_GUARD];
+	int rounds = argc >= 2 ? atoi(argv[1]) : 20000, failures = 0;
+	rng_state = argc >= 3 ? strtoul(argv[2], NULL, 0) : 0x6E6E6321;
+	if(rng_state == 0) rng_state = 1;
+
+	for(int round = 0; round < rounds; ++round)
+	{
+		/* also start at odd addresses so no load is ever aligned */
+		size_t shift = rng() % 3, len, outlen, want, got;
+
+		len = fuzz_utf16(in16 + shift);
+		want = ref_utf16_to_utf8(NULL, 0, in16 + shift, len);
+		outlen = fuzz_outlen(want);
+		memset(out8, 0xAA, sizeof(out8));
+		ref_utf16_to_utf8(out8[0], outlen, in16 + shift, len);
+		got = nnc_utf16_to_utf8(out8[1], outlen, in16 + shift, len);
+		if(got != want || nnc_utf16_to_utf8_length(in16 + shift, len) != want
+				|| memcmp(out8[0], out8[1], sizeof(out8[0])) != 0)
+		{
+			fprintf(stderr, "utf: UTF-16 to UTF-8 mismatch in round %d (%zu units, %zu/%zu out)\n", round, len, got, want);
+			++failures;
+		}
+
+		len = fuzz_utf8(in8 + shift);
+		want = ref_utf8_to_utf16(NULL, 0, in8 + shift, len);
+		outlen = fuzz_outlen(want);
+		memset(out16, 0xAA, sizeof(out16));
+		ref_utf8_to_utf16(out16[0], outlen, in8 + shift, len);
+		got = nnc_utf8_to_utf16(out16[1], outlen, in8 + shift, len);
+		if(got != want || nnc_utf8_to_utf16_length(in8 + shift, len) != want
+				|| memcmp(out16[0], out16[1], sizeof(out16[0])) != 0)
+		{
+			fprintf(stderr, "utf: UTF-8 to UTF-16 mismatch in round %d (%zu bytes, %zu/%zu out)\n", round, len, got, want);
+			++failures;
+		}
+	}
+
+	/* a round trip of something that isn't ASCII at all */
+	static const nnc_u16 astral[] = { 'a', 0xD83D, 0xDE00, 0x00FC, 0x4E2D, 0xDBFF, 0xDFFF };
+	nnc_u16 back[16];
+	size_t n8 = nnc_utf16_to_utf8(out8[0], sizeof(out8[0]), astral, 7);
+	if(n8 != 1 + 4 + 2 + 3 + 4 || nnc_utf8_to_utf16(back, 16, out8[0], n8) != 7 || memcmp(back, astral, sizeof(astral)) != 0)
+	{
+		fputs("utf: round trip failed\n", stderr);
+		++failures;
+	}
+
+	if(failures) die("%d check(s) failed", failures);
+	puts("utf: done");
+	return 0;
+}
+